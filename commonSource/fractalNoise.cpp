@@ -4,6 +4,15 @@
 #include "fractalNoise.h"
 
 
+// SIMD row path only where it matches the scalar path bit for bit:
+// SSE2 doubles with no excess precision, and no FMA that the compiler
+// could contract the scalar math into
+#if defined( __SSE2__ ) && defined( __x86_64__ ) && ! defined( __FMA__ )
+#define FRACTAL_NOISE_SSE2
+#include <emmintrin.h>
+#endif
+
+
 #define XX_PRIME32_1 2654435761U
 #define XX_PRIME32_2 2246822519U
 #define XX_PRIME32_3 3266489917U
@@ -11,8 +20,9 @@
 #define XX_PRIME32_5 374761393U
 
 
-static uint32_t xxSeedA = 0U;
-static uint32_t xxSeedB = 0U;
+// per thread, so map generation can run on worker threads
+static __thread uint32_t xxSeedA = 0U;
+static __thread uint32_t xxSeedB = 0U;
 
 
 
@@ -161,4 +171,394 @@ double getXYFractal2( int inX, int inY, double inRoughness, double inScale ) {
                                    inY / (inScale) ) ));
     
     return sum * oneOverIntMax;
-    }
\ No newline at end of file
+    }
+
+
+
+// Row versions of the above
+//
+// These do exactly the same math, in the same order, as the single-value
+// versions, so results match bit for bit.  They save work by computing
+// each octave's y terms once per row, and by sharing corner hashes between
+// neighboring x values that fall in the same noise cell.
+
+
+// rows are done in pieces of this size, so scratch space can be on stack
+#define ROW_CHUNK 256
+
+
+
+#ifdef FRACTAL_NOISE_SSE2
+
+// low 32 bits of 32x32 multiply in each lane
+// SSE2 has no _mm_mullo_epi32
+static inline __m128i mulLo32( __m128i inA, __m128i inB ) {
+    __m128i even = _mm_mul_epu32( inA, inB );
+    __m128i odd = _mm_mul_epu32( _mm_srli_epi64( inA, 32 ),
+                                 _mm_srli_epi64( inB, 32 ) );
+    
+    return _mm_unpacklo_epi32(
+        _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ),
+        _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+    }
+
+
+
+// same as xxTweakedHash2D, four at a time
+static inline __m128i xxTweakedHash2D4( __m128i inX, __m128i inY ) {
+    __m128i h32 = _mm_add_epi32( _mm_set1_epi32( (int)xxSeedA ), inX );
+    h32 = _mm_add_epi32( h32, _mm_set1_epi32( (int)XX_PRIME32_5 ) );
+    
+    h32 = _mm_add_epi32( h32, 
+                         mulLo32( inY, _mm_set1_epi32( (int)XX_PRIME32_3 ) ) );
+    
+    h32 = mulLo32( h32, _mm_set1_epi32( (int)XX_PRIME32_2 ) );
+    h32 = _mm_xor_si128( h32, _mm_srli_epi32( h32, 13 ) );
+    h32 = _mm_add_epi32( h32, _mm_set1_epi32( (int)xxSeedB ) );
+    h32 = mulLo32( h32, _mm_set1_epi32( (int)XX_PRIME32_3 ) );
+    h32 = _mm_xor_si128( h32, _mm_srli_epi32( h32, 16 ) );
+    return h32;
+    }
+
+
+
+// converts low two lanes from uint32 to double, exactly
+static inline __m128d uint32ToDouble2( __m128i inV ) {
+    __m128d d = _mm_cvtepi32_pd( inV );
+    
+    // lanes that came out negative were >= 2^31 as unsigned
+    __m128d neg = _mm_cmplt_pd( d, _mm_setzero_pd() );
+    
+    return _mm_add_pd( d, _mm_and_pd( neg, _mm_set1_pd( 4294967296.0 ) ) );
+    }
+
+
+
+// stores four hashes as doubles
+static inline void storeHashes4( __m128i inHashes, double *outValues ) {
+    _mm_storeu_pd( outValues, uint32ToDouble2( inHashes ) );
+    _mm_storeu_pd( outValues + 2,
+                   uint32ToDouble2( 
+                       _mm_shuffle_epi32( inHashes, 
+                                          _MM_SHUFFLE( 1, 0, 3, 2 ) ) ) );
+    }
+
+#endif
+
+
+
+// interpolated hash values at ( inStartX + i ) / inDivisor,
+// inY / inDivisor
+// same as getXYRandomBN( inX / inDivisor, inY / inDivisor )
+// inNumValues at most ROW_CHUNK
+static void getXYRandomBNRow( int inStartX, int inY, int inNumValues,
+                              double inDivisor, double *outValues ) {
+    
+    double yd = inY / inDivisor;
+    
+    int floorY = lrint( floor( yd ) );
+    int ceilY = floorY + 1;
+
+    double yOffset = yd - floorY;
+    
+
+    int floorX[ ROW_CHUNK ];
+    double xOffset[ ROW_CHUNK ];
+
+    int i = 0;
+    
+#ifdef FRACTAL_NOISE_SSE2
+    __m128d divisor = _mm_set1_pd( inDivisor );
+    __m128d one = _mm_set1_pd( 1.0 );
+    
+    for( ; i + 1 < inNumValues; i += 2 ) {
+        __m128d xd = 
+            _mm_div_pd( 
+                _mm_cvtepi32_pd( _mm_set_epi32( 0, 0, 
+                                                inStartX + i + 1,
+                                                inStartX + i ) ),
+                divisor );
+        
+        // floor, from truncation toward zero
+        __m128d t = _mm_cvtepi32_pd( _mm_cvttpd_epi32( xd ) );
+        __m128d fl = _mm_sub_pd( t, 
+                                 _mm_and_pd( _mm_cmpgt_pd( t, xd ), one ) );
+        
+        __m128i flInt = _mm_cvttpd_epi32( fl );
+        
+        floorX[i] = _mm_cvtsi128_si32( flInt );
+        floorX[i + 1] = _mm_cvtsi128_si32( _mm_srli_si128( flInt, 4 ) );
+        
+        _mm_storeu_pd( &( xOffset[i] ), _mm_sub_pd( xd, fl ) );
+        }
+#endif
+
+    for( ; i < inNumValues; i++ ) {
+        double xd = ( inStartX + i ) / inDivisor;
+        
+        floorX[i] = lrint( floor( xd ) );
+        xOffset[i] = xd - floorX[i];
+        }
+    
+    
+    // corner values
+    double cornerA1[ ROW_CHUNK ];
+    double cornerA2[ ROW_CHUNK ];
+    double cornerB1[ ROW_CHUNK ];
+    double cornerB2[ ROW_CHUNK ];
+
+    
+#ifdef FRACTAL_NOISE_SSE2
+    if( inDivisor < 1 ) {
+        // every x lands in a different cell, no sharing
+        // all four corners of a cell in one hash call
+        __m128i ys = _mm_set_epi32( ceilY, ceilY, floorY, floorY );
+        
+        for( i=0; i<inNumValues; i++ ) {
+            double c[4];
+            
+            storeHashes4( 
+                xxTweakedHash2D4( _mm_set_epi32( floorX[i] + 1, floorX[i],
+                                                 floorX[i] + 1, floorX[i] ),
+                                  ys ),
+                c );
+            
+            cornerA1[i] = c[0];
+            cornerA2[i] = c[1];
+            cornerB1[i] = c[2];
+            cornerB2[i] = c[3];
+            }
+        }
+    else
+#endif
+    {
+        // floorX never decreases along row, so hash each cell once
+        // and reuse it until x moves to the next cell
+        int lastFloorX = floorX[0] - 2;
+        
+        double a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+        
+        for( i=0; i<inNumValues; i++ ) {
+            int fx = floorX[i];
+            
+            if( fx != lastFloorX ) {
+                if( fx == lastFloorX + 1 ) {
+                    // right corners become left corners
+                    a1 = a2;
+                    b1 = b2;
+                    }
+                else {
+                    a1 = xxTweakedHash2D( fx, floorY );
+                    b1 = xxTweakedHash2D( fx, ceilY );
+                    }
+                a2 = xxTweakedHash2D( fx + 1, floorY );
+                b2 = xxTweakedHash2D( fx + 1, ceilY );
+                
+                lastFloorX = fx;
+                }
+            
+            cornerA1[i] = a1;
+            cornerA2[i] = a2;
+            cornerB1[i] = b1;
+            cornerB2[i] = b2;
+            }
+        }
+    
+
+    i = 0;
+    
+#ifdef FRACTAL_NOISE_SSE2
+    __m128d yOff = _mm_set1_pd( yOffset );
+    __m128d oneMinusYOff = _mm_sub_pd( one, yOff );
+
+    for( ; i + 1 < inNumValues; i += 2 ) {
+        __m128d xOff = _mm_loadu_pd( &( xOffset[i] ) );
+        __m128d oneMinusXOff = _mm_sub_pd( one, xOff );
+        
+        __m128d topBlend = 
+            _mm_add_pd( 
+                _mm_mul_pd( _mm_loadu_pd( &( cornerA2[i] ) ), xOff ),
+                _mm_mul_pd( oneMinusXOff, 
+                            _mm_loadu_pd( &( cornerA1[i] ) ) ) );
+        
+        __m128d bottomBlend = 
+            _mm_add_pd( 
+                _mm_mul_pd( _mm_loadu_pd( &( cornerB2[i] ) ), xOff ),
+                _mm_mul_pd( oneMinusXOff, 
+                            _mm_loadu_pd( &( cornerB1[i] ) ) ) );
+        
+        _mm_storeu_pd( &( outValues[i] ),
+                       _mm_add_pd( _mm_mul_pd( bottomBlend, yOff ),
+                                   _mm_mul_pd( oneMinusYOff, topBlend ) ) );
+        }
+#endif
+    
+    for( ; i < inNumValues; i++ ) {
+        double topBlend = 
+            cornerA2[i] * xOffset[i] + (1-xOffset[i]) * cornerA1[i];
+    
+        double bottomBlend = 
+            cornerB2[i] * xOffset[i] + (1-xOffset[i]) * cornerB1[i];
+        
+        outValues[i] = bottomBlend * yOffset + (1-yOffset) * topBlend;
+        }
+    }
+
+
+
+// ioSum[i] = inA * inOctave[i] + inB * ioSum[i]
+// one nesting level of the octave sums in getXYFractal
+static void addOctaveRow( double inA, double inB, double *inOctave,
+                          int inNumValues, double *ioSum ) {
+    int i = 0;
+    
+#ifdef FRACTAL_NOISE_SSE2
+    __m128d a = _mm_set1_pd( inA );
+    __m128d b = _mm_set1_pd( inB );
+    
+    for( ; i + 1 < inNumValues; i += 2 ) {
+        _mm_storeu_pd( 
+            &( ioSum[i] ),
+            _mm_add_pd( _mm_mul_pd( a, _mm_loadu_pd( &( inOctave[i] ) ) ),
+                        _mm_mul_pd( b, _mm_loadu_pd( &( ioSum[i] ) ) ) ) );
+        }
+#endif
+
+    for( ; i < inNumValues; i++ ) {
+        ioSum[i] = inA * inOctave[i] + inB * ioSum[i];
+        }
+    }
+
+
+
+// inDivisors from coarsest to finest
+// sum nested like in getXYFractal, with finest octave innermost
+// if inScaleFinest, finest octave is also multiplied by 1 - inRoughness,
+// like in getXYFractal2
+static void getXYFractalOctavesRow( int inStartX, int inY, int inNumValues,
+                                    double inRoughness, 
+                                    int inNumOctaves, double *inDivisors,
+                                    char inScaleFinest,
+                                    double *outValues ) {
+    double b = inRoughness;
+    double a = 1 - b;
+
+    double octave[ ROW_CHUNK ];
+
+    for( int start=0; start<inNumValues; start += ROW_CHUNK ) {
+        int num = inNumValues - start;
+        if( num > ROW_CHUNK ) {
+            num = ROW_CHUNK;
+            }
+        
+        double *sum = &( outValues[start] );
+        
+        getXYRandomBNRow( inStartX + start, inY, num, 
+                          inDivisors[ inNumOctaves - 1 ], sum );
+        
+        if( inScaleFinest ) {
+            for( int i=0; i<num; i++ ) {
+                sum[i] = a * sum[i];
+                }
+            }
+        
+        for( int o = inNumOctaves - 2; o >= 0; o-- ) {
+            getXYRandomBNRow( inStartX + start, inY, num, 
+                              inDivisors[o], octave );
+
+            addOctaveRow( a, b, octave, num, sum );
+            }
+        
+        for( int i=0; i<num; i++ ) {
+            sum[i] = sum[i] * oneOverIntMax;
+            }
+        }
+    }
+
+
+
+void getXYRandomRow( int inStartX, int inY, int inNumValues, 
+                     double *outValues ) {
+    int i = 0;
+    
+#ifdef FRACTAL_NOISE_SSE2
+    __m128i y = _mm_set1_epi32( inY );
+    __m128d scale = _mm_set1_pd( oneOverIntMax );
+
+    for( ; i + 3 < inNumValues; i += 4 ) {
+        int x = inStartX + i;
+        
+        storeHashes4( 
+            xxTweakedHash2D4( _mm_set_epi32( x + 3, x + 2, x + 1, x ), y ),
+            &( outValues[i] ) );
+        
+        _mm_storeu_pd( &( outValues[i] ),
+                       _mm_mul_pd( _mm_loadu_pd( &( outValues[i] ) ),
+                                   scale ) );
+        _mm_storeu_pd( &( outValues[i + 2] ),
+                       _mm_mul_pd( _mm_loadu_pd( &( outValues[i + 2] ) ),
+                                   scale ) );
+        }
+#endif
+    
+    for( ; i < inNumValues; i++ ) {
+        outValues[i] = getXYRandom( inStartX + i, inY );
+        }
+    }
+
+
+
+void getXYFractalRow( int inStartX, int inY, int inNumValues,
+                      double inRoughness, double inScale,
+                      double *outValues ) {
+    
+    double divisors[6] = { 32 * inScale,
+                           16 * inScale,
+                           8 * inScale,
+                           4 * inScale,
+                           2 * inScale,
+                           inScale };
+    
+    getXYFractalOctavesRow( inStartX, inY, inNumValues, inRoughness,
+                            6, divisors, false, outValues );
+    }
+
+
+
+void getXYFractal2Row( int inStartX, int inY, int inNumValues,
+                       double inRoughness, double inScale,
+                       double *outValues ) {
+    
+    double divisors[3] = { 4 * inScale,
+                           2 * inScale,
+                           inScale };
+    
+    getXYFractalOctavesRow( inStartX, inY, inNumValues, inRoughness,
+                            3, divisors, true, outValues );
+    }
+
+
+
+void getXYFractalBlock( int inStartX, int inStartY, 
+                        int inWidth, int inHeight,
+                        double inRoughness, double inScale,
+                        double *outValues ) {
+    for( int y=0; y<inHeight; y++ ) {
+        getXYFractalRow( inStartX, inStartY + y, inWidth, 
+                         inRoughness, inScale,
+                         &( outValues[ y * inWidth ] ) );
+        }
+    }
+
+
+
+void getXYFractal2Block( int inStartX, int inStartY, 
+                         int inWidth, int inHeight,
+                         double inRoughness, double inScale,
+                         double *outValues ) {
+    for( int y=0; y<inHeight; y++ ) {
+        getXYFractal2Row( inStartX, inStartY + y, inWidth, 
+                          inRoughness, inScale,
+                          &( outValues[ y * inWidth ] ) );
+        }
+    }
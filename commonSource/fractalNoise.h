@@ -1,7 +1,7 @@
 #include <stdint.h>
 
 
-// sets seed for all subsequent calls
+// sets seed for all subsequent calls from this thread
 // Two 32-bit seeds, for a 64-bit total seed space
 // Second seed defaults to 0.  If 0, seed-response is same as old single-seed
 // version.
@@ -19,4 +19,35 @@ double getXYRandom( int inX, int inY );
 double getXYFractal( int inX, int inY, double inRoughness, double inScale );
 
 // fewer octaves
-double getXYFractal2( int inX, int inY, double inRoughness, double inScale );
\ No newline at end of file
+double getXYFractal2( int inX, int inY, double inRoughness, double inScale );
+
+
+
+// Row and block versions of the above, for filling in many values at once.
+//
+// Results are the same, bit for bit, as calling the single-value versions
+// for each (x,y), but much faster.
+
+// outValues[i] gets value for ( inStartX + i, inY )
+void getXYRandomRow( int inStartX, int inY, int inNumValues, 
+                     double *outValues );
+
+void getXYFractalRow( int inStartX, int inY, int inNumValues,
+                      double inRoughness, double inScale,
+                      double *outValues );
+
+void getXYFractal2Row( int inStartX, int inY, int inNumValues,
+                       double inRoughness, double inScale,
+                       double *outValues );
+
+
+// outValues has inWidth * inHeight values, in rows starting from inStartY
+void getXYFractalBlock( int inStartX, int inStartY, 
+                        int inWidth, int inHeight,
+                        double inRoughness, double inScale,
+                        double *outValues );
+
+void getXYFractal2Block( int inStartX, int inStartY, 
+                         int inWidth, int inHeight,
+                         double inRoughness, double inScale,
+                         double *outValues );
@@ -50,6 +50,7 @@
 #include "OneLife/server/HashTable.h"
 
 #include <stdlib.h>//#include <math.h>
+#include <zlib.h>
 #include <string>
 #include <fstream>
 
@@ -2355,6 +2356,8 @@ typedef enum messageType {
     CRAVING,
     PONG,
     COMPRESSED_MESSAGE,
+    COMPRESSED_FRAME,
+    COMPRESSED_STREAM,
     UNKNOWN
     } messageType;
 
@@ -2377,6 +2380,12 @@ messageType getMessageType( char *inMessage ) {
     if( strcmp( copy, "CM" ) == 0 ) {
         returnValue = COMPRESSED_MESSAGE;
         }
+    else if( strcmp( copy, "CF" ) == 0 ) {
+        returnValue = COMPRESSED_FRAME;
+        }
+    else if( strcmp( copy, "CZ" ) == 0 ) {
+        returnValue = COMPRESSED_STREAM;
+        }
     else if( strcmp( copy, "MC" ) == 0 ) {
         returnValue = MAP_CHUNK;
         }
@@ -2519,6 +2528,61 @@ char pendingCMData = false;
 int pendingCMCompressedSize = 0;
 int pendingCMDecompressedSize = 0;
 
+char pendingCFData = false;
+int pendingCFCompressedSize = 0;
+int pendingCFDecompressedSize = 0;
+
+char pendingCZData = false;
+int pendingCZCompressedSize = 0;
+int pendingCZDecompressedSize = 0;
+
+// one for whole connection, CZ messages each continue it
+static z_stream serverInflateStream;
+static char serverInflateStreamOn = false;
+
+
+static void endServerInflateStream() {
+    if( serverInflateStreamOn ) {
+        inflateEnd( &serverInflateStream );
+        serverInflateStreamOn = false;
+        }
+    }
+
+
+// returns NULL on failure
+static unsigned char *inflateServerStream( unsigned char *inData,
+                                           int inDataLength,
+                                           int inInflatedLength ) {
+    if( ! serverInflateStreamOn ) {
+        memset( &serverInflateStream, 0, sizeof( serverInflateStream ) );
+        
+        if( inflateInit( &serverInflateStream ) != Z_OK ) {
+            return NULL;
+            }
+        serverInflateStreamOn = true;
+        }
+    
+    unsigned char *inflated = new unsigned char[ inInflatedLength ];
+    
+    serverInflateStream.next_in = inData;
+    serverInflateStream.avail_in = inDataLength;
+    serverInflateStream.next_out = inflated;
+    serverInflateStream.avail_out = inInflatedLength;
+    
+    int result = inflate( &serverInflateStream, Z_SYNC_FLUSH );
+    
+    if( ( result != Z_OK && result != Z_BUF_ERROR ) ||
+        serverInflateStream.avail_in != 0 ||
+        serverInflateStream.avail_out != 0 ) {
+        
+        // stream can't be trusted after this
+        delete [] inflated;
+        return NULL;
+        }
+    
+    return inflated;
+    }
+
 
 SimpleVector<char*> readyPendingReceivedMessages;
 
@@ -2594,6 +2658,96 @@ char *getNextServerMessageRaw() {
             return NULL;
             }
         }
+
+    if( pendingCFData ) {
+        if( serverSocketBuffer.size() >= pendingCFCompressedSize ) {
+            pendingCFData = false;
+            
+            unsigned char *compressedData = 
+                new unsigned char[ pendingCFCompressedSize ];
+            
+            for( int i=0; i<pendingCFCompressedSize; i++ ) {
+                compressedData[i] = serverSocketBuffer.getElementDirect( i );
+                }
+            serverSocketBuffer.deleteStartElements( pendingCFCompressedSize );
+            
+            unsigned char *decompressedFrame =
+                zipDecompress( compressedData, 
+                               pendingCFCompressedSize,
+                               pendingCFDecompressedSize );
+
+            delete [] compressedData;
+
+            if( decompressedFrame == NULL ) {
+                printf( "Decompressing CF message failed\n" );
+                return NULL;
+                }
+
+            // several whole messages in a row
+            // put them back at the front of the buffer, to be read
+            // like any others
+            int restSize = serverSocketBuffer.size();
+            unsigned char *rest = serverSocketBuffer.getElementArray();
+            
+            serverSocketBuffer.deleteAll();
+            serverSocketBuffer.appendArray( decompressedFrame,
+                                            pendingCFDecompressedSize );
+            serverSocketBuffer.appendArray( rest, restSize );
+            
+            delete [] rest;
+            delete [] decompressedFrame;
+
+            return getNextServerMessageRaw();
+            }
+        else {
+            // wait for more data to arrive
+            return NULL;
+            }
+        }
+
+    if( pendingCZData ) {
+        if( serverSocketBuffer.size() >= pendingCZCompressedSize ) {
+            pendingCZData = false;
+            
+            unsigned char *compressedData = 
+                new unsigned char[ pendingCZCompressedSize ];
+            
+            for( int i=0; i<pendingCZCompressedSize; i++ ) {
+                compressedData[i] = serverSocketBuffer.getElementDirect( i );
+                }
+            serverSocketBuffer.deleteStartElements( pendingCZCompressedSize );
+            
+            unsigned char *decompressedFrame =
+                inflateServerStream( compressedData, 
+                                     pendingCZCompressedSize,
+                                     pendingCZDecompressedSize );
+
+            delete [] compressedData;
+
+            if( decompressedFrame == NULL ) {
+                printf( "Decompressing CZ message failed\n" );
+                return NULL;
+                }
+
+            // same as CF from here
+            int restSize = serverSocketBuffer.size();
+            unsigned char *rest = serverSocketBuffer.getElementArray();
+            
+            serverSocketBuffer.deleteAll();
+            serverSocketBuffer.appendArray( decompressedFrame,
+                                            pendingCZDecompressedSize );
+            serverSocketBuffer.appendArray( rest, restSize );
+            
+            delete [] rest;
+            delete [] decompressedFrame;
+
+            return getNextServerMessageRaw();
+            }
+        else {
+            // wait for more data to arrive
+            return NULL;
+            }
+        }
     
 
 
@@ -2651,6 +2805,24 @@ char *getNextServerMessageRaw() {
         delete [] message;
         return NULL;
         }
+    else if( getMessageType( message ) == COMPRESSED_FRAME ) {
+        pendingCFData = true;
+
+        sscanf( message, "CF\n%d %d\n", 
+                &pendingCFDecompressedSize, &pendingCFCompressedSize );
+
+        delete [] message;
+        return getNextServerMessageRaw();
+        }
+    else if( getMessageType( message ) == COMPRESSED_STREAM ) {
+        pendingCZData = true;
+
+        sscanf( message, "CZ\n%d %d\n", 
+                &pendingCZDecompressedSize, &pendingCZCompressedSize );
+
+        delete [] message;
+        return getNextServerMessageRaw();
+        }
     else {
         messagesInCount++;
         return message;
@@ -4806,6 +4978,8 @@ LivingLifePage::~LivingLifePage() {
     readyPendingReceivedMessages.deallocateStringElements();
 
     serverFrameMessages.deallocateStringElements();
+
+    endServerInflateStream();
     
     if( pendingMapChunkMessage != NULL ) {
         delete [] pendingMapChunkMessage;
@@ -16519,6 +16693,11 @@ void LivingLifePage::step() {
             // subsequent messages should all be part of FRAME batches
             waitForFrameMessages = true;
 
+            // let server know which protocol extensions we understand
+            // older servers ignore this
+            // 1 = CF frames, 2 = CZ deflate stream
+            sendToServerSocket( (char*)"FEATURES 3 0#" );
+
             SettingsManager::setSetting( "loginSuccess", 1 );
 
             delete [] message;
@@ -24445,6 +24624,11 @@ void LivingLifePage::makeActive( char inFresh ) {
         pendingMapChunkMessage = NULL;
         }
     pendingCMData = false;
+    pendingCFData = false;
+    pendingCZData = false;
+    
+    // server starts a new deflate stream for each connection
+    endServerInflateStream();
     
 
     clearLiveObjects();
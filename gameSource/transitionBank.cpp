@@ -12,6 +12,8 @@
 #include "objectBank.h"
 #include "categoryBank.h"
 
+#include <math.h>
+
 
 
 void regenerateDepthMap();
@@ -20,6 +22,8 @@ void regenerateHumanMadeMap();
 
 void regenerateBecomeFoodMap();
 
+void regenerateDecayChainMap();
+
 
 
 // track pointers to all records
@@ -52,6 +56,23 @@ static int humanMadeMapSize = 0;
 static char *humanMadeMap = NULL;
 
 
+typedef struct DecayChainRecord {
+        // -1 if decay can't be skipped over (or there's no decay)
+        int next;
+        double seconds;
+        
+        // total seconds to come back around to this object, or 0 if
+        // chain never comes back
+        double cycleSeconds;
+
+        // part of any containment transition
+        char inContTrans;
+    } DecayChainRecord;
+
+static int decayChainMapSize = 0;
+static DecayChainRecord *decayChainMap = NULL;
+
+
 
 static FolderCache cache;
 
@@ -1592,6 +1613,7 @@ void initTransBankFinish() {
     regenerateDepthMap();
     regenerateHumanMadeMap();
     regenerateBecomeFoodMap();
+    regenerateDecayChainMap();
     }
 
 
@@ -1617,7 +1639,12 @@ void freeTransBank() {
         humanMadeMap = NULL;
         }
     humanMadeMapSize = 0;
-    
+
+    if( decayChainMap != NULL ) {
+        delete [] decayChainMap;
+        decayChainMap = NULL;
+        }
+    decayChainMapSize = 0;
     }
 
 
@@ -2175,6 +2202,102 @@ void regenerateBecomeFoodMap() {
 
 
 
+// longest chain we will follow, to find cycles, or in one catch-up
+#define DECAY_CHAIN_MAX_STEPS 256
+
+
+void regenerateDecayChainMap() {
+    
+    if( decayChainMap != NULL ) {    
+        delete [] decayChainMap;
+        decayChainMap = NULL;
+        }
+    
+    decayChainMapSize = getMaxObjectID() + 1;
+        
+    decayChainMap = new DecayChainRecord[ decayChainMapSize ];
+    
+    for( int i=0; i<decayChainMapSize; i++ ) {
+        decayChainMap[i].next = -1;
+        decayChainMap[i].seconds = 0;
+        decayChainMap[i].cycleSeconds = 0;
+        decayChainMap[i].inContTrans = false;
+        }
+    
+
+    for( int i=0; i<records.size(); i++ ) {
+        TransRecord *t = records.getElementDirect(i);
+        
+        if( t->contTransFlag != 0 ) {
+            if( t->actor > 0 && t->actor < decayChainMapSize ) {
+                decayChainMap[ t->actor ].inContTrans = true;
+                }
+            if( t->target > 0 && t->target < decayChainMapSize ) {
+                decayChainMap[ t->target ].inContTrans = true;
+                }
+            }
+        }
+    
+
+    for( int i=0; i<decayChainMapSize; i++ ) {
+        ObjectRecord *o = getObject( i );
+        
+        if( o == NULL || o->numSlots > 0 ) {
+            continue;
+            }
+        
+        TransRecord *t = getTrans( -1, i );
+        
+        if( t == NULL || t->autoDecaySeconds <= 0 ) {
+            continue;
+            }
+        
+        // only decays that end up in the same place every time
+        // can be skipped over
+        if( t->move != 0 ||
+            t->targetChangeChance != 1.0f ||
+            t->newTarget < 0 ||
+            t->newTarget >= decayChainMapSize ||
+            isProbabilitySet( t->newTarget ) ) {
+            continue;
+            }
+        
+        if( t->newTarget > 0 && 
+            ( getObject( t->newTarget ) == NULL ||
+              getObject( t->newTarget )->numSlots > 0 ) ) {
+            continue;
+            }
+
+        decayChainMap[i].next = t->newTarget;
+        decayChainMap[i].seconds = t->autoDecaySeconds;
+        }
+    
+
+    // find cycles (seasonal things, regrowth, etc.)
+    for( int i=0; i<decayChainMapSize; i++ ) {
+        if( decayChainMap[i].next <= 0 ) {
+            continue;
+            }
+        
+        double total = decayChainMap[i].seconds;
+        int cur = decayChainMap[i].next;
+        
+        for( int s=0; s<DECAY_CHAIN_MAX_STEPS; s++ ) {
+            if( cur == i ) {
+                decayChainMap[i].cycleSeconds = total;
+                break;
+                }
+            if( cur <= 0 || decayChainMap[cur].next == -1 ) {
+                break;
+                }
+            total += decayChainMap[cur].seconds;
+            cur = decayChainMap[cur].next;
+            }
+        }
+    }
+
+
+
 
 TransRecord *getTrans( int inActor, int inTarget, char inLastUseActor,
                        char inLastUseTarget, int inContTransFlag ) {
@@ -3371,6 +3494,80 @@ char isHumanMade( int inObjectID ) {
 
 
 
+int getDecayChainNext( int inObjectID ) {
+    if( inObjectID <= 0 || inObjectID >= decayChainMapSize ) {
+        return -1;
+        }
+    return decayChainMap[ inObjectID ].next;
+    }
+
+
+
+int getDecayChainResult( int inObjectID, double inElapsedSeconds,
+                         double *outSecondsLeft ) {
+    int cur = inObjectID;
+    double elapsed = inElapsedSeconds;
+    
+    for( int s=0; s<DECAY_CHAIN_MAX_STEPS; s++ ) {
+        
+        if( cur <= 0 || cur >= decayChainMapSize ) {
+            // gone, or an object we know nothing about
+            *outSecondsLeft = 0;
+            return cur;
+            }
+        
+        DecayChainRecord *r = &( decayChainMap[ cur ] );
+        
+        if( r->next == -1 ) {
+            // chain ends here, but object might still have a decay that
+            // has to be handled step by step
+            TransRecord *t = getTrans( -1, cur );
+            
+            if( t == NULL || t->autoDecaySeconds <= 0 ) {
+                *outSecondsLeft = 0;
+                }
+            else {
+                *outSecondsLeft = t->autoDecaySeconds - elapsed;
+                
+                if( *outSecondsLeft < 1 ) {
+                    // overdue, let it happen right away
+                    *outSecondsLeft = 1;
+                    }
+                }
+            return cur;
+            }
+        
+        if( r->cycleSeconds > 0 && elapsed >= r->cycleSeconds ) {
+            // skip whole trips around cycle
+            elapsed = fmod( elapsed, r->cycleSeconds );
+            }
+
+        if( elapsed < r->seconds ) {
+            *outSecondsLeft = r->seconds - elapsed;
+            return cur;
+            }
+        
+        elapsed -= r->seconds;
+        cur = r->next;
+        }
+    
+    // chain longer than we're willing to follow at once
+    // pick up from here next time
+    *outSecondsLeft = 1;
+    return cur;
+    }
+
+
+
+char isInContTrans( int inObjectID ) {
+    if( inObjectID <= 0 || inObjectID >= decayChainMapSize ) {
+        return false;
+        }
+    return decayChainMap[ inObjectID ].inContTrans;
+    }
+
+
+
 void setTransitionEpoch( int inEpocSeconds ) {
     for( int i=0; i<records.size(); i++ ) {
         TransRecord *tr = records.getElementDirect(i);
@@ -3379,4 +3576,8 @@ void setTransitionEpoch( int inEpocSeconds ) {
             tr->autoDecaySeconds = tr->epochAutoDecay * inEpocSeconds;
             }
         }
+    
+    // chain times have changed
+    regenerateDecayChainMap();
     }
+
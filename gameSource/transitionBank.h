@@ -253,6 +253,33 @@ char isHumanMade( int inObjectID );
 
 
 
+// Auto-decay chains, for skipping ahead over many decays at once.
+//
+// A decay is part of a chain only if it has the same result every time
+// (no movement, no change chance, no probability set), and neither
+// object involved is a container.
+
+// returns object that inObjectID decays into, or -1 if inObjectID has no
+// decay that can be skipped over
+int getDecayChainNext( int inObjectID );
+
+
+// inObjectID came into being inElapsedSeconds ago
+// returns the object that exists now, after following the chain,
+// and sets outSecondsLeft to time left until that object decays,
+// or 0 if it never decays.
+//
+// cycles in chains are jumped over in one step, so inElapsedSeconds can be
+// very large
+int getDecayChainResult( int inObjectID, double inElapsedSeconds,
+                         double *outSecondsLeft );
+
+
+// true if object is the actor or target of any containment transition
+char isInContTrans( int inObjectID );
+
+
+
 // walks through all transitions and replaces any epoch-based autoDecay
 // transition times with inEpocSeconds
 // Intended to be called at server startup or when epoch time changes
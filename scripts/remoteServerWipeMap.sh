@@ -62,7 +62,13 @@ then
 	rm ~/checkout/OneLife/server/lookTime.db
 	rm ~/checkout/OneLife/server/floor.db 
 	rm ~/checkout/OneLife/server/floorTime.db
+	rm -f ~/checkout/OneLife/server/mapTile.db
+	rm -f ~/checkout/OneLife/server/mapTile.db.cold
 	rm ~/checkout/OneLife/server/eve.db
+	
+	# saved hash table indexes and deleted-record journals for the db files above
+	rm -f ~/checkout/OneLife/server/*.db.index
+	rm -f ~/checkout/OneLife/server/*.db.holes
 
     # don't delete playerStats.db
 
@@ -3,131 +3,134 @@
 
 
 CoordinateTimeTracking::CoordinateTimeTracking()
-        :mNextIndex( 0 ) {
+        : mRegionIndex( 1024, -1 ),
+          mStaleTime( 0 ),
+          mLastRegion( NULL ) {
     }
 
 
 
+CoordinateTimeTracking::~CoordinateTimeTracking() {
+    for( int i=0; i<mRegions.size(); i++ ) {
+        delete mRegions.getElementDirect( i );
+        }
+    }
 
-char CoordinateTimeTracking::checkExists( int inX, int inY, 
-                                          timeSec_t inCurTime ) {
-    
-    int dir = 1;
-    
-    int numRecords = mRecords.size();
-    
 
-    if( numRecords > 0 ) {
-        
-        CoordinateXYRecord *testR = mRecords.getElement( mNextIndex );
 
-        if( testR->y == inY &&
-            testR->x == inX ) {
-            
-            testR->t = inCurTime;
-            
-            return true;
-            }
+// floor division, so negative coordinates map to the right region
+static int toRegion( int inCoord ) {
+    if( inCoord >= 0 ) {
+        return inCoord / COORD_TRACKING_REGION_SIZE;
+        }
+    return - ( ( - inCoord - 1 ) / COORD_TRACKING_REGION_SIZE ) - 1;
+    }
 
 
-        if( testR->y > inY ||
-            ( testR->y == inY 
-              && 
-              testR->x > inX ) ) {
-            dir = -1;
-            }
 
-
-        if( dir == 1 ) {
-            for( mNextIndex = mNextIndex; 
-                 mNextIndex < numRecords; mNextIndex ++ ) {
-                
-                CoordinateXYRecord *r = mRecords.getElement( mNextIndex );
-                if( r->y == inY &&
-                    r->x == inX ) {
-                    
-                    r->t = inCurTime;
-                    
-                    return true;
-                    }
-                
-                if( r->y > inY ||
-                    ( r->y == inY &&
-                      r->x > inX ) ) {
-                    // walked past spot and not found
-                    // keep mNextIndex as insert point
-                    break;
-                    }
-                }
-            }
-        else if( dir == -1 ) {
-            for( mNextIndex = mNextIndex; mNextIndex > -1; mNextIndex -- ) {
-                CoordinateXYRecord *r = mRecords.getElement( mNextIndex );
-                if( r->y == inY &&
-                    r->x == inX ) {
-                    
-                    r->t = inCurTime;
-                    
-                    return true;
-                    }
-                
-                if( r->y < inY ||
-                    ( r->y == inY &&
-                      r->x < inX ) ) {
-                    // walked past spot and not found
-                    // keep mNextIndex as insert point
-                    break;
-                    }
-                }
-            }
+CoordinateRegionRecord *CoordinateTimeTracking::getRegion( int inRegionX,
+                                                           int inRegionY ) {
+    if( mLastRegion != NULL &&
+        mLastRegion->regionX == inRegionX &&
+        mLastRegion->regionY == inRegionY ) {
+        return mLastRegion;
         }
-    else {
-        // no records, use this as insertion point
-        mNextIndex = 0;
+    
+    char found;
+    int index = mRegionIndex.lookup( inRegionX, inRegionY, 0, 0, &found );
+    
+    if( found ) {
+        mLastRegion = mRegions.getElementDirect( index );
+        return mLastRegion;
         }
     
+    return NULL;
+    }
+
+
 
-    // not found
+char CoordinateTimeTracking::checkExists( int inX, int inY, 
+                                          timeSec_t inCurTime ) {
     
-    // insert new
-    CoordinateXYRecord r = { inX, inY, inCurTime };
+    int regionX = toRegion( inX );
+    int regionY = toRegion( inY );
     
-    if( mNextIndex == numRecords ) {
-        // stick on end
-        mRecords.push_back( r );
-        }
-    else if( mNextIndex == -1 ) {
-        // stick on front
-        mRecords.push_front( r );
-        mNextIndex = 0;
+    CoordinateRegionRecord *r = getRegion( regionX, regionY );
+    
+    if( r == NULL ) {
+        r = new CoordinateRegionRecord;
+        
+        r->regionX = regionX;
+        r->regionY = regionY;
+        r->baseTime = inCurTime;
+        r->lastTime = inCurTime;
+        
+        for( int i=0; i<COORD_TRACKING_REGION_CELLS; i++ ) {
+            r->cellTimes[i] = -1;
+            }
+        
+        mRegionIndex.insert( regionX, regionY, 0, 0, mRegions.size() );
+        mRegions.push_back( r );
+        
+        mLastRegion = r;
         }
-    else {
-        mRecords.push_middle( r, mNextIndex );
+    
+    int cell = 
+        ( inY - regionY * COORD_TRACKING_REGION_SIZE ) * 
+        COORD_TRACKING_REGION_SIZE +
+        ( inX - regionX * COORD_TRACKING_REGION_SIZE );
+    
+    float oldTime = r->cellTimes[ cell ];
+    
+    char exists = 
+        oldTime >= 0 && r->baseTime + oldTime > mStaleTime;
+    
+    r->cellTimes[ cell ] = (float)( inCurTime - r->baseTime );
+    
+    if( inCurTime > r->lastTime ) {
+        r->lastTime = inCurTime;
         }
-    return false;
+    
+    return exists;
     }
 
 
 
 void CoordinateTimeTracking::cleanStale( timeSec_t inStaleTime ) {
-    int beforeCleanSize = mRecords.size();
-    
-    // pre-allocate space
-    SimpleVector<CoordinateXYRecord> temp( beforeCleanSize );
-    
+    if( inStaleTime > mStaleTime ) {
+        mStaleTime = inStaleTime;
+        }
     
-    for( int i=0; i<mRecords.size(); i++ ) {
-        CoordinateXYRecord *r = mRecords.getElement( i );
+    // stale cells in live regions are left in place, they read as
+    // cleared because of mStaleTime
+    // only whole regions that have gone stale are dropped
+    for( int i=0; i<mRegions.size(); i++ ) {
+        CoordinateRegionRecord *r = mRegions.getElementDirect( i );
         
-        if( r->t > inStaleTime ) {
-            temp.push_back( *r );
+        if( r->lastTime <= mStaleTime ) {
+            mRegionIndex.remove( r->regionX, r->regionY, 0, 0 );
+            
+            if( r == mLastRegion ) {
+                mLastRegion = NULL;
+                }
+            delete r;
+            
+            // move last region into this spot
+            int lastIndex = mRegions.size() - 1;
+            
+            if( i != lastIndex ) {
+                CoordinateRegionRecord *lastR = 
+                    mRegions.getElementDirect( lastIndex );
+                
+                *( mRegions.getElement( i ) ) = lastR;
+                mRegionIndex.insert( lastR->regionX, lastR->regionY, 0, 0,
+                                     i );
+                }
+            mRegions.deleteElement( lastIndex );
+            
+            // check moved region next
+            i--;
             }
         }
-    mRecords.deleteAll();
-    mRecords.push_back_other( &temp );
-    
-
-    // start index over after cleaning
-    mNextIndex = 0;
     }
 
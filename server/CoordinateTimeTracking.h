@@ -1,13 +1,29 @@
 #include "minorGems/system/Time.h"
 #include "minorGems/util/SimpleVector.h"
 
+#include "FlatHashTable.h"
 
 
-// for testing
-typedef struct CoordinateXYRecord {
-        int x, y;
-        timeSec_t t;
-    } CoordinateXYRecord;
+// coordinates are tracked in square regions of this many cells per side
+#define COORD_TRACKING_REGION_SIZE 64
+#define COORD_TRACKING_REGION_CELLS \
+    ( COORD_TRACKING_REGION_SIZE * COORD_TRACKING_REGION_SIZE )
+
+
+typedef struct CoordinateRegionRecord {
+        int regionX, regionY;
+        
+        // cell times are stored relative to this, to save space
+        timeSec_t baseTime;
+        
+        // latest time of any cell in region
+        timeSec_t lastTime;
+        
+        // seconds after baseTime, or negative if never set
+        // float rounding is far below stale time granularity, even for
+        // regions looked at continuously for weeks
+        float cellTimes[ COORD_TRACKING_REGION_CELLS ];
+    } CoordinateRegionRecord;
 
 
 
@@ -16,6 +32,8 @@ class CoordinateTimeTracking {
 
         CoordinateTimeTracking();
 
+        ~CoordinateTimeTracking();
+
 
         // returns true if exists, or false if not (and new record created if
         // not).  If exists, time of record will be updated to inCurTime
@@ -23,17 +41,27 @@ class CoordinateTimeTracking {
 
         // any records with times equal to or older than inStaleTime will be
         // cleared
+        // inStaleTime should never go backward from one call to the next
         void cleanStale( timeSec_t inStaleTime );
 
 
     private:
 
-        SimpleVector<CoordinateXYRecord> mRecords;
+        SimpleVector<CoordinateRegionRecord*> mRegions;
+        
+        // index into mRegions for each region x,y
+        FlatHashTable<int> mRegionIndex;
+        
+        // cells with times at or before this are treated as cleared,
+        // so they don't each need to be touched in cleanStale
+        timeSec_t mStaleTime;
+        
+        // region of last check, usually same as next, because
+        // coordinates are checked in row-major order (a rectangular
+        // look region)
+        CoordinateRegionRecord *mLastRegion;
         
-        // track index across searches as starting point for next
-        // search, because usually coordinates are checked in
-        // row-major order (a rectangular look region)
-        int mNextIndex;
+        CoordinateRegionRecord *getRegion( int inRegionX, int inRegionY );
         
     };
 
@@ -0,0 +1,374 @@
+#ifndef FLAT_HASH_TABLE_H_INCLUDED
+#define FLAT_HASH_TABLE_H_INCLUDED
+
+
+#include <stdint.h>
+#include <string.h>
+
+
+
+// Same interface as HashTable, but one flat array of records with keys
+// stored inline, using open addressing (robin hood probing).
+//
+// A lookup touches one probe-distance byte and one record per probe,
+// instead of five separate bin vectors.
+//
+// Grows as needed, so inSize is just a starting capacity.
+//
+// Pointers returned by lookupPointer are only valid until the next
+// insert, remove, or clear, since records move around.
+template <class Type>
+class FlatHashTable {
+
+    public:
+
+        // note that inDefaultValue MUST be provided
+        // for any Type that cannot have a value of NULL (example: a struct)
+        FlatHashTable( int inSize,
+                       Type inDefaultValue = (Type)NULL );
+
+        ~FlatHashTable();
+
+        Type lookup( int inKeyA, int inKeyB, int inKeyC, int inKeyD,
+                     char *outFound );
+
+        // pointer to entry
+        Type *lookupPointer( int inKeyA, int inKeyB, int inKeyC, int inKeyD );
+
+        void insert( int inKeyA, int inKeyB, int inKeyC, int inKeyD,
+                     Type inItem );
+
+        void remove( int inKeyA, int inKeyB, int inKeyC, int inKeyD );
+
+
+        int getNumElements() {
+            return mNumElements;
+            }
+
+        // flush all entries from table
+        void clear();
+
+    private:
+
+        typedef struct FlatRecord {
+                int keyA, keyB, keyC, keyD;
+                Type value;
+            } FlatRecord;
+
+
+        // power of 2
+        uint32_t mSize;
+        uint32_t mMask;
+
+        int mNumElements;
+
+        Type mDefaultValue;
+
+        FlatRecord *mRecords;
+
+        // 0 for empty slot, or 1 + distance of record from its home slot
+        uint8_t *mDist;
+
+
+        uint32_t computeHash( int inKeyA, int inKeyB, int inKeyC,
+                              int inKeyD );
+
+        // index of record, or -1 if not found
+        int findIndex( int inKeyA, int inKeyB, int inKeyC, int inKeyD );
+
+        void allocate( uint32_t inSize );
+
+        // places a record known not to be in table
+        // returns false if a probe distance would overflow, with
+        // ioRecord set to the record still left to place (possibly a
+        // different one that it displaced)
+        char place( FlatRecord *ioRecord );
+
+        // at least doubles size, more if records don't all fit
+        void grow();
+
+    };
+
+
+
+// max records per slot before growing, out of 8
+#define FLAT_HASH_MAX_LOAD_EIGHTHS 7
+
+// probe distances are stored in a byte, grow well before overflow
+#define FLAT_HASH_MAX_DIST 250
+
+
+
+template <class Type>
+FlatHashTable<Type>::FlatHashTable( int inSize, Type inDefaultValue )
+        : mNumElements( 0 ),
+          mDefaultValue( inDefaultValue ) {
+
+    uint32_t size = 16;
+    while( size < (uint32_t)inSize ) {
+        size *= 2;
+        }
+    allocate( size );
+    }
+
+
+
+template <class Type>
+FlatHashTable<Type>::~FlatHashTable() {
+    delete [] mRecords;
+    delete [] mDist;
+    }
+
+
+
+template <class Type>
+void FlatHashTable<Type>::allocate( uint32_t inSize ) {
+    mSize = inSize;
+    mMask = inSize - 1;
+    mRecords = new FlatRecord[ inSize ];
+    mDist = new uint8_t[ inSize ];
+    memset( mDist, 0, inSize );
+    }
+
+
+
+template <class Type>
+inline uint32_t FlatHashTable<Type>::computeHash( int inKeyA, int inKeyB,
+                                                  int inKeyC, int inKeyD ) {
+    // neighboring map cells must not land in neighboring slots, or
+    // probe runs get long
+    uint32_t hashKey = (uint32_t)inKeyA * 734727 +
+        (uint32_t)inKeyB * 263471 +
+        (uint32_t)inKeyC * 2753 +
+        (uint32_t)inKeyD * 948731;
+
+    hashKey ^= hashKey >> 16;
+    hashKey *= 0x85ebca6bU;
+    hashKey ^= hashKey >> 13;
+    hashKey *= 0xc2b2ae35U;
+    hashKey ^= hashKey >> 16;
+
+    return hashKey;
+    }
+
+
+
+template <class Type>
+int FlatHashTable<Type>::findIndex( int inKeyA, int inKeyB, int inKeyC,
+                                    int inKeyD ) {
+    uint32_t i = computeHash( inKeyA, inKeyB, inKeyC, inKeyD ) & mMask;
+
+    uint8_t dist = 1;
+
+    while( true ) {
+        uint8_t d = mDist[i];
+
+        // robin hood:  a record farther from its home than we are
+        // from ours can't be followed by ours
+        if( d < dist ) {
+            return -1;
+            }
+
+        if( d == dist ) {
+            FlatRecord *r = &( mRecords[i] );
+
+            if( r->keyA == inKeyA && r->keyB == inKeyB &&
+                r->keyC == inKeyC && r->keyD == inKeyD ) {
+                return (int)i;
+                }
+            }
+
+        i = ( i + 1 ) & mMask;
+        dist++;
+        }
+    }
+
+
+
+template <class Type>
+Type FlatHashTable<Type>::lookup( int inKeyA, int inKeyB, int inKeyC,
+                                  int inKeyD, char *outFound ) {
+
+    int i = findIndex( inKeyA, inKeyB, inKeyC, inKeyD );
+
+    if( i != -1 ) {
+        *outFound = true;
+        return mRecords[i].value;
+        }
+
+    *outFound = false;
+
+    // else return an undefined item (okay, since outFound is false);
+    return mDefaultValue;
+    }
+
+
+
+template <class Type>
+Type *FlatHashTable<Type>::lookupPointer( int inKeyA, int inKeyB, int inKeyC,
+                                          int inKeyD ) {
+
+    int i = findIndex( inKeyA, inKeyB, inKeyC, inKeyD );
+
+    if( i != -1 ) {
+        return &( mRecords[i].value );
+        }
+
+    return NULL;
+    }
+
+
+
+template <class Type>
+char FlatHashTable<Type>::place( FlatRecord *ioRecord ) {
+
+    FlatRecord inRecord = *ioRecord;
+
+    uint32_t i = computeHash( inRecord.keyA, inRecord.keyB,
+                              inRecord.keyC, inRecord.keyD ) & mMask;
+
+    unsigned int dist = 1;
+
+    while( true ) {
+        if( dist > FLAT_HASH_MAX_DIST ) {
+            *ioRecord = inRecord;
+            return false;
+            }
+
+        uint8_t d = mDist[i];
+
+        if( d == 0 ) {
+            mRecords[i] = inRecord;
+            mDist[i] = (uint8_t)dist;
+            return true;
+            }
+
+        if( d < dist ) {
+            // take from the rich, keep placing the displaced record
+            FlatRecord displaced = mRecords[i];
+
+            mRecords[i] = inRecord;
+            mDist[i] = (uint8_t)dist;
+
+            inRecord = displaced;
+            dist = d;
+            }
+
+        i = ( i + 1 ) & mMask;
+        dist++;
+        }
+    }
+
+
+
+template <class Type>
+void FlatHashTable<Type>::grow() {
+    FlatRecord *oldRecords = mRecords;
+    uint8_t *oldDist = mDist;
+    uint32_t oldSize = mSize;
+
+    uint32_t newSize = oldSize * 2;
+
+    while( true ) {
+        allocate( newSize );
+
+        char placedAll = true;
+
+        for( uint32_t i=0; i<oldSize; i++ ) {
+            if( oldDist[i] != 0 ) {
+                // rare at half the load, but keys that all hash close
+                // together can still make a run too long
+                // place a copy, so old table is left whole for retry
+                FlatRecord r = oldRecords[i];
+
+                if( ! place( &r ) ) {
+                    placedAll = false;
+                    break;
+                    }
+                }
+            }
+
+        if( placedAll ) {
+            break;
+            }
+
+        delete [] mRecords;
+        delete [] mDist;
+
+        newSize *= 2;
+        }
+
+    delete [] oldRecords;
+    delete [] oldDist;
+    }
+
+
+
+template <class Type>
+void FlatHashTable<Type>::insert( int inKeyA, int inKeyB, int inKeyC,
+                                  int inKeyD, Type inItem ) {
+
+    int i = findIndex( inKeyA, inKeyB, inKeyC, inKeyD );
+
+    if( i != -1 ) {
+        // replace
+        mRecords[i].value = inItem;
+        return;
+        }
+
+    if( (uint32_t)( mNumElements + 1 ) * 8 >
+        mSize * FLAT_HASH_MAX_LOAD_EIGHTHS ) {
+        grow();
+        }
+
+    FlatRecord r = { inKeyA, inKeyB, inKeyC, inKeyD, inItem };
+
+    while( ! place( &r ) ) {
+        // growing spreads out long probe runs, then finish placing
+        // whatever record was left over
+        grow();
+        }
+
+    mNumElements++;
+    }
+
+
+
+template <class Type>
+void FlatHashTable<Type>::remove( int inKeyA, int inKeyB, int inKeyC,
+                                  int inKeyD ) {
+    int found = findIndex( inKeyA, inKeyB, inKeyC, inKeyD );
+
+    if( found == -1 ) {
+        return;
+        }
+
+    // shift following records back toward their homes, so no
+    // tombstones are needed
+    uint32_t i = (uint32_t)found;
+    uint32_t next = ( i + 1 ) & mMask;
+
+    while( mDist[ next ] > 1 ) {
+        mRecords[i] = mRecords[ next ];
+        mDist[i] = mDist[ next ] - 1;
+
+        i = next;
+        next = ( next + 1 ) & mMask;
+        }
+
+    mDist[i] = 0;
+
+    mNumElements--;
+    }
+
+
+
+template <class Type>
+void FlatHashTable<Type>::clear() {
+    memset( mDist, 0, mSize );
+    mNumElements = 0;
+    }
+
+
+
+#endif
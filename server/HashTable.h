@@ -1,3 +1,6 @@
+#ifndef HASH_TABLE_H_INCLUDED
+#define HASH_TABLE_H_INCLUDED
+
 #include "minorGems/util/SimpleVector.h"
 
 
@@ -238,3 +241,5 @@ void HashTable<Type>::clear() {
     mNumElements = 0;
     }
 
+
+#endif
@@ -0,0 +1,468 @@
+#ifndef TIMING_WHEEL_H_INCLUDED
+#define TIMING_WHEEL_H_INCLUDED
+
+
+#include "minorGems/system/Time.h"
+#include "minorGems/util/SimpleVector.h"
+
+#include <stdint.h>
+#include <math.h>
+
+
+
+// Hierarchical timing wheel of items keyed by ETA in seconds.
+//
+// Level 0 has one slot per second for the current 64-second block,
+// level 1 one slot per 64-second block in the current 4096-second block,
+// and so on for 4 levels (about 194 days), with anything later in an
+// overflow list.  Slots of a higher level are spread into lower levels
+// as time reaches them.
+//
+// Insert, cancel, and reschedule are O(1) through handles.  Finding the
+// next ETA is O(1) too, using a bitmap of occupied slots per level and
+// a cached minimum per slot.
+//
+// Items due in the same second come out in no particular order.
+
+
+// 2^TW_LEVEL_BITS slots per level
+#define TW_LEVEL_BITS 6
+#define TW_SLOTS 64
+#define TW_LEVELS 4
+#define TW_OVERFLOW_BUCKET ( TW_LEVELS * TW_SLOTS )
+#define TW_NUM_BUCKETS ( TW_OVERFLOW_BUCKET + 1 )
+
+
+
+template <class Type>
+class TimingWheel {
+
+    public:
+
+        TimingWheel();
+
+
+        // returns handle to item, valid until item is popped or cancelled
+        int insert( Type inItem, timeSec_t inETA );
+
+        void cancel( int inHandle );
+
+        void reschedule( int inHandle, timeSec_t inETA );
+
+        // pointer valid until next insert
+        Type *getItem( int inHandle );
+
+        timeSec_t getETA( int inHandle );
+
+
+        // removes one item with ETA at or before inCurTime
+        // returns false if there are none
+        //
+        // inCurTime should never go backward from one call to the next
+        char popDue( timeSec_t inCurTime, Type *outItem );
+
+        // returns false if empty
+        char getNextETA( timeSec_t *outETA );
+
+        int size() {
+            return mNumItems;
+            }
+
+        void clear();
+
+
+    private:
+
+        typedef struct WheelNode {
+                Type item;
+                timeSec_t eta;
+                // -1 for none
+                int prev, next;
+                // -1 if node is free
+                int bucket;
+            } WheelNode;
+
+
+        SimpleVector<WheelNode> mNodes;
+
+        // free nodes, linked through next
+        int mFreeHead;
+
+        int mNumItems;
+
+
+        int mHeads[ TW_NUM_BUCKETS ];
+
+        timeSec_t mBucketMin[ TW_NUM_BUCKETS ];
+
+        // true if min node was removed, and mBucketMin needs recomputing
+        char mBucketMinStale[ TW_NUM_BUCKETS ];
+
+        uint64_t mLevelBits[ TW_LEVELS ];
+
+        // wheel is positioned at this second
+        // never past the current time
+        int64_t mCurrent;
+
+
+        int computeBucket( timeSec_t inETA );
+
+        void link( int inNode, int inBucket );
+
+        void unlink( int inNode );
+
+        void freeNode( int inNode );
+
+        // relinks every item in bucket where it belongs now
+        void spreadBucket( int inBucket );
+
+        // returns -1 if empty
+        int findNextBucket( int64_t *outStartSecond );
+
+        timeSec_t getBucketMin( int inBucket );
+
+    };
+
+
+
+template <class Type>
+TimingWheel<Type>::TimingWheel()
+        : mFreeHead( -1 ),
+          mNumItems( 0 ),
+          mCurrent( 0 ) {
+
+    for( int b=0; b<TW_NUM_BUCKETS; b++ ) {
+        mHeads[b] = -1;
+        mBucketMinStale[b] = false;
+        }
+    for( int l=0; l<TW_LEVELS; l++ ) {
+        mLevelBits[l] = 0;
+        }
+    }
+
+
+
+template <class Type>
+inline int TimingWheel<Type>::computeBucket( timeSec_t inETA ) {
+    int64_t sec = (int64_t)floor( inETA );
+
+    if( sec < mCurrent ) {
+        // already due
+        sec = mCurrent;
+        }
+
+    for( int l=0; l<TW_LEVELS; l++ ) {
+        int shift = TW_LEVEL_BITS * ( l + 1 );
+
+        if( ( sec >> shift ) == ( mCurrent >> shift ) ) {
+            return l * TW_SLOTS +
+                (int)( ( sec >> ( TW_LEVEL_BITS * l ) ) & ( TW_SLOTS - 1 ) );
+            }
+        }
+
+    return TW_OVERFLOW_BUCKET;
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::link( int inNode, int inBucket ) {
+    WheelNode *n = mNodes.getElement( inNode );
+
+    n->bucket = inBucket;
+    n->prev = -1;
+    n->next = mHeads[ inBucket ];
+
+    if( n->next != -1 ) {
+        mNodes.getElement( n->next )->prev = inNode;
+
+        if( ! mBucketMinStale[ inBucket ] &&
+            n->eta < mBucketMin[ inBucket ] ) {
+            mBucketMin[ inBucket ] = n->eta;
+            }
+        }
+    else {
+        mBucketMin[ inBucket ] = n->eta;
+        mBucketMinStale[ inBucket ] = false;
+
+        if( inBucket < TW_OVERFLOW_BUCKET ) {
+            mLevelBits[ inBucket / TW_SLOTS ] |=
+                (uint64_t)1 << ( inBucket % TW_SLOTS );
+            }
+        }
+
+    mHeads[ inBucket ] = inNode;
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::unlink( int inNode ) {
+    WheelNode *n = mNodes.getElement( inNode );
+
+    int b = n->bucket;
+
+    if( n->prev != -1 ) {
+        mNodes.getElement( n->prev )->next = n->next;
+        }
+    else {
+        mHeads[b] = n->next;
+        }
+
+    if( n->next != -1 ) {
+        mNodes.getElement( n->next )->prev = n->prev;
+        }
+
+    if( mHeads[b] == -1 ) {
+        mBucketMinStale[b] = false;
+
+        if( b < TW_OVERFLOW_BUCKET ) {
+            mLevelBits[ b / TW_SLOTS ] &= ~( (uint64_t)1 << ( b % TW_SLOTS ) );
+            }
+        }
+    else if( n->eta == mBucketMin[b] ) {
+        mBucketMinStale[b] = true;
+        }
+
+    n->bucket = -1;
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::freeNode( int inNode ) {
+    mNodes.getElement( inNode )->next = mFreeHead;
+    mFreeHead = inNode;
+    mNumItems--;
+    }
+
+
+
+template <class Type>
+int TimingWheel<Type>::insert( Type inItem, timeSec_t inETA ) {
+    int node;
+
+    if( mFreeHead != -1 ) {
+        node = mFreeHead;
+        mFreeHead = mNodes.getElement( node )->next;
+        }
+    else {
+        WheelNode n;
+        mNodes.push_back( n );
+        node = mNodes.size() - 1;
+        }
+
+    WheelNode *n = mNodes.getElement( node );
+    n->item = inItem;
+    n->eta = inETA;
+
+    link( node, computeBucket( inETA ) );
+
+    mNumItems++;
+
+    return node;
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::cancel( int inHandle ) {
+    unlink( inHandle );
+    freeNode( inHandle );
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::reschedule( int inHandle, timeSec_t inETA ) {
+    unlink( inHandle );
+    mNodes.getElement( inHandle )->eta = inETA;
+    link( inHandle, computeBucket( inETA ) );
+    }
+
+
+
+template <class Type>
+Type *TimingWheel<Type>::getItem( int inHandle ) {
+    return &( mNodes.getElement( inHandle )->item );
+    }
+
+
+
+template <class Type>
+timeSec_t TimingWheel<Type>::getETA( int inHandle ) {
+    return mNodes.getElement( inHandle )->eta;
+    }
+
+
+
+template <class Type>
+timeSec_t TimingWheel<Type>::getBucketMin( int inBucket ) {
+    if( mBucketMinStale[ inBucket ] ) {
+        int node = mHeads[ inBucket ];
+
+        timeSec_t min = mNodes.getElement( node )->eta;
+
+        while( node != -1 ) {
+            WheelNode *n = mNodes.getElement( node );
+            if( n->eta < min ) {
+                min = n->eta;
+                }
+            node = n->next;
+            }
+
+        mBucketMin[ inBucket ] = min;
+        mBucketMinStale[ inBucket ] = false;
+        }
+    return mBucketMin[ inBucket ];
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::spreadBucket( int inBucket ) {
+    int node = mHeads[ inBucket ];
+
+    while( node != -1 ) {
+        int next = mNodes.getElement( node )->next;
+
+        unlink( node );
+        link( node, computeBucket( mNodes.getElement( node )->eta ) );
+
+        node = next;
+        }
+    }
+
+
+
+template <class Type>
+int TimingWheel<Type>::findNextBucket( int64_t *outStartSecond ) {
+    // items inserted while wheel was far behind them (before first pop,
+    // or before time crossed into a new top-level block) sit in overflow
+    // even once they're in range of the levels
+    // move them down before looking, or later items in levels would
+    // come out ahead of them
+    if( mHeads[ TW_OVERFLOW_BUCKET ] != -1 &&
+        computeBucket( getBucketMin( TW_OVERFLOW_BUCKET ) ) !=
+        TW_OVERFLOW_BUCKET ) {
+
+        spreadBucket( TW_OVERFLOW_BUCKET );
+        }
+
+    // lower levels hold earlier blocks, so first occupied slot at or
+    // after current position in lowest level is the earliest
+    for( int l=0; l<TW_LEVELS; l++ ) {
+        int levelShift = TW_LEVEL_BITS * l;
+
+        int curSlot = (int)( ( mCurrent >> levelShift ) & ( TW_SLOTS - 1 ) );
+
+        uint64_t bits = mLevelBits[l] & ( ~(uint64_t)0 << curSlot );
+
+        if( bits != 0 ) {
+            int slot = __builtin_ctzll( bits );
+
+            int blockShift = levelShift + TW_LEVEL_BITS;
+
+            *outStartSecond =
+                ( ( mCurrent >> blockShift ) << blockShift ) +
+                ( (int64_t)slot << levelShift );
+
+            return l * TW_SLOTS + slot;
+            }
+        }
+
+    if( mHeads[ TW_OVERFLOW_BUCKET ] != -1 ) {
+        int64_t minSec = (int64_t)floor( getBucketMin( TW_OVERFLOW_BUCKET ) );
+
+        if( minSec < mCurrent ) {
+            minSec = mCurrent;
+            }
+        *outStartSecond = minSec;
+
+        return TW_OVERFLOW_BUCKET;
+        }
+
+    return -1;
+    }
+
+
+
+template <class Type>
+char TimingWheel<Type>::popDue( timeSec_t inCurTime, Type *outItem ) {
+    int64_t now = (int64_t)floor( inCurTime );
+
+    while( true ) {
+        int64_t start;
+        int b = findNextBucket( &start );
+
+        if( b == -1 || start > now ) {
+            // nothing due, catch up to now, which is safe because no
+            // slot starts at or before it
+            if( now > mCurrent ) {
+                mCurrent = now;
+                }
+            return false;
+            }
+
+        mCurrent = start;
+
+        if( b < TW_SLOTS ) {
+            // a level 0 slot, one second
+            int node = mHeads[b];
+
+            while( node != -1 ) {
+                WheelNode *n = mNodes.getElement( node );
+
+                if( n->eta <= inCurTime ) {
+                    *outItem = n->item;
+                    unlink( node );
+                    freeNode( node );
+                    return true;
+                    }
+                node = n->next;
+                }
+
+            // rest of this second's items are due later in the second
+            return false;
+            }
+
+        // spread this slot into lower levels
+        spreadBucket( b );
+        }
+    }
+
+
+
+template <class Type>
+char TimingWheel<Type>::getNextETA( timeSec_t *outETA ) {
+    int64_t start;
+    int b = findNextBucket( &start );
+
+    if( b == -1 ) {
+        return false;
+        }
+
+    *outETA = getBucketMin( b );
+    return true;
+    }
+
+
+
+template <class Type>
+void TimingWheel<Type>::clear() {
+    mNodes.deleteAll();
+    mFreeHead = -1;
+    mNumItems = 0;
+
+    for( int b=0; b<TW_NUM_BUCKETS; b++ ) {
+        mHeads[b] = -1;
+        mBucketMinStale[b] = false;
+        }
+    for( int l=0; l<TW_LEVELS; l++ ) {
+        mLevelBits[l] = 0;
+        }
+    }
+
+
+
+#endif
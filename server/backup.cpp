@@ -8,12 +8,280 @@
 #include "minorGems/system/Time.h"
 
 #include "minorGems/util/log/AppLog.h"
+#include "minorGems/util/SimpleVector.h"
+#include "minorGems/util/stringUtils.h"
+#include "minorGems/system/Thread.h"
+#include "minorGems/system/MutexLock.h"
+
+#include "map.h"
+#include "lineardb3.h"
+
+#include "../gameSource/objectBank.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 
 static timeSec_t lastBackupTime = 0;
 static int targetHour = 8;
 
+
+
+// copies frozen map DB files into a backup folder in the background
+// folder is named .partial until all files are copied
+class BackupCopyThread : public Thread {
+    public:
+        
+        // takes ownership of inFileNames strings
+        BackupCopyThread( SimpleVector<char*> *inFileNames,
+                          const char *inFolderName )
+                : mFolderName( stringDuplicate( inFolderName ) ),
+                  mDone( false ),
+                  mFailed( false ),
+                  mBytesCopied( 0 ) {
+            mFileNames.push_back_other( inFileNames );
+            }
+        
+        
+        ~BackupCopyThread() {
+            mFileNames.deallocateStringElements();
+            delete [] mFolderName;
+            }
+        
+        
+        virtual void run() {
+            char failed = false;
+            double bytesCopied = 0;
+            
+            char *partialName = autoSprintf( "backups/%s.partial", 
+                                             mFolderName );
+            
+            // created by checkBackup
+            File partialFolder( NULL, partialName );
+            
+            if( ! partialFolder.isDirectory() ) {
+                failed = true;
+                }
+            
+            for( int i=0; i<mFileNames.size() && ! failed; i++ ) {
+                File sourceFile( NULL, mFileNames.getElementDirect( i ) );
+                
+                File *destFile = 
+                    partialFolder.getChildFile( 
+                        mFileNames.getElementDirect( i ) );
+                
+                sourceFile.copy( destFile );
+                
+                // source is frozen, so a complete copy has the same length
+                long length = sourceFile.getLength();
+                
+                if( ! destFile->exists() || 
+                    destFile->getLength() != length ) {
+                    failed = true;
+                    }
+                else {
+                    bytesCopied += length;
+                    }
+                
+                delete destFile;
+                }
+            
+            if( ! failed ) {
+                char *finalName = autoSprintf( "backups/%s", mFolderName );
+                
+                if( rename( partialName, finalName ) != 0 ) {
+                    failed = true;
+                    }
+                delete [] finalName;
+                }
+            
+            delete [] partialName;
+            
+            mLock.lock();
+            mFailed = failed;
+            mBytesCopied = bytesCopied;
+            mDone = true;
+            mLock.unlock();
+            }
+        
+        
+        char isDone() {
+            mLock.lock();
+            char done = mDone;
+            mLock.unlock();
+            return done;
+            }
+        
+        
+        // only valid once isDone
+        char isFailed() {
+            return mFailed;
+            }
+        
+        double getBytesCopied() {
+            return mBytesCopied;
+            }
+        
+        const char *getFolderName() {
+            return mFolderName;
+            }
+        
+        
+    protected:
+        SimpleVector<char*> mFileNames;
+        char *mFolderName;
+        
+        MutexLock mLock;
+        char mDone;
+        char mFailed;
+        double mBytesCopied;
+    };
+
+
+// NULL if no copy in progress
+static BackupCopyThread *copyThread = NULL;
+static double copyStartTime = 0;
+
+
+
+// removes files and folders inside a folder, then the folder itself
+static char removeRecursive( File *inFile ) {
+    if( inFile->isDirectory() ) {
+        int numChildren;
+        File **childFiles = inFile->getChildFiles( &numChildren );
+        
+        for( int i=0; i<numChildren; i++ ) {
+            removeRecursive( childFiles[i] );
+            delete childFiles[i];
+            }
+        delete [] childFiles;
+        
+        return Directory::removeDirectory( inFile );
+        }
+    
+    return inFile->remove();
+    }
+
+
+
+// copies map DB files from backups/<inSnapshotName> into the
+// server folder, in place of the current ones
+// map must not be inited
+// returns true if all files were restored
+static char restoreMapFiles( const char *inSnapshotName ) {
+    char *folderName = autoSprintf( "backups/%s", inSnapshotName );
+    
+    File snapshotFolder( NULL, folderName );
+    
+    delete [] folderName;
+    
+    if( ! snapshotFolder.isDirectory() ) {
+        AppLog::errorF( "Map snapshot backups/%s not found, "
+                        "not restoring", inSnapshotName );
+        return false;
+        }
+    
+    AppLog::infoF( "Restoring map DB files from snapshot backups/%s ...",
+                   inSnapshotName );
+    
+    int numChildren;
+    File **childFiles = snapshotFolder.getChildFiles( &numChildren );
+    
+    // first clear out current files that the snapshot replaces, along
+    // with index, holes, and cold files that go with them, because
+    // the snapshot's versions of those may not exist
+    for( int i=0; i<numChildren; i++ ) {
+        char *fileName = childFiles[i]->getFileName();
+        
+        int length = strlen( fileName );
+        
+        if( length > 3 && strcmp( &( fileName[ length - 3 ] ), ".db" ) == 0 ) {
+            remove( fileName );
+            LINEARDB3_removeIndex( fileName );
+            
+            char *coldName = autoSprintf( "%s.cold", fileName );
+            remove( coldName );
+            delete [] coldName;
+            }
+        delete [] fileName;
+        }
+    
+    int numRestored = 0;
+    
+    for( int i=0; i<numChildren; i++ ) {
+        char *fileName = childFiles[i]->getFileName();
+        
+        File destFile( NULL, fileName );
+        
+        childFiles[i]->copy( &destFile );
+        
+        if( destFile.exists() && 
+            destFile.getLength() == childFiles[i]->getLength() ) {
+            numRestored++;
+            }
+        else {
+            AppLog::errorF( "Failed to restore %s", fileName );
+            }
+        
+        delete [] fileName;
+        delete childFiles[i];
+        }
+    delete [] childFiles;
+    
+    AppLog::infoF( "...Restored %d of %d files from snapshot", 
+                   numRestored, numChildren );
+    
+    return numRestored == numChildren;
+    }
+
+
+
+// restores from backups/<restoreMapSnapshot>, if that setting is set
+static void restoreMapSnapshot() {
+    char *snapshotName = 
+        SettingsManager::getStringSetting( "restoreMapSnapshot", "none" );
+    
+    if( strcmp( snapshotName, "none" ) == 0 ||
+        strcmp( snapshotName, "" ) == 0 ) {
+        delete [] snapshotName;
+        return;
+        }
+    
+    // only try this once, even if it fails
+    SettingsManager::setSetting( "restoreMapSnapshot", "none" );
+    
+    restoreMapFiles( snapshotName );
+    
+    delete [] snapshotName;
+    }
+
+
+
 void initBackup() {
+    restoreMapSnapshot();
+    
+    // left behind if server stopped during a copy
+    File backupFolder( NULL, "backups" );
+    
+    if( backupFolder.isDirectory() ) {
+        int numChildren;
+        File **childFiles = backupFolder.getChildFiles( &numChildren );
+        
+        for( int i=0; i<numChildren; i++ ) {
+            char *fileName = childFiles[i]->getFileName();
+            
+            if( strstr( fileName, ".partial" ) != NULL ) {
+                AppLog::infoF( "Removing incomplete backup %s", fileName );
+                removeRecursive( childFiles[i] );
+                }
+            delete [] fileName;
+            delete childFiles[i];
+            }
+        delete [] childFiles;
+        }
+    
+
     lastBackupTime = SettingsManager::getTimeSetting( "lastBackupTimeUTC",
                                                       lastBackupTime );
 
@@ -40,29 +308,65 @@ void initBackup() {
     }
 
 
-// call with "map" or "eve" for example
-void backupDBFile( const char *inFileNamePrefix, char *inTimeFileNamePart,
-                   File *inBackupFolder ) {
+// call with "playerStats" for example
+void backupDBFile( const char *inFileNamePrefix, File *inBackupFolder ) {
     char *fileName = autoSprintf( "%s.db", inFileNamePrefix );
     
     File dbFile( NULL, fileName );
 
-    delete [] fileName;
-
     if( dbFile.exists() ) {
         
-
-        char *backFileName =
-            autoSprintf( "%s_%s.db", inFileNamePrefix, inTimeFileNamePart );
-        
         File *backFile = 
-            inBackupFolder->getChildFile( backFileName );
+            inBackupFolder->getChildFile( fileName );
         
         dbFile.copy( backFile );
         
-        delete [] backFileName;
         delete backFile;
         }
+
+    delete [] fileName;
+    }
+
+
+
+// joins finished copy thread and lets held map writes through
+static void finishBackupCopy() {
+    copyThread->join();
+    
+    endMapSnapshot();
+    
+    if( copyThread->isFailed() ) {
+        AppLog::errorF( "...Failed to save snapshot backup %s",
+                        copyThread->getFolderName() );
+        
+        char *partialName = autoSprintf( "backups/%s.partial", 
+                                         copyThread->getFolderName() );
+        File partialFolder( NULL, partialName );
+        delete [] partialName;
+        
+        if( partialFolder.exists() ) {
+            removeRecursive( &partialFolder );
+            }
+        }
+    else {
+        AppLog::infoF( "...Done saving snapshot backup backups/%s, "
+                       "%.1f MiB copied in %.1f seconds",
+                       copyThread->getFolderName(),
+                       copyThread->getBytesCopied() / ( 1024 * 1024 ),
+                       Time::getCurrentTime() - copyStartTime );
+        }
+    
+    delete copyThread;
+    copyThread = NULL;
+    }
+
+
+
+void waitForBackup() {
+    if( copyThread != NULL ) {
+        AppLog::info( "Waiting for snapshot backup copy to finish..." );
+        finishBackupCopy();
+        }
     }
 
     
@@ -71,6 +375,14 @@ void backupDBFile( const char *inFileNamePrefix, char *inTimeFileNamePart,
 // makes a new backup if needed
 // also handles deleting old backups
 void checkBackup() {
+    if( copyThread != NULL ) {
+        if( copyThread->isDone() ) {
+            finishBackupCopy();
+            }
+        // one backup at a time
+        return;
+        }
+    
     timeSec_t curTime = Time::timeSec();
     
     if( curTime - lastBackupTime > 12 * 3600 
@@ -96,8 +408,9 @@ void checkBackup() {
             if( SettingsManager::getIntSetting( "saveBackups", 0 ) ) {
                 
                 AppLog::info( 
-                    "Saving a backup of map.db, mapTime.db, and biome.db "
-                    "floor.db, floorTime.db, playerStats.db, and eve.db ..." );
+                    "Saving a snapshot backup of map.db, mapTime.db, "
+                    "biome.db, floor.db, floorTime.db, mapTile.db, "
+                    "lookTime.db, eve.db, and playerStats.db ..." );
                 
                 char backupsSaved = false;
                 
@@ -118,29 +431,40 @@ void checkBackup() {
                     Directory::makeDirectory( &backupFolder );
                     }
                 
+                char *partialName = 
+                    autoSprintf( "%s.partial", timeFileNamePart );
+                
+                File *partialFolder = NULL;
+                
                 if( backupFolder.isDirectory() ) {
-                    
-                    backupDBFile( "lookTime", timeFileNamePart, &backupFolder );
+                    partialFolder = backupFolder.getChildFile( partialName );
+                    Directory::makeDirectory( partialFolder );
+                    }
+                
+                delete [] partialName;
+                
 
-                    backupDBFile( "map", timeFileNamePart, &backupFolder );
+                if( partialFolder != NULL && partialFolder->isDirectory() ) {
                     
-                    backupDBFile( "mapTime", timeFileNamePart, &backupFolder );
+                    // not a map DB, can't be frozen, but small
+                    backupDBFile( "playerStats", partialFolder );
                     
-                    backupDBFile( "biome", timeFileNamePart, &backupFolder );
+                    SimpleVector<char*> fileNames;
                     
-                    backupDBFile( "eve", timeFileNamePart, &backupFolder );
-                    
-                    backupDBFile( "floor", timeFileNamePart, &backupFolder );
-                    
-                    backupDBFile( "floorTime", timeFileNamePart, 
-                                  &backupFolder );
-                    
-                    backupDBFile( "playerStats", 
-                                  timeFileNamePart, &backupFolder );
-
-
-                    AppLog::info( "...Done saving backups" );
-                    backupsSaved = true;
+                    if( beginMapSnapshot( &fileNames ) ) {
+                        // map keeps running on held writes while
+                        // frozen files are copied
+                        copyThread = 
+                            new BackupCopyThread( &fileNames, 
+                                                  timeFileNamePart );
+                        copyStartTime = Time::getCurrentTime();
+                        copyThread->start();
+                        
+                        backupsSaved = true;
+                        }
+                    else {
+                        fileNames.deallocateStringElements();
+                        }
 
                     
                     int keepDays = 
@@ -164,7 +488,9 @@ void checkBackup() {
                             childFiles[i]->getModificationTime()
                             > keepSeconds ) {
                             
-                            char removed = childFiles[i]->remove();
+                            // old single-file backups, or whole
+                            // snapshot folders
+                            char removed = removeRecursive( childFiles[i] );
 
                             char *fileName = childFiles[i]->getFileName();
                             
@@ -187,6 +513,13 @@ void checkBackup() {
                                    numRemoved );
                     }
                 
+                if( partialFolder != NULL ) {
+                    if( ! backupsSaved && partialFolder->exists() ) {
+                        removeRecursive( partialFolder );
+                        }
+                    delete partialFolder;
+                    }
+                
                 if( !backupsSaved ) {
                     AppLog::error( "...Failed to save backups" );
                     }
@@ -215,3 +548,227 @@ void checkBackup() {
     
     }
 
+
+
+// one region of mapTile.db, far from where anyone plays
+#define SNAPSHOT_TEST_X 1600000
+#define SNAPSHOT_TEST_Y 1600000
+#define SNAPSHOT_TEST_SIZE 16
+
+#define SNAPSHOT_TEST_CELLS ( SNAPSHOT_TEST_SIZE * SNAPSHOT_TEST_SIZE )
+
+
+typedef struct SnapshotTestCell {
+        int id;
+        timeSec_t etaDecay;
+        int floorID;
+        timeSec_t floorEtaDecay;
+    } SnapshotTestCell;
+
+
+
+static void getSnapshotTestCells( SnapshotTestCell *outCells ) {
+    for( int i=0; i<SNAPSHOT_TEST_CELLS; i++ ) {
+        int x = SNAPSHOT_TEST_X + i % SNAPSHOT_TEST_SIZE;
+        int y = SNAPSHOT_TEST_Y + i / SNAPSHOT_TEST_SIZE;
+        
+        outCells[i].id = getMapObjectRaw( x, y );
+        outCells[i].etaDecay = getEtaDecay( x, y );
+        outCells[i].floorID = getMapFloor( x, y );
+        outCells[i].floorEtaDecay = getFloorEtaDecay( x, y );
+        }
+    }
+
+
+
+static void setSnapshotTestCells( SnapshotTestCell *inCells ) {
+    for( int i=0; i<SNAPSHOT_TEST_CELLS; i++ ) {
+        int x = SNAPSHOT_TEST_X + i % SNAPSHOT_TEST_SIZE;
+        int y = SNAPSHOT_TEST_Y + i / SNAPSHOT_TEST_SIZE;
+        
+        setMapObject( x, y, inCells[i].id );
+        setEtaDecay( x, y, inCells[i].etaDecay );
+        setMapFloor( x, y, inCells[i].floorID );
+        setFloorEtaDecay( x, y, inCells[i].floorEtaDecay );
+        }
+    }
+
+
+
+// fills cells with a pattern of real objects and far-off ETAs that
+// differs for each inPattern
+static void makeSnapshotTestCells( SnapshotTestCell *outCells, 
+                                   int inPattern ) {
+    SimpleVector<int> ids;
+    
+    int maxID = getMaxObjectID();
+    
+    for( int id=1; id<=maxID && ids.size() < 100; id++ ) {
+        if( getObject( id, true ) != NULL ) {
+            ids.push_back( id );
+            }
+        }
+    
+    // whole seconds, as they're stored, a year out so nothing decays
+    timeSec_t baseETA = 
+        floor( Time::timeSec() ) + 365 * 24 * 3600 + inPattern * 100000;
+    
+    for( int i=0; i<SNAPSHOT_TEST_CELLS; i++ ) {
+        int index = i + inPattern * 7;
+        
+        outCells[i].id = 0;
+        outCells[i].floorID = 0;
+        
+        if( ids.size() > 0 ) {
+            outCells[i].id = ids.getElementDirect( index % ids.size() );
+            outCells[i].floorID = 
+                ids.getElementDirect( ( index * 3 ) % ids.size() );
+            }
+        
+        outCells[i].etaDecay = baseETA + i;
+        outCells[i].floorEtaDecay = baseETA + SNAPSHOT_TEST_CELLS + i;
+        }
+    }
+
+
+
+// returns number of cells that don't match
+static int compareSnapshotTestCells( SnapshotTestCell *inExpected,
+                                     const char *inWhen ) {
+    SnapshotTestCell cells[ SNAPSHOT_TEST_CELLS ];
+    
+    getSnapshotTestCells( cells );
+    
+    int numBad = 0;
+    
+    for( int i=0; i<SNAPSHOT_TEST_CELLS; i++ ) {
+        SnapshotTestCell *e = &( inExpected[i] );
+        SnapshotTestCell *c = &( cells[i] );
+        
+        if( c->id != e->id || c->etaDecay != e->etaDecay ||
+            c->floorID != e->floorID || 
+            c->floorEtaDecay != e->floorEtaDecay ) {
+            
+            if( numBad < 10 ) {
+                printf( "%s, cell %d,%d:  "
+                        "got %d/%.0f floor %d/%.0f, "
+                        "expected %d/%.0f floor %d/%.0f\n",
+                        inWhen,
+                        SNAPSHOT_TEST_X + i % SNAPSHOT_TEST_SIZE,
+                        SNAPSHOT_TEST_Y + i / SNAPSHOT_TEST_SIZE,
+                        c->id, c->etaDecay, c->floorID, c->floorEtaDecay,
+                        e->id, e->etaDecay, e->floorID, e->floorEtaDecay );
+                }
+            numBad++;
+            }
+        }
+    
+    return numBad;
+    }
+
+
+
+int checkMapSnapshotRestore() {
+    const char *snapshotName = "snapshotCheck";
+    
+    char *finalName = autoSprintf( "backups/%s", snapshotName );
+    char *partialName = autoSprintf( "backups/%s.partial", snapshotName );
+    
+    File backupFolder( NULL, "backups" );
+    File finalFolder( NULL, finalName );
+    File partialFolder( NULL, partialName );
+    
+    delete [] finalName;
+    delete [] partialName;
+    
+    if( ! backupFolder.exists() ) {
+        Directory::makeDirectory( &backupFolder );
+        }
+    
+    // left from an earlier check
+    if( finalFolder.exists() ) {
+        removeRecursive( &finalFolder );
+        }
+    if( partialFolder.exists() ) {
+        removeRecursive( &partialFolder );
+        }
+    
+    Directory::makeDirectory( &partialFolder );
+    
+    
+    SnapshotTestCell original[ SNAPSHOT_TEST_CELLS ];
+    SnapshotTestCell atSnapshot[ SNAPSHOT_TEST_CELLS ];
+    SnapshotTestCell afterSnapshot[ SNAPSHOT_TEST_CELLS ];
+    
+    getSnapshotTestCells( original );
+    
+    makeSnapshotTestCells( atSnapshot, 1 );
+    makeSnapshotTestCells( afterSnapshot, 2 );
+    
+    int numBad = 0;
+    
+    setSnapshotTestCells( atSnapshot );
+    
+    SimpleVector<char*> fileNames;
+    
+    if( ! beginMapSnapshot( &fileNames ) ) {
+        printf( "Failed to begin map snapshot\n" );
+        fileNames.deallocateStringElements();
+        return -1;
+        }
+    
+    printf( "Copying %d map files to backups/%s, while writing over "
+            "%d cells at %d,%d\n",
+            fileNames.size(), snapshotName, 
+            SNAPSHOT_TEST_CELLS, SNAPSHOT_TEST_X, SNAPSHOT_TEST_Y );
+    
+    BackupCopyThread thread( &fileNames, snapshotName );
+    thread.start();
+    
+    // held in RAM, but should read back
+    setSnapshotTestCells( afterSnapshot );
+    numBad += compareSnapshotTestCells( afterSnapshot, "While held" );
+    
+    thread.join();
+    
+    endMapSnapshot();
+    
+    numBad += compareSnapshotTestCells( afterSnapshot, "After held flushed" );
+    
+    if( thread.isFailed() ) {
+        printf( "Failed to copy map snapshot\n" );
+        return -1;
+        }
+    
+    
+    freeMap();
+    
+    char restored = restoreMapFiles( snapshotName );
+    
+    if( ! initMap() ) {
+        printf( "Failed to init map after restoring snapshot\n" );
+        return -1;
+        }
+    
+    if( ! restored ) {
+        printf( "Failed to restore map snapshot\n" );
+        numBad++;
+        }
+    
+    numBad += compareSnapshotTestCells( atSnapshot, "After restore" );
+    
+    
+    // put region back as it was
+    setSnapshotTestCells( original );
+    
+    removeRecursive( &finalFolder );
+    
+    if( numBad > 0 ) {
+        printf( "Map snapshot check failed, %d mismatches\n", numBad );
+        return -1;
+        }
+    
+    printf( "Map snapshot check passed, %d cells came back as they were "
+            "at snapshot\n", SNAPSHOT_TEST_CELLS );
+    return 0;
+    }
@@ -1,8 +1,35 @@
 
 
+// also restores map DB files from backups/<restoreMapSnapshot> folder,
+// if that setting is set
+// must be called before initMap
 void initBackup();
 
 
 // makes a new backup if needed
 // also handles deleting old backups
 void checkBackup();
+
+
+// waits for a snapshot backup copy in progress, if any, to finish
+// must be called before freeMap
+void waitForBackup();
+
+
+
+// offline check, run in place of server, after initMap
+//
+// takes a snapshot of the map, writes over one region while the
+// snapshot's writes are held, then restores the snapshot and reinits the
+// map, checking that the region's objects, floors, and ETAs come back
+// as they were at the snapshot
+//
+// puts region back how it was when done, but replaces the map files
+// along the way, so it must only be run in a copy of the server folder
+// marked with a MAP_SCRATCH_MARKER file (server checks before initMap)
+//
+// returns 0 if everything matched, -1 otherwise
+int checkMapSnapshotRestore();
+
+
+#define MAP_SCRATCH_MARKER "mapScratchCopy.txt"
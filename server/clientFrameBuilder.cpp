@@ -0,0 +1,430 @@
+#include "clientFrameBuilder.h"
+
+#include "minorGems/formats/encodingUtils.h"
+#include "minorGems/util/stringUtils.h"
+#include "minorGems/system/Time.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+
+
+
+// smaller runs aren't worth compressing
+// matches server's maxUncompressedSize for single messages
+#define MIN_COMPRESS_RUN 256
+
+// with the stream's history to draw on, much smaller runs shrink
+// below that, headers and sync flush add about 15 bytes
+#define MIN_STREAM_RUN 64
+
+// deflate output is collected in steps this big
+#define DEFLATE_OUT_CHUNK 16384
+
+
+static double compressSeconds = 0;
+static double compressBytesIn = 0;
+static double compressBytesOut = 0;
+
+
+
+ClientFrameBuilder::ClientFrameBuilder()
+        : mCompress( false ),
+          mDeflate( NULL ),
+          mRunLowPriority( false ),
+          mRunNumMessages( 0 ),
+          mNumBytes( 0 ),
+          mNumDropped( 0 ),
+          mNumBytesDropped( 0 ) {
+    }
+
+
+
+ClientFrameBuilder::~ClientFrameBuilder() {
+    clear();
+
+    if( mDeflate != NULL ) {
+        deflateEnd( mDeflate );
+        delete mDeflate;
+        }
+    }
+
+
+
+void ClientFrameBuilder::setCompress( char inCompress ) {
+    mCompress = inCompress;
+    }
+
+
+
+void ClientFrameBuilder::startDeflateStream( int inLevel ) {
+    if( mDeflate != NULL ) {
+        return;
+        }
+
+    if( inLevel < 1 ) {
+        inLevel = 1;
+        }
+    if( inLevel > 9 ) {
+        inLevel = 9;
+        }
+
+    mDeflate = new z_stream;
+    memset( mDeflate, 0, sizeof( z_stream ) );
+
+    if( deflateInit( mDeflate, inLevel ) != Z_OK ) {
+        printf( "Failed to start deflate stream for client\n" );
+        delete mDeflate;
+        mDeflate = NULL;
+        }
+    }
+
+
+
+char ClientFrameBuilder::getDeflateStream() {
+    return mDeflate != NULL;
+    }
+
+
+
+char ClientFrameBuilder::getCompress() {
+    return mCompress || mDeflate != NULL;
+    }
+
+
+
+void ClientFrameBuilder::addPart( unsigned char *inData, int inLength,
+                                  char inLowPriority, char inIsRun,
+                                  int inNumMessages ) {
+    mParts.push_back( inData );
+    mPartLengths.push_back( inLength );
+    mPartLowPriority.push_back( inLowPriority );
+    mPartIsRun.push_back( inIsRun );
+    mPartNumMessages.push_back( inNumMessages );
+    }
+
+
+
+unsigned char *ClientFrameBuilder::deflateRun( unsigned char *inRun,
+                                               int inRunLength,
+                                               int *outLength ) {
+    SimpleVector<unsigned char> out;
+
+    unsigned char buffer[ DEFLATE_OUT_CHUNK ];
+
+    mDeflate->next_in = inRun;
+    mDeflate->avail_in = inRunLength;
+
+    // keep going until a flush leaves room to spare, which means
+    // it's all out
+    do {
+        mDeflate->next_out = buffer;
+        mDeflate->avail_out = DEFLATE_OUT_CHUNK;
+
+        int result = deflate( mDeflate, Z_SYNC_FLUSH );
+
+        if( result != Z_OK && result != Z_BUF_ERROR ) {
+            printf( "Client deflate stream failed (%d), turning it off\n",
+                    result );
+
+            // client never sees any of this, so the stream is
+            // still good on its end, but no way to rewind ours
+            deflateEnd( mDeflate );
+            delete mDeflate;
+            mDeflate = NULL;
+            return NULL;
+            }
+
+        out.appendArray( buffer, DEFLATE_OUT_CHUNK - mDeflate->avail_out );
+        }
+    while( mDeflate->avail_out == 0 );
+
+    *outLength = out.size();
+    return out.getElementArray();
+    }
+
+
+
+void ClientFrameBuilder::endRun() {
+    int runLength = mRun.size();
+
+    if( runLength == 0 ) {
+        return;
+        }
+
+    // compressed later, in finish
+    addPart( mRun.getElementArray(), runLength,
+             mRunLowPriority, true, mRunNumMessages );
+
+    mRun.deleteAll();
+    mRunNumMessages = 0;
+    }
+
+
+
+unsigned char *ClientFrameBuilder::compressRun( unsigned char *inRun,
+                                                int inRunLength,
+                                                int *outLength,
+                                                char *outDeflated ) {
+    *outLength = inRunLength;
+    *outDeflated = false;
+
+    if( mDeflate != NULL && inRunLength >= MIN_STREAM_RUN ) {
+        double startTime = Time::getCurrentTime();
+
+        int compressedSize;
+        unsigned char *compressedData =
+            deflateRun( inRun, inRunLength, &compressedSize );
+
+        if( compressedData != NULL ) {
+            // must go out even if it didn't pay off, because stream
+            // has moved past it
+            char *header = autoSprintf( "CZ\n%d %d\n#",
+                                        inRunLength, compressedSize );
+            int headerLength = strlen( header );
+
+            int fullLength = headerLength + compressedSize;
+
+            unsigned char *full = new unsigned char[ fullLength ];
+
+            memcpy( full, header, headerLength );
+            memcpy( &( full[ headerLength ] ), compressedData,
+                    compressedSize );
+
+            delete [] header;
+            delete [] compressedData;
+            delete [] inRun;
+
+            compressSeconds += Time::getCurrentTime() - startTime;
+            compressBytesIn += inRunLength;
+            compressBytesOut += fullLength;
+
+            *outLength = fullLength;
+            *outDeflated = true;
+            return full;
+            }
+        }
+
+    if( mCompress && mDeflate == NULL && inRunLength >= MIN_COMPRESS_RUN ) {
+        double startTime = Time::getCurrentTime();
+
+        int compressedSize;
+        unsigned char *compressedData =
+            zipCompress( inRun, inRunLength, &compressedSize );
+
+        if( compressedData != NULL ) {
+            char *header = autoSprintf( "CF\n%d %d\n#",
+                                        inRunLength, compressedSize );
+            int headerLength = strlen( header );
+
+            int fullLength = headerLength + compressedSize;
+
+            compressSeconds += Time::getCurrentTime() - startTime;
+            compressBytesIn += inRunLength;
+
+            if( fullLength < inRunLength ) {
+                // pays off
+                unsigned char *full = new unsigned char[ fullLength ];
+
+                memcpy( full, header, headerLength );
+                memcpy( &( full[ headerLength ] ), compressedData,
+                        compressedSize );
+
+                delete [] header;
+                delete [] compressedData;
+                delete [] inRun;
+
+                compressBytesOut += fullLength;
+
+                *outLength = fullLength;
+                return full;
+                }
+
+            compressBytesOut += inRunLength;
+
+            delete [] header;
+            delete [] compressedData;
+            }
+        }
+
+    return inRun;
+    }
+
+
+
+void ClientFrameBuilder::add( unsigned char *inBytes, int inNumBytes,
+                              char inLowPriority ) {
+    mNumBytes += inNumBytes;
+
+    if( inNumBytes >= 3 &&
+        inBytes[2] == '\n' &&
+        ( ( inBytes[0] == 'C' && inBytes[1] == 'M' ) ||
+          ( inBytes[0] == 'M' && inBytes[1] == 'C' ) ) ) {
+
+        // binary data follows header, keep it out of text runs
+        endRun();
+
+        unsigned char *copy = new unsigned char[ inNumBytes ];
+        memcpy( copy, inBytes, inNumBytes );
+
+        addPart( copy, inNumBytes, inLowPriority, false, 1 );
+        return;
+        }
+
+    if( inLowPriority != mRunLowPriority ) {
+        // keep low-priority messages in runs of their own
+        endRun();
+        mRunLowPriority = inLowPriority;
+        }
+
+    mRun.appendArray( inBytes, inNumBytes );
+    mRunNumMessages++;
+    }
+
+
+
+char ClientFrameBuilder::isEmpty() {
+    return mRun.size() == 0 && mParts.size() == 0;
+    }
+
+
+
+int ClientFrameBuilder::getNumBytes() {
+    return mNumBytes;
+    }
+
+
+
+void ClientFrameBuilder::finish( char inDropLowPriority ) {
+    endRun();
+
+    mNumDropped = 0;
+    mNumBytesDropped = 0;
+
+    SimpleVector<unsigned char*> parts;
+    SimpleVector<int> lengths;
+    SimpleVector<char> lowPriority;
+
+    for( int i=0; i<mParts.size(); i++ ) {
+        unsigned char *data = mParts.getElementDirect( i );
+        int length = mPartLengths.getElementDirect( i );
+        char low = mPartLowPriority.getElementDirect( i );
+
+        if( low && inDropLowPriority ) {
+            // before compressing, so the deflate stream never sees it
+            mNumDropped += mPartNumMessages.getElementDirect( i );
+            mNumBytesDropped += length;
+
+            delete [] data;
+            continue;
+            }
+
+        if( mPartIsRun.getElementDirect( i ) ) {
+            char deflated;
+            data = compressRun( data, length, &length, &deflated );
+
+            if( deflated ) {
+                // later CZ parts depend on this one
+                low = false;
+                }
+            }
+
+        parts.push_back( data );
+        lengths.push_back( length );
+        lowPriority.push_back( low );
+        }
+
+    int numParts = parts.size();
+
+    mParts.deleteAll();
+    mParts.push_back_other( &parts );
+
+    mPartLengths.deleteAll();
+    mPartLengths.push_back_other( &lengths );
+
+    mPartLowPriority.deleteAll();
+    mPartLowPriority.push_back_other( &lowPriority );
+
+    mPartIsRun.deleteAll();
+    mPartNumMessages.deleteAll();
+
+    for( int i=0; i<numParts; i++ ) {
+        mPartIsRun.push_back( false );
+        mPartNumMessages.push_back( 0 );
+        }
+    }
+
+
+
+int ClientFrameBuilder::getNumParts() {
+    return mParts.size();
+    }
+
+
+
+unsigned char **ClientFrameBuilder::getParts() {
+    if( mParts.size() == 0 ) {
+        return NULL;
+        }
+    return mParts.getElement( 0 );
+    }
+
+
+
+int *ClientFrameBuilder::getPartLengths() {
+    if( mPartLengths.size() == 0 ) {
+        return NULL;
+        }
+    return mPartLengths.getElement( 0 );
+    }
+
+
+
+char *ClientFrameBuilder::getPartLowPriority() {
+    if( mPartLowPriority.size() == 0 ) {
+        return NULL;
+        }
+    return mPartLowPriority.getElement( 0 );
+    }
+
+
+
+int ClientFrameBuilder::getNumDropped() {
+    return mNumDropped;
+    }
+
+
+
+int ClientFrameBuilder::getNumBytesDropped() {
+    return mNumBytesDropped;
+    }
+
+
+
+void ClientFrameBuilder::clear() {
+    for( int i=0; i<mParts.size(); i++ ) {
+        delete [] mParts.getElementDirect( i );
+        }
+    mParts.deleteAll();
+    mPartLengths.deleteAll();
+    mPartLowPriority.deleteAll();
+    mPartIsRun.deleteAll();
+    mPartNumMessages.deleteAll();
+
+    mRun.deleteAll();
+    mRunNumMessages = 0;
+    mNumBytes = 0;
+    }
+
+
+
+void ClientFrameBuilder::getStats( double *outCompressSeconds,
+                                   double *outBytesIn, double *outBytesOut ) {
+    *outCompressSeconds = compressSeconds;
+    *outBytesIn = compressBytesIn;
+    *outBytesOut = compressBytesOut;
+
+    compressSeconds = 0;
+    compressBytesIn = 0;
+    compressBytesOut = 0;
+    }
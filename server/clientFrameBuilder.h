@@ -0,0 +1,139 @@
+#ifndef CLIENT_FRAME_BUILDER_H_INCLUDED
+#define CLIENT_FRAME_BUILDER_H_INCLUDED
+
+
+#include "minorGems/util/SimpleVector.h"
+
+
+// from zlib.h, so includers don't need it
+struct z_stream_s;
+
+
+// Collects everything sent to one client during a server step, so that
+// it can go out in one write at the end of the step.
+//
+// Plain text messages are gathered into runs.  When compression is on
+// (for clients that understand CF messages), each run big enough to be
+// worth it is compressed as a whole and sent as one CF message, which the
+// client unpacks back into its receive buffer.
+//
+// Clients that keep an inflate stream open for the whole connection
+// can get CZ messages instead.  Each run goes through one deflate stream
+// that lives as long as the connection and is sync-flushed at the end of
+// the run, so later runs are compressed against everything sent before
+// them, and the client can unpack each one as soon as it arrives.
+//
+// Messages that are already compressed or carry binary data (CM and MC)
+// end the current run and are passed through as they are.
+//
+// Low-priority messages are kept in runs of their own, and nothing is
+// compressed until the frame is finished, so that if the client's
+// connection is backed up by then, those runs can be dropped before
+// they ever reach the deflate stream.
+class ClientFrameBuilder {
+    public:
+
+        ClientFrameBuilder();
+
+        ~ClientFrameBuilder();
+
+
+        void setCompress( char inCompress );
+
+        // once on, stays on for the life of the connection, because client
+        // has no way to start a new stream
+        // inLevel is a zlib compression level, 1 to 9
+        void startDeflateStream( int inLevel );
+
+        char getDeflateStream();
+
+
+        // true if client gets whole compressed runs, so callers don't
+        // need to compress messages on their own
+        char getCompress();
+
+
+        // copies inBytes
+        void add( unsigned char *inBytes, int inNumBytes,
+                  char inLowPriority = false );
+
+        char isEmpty();
+
+        // bytes added since last clear, before compression
+        int getNumBytes();
+
+
+        // closes out the last run, drops low-priority messages if
+        // inDropLowPriority is set, and compresses what's left
+        // parts are then valid until clear is called
+        void finish( char inDropLowPriority = false );
+
+        int getNumParts();
+
+        unsigned char **getParts();
+        int *getPartLengths();
+
+        // true for parts made only of low-priority messages that could
+        // still be dropped later without hurting the rest
+        // (never true for CZ parts, which the stream depends on)
+        char *getPartLowPriority();
+
+
+        // low-priority messages dropped by last finish
+        int getNumDropped();
+        int getNumBytesDropped();
+
+
+        void clear();
+
+
+        // totals over all builders since last call, for server reports
+        static void getStats( double *outCompressSeconds,
+                              double *outBytesIn, double *outBytesOut );
+
+
+    protected:
+
+        char mCompress;
+
+        struct z_stream_s *mDeflate;
+
+        SimpleVector<unsigned char> mRun;
+        char mRunLowPriority;
+        int mRunNumMessages;
+
+        // each its own allocation
+        SimpleVector<unsigned char*> mParts;
+        SimpleVector<int> mPartLengths;
+        SimpleVector<char> mPartLowPriority;
+
+        // true for text runs that haven't been compressed yet
+        SimpleVector<char> mPartIsRun;
+        SimpleVector<int> mPartNumMessages;
+
+        int mNumBytes;
+
+        int mNumDropped;
+        int mNumBytesDropped;
+
+
+        void endRun();
+
+        // takes ownership of inRun, and returns it or a compressed
+        // replacement
+        // outDeflated set to true if result went through deflate stream
+        unsigned char *compressRun( unsigned char *inRun, int inRunLength,
+                                    int *outLength, char *outDeflated );
+
+        // returns NULL on failure, after which stream is off
+        unsigned char *deflateRun( unsigned char *inRun, int inRunLength,
+                                   int *outLength );
+
+        void addPart( unsigned char *inData, int inLength,
+                      char inLowPriority, char inIsRun, int inNumMessages );
+
+    };
+
+
+
+#endif
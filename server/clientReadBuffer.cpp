@@ -0,0 +1,167 @@
+#include "clientReadBuffer.h"
+
+#include <string.h>
+
+
+
+ClientReadBuffer::ClientReadBuffer( int inStartSize )
+        : mCapacity( 16 ), mStart( 0 ), mSize( 0 ) {
+
+    while( mCapacity < inStartSize ) {
+        mCapacity *= 2;
+        }
+
+    mData = new char[ mCapacity ];
+    }
+
+
+
+ClientReadBuffer::~ClientReadBuffer() {
+    delete [] mData;
+    }
+
+
+
+int ClientReadBuffer::size() {
+    return mSize;
+    }
+
+
+
+char ClientReadBuffer::getElementDirect( int inIndex ) {
+    return mData[ ( mStart + inIndex ) & ( mCapacity - 1 ) ];
+    }
+
+
+
+int ClientReadBuffer::getElementIndex( char inElement ) {
+    // data is at most two runs, end of array, then wrapped to start
+    int firstRun = mCapacity - mStart;
+
+    if( firstRun > mSize ) {
+        firstRun = mSize;
+        }
+
+    char *found = (char*)memchr( &( mData[ mStart ] ), inElement, firstRun );
+
+    if( found != NULL ) {
+        return found - &( mData[ mStart ] );
+        }
+
+    found = (char*)memchr( mData, inElement, mSize - firstRun );
+
+    if( found != NULL ) {
+        return firstRun + ( found - mData );
+        }
+
+    return -1;
+    }
+
+
+
+void ClientReadBuffer::getStartElements( char *outBytes, int inNumBytes ) {
+    int firstRun = mCapacity - mStart;
+
+    if( firstRun > inNumBytes ) {
+        firstRun = inNumBytes;
+        }
+
+    memcpy( outBytes, &( mData[ mStart ] ), firstRun );
+    memcpy( &( outBytes[ firstRun ] ), mData, inNumBytes - firstRun );
+    }
+
+
+
+char *ClientReadBuffer::getElementString() {
+    char *string = new char[ mSize + 1 ];
+
+    getStartElements( string, mSize );
+    string[ mSize ] = '\0';
+
+    return string;
+    }
+
+
+
+void ClientReadBuffer::deleteStartElements( int inNumBytes ) {
+    if( inNumBytes >= mSize ) {
+        // empty, start over at front to keep next reads in one run
+        mStart = 0;
+        mSize = 0;
+        return;
+        }
+
+    mStart = ( mStart + inNumBytes ) & ( mCapacity - 1 );
+    mSize -= inNumBytes;
+    }
+
+
+
+void ClientReadBuffer::grow( int inMinCapacity ) {
+    int newCapacity = mCapacity;
+
+    while( newCapacity < inMinCapacity ) {
+        newCapacity *= 2;
+        }
+
+    if( newCapacity == mCapacity ) {
+        return;
+        }
+
+    char *newData = new char[ newCapacity ];
+
+    getStartElements( newData, mSize );
+
+    delete [] mData;
+
+    mData = newData;
+    mCapacity = newCapacity;
+    mStart = 0;
+    }
+
+
+
+void ClientReadBuffer::appendArray( const char *inBytes, int inNumBytes ) {
+    while( inNumBytes > 0 ) {
+        int numFree;
+        char *space = getWriteSpace( inNumBytes, &numFree );
+
+        if( numFree > inNumBytes ) {
+            numFree = inNumBytes;
+            }
+
+        memcpy( space, inBytes, numFree );
+        commitWrite( numFree );
+
+        inBytes = &( inBytes[ numFree ] );
+        inNumBytes -= numFree;
+        }
+    }
+
+
+
+char *ClientReadBuffer::getWriteSpace( int inMinFree, int *outNumBytes ) {
+    if( mCapacity - mSize < inMinFree ) {
+        grow( mSize + inMinFree );
+        }
+
+    int end = ( mStart + mSize ) & ( mCapacity - 1 );
+
+    if( end < mStart || mSize == mCapacity ) {
+        // free space is the gap before start
+        *outNumBytes = mStart - end;
+        }
+    else {
+        // free space runs to end of array (and wraps to front too,
+        // but that's a second run)
+        *outNumBytes = mCapacity - end;
+        }
+
+    return &( mData[ end ] );
+    }
+
+
+
+void ClientReadBuffer::commitWrite( int inNumBytes ) {
+    mSize += inNumBytes;
+    }
@@ -0,0 +1,66 @@
+#ifndef CLIENT_READ_BUFFER_H_INCLUDED
+#define CLIENT_READ_BUFFER_H_INCLUDED
+
+
+
+// Receive buffer for one client connection.
+//
+// A ring buffer that grows when full, so that taking messages off the
+// front doesn't shift what's left down, and socket reads can go
+// straight into the free space behind the data.
+//
+// Access functions mirror the SimpleVector<char> ones that the server
+// used for this before.
+class ClientReadBuffer {
+    public:
+
+        ClientReadBuffer( int inStartSize = 4096 );
+
+        ~ClientReadBuffer();
+
+
+        int size();
+
+        char getElementDirect( int inIndex );
+
+        // -1 if not present
+        int getElementIndex( char inElement );
+
+        // new[]'d, \0-terminated copy of the whole buffer
+        char *getElementString();
+
+        // copies the first inNumBytes into outBytes
+        void getStartElements( char *outBytes, int inNumBytes );
+
+        void deleteStartElements( int inNumBytes );
+
+        void appendArray( const char *inBytes, int inNumBytes );
+
+
+        // for reading directly into the buffer
+        //
+        // returns contiguous free space after the data, grows buffer
+        // if there's less than inMinFree free in total
+        char *getWriteSpace( int inMinFree, int *outNumBytes );
+
+        // marks inNumBytes of the space returned by getWriteSpace as used
+        void commitWrite( int inNumBytes );
+
+
+    protected:
+
+        char *mData;
+
+        // always a power of 2
+        int mCapacity;
+
+        int mStart;
+        int mSize;
+
+        void grow( int inMinCapacity );
+
+    };
+
+
+
+#endif
@@ -0,0 +1,359 @@
+#include "clientSendQueue.h"
+
+#include <string.h>
+
+
+#ifdef __linux__
+#define SEND_QUEUE_VECTORED_WRITE
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
+
+// most messages we hand to one vectored write
+#define MAX_PARTS_PER_WRITE 64
+
+
+
+ClientSendQueue::ClientSendQueue( int inLowWatermark, int inHighWatermark,
+                                  int inMaxBytes )
+        : mLowWatermark( inLowWatermark ),
+          mHighWatermark( inHighWatermark ),
+          mMaxBytes( inMaxBytes ),
+          mFrontSent( 0 ),
+          mNumBytes( 0 ),
+          mBackedUp( false ),
+          mSocketError( false ) {
+
+    clearStats();
+    }
+
+
+
+ClientSendQueue::~ClientSendQueue() {
+    for( int i=0; i<mMessages.size(); i++ ) {
+        delete [] mMessages.getElementDirect( i ).data;
+        }
+    }
+
+
+
+void ClientSendQueue::addMessage( unsigned char *inBytes, int inNumBytes,
+                                  char inLowPriority ) {
+    QueuedClientMessage m;
+
+    m.data = new unsigned char[ inNumBytes ];
+    memcpy( m.data, inBytes, inNumBytes );
+
+    m.length = inNumBytes;
+    m.lowPriority = inLowPriority;
+
+    mMessages.push_back( m );
+
+    mNumBytes += inNumBytes;
+
+    if( mNumBytes > mPeakBytes ) {
+        mPeakBytes = mNumBytes;
+        }
+    }
+
+
+
+void ClientSendQueue::dropLowPriority() {
+    SimpleVector<QueuedClientMessage> kept;
+
+    for( int i=0; i<mMessages.size(); i++ ) {
+        QueuedClientMessage m = mMessages.getElementDirect( i );
+
+        if( m.lowPriority && ! ( i == 0 && mFrontSent > 0 ) ) {
+            mNumBytes -= m.length;
+            mNumDropped++;
+            mNumBytesDropped += m.length;
+
+            delete [] m.data;
+            }
+        else {
+            kept.push_back( m );
+            }
+        }
+
+    if( kept.size() < mMessages.size() ) {
+        mMessages.deleteAll();
+        mMessages.push_back_other( &kept );
+        }
+    }
+
+
+
+// returns number of bytes written, -2 if socket would block, or -1 on error
+static int writeParts( Socket *inSock, int inNumParts,
+                       unsigned char **inParts, int *inPartLengths ) {
+
+#ifdef SEND_QUEUE_VECTORED_WRITE
+    if( inNumParts > MAX_PARTS_PER_WRITE ) {
+        inNumParts = MAX_PARTS_PER_WRITE;
+        }
+
+    struct iovec parts[ MAX_PARTS_PER_WRITE ];
+
+    for( int i=0; i<inNumParts; i++ ) {
+        parts[i].iov_base = inParts[i];
+        parts[i].iov_len = inPartLengths[i];
+        }
+
+    struct msghdr header;
+    memset( &header, 0, sizeof( header ) );
+
+    header.msg_iov = parts;
+    header.msg_iovlen = inNumParts;
+
+    // minorGems keeps the FD behind this pointer on Linux
+    int fd = *( (int*)( inSock->mNativeObjectPointer ) );
+
+    int numSent = sendmsg( fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL );
+
+    if( numSent == -1 ) {
+        if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
+            return -2;
+            }
+        return -1;
+        }
+
+    return numSent;
+#else
+    int total = 0;
+
+    for( int i=0; i<inNumParts; i++ ) {
+        int numSent = inSock->send( inParts[i], inPartLengths[i],
+                                    false, false );
+
+        if( numSent < 0 ) {
+            if( total > 0 ) {
+                return total;
+                }
+            return numSent;
+            }
+
+        total += numSent;
+
+        if( numSent < inPartLengths[i] ) {
+            break;
+            }
+        }
+
+    return total;
+#endif
+    }
+
+
+
+char ClientSendQueue::checkLimits() {
+    if( ! mBackedUp && mNumBytes > mHighWatermark ) {
+        mBackedUp = true;
+        dropLowPriority();
+        }
+
+    if( mNumBytes > mMaxBytes ) {
+        return false;
+        }
+
+    return true;
+    }
+
+
+
+char ClientSendQueue::sendParts( Socket *inSock, int inNumParts,
+                                 unsigned char **inParts,
+                                 int *inPartLengths,
+                                 char *inPartLowPriority ) {
+
+    if( mMessages.size() > 0 ) {
+        // stay in order behind what's waiting
+        for( int i=0; i<inNumParts; i++ ) {
+            char low = false;
+            if( inPartLowPriority != NULL ) {
+                low = inPartLowPriority[i];
+                }
+            addMessage( inParts[i], inPartLengths[i], low );
+            }
+
+        if( ! flush( inSock ) ) {
+            return false;
+            }
+        }
+    else {
+        int numSent = writeParts( inSock, inNumParts,
+                                  inParts, inPartLengths );
+
+        if( numSent == -1 ) {
+            mSocketError = true;
+            return false;
+            }
+        if( numSent < 0 ) {
+            numSent = 0;
+            }
+
+        for( int i=0; i<inNumParts; i++ ) {
+            if( numSent >= inPartLengths[i] ) {
+                numSent -= inPartLengths[i];
+                }
+            else {
+                // rest of a partly-sent message can't be dropped
+                char low = false;
+                if( numSent == 0 && inPartLowPriority != NULL ) {
+                    low = inPartLowPriority[i];
+                    }
+
+                // numSent is 0 for all parts after partly-sent one
+                addMessage( &( inParts[i][ numSent ] ),
+                            inPartLengths[i] - numSent, low );
+                numSent = 0;
+                }
+            }
+        }
+
+    return checkLimits();
+    }
+
+
+
+char ClientSendQueue::flush( Socket *inSock ) {
+    unsigned char *parts[ MAX_PARTS_PER_WRITE ];
+    int partLengths[ MAX_PARTS_PER_WRITE ];
+
+    while( mMessages.size() > 0 ) {
+
+        int numParts = mMessages.size();
+
+        if( numParts > MAX_PARTS_PER_WRITE ) {
+            numParts = MAX_PARTS_PER_WRITE;
+            }
+
+        int numToSend = 0;
+
+        for( int i=0; i<numParts; i++ ) {
+            QueuedClientMessage *m = mMessages.getElement( i );
+
+            parts[i] = m->data;
+            partLengths[i] = m->length;
+
+            if( i == 0 ) {
+                parts[i] = &( m->data[ mFrontSent ] );
+                partLengths[i] -= mFrontSent;
+                }
+            numToSend += partLengths[i];
+            }
+
+        int numSent = writeParts( inSock, numParts, parts, partLengths );
+
+        if( numSent == -1 ) {
+            mSocketError = true;
+            return false;
+            }
+        if( numSent < 0 ) {
+            // -2, would block
+            break;
+            }
+
+        mNumBytes -= numSent;
+
+        int numDone = 0;
+        int numLeft = numSent;
+
+        for( int i=0; i<numParts; i++ ) {
+            if( numLeft < partLengths[i] ) {
+                mFrontSent += numLeft;
+                break;
+                }
+
+            numLeft -= partLengths[i];
+
+            delete [] mMessages.getElement( i )->data;
+            mFrontSent = 0;
+            numDone++;
+            }
+
+        mMessages.deleteStartElements( numDone );
+
+        if( numSent < numToSend ) {
+            // socket full
+            break;
+            }
+        }
+
+    if( mBackedUp && mNumBytes <= mLowWatermark ) {
+        mBackedUp = false;
+        }
+
+    return true;
+    }
+
+
+
+void ClientSendQueue::noteDropped( int inNumBytes, int inNumMessages ) {
+    mNumDropped += inNumMessages;
+    mNumBytesDropped += inNumBytes;
+    }
+
+
+
+int ClientSendQueue::getNumBytes() {
+    return mNumBytes;
+    }
+
+
+
+char ClientSendQueue::isBackedUp() {
+    return mBackedUp;
+    }
+
+
+
+char ClientSendQueue::wouldBackUp( int inNumBytes ) {
+    if( mBackedUp ) {
+        return true;
+        }
+
+    // if nothing is waiting, socket will probably take most of it
+    return mMessages.size() > 0 &&
+        mNumBytes + inNumBytes > mHighWatermark;
+    }
+
+
+
+char ClientSendQueue::isOverMax() {
+    return mNumBytes > mMaxBytes;
+    }
+
+
+
+char ClientSendQueue::hadSocketError() {
+    return mSocketError;
+    }
+
+
+
+int ClientSendQueue::getPeakBytes() {
+    return mPeakBytes;
+    }
+
+
+
+int ClientSendQueue::getNumDropped() {
+    return mNumDropped;
+    }
+
+
+
+int ClientSendQueue::getNumBytesDropped() {
+    return mNumBytesDropped;
+    }
+
+
+
+void ClientSendQueue::clearStats() {
+    mPeakBytes = mNumBytes;
+    mNumDropped = 0;
+    mNumBytesDropped = 0;
+    }
@@ -0,0 +1,118 @@
+#ifndef CLIENT_SEND_QUEUE_H_INCLUDED
+#define CLIENT_SEND_QUEUE_H_INCLUDED
+
+
+#include "minorGems/network/Socket.h"
+#include "minorGems/util/SimpleVector.h"
+
+
+
+typedef struct QueuedClientMessage {
+        unsigned char *data;
+        int length;
+        char lowPriority;
+    } QueuedClientMessage;
+
+
+
+// Outbound queue for one client connection.
+//
+// Messages are written without blocking, and whatever the socket won't
+// take right now waits here until flush is called again.
+//
+// Once more than the high watermark is waiting, the connection counts
+// as backed up:  waiting low-priority messages are dropped, and callers
+// should drop new ones instead of sending them (see wouldBackUp), until
+// it drains back below the low watermark.  Only going over the max means
+// the connection is hopeless.
+//
+// Messages are only ever dropped whole, never once partly sent.
+class ClientSendQueue {
+    public:
+
+        ClientSendQueue( int inLowWatermark, int inHighWatermark,
+                         int inMaxBytes );
+
+        ~ClientSendQueue();
+
+
+        // sends messages right away, with one vectored write where
+        // possible, if nothing is waiting, and queues copies of whatever
+        // the socket doesn't take
+        //
+        // inPartLowPriority can be NULL if none are low priority
+        //
+        // returns false on socket error or if queue goes over max
+        char sendParts( Socket *inSock, int inNumParts,
+                        unsigned char **inParts, int *inPartLengths,
+                        char *inPartLowPriority = NULL );
+
+        // sends as much of queue as socket will take without blocking
+        //
+        // returns false on socket error
+        char flush( Socket *inSock );
+
+
+        // for low-priority messages dropped before they got here
+        void noteDropped( int inNumBytes, int inNumMessages = 1 );
+
+
+        // bytes waiting
+        int getNumBytes();
+
+        char isBackedUp();
+
+        // true if already backed up, or if sending inNumBytes more
+        // would back it up
+        // low-priority messages should be dropped instead of sent then
+        char wouldBackUp( int inNumBytes );
+
+        char isOverMax();
+
+        // true once a write has failed, after which nothing more
+        // should be sent
+        char hadSocketError();
+
+
+        // stats since last call to clearStats
+        int getPeakBytes();
+        int getNumDropped();
+        int getNumBytesDropped();
+
+        void clearStats();
+
+
+    protected:
+
+        int mLowWatermark;
+        int mHighWatermark;
+        int mMaxBytes;
+
+        SimpleVector<QueuedClientMessage> mMessages;
+
+        // how much of first message has been sent already
+        int mFrontSent;
+
+        int mNumBytes;
+
+        char mBackedUp;
+
+        char mSocketError;
+
+        int mPeakBytes;
+        int mNumDropped;
+        int mNumBytesDropped;
+
+
+        void addMessage( unsigned char *inBytes, int inNumBytes,
+                         char inLowPriority );
+
+        void dropLowPriority();
+
+        char checkLimits();
+
+    };
+
+
+
+#endif
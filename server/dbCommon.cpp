@@ -90,3 +90,44 @@ void intPairToKey( int inX, int inY, unsigned char *outKey ) {
         outKey[i+4] = ( inY >> offset ) & 0xFF;
         }    
     }
+
+
+
+void clearTileRecord( TileRecord *outRecord ) {
+    outRecord->object = -1;
+    outRecord->numContained = -1;
+    outRecord->etaDecay = 0;
+    outRecord->floor = -1;
+    outRecord->floorEtaDecay = 0;
+    }
+
+
+
+char isTileRecordEmpty( TileRecord *inRecord ) {
+    return 
+        inRecord->object == -1 &&
+        inRecord->numContained == -1 &&
+        inRecord->etaDecay == 0 &&
+        inRecord->floor == -1 &&
+        inRecord->floorEtaDecay == 0;
+    }
+
+
+
+void tileRecordToValue( TileRecord *inRecord, unsigned char *outValue ) {
+    intToValue( inRecord->object, outValue );
+    intToValue( inRecord->numContained, &( outValue[4] ) );
+    timeToValue( inRecord->etaDecay, &( outValue[8] ) );
+    intToValue( inRecord->floor, &( outValue[16] ) );
+    timeToValue( inRecord->floorEtaDecay, &( outValue[20] ) );
+    }
+
+
+
+void valueToTileRecord( unsigned char *inValue, TileRecord *outRecord ) {
+    outRecord->object = valueToInt( inValue );
+    outRecord->numContained = valueToInt( &( inValue[4] ) );
+    outRecord->etaDecay = valueToTime( &( inValue[8] ) );
+    outRecord->floor = valueToInt( &( inValue[16] ) );
+    outRecord->floorEtaDecay = valueToTime( &( inValue[20] ) );
+    }
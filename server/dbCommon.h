@@ -1,3 +1,6 @@
+#ifndef DB_COMMON_H_INCLUDED
+#define DB_COMMON_H_INCLUDED
+
 #include "minorGems/system/Time.h"
 
 
@@ -30,3 +33,50 @@ void intQuadToKey( int inX, int inY, int inSlot, int inB,
 // two ints to an 8-byte key
 void intPairToKey( int inX, int inY, unsigned char *outKey );
 
+
+
+// all of one map cell's own state, stored together in mapTile.db
+// when the useMapTileDB setting is on
+//
+// Each field holds what the per-DB get returns when that DB has no
+// record for the cell.  Contained objects, and their decay ETAs, stay in
+// map.db and mapTime.db, because their number varies.
+typedef struct TileRecord {
+        // map.db slot 0, -1 if not set (natural object)
+        int object;
+        
+        // map.db slot 2 (b=0), -1 if not set
+        int numContained;
+        
+        // mapTime.db slot 1 (b=0), 0 if not set
+        timeSec_t etaDecay;
+        
+        // floor.db, -1 if not set
+        int floor;
+        
+        // floorTime.db, 0 if not set
+        timeSec_t floorEtaDecay;
+    } TileRecord;
+
+
+// bytes in a mapTile.db value
+#define TILE_RECORD_SIZE 28
+
+
+// sets all fields to not set
+void clearTileRecord( TileRecord *outRecord );
+
+
+// true if no fields set, so record need not be stored
+char isTileRecordEmpty( TileRecord *inRecord );
+
+
+// outValue must be TILE_RECORD_SIZE bytes
+void tileRecordToValue( TileRecord *inRecord, unsigned char *outValue );
+
+
+// inValue is TILE_RECORD_SIZE bytes
+void valueToTileRecord( unsigned char *inValue, TileRecord *outRecord );
+
+
+#endif
@@ -4,6 +4,7 @@
 #include "minorGems/util/log/AppLog.h"
 
 #include "lineardb3.h"
+#include "regiondb.h"
 
 #define DB LINEARDB3
 #define DB_open LINEARDB3_open
@@ -47,7 +48,7 @@ extern int cellsLookedAtToInit;
 // If lookTimeDBEmpty, this call just opens the target DB normally without
 // shrinking it.
 //
-// Can handle max key and value size of 16 and 12 bytes
+// Can handle max key and value size of 16 and 28 bytes
 // Assumes that first 8 bytes of key are xy as 32-bit ints
 
 int DB_open_timeShrunk(
@@ -85,7 +86,7 @@ int DB_open_timeShrunk(
             // key and value size that are big enough to handle all of our DB
             unsigned char key[16];
    
-            unsigned char value[12];
+            unsigned char value[ TILE_RECORD_SIZE ];
    
             while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
                 int x = valueToInt( key );
@@ -148,7 +149,7 @@ int DB_open_timeShrunk(
     // key and value size that are big enough to handle all of our DB
     unsigned char key[16];
    
-    unsigned char value[12];
+    unsigned char value[ TILE_RECORD_SIZE ];
    
     int total = 0;
     int stale = 0;
@@ -232,6 +233,7 @@ int DB_open_timeShrunk(
  
     dbTempFile.copy( &dbFile );
     dbTempFile.remove();
+    LINEARDB3_removeIndex( dbTempName );
  
     delete [] dbTempName;
  
@@ -419,6 +421,7 @@ int DB_open_naturalTileShrunk_mapDb(
  
     dbTempFile.copy( &dbFile );
     dbTempFile.remove();
+    LINEARDB3_removeIndex( dbTempName );
  
     delete [] dbTempName;
  
@@ -588,6 +591,7 @@ int DB_open_naturalTileShrunk(
  
     dbTempFile.copy( &dbFile );
     dbTempFile.remove();
+    LINEARDB3_removeIndex( dbTempName );
  
     delete [] dbTempName;
  
@@ -655,6 +659,99 @@ int DB_open_modeSwitch(
 
 
 
+// Biome settings need to be loaded before this
+// as it will call the map generating function
+//
+// mapTile.db version of DB_open_modeSwitch
+// Shrinks in place, by deleting cells and then compacting the emptied
+// region pages out of the file.
+//
+// In mode 1, cells that have no look time are deleted (or, if
+// lookTimeDBEmpty, every cell's look time is set to now).
+// In mode 2, whole cell record is left out if the cell object is natural,
+// which matches what happens to the floor and time records of such cells
+// when they are kept in separate DBs.
+int REGIONDB_open_modeSwitch(
+    REGIONDB *db,
+    const char *path,
+    unsigned int value_size,
+    unsigned int cached_pages ) {
+    
+    int error = REGIONDB_open( db, path, value_size, cached_pages );
+    
+    if( error || dbShrinkMode == 0 ) {
+        return error;
+        }
+    
+    if( dbShrinkMode == 1 && skipLookTimeCleanup ) {
+        if( lookTimeDBEmpty ) {
+            AppLog::infoF( "No lookTimes present, not cleaning %s", path );
+            }
+        return error;
+        }
+    
+    
+    REGIONDB_Iterator dbi;
+    
+    REGIONDB_Iterator_init( db, &dbi );
+    
+    unsigned char value[ TILE_RECORD_SIZE ];
+    
+    int x, y;
+    
+    int total = 0;
+    int discardCount = 0;
+    
+    // deletes only clear bits in pages that the iterator has already
+    // read, so it is safe to delete as we go
+    while( REGIONDB_Iterator_next( &dbi, &x, &y, value ) > 0 ) {
+        total++;
+        
+        char discard;
+        
+        if( dbShrinkMode == 1 ) {
+            if( lookTimeDBEmpty ) {
+                cellsLookedAtToInit++;
+                dbLookTimePut( x, y, MAP_TIMESEC );
+                continue;
+                }
+            discard = ( dbLookTimeGet( x, y ) <= 0 );
+            }
+        else {
+            int id = valueToInt( value );
+            
+            discard = ( id == -1 || getTweakedBaseMap( x, y ) == id );
+            }
+        
+        if( discard ) {
+            REGIONDB_delete( db, x, y );
+            discardCount++;
+            }
+        }
+    
+    if( dbShrinkMode == 1 && lookTimeDBEmpty ) {
+        AppLog::infoF( "No lookTimes present, not cleaning %s", path );
+        return 0;
+        }
+    
+    uint32_t oldNumPages = db->numPages;
+    
+    REGIONDB_flush( db );
+    
+    while( REGIONDB_compact( db, db->numPages ) > 0 ) {
+        }
+    
+    AppLog::infoF( "Cleaned %d / %d %s map cells from %s, "
+                   "%u pages down to %u",
+                   discardCount, total,
+                   ( dbShrinkMode == 1 ) ? "stale" : "natural",
+                   path, oldNumPages, db->numPages );
+    
+    return 0;
+    }
+
+
+
 extern char skipLookTimeCleanup;
 extern int staleSec;
 
@@ -23,6 +23,12 @@ int DB_open_naturalTileShrunk_both(
     unsigned long key_size_time,
     unsigned long value_size_time);
     
+int REGIONDB_open_modeSwitch(
+    REGIONDB *db,
+    const char *path,
+    unsigned int value_size,
+    unsigned int cached_pages );
+    
 void loadDBShrinkSettings();
     
 #endif
\ No newline at end of file
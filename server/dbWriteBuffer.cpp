@@ -0,0 +1,221 @@
+#include "dbWriteBuffer.h"
+
+#include <string.h>
+
+
+
+DBWriteBuffer::DBWriteBuffer( LINEARDB3 *inDB, int inMaxRecords )
+        : mDB( inDB ),
+          mKeySize( inDB->keySize ),
+          mValueSize( inDB->valueSize ),
+          mMaxRecords( inMaxRecords ),
+          mNumPending( 0 ),
+          mHold( false ),
+          mNumPuts( 0 ),
+          mNumCoalesced( 0 ),
+          mNumWritten( 0 ),
+          mNumFlushes( 0 ) {
+
+    if( mMaxRecords < 1 ) {
+        mMaxRecords = 1;
+        }
+
+    mSpace = mMaxRecords;
+
+    mKeys = new uint8_t[ mSpace * mKeySize ];
+    mValues = new uint8_t[ mSpace * mValueSize ];
+    mDeleted = new char[ mSpace ];
+
+    uint32_t numSlots = 1;
+    while( numSlots < (uint32_t)( 2 * mSpace ) ) {
+        numSlots *= 2;
+        }
+
+    mSlotMask = numSlots - 1;
+    mSlots = new int[ numSlots ];
+    memset( mSlots, -1, numSlots * sizeof( int ) );
+    }
+
+
+
+DBWriteBuffer::~DBWriteBuffer() {
+    delete [] mKeys;
+    delete [] mValues;
+    delete [] mDeleted;
+    delete [] mSlots;
+    }
+
+
+
+uint32_t DBWriteBuffer::findSlot( const void *inKey ) {
+    const uint8_t *key = (const uint8_t*)inKey;
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    for( unsigned int i=0; i<mKeySize; i++ ) {
+        hash ^= key[i];
+        hash *= 16777619U;
+        }
+
+    uint32_t slot = hash & mSlotMask;
+
+    // table never more than half full, so this always ends
+    while( true ) {
+        int r = mSlots[ slot ];
+
+        if( r == -1 ||
+            memcmp( &( mKeys[ r * mKeySize ] ), key, mKeySize ) == 0 ) {
+            return slot;
+            }
+
+        slot = ( slot + 1 ) & mSlotMask;
+        }
+    }
+
+
+
+void DBWriteBuffer::grow() {
+    int newSpace = mSpace * 2;
+
+    uint8_t *newKeys = new uint8_t[ newSpace * mKeySize ];
+    uint8_t *newValues = new uint8_t[ newSpace * mValueSize ];
+    char *newDeleted = new char[ newSpace ];
+
+    memcpy( newKeys, mKeys, mNumPending * mKeySize );
+    memcpy( newValues, mValues, mNumPending * mValueSize );
+    memcpy( newDeleted, mDeleted, mNumPending );
+
+    delete [] mKeys;
+    delete [] mValues;
+    delete [] mDeleted;
+
+    mKeys = newKeys;
+    mValues = newValues;
+    mDeleted = newDeleted;
+    mSpace = newSpace;
+
+    uint32_t numSlots = ( mSlotMask + 1 ) * 2;
+
+    delete [] mSlots;
+    mSlotMask = numSlots - 1;
+    mSlots = new int[ numSlots ];
+    memset( mSlots, -1, numSlots * sizeof( int ) );
+
+    for( int r=0; r<mNumPending; r++ ) {
+        mSlots[ findSlot( &( mKeys[ r * mKeySize ] ) ) ] = r;
+        }
+    }
+
+
+
+int DBWriteBuffer::write( const void *inKey, const void *inValue,
+                          char inDelete ) {
+    mNumPuts++;
+
+    uint32_t slot = findSlot( inKey );
+
+    int r = mSlots[ slot ];
+
+    if( r != -1 ) {
+        // already pending, replace it
+        if( ! inDelete ) {
+            memcpy( &( mValues[ r * mValueSize ] ), inValue, mValueSize );
+            }
+        mDeleted[r] = inDelete;
+        mNumCoalesced++;
+        return 0;
+        }
+
+    r = mNumPending;
+    mNumPending++;
+
+    memcpy( &( mKeys[ r * mKeySize ] ), inKey, mKeySize );
+    if( ! inDelete ) {
+        memcpy( &( mValues[ r * mValueSize ] ), inValue, mValueSize );
+        }
+    mDeleted[r] = inDelete;
+    mSlots[ slot ] = r;
+
+    if( mNumPending >= mMaxRecords && ! mHold ) {
+        return flush();
+        }
+    if( mNumPending >= mSpace ) {
+        grow();
+        }
+    return 0;
+    }
+
+
+
+int DBWriteBuffer::put( const void *inKey, const void *inValue ) {
+    return write( inKey, inValue, false );
+    }
+
+
+
+int DBWriteBuffer::remove( const void *inKey ) {
+    return write( inKey, NULL, true );
+    }
+
+
+
+int DBWriteBuffer::get( const void *inKey, void *outValue ) {
+    if( mNumPending == 0 ) {
+        return -1;
+        }
+
+    int r = mSlots[ findSlot( inKey ) ];
+
+    if( r == -1 ) {
+        return -1;
+        }
+
+    if( mDeleted[r] ) {
+        return 1;
+        }
+
+    memcpy( outValue, &( mValues[ r * mValueSize ] ), mValueSize );
+    return 0;
+    }
+
+
+
+int DBWriteBuffer::flush() {
+    if( mNumPending == 0 || mHold ) {
+        return 0;
+        }
+
+    // pack puts at front, so they can go in one batch
+    // deletes are rare enough to do one at a time afterward
+    int numPuts = 0;
+    int result = 0;
+
+    for( int r=0; r<mNumPending; r++ ) {
+        if( ! mDeleted[r] ) {
+            if( r != numPuts ) {
+                memcpy( &( mKeys[ numPuts * mKeySize ] ),
+                        &( mKeys[ r * mKeySize ] ), mKeySize );
+                memcpy( &( mValues[ numPuts * mValueSize ] ),
+                        &( mValues[ r * mValueSize ] ), mValueSize );
+                }
+            numPuts++;
+            }
+        else if( LINEARDB3_delete( mDB, &( mKeys[ r * mKeySize ] ) ) == -1 ) {
+            result = -1;
+            }
+        }
+
+    if( numPuts > 0 &&
+        LINEARDB3_putBatch( mDB, numPuts, mKeys, mValues ) == -1 ) {
+        result = -1;
+        }
+
+    mNumWritten += mNumPending;
+    mNumFlushes++;
+
+    mNumPending = 0;
+    memset( mSlots, -1, ( mSlotMask + 1 ) * sizeof( int ) );
+
+    return result;
+    }
+
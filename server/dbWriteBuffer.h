@@ -0,0 +1,133 @@
+#ifndef DB_WRITE_BUFFER_H_INCLUDED
+#define DB_WRITE_BUFFER_H_INCLUDED
+
+
+#include "lineardb3.h"
+
+
+
+// Write-back buffer sitting in front of a LINEARDB3
+//
+// Puts and deletes are held in RAM, and repeated writes to the same key
+// replace each other there without touching the file.  flush() pushes
+// all pending puts to the DB with one LINEARDB3_putBatch call, which
+// writes them in file-offset order, and then applies pending deletes.
+//
+// Callers must check get() before reading from the DB itself, and must
+// flush() before iterating through the DB or closing it.
+//
+// While held (see setHold), nothing reaches the DB, so that its file
+// stays frozen for a snapshot.  The buffer grows as needed instead.
+class DBWriteBuffer {
+    public:
+
+        // inDB must stay open for the life of this buffer
+        // put() forces a flush once inMaxRecords distinct keys are
+        // pending
+        DBWriteBuffer( LINEARDB3 *inDB, int inMaxRecords );
+
+        // pending records are discarded, flush() first
+        ~DBWriteBuffer();
+
+
+        // returns -1 on I/O error (during a forced flush), 0 on success
+        int put( const void *inKey, const void *inValue );
+
+        // returns -1 on I/O error (during a forced flush), 0 on success
+        int remove( const void *inKey );
+
+        // returns 0 if inKey has a pending value, and fills outValue
+        // returns 1 if inKey has a pending delete
+        // returns -1 if not pending (DB must be consulted)
+        int get( const void *inKey, void *outValue );
+
+        // writes all pending records to DB
+        // returns -1 on I/O error, 0 on success
+        // pending records are dropped either way
+        int flush();
+
+
+        // while held, flush() does nothing, and put() grows buffer
+        // instead of forcing a flush
+        // flush() after releasing hold to push held writes through
+        void setHold( char inHold ) {
+            mHold = inHold;
+            }
+
+        char isHeld() {
+            return mHold;
+            }
+
+
+        int getNumPending() {
+            return mNumPending;
+            }
+
+        // total puts and removes received
+        uint64_t getNumPuts() {
+            return mNumPuts;
+            }
+
+        // puts and removes that replaced a pending one instead of
+        // reaching the DB
+        uint64_t getNumCoalesced() {
+            return mNumCoalesced;
+            }
+
+        // records actually written to (or deleted from) DB
+        uint64_t getNumWritten() {
+            return mNumWritten;
+            }
+
+        uint64_t getNumFlushes() {
+            return mNumFlushes;
+            }
+
+
+    private:
+
+        LINEARDB3 *mDB;
+
+        unsigned int mKeySize;
+        unsigned int mValueSize;
+
+        int mMaxRecords;
+        int mNumPending;
+
+        char mHold;
+
+        // current space, can grow past mMaxRecords while held
+        int mSpace;
+
+        // keys and values of pending records, packed back-to-back
+        uint8_t *mKeys;
+        uint8_t *mValues;
+
+        // true for pending records that are deletes
+        char *mDeleted;
+
+        // open-addressed index into pending records, -1 for empty
+        // size is a power of 2, at least twice mSpace
+        int *mSlots;
+        uint32_t mSlotMask;
+
+        uint64_t mNumPuts;
+        uint64_t mNumCoalesced;
+        uint64_t mNumWritten;
+        uint64_t mNumFlushes;
+
+
+        // returns slot holding inKey, or empty slot where it belongs
+        uint32_t findSlot( const void *inKey );
+
+        // doubles space, while held
+        void grow();
+
+        // shared by put and remove, inValue ignored for deletes
+        int write( const void *inKey, const void *inValue, char inDelete );
+
+    };
+
+
+
+#endif
@@ -0,0 +1,185 @@
+// Checks that row versions of the fractal noise functions match the
+// single-value versions bit for bit, and compares their speed
+//
+// Timing uses an area the size of what's generated around a new Eve,
+// with the noise parameters that computeMapBiomeIndex uses.
+
+
+#include "../commonSource/fractalNoise.h"
+
+#include "minorGems/system/Time.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define AREA_SIZE 512
+
+#define NUM_TIMING_RUNS 5
+
+
+static double rowValues[ AREA_SIZE ];
+
+
+typedef struct NoiseParams {
+        double roughness;
+        double scale;
+    } NoiseParams;
+
+
+// biome layout, rivers, object density, and grid wiggle
+static NoiseParams paramsToCheck[] = { 
+    { 0.55, 0.83332 + 0.08333 * 7 },
+    { 0.55, 2.4999 + 0.2499 * 2 },
+    { 0.2, 8 * 4.8 },
+    { 0.1, 0.25 },
+    { 0.1, 0.1 },
+    { 0.7, 1.0 } };
+
+
+static int numMismatches = 0;
+
+
+static void checkRow( int inStartX, int inY, int inNumValues,
+                      NoiseParams inP ) {
+    
+    getXYFractalRow( inStartX, inY, inNumValues, inP.roughness, inP.scale,
+                     rowValues );
+    
+    for( int i=0; i<inNumValues; i++ ) {
+        double v = getXYFractal( inStartX + i, inY, inP.roughness, inP.scale );
+        
+        if( memcmp( &v, &( rowValues[i] ), sizeof( double ) ) != 0 ) {
+            if( numMismatches < 10 ) {
+                printf( "getXYFractalRow mismatch at (%d,%d):  %.17g vs %.17g\n",
+                        inStartX + i, inY, rowValues[i], v );
+                }
+            numMismatches++;
+            }
+        }
+
+    getXYFractal2Row( inStartX, inY, inNumValues, inP.roughness, inP.scale,
+                      rowValues );
+    
+    for( int i=0; i<inNumValues; i++ ) {
+        double v = getXYFractal2( inStartX + i, inY, 
+                                  inP.roughness, inP.scale );
+        
+        if( memcmp( &v, &( rowValues[i] ), sizeof( double ) ) != 0 ) {
+            if( numMismatches < 10 ) {
+                printf( "getXYFractal2Row mismatch at (%d,%d):  %.17g vs %.17g\n",
+                        inStartX + i, inY, rowValues[i], v );
+                }
+            numMismatches++;
+            }
+        }
+
+    getXYRandomRow( inStartX, inY, inNumValues, rowValues );
+    
+    for( int i=0; i<inNumValues; i++ ) {
+        double v = getXYRandom( inStartX + i, inY );
+        
+        if( memcmp( &v, &( rowValues[i] ), sizeof( double ) ) != 0 ) {
+            if( numMismatches < 10 ) {
+                printf( "getXYRandomRow mismatch at (%d,%d):  %.17g vs %.17g\n",
+                        inStartX + i, inY, rowValues[i], v );
+                }
+            numMismatches++;
+            }
+        }
+    }
+
+
+
+int main() {
+    
+    int numParams = sizeof( paramsToCheck ) / sizeof( NoiseParams );
+
+    int numChecked = 0;
+    
+    for( int seed=0; seed<4; seed++ ) {
+        setXYRandomSeed( seed * 9377 + 17, seed * 12113 );
+        
+        for( int p=0; p<numParams; p++ ) {
+            
+            // odd lengths and offsets to hit leftover scalar lanes,
+            // negative coordinates, and far-out coordinates
+            int starts[] = { -300, -1, 0, 17, 1000003, -2000001 };
+            
+            for( int s=0; s<6; s++ ) {
+                for( int y = starts[s] - 20; y < starts[s] + 20; y += 3 ) {
+                    checkRow( starts[s] - 7, y, AREA_SIZE - 5,
+                              paramsToCheck[p] );
+                    numChecked += 3 * ( AREA_SIZE - 5 );
+                    }
+                }
+            }
+        }
+    
+    if( numMismatches > 0 ) {
+        printf( "%d of %d row values don't match single-value versions\n",
+                numMismatches, numChecked );
+        return 1;
+        }
+    
+    printf( "All %d row values match single-value versions\n", numChecked );
+
+    
+    setXYRandomSeed( 1234, 5678 );
+    
+    int startX = -AREA_SIZE / 2;
+    int startY = -AREA_SIZE / 2;
+
+    for( int p=0; p<numParams; p++ ) {
+        NoiseParams np = paramsToCheck[p];
+
+        printf( "\nroughness %.2f, scale %.4f, %dx%d area:\n", 
+                np.roughness, np.scale, AREA_SIZE, AREA_SIZE );
+
+        double checksum = 0;
+        
+        double startTime = Time::getCurrentTime();
+
+        for( int r=0; r<NUM_TIMING_RUNS; r++ ) {
+            for( int y=startY; y<startY + AREA_SIZE; y++ ) {
+                for( int x=startX; x<startX + AREA_SIZE; x++ ) {
+                    checksum += getXYFractal( x, y, np.roughness, np.scale );
+                    }
+                }
+            }
+
+        double singleTime = Time::getCurrentTime() - startTime;
+        
+
+        double rowChecksum = 0;
+
+        startTime = Time::getCurrentTime();
+
+        for( int r=0; r<NUM_TIMING_RUNS; r++ ) {
+            for( int y=startY; y<startY + AREA_SIZE; y++ ) {
+                getXYFractalRow( startX, y, AREA_SIZE, 
+                                 np.roughness, np.scale, rowValues );
+                
+                for( int x=0; x<AREA_SIZE; x++ ) {
+                    rowChecksum += rowValues[x];
+                    }
+                }
+            }
+
+        double rowTime = Time::getCurrentTime() - startTime;
+        
+        if( checksum != rowChecksum ) {
+            printf( "Checksum mismatch (%f vs %f)\n", checksum, rowChecksum );
+            return 1;
+            }
+        
+        double numValues = (double)NUM_TIMING_RUNS * AREA_SIZE * AREA_SIZE;
+        
+        printf( "    getXYFractal     %8.3f Mvalues/sec\n",
+                numValues / singleTime / 1000000.0 );
+        printf( "    getXYFractalRow  %8.3f Mvalues/sec  (%.1fx)\n",
+                numValues / rowTime / 1000000.0, singleTime / rowTime );
+        }
+    
+    return 0;
+    }
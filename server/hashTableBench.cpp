@@ -0,0 +1,172 @@
+// Microbenchmark comparing HashTable (bins of SimpleVectors) to
+// FlatHashTable (open addressing) for the live decay bookkeeping in map.cpp
+//
+// Both start at size 1024, like the tables in map.cpp, and are filled to
+// the record counts we see on small, busy, and very busy servers.
+//
+// Keys are shaped like live decay records (x, y, slot, subCont).
+
+
+#include "HashTable.h"
+#include "FlatHashTable.h"
+
+#include "minorGems/system/Time.h"
+
+#include "minorGems/util/random/CustomRandomSource.h"
+
+#include <stdio.h>
+
+
+#define NUM_OPS 1000000
+
+
+static int tableSizes[] = { 1000, 50000, 300000 };
+
+
+static int keyA, keyB, keyC, keyD;
+
+
+
+// same key sequence every time for a given seed
+// cells clustered in a 2000x2000 area, a few contained slots each
+static void makeKey( CustomRandomSource *inSource, int inSlotOffset ) {
+    keyA = inSource->getRandomBoundedInt( -1000, 999 );
+    keyB = inSource->getRandomBoundedInt( -1000, 999 );
+    keyC = inSource->getRandomBoundedInt( 0, 3 ) + inSlotOffset;
+    keyD = inSource->getRandomBoundedInt( 0, 1 );
+    }
+
+
+
+static void printRate( const char *inLabel, int inCount, double inSeconds ) {
+    printf( "    %-16s %8.3f Mops/sec  (%d in %.3f sec)\n",
+            inLabel, inCount / inSeconds / 1000000.0, inCount, inSeconds );
+    }
+
+
+
+// returns checksum of values read
+template <class Table>
+static double runBench( Table *inTable, int inNumRecords ) {
+
+    double startTime = Time::getCurrentTime();
+
+    CustomRandomSource putSource( 1731 );
+
+    for( int i=0; i<inNumRecords; i++ ) {
+        makeKey( &putSource, 0 );
+        inTable->insert( keyA, keyB, keyC, keyD, i );
+        }
+
+    printRate( "insert", inNumRecords, Time::getCurrentTime() - startTime );
+
+
+    double checksum = 0;
+    int numHits = 0;
+
+    startTime = Time::getCurrentTime();
+
+    // same seed as inserts, so these all hit
+    CustomRandomSource hitSource( 1731 );
+
+    for( int i=0; i<NUM_OPS; i++ ) {
+        if( i % inNumRecords == 0 ) {
+            hitSource.reseed( 1731 );
+            }
+        makeKey( &hitSource, 0 );
+
+        char found;
+        double v = inTable->lookup( keyA, keyB, keyC, keyD, &found );
+
+        if( found ) {
+            checksum += v;
+            numHits++;
+            }
+        }
+
+    printRate( "lookup (hit)", NUM_OPS, Time::getCurrentTime() - startTime );
+    printf( "      (%d/%d hits)\n", numHits, NUM_OPS );
+
+
+    startTime = Time::getCurrentTime();
+
+    // slots never used in inserts above, so these all miss
+    CustomRandomSource missSource( 9941 );
+
+    for( int i=0; i<NUM_OPS; i++ ) {
+        makeKey( &missSource, 100 );
+
+        double *v = inTable->lookupPointer( keyA, keyB, keyC, keyD );
+
+        if( v != NULL ) {
+            checksum += *v;
+            }
+        }
+
+    printRate( "lookup (miss)", NUM_OPS, Time::getCurrentTime() - startTime );
+
+
+    startTime = Time::getCurrentTime();
+
+    // remove half, then put them back, like decays expiring and
+    // being re-added
+    CustomRandomSource removeSource( 1731 );
+
+    int numChurn = inNumRecords / 2;
+
+    for( int i=0; i<numChurn; i++ ) {
+        makeKey( &removeSource, 0 );
+        inTable->remove( keyA, keyB, keyC, keyD );
+        }
+
+    removeSource.reseed( 1731 );
+
+    for( int i=0; i<numChurn; i++ ) {
+        makeKey( &removeSource, 0 );
+        inTable->insert( keyA, keyB, keyC, keyD, i );
+        }
+
+    printRate( "remove+insert", 2 * numChurn,
+               Time::getCurrentTime() - startTime );
+
+    printf( "    %d records\n", inTable->getNumElements() );
+
+    return checksum;
+    }
+
+
+
+int main() {
+    printf( "HashTable vs FlatHashTable benchmark, %d lookups\n", NUM_OPS );
+
+    int numSizes = sizeof( tableSizes ) / sizeof( int );
+
+    for( int s=0; s<numSizes; s++ ) {
+
+        printf( "\n%d inserts, HashTable:\n", tableSizes[s] );
+
+        HashTable<double> *oldTable = new HashTable<double>( 1024, 0 );
+
+        double oldChecksum = runBench( oldTable, tableSizes[s] );
+
+        delete oldTable;
+
+
+        printf( "\n%d inserts, FlatHashTable:\n", tableSizes[s] );
+
+        FlatHashTable<double> *flatTable = new FlatHashTable<double>( 1024, 0 );
+
+        double flatChecksum = runBench( flatTable, tableSizes[s] );
+
+        delete flatTable;
+
+
+        if( oldChecksum != flatChecksum ) {
+            printf( "Checksum mismatch between tables (%f vs %f)\n",
+                    flatChecksum, oldChecksum );
+            return 1;
+            }
+        }
+
+    return 0;
+    }
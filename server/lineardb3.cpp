@@ -9,6 +9,23 @@
 #ifdef _WIN32
 #define fseeko fseeko64
 #define ftello ftello64
+#include <io.h>
+#else
+#define LINEARDB3_MMAP_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+
+
+// SIMD bucket probes are only built for x86 GCC/clang, where we can
+// compile AVX2 code for just one function and check CPU support at
+// runtime.  Everywhere else, the scalar probe is used.
+#if defined( __GNUC__ ) && defined( __SSE2__ ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define LINEARDB3_SIMD_SUPPORTED
+#include <immintrin.h>
 #endif
 
 
@@ -32,6 +49,32 @@ void LINEARDB3_setMaxLoad( double inMaxLoad ) {
 
 
 
+static char useMmapForOpenCalls = false;
+
+
+void LINEARDB3_setUseMmap( char inUseMmap ) {
+#ifdef LINEARDB3_MMAP_SUPPORTED
+    useMmapForOpenCalls = inUseMmap;
+#else
+    // stdio is all we have
+    useMmapForOpenCalls = false;
+#endif
+    }
+
+
+
+char LINEARDB3_getUseMmap() {
+    return useMmapForOpenCalls;
+    }
+
+
+
+// mapped area grows in 64 MiB steps as file grows
+// this is only address space, not RAM, so we can be generous here
+#define LINEARDB3_MMAP_STEP_BYTES 67108864
+
+
+
 
 #include "murmurhash2_64.cpp"
 
@@ -402,894 +445,2754 @@ uint32_t LINEARDB3_getPerfectTableSize( double inMaxLoad,
 
 
 
-// if inIgnoreDataFile (which only applies if inPut is true), we completely
-// ignore the data file and don't touch it, updating the RAM hash table only,
-// and assuming all unique values on collision
-int LINEARDB3_getOrPut( LINEARDB3 *inDB, const void *inKey, void *inOutValue,
-                        char inPut, char inIgnoreDataFile = false );
+// maps file into memory, covering at least inMinBytes, leaving room
+// for growth
+// returns 0 on success, -1 on failure
+static int mapFile( LINEARDB3 *inDB, uint64_t inMinBytes ) {
+#ifdef LINEARDB3_MMAP_SUPPORTED
+    
+    if( inDB->mapData != NULL ) {
+        munmap( inDB->mapData, inDB->mapSize );
+        inDB->mapData = NULL;
+        inDB->mapSize = 0;
+        }
+
+    uint64_t numSteps = inMinBytes / LINEARDB3_MMAP_STEP_BYTES + 1;
+    
+    uint64_t newSize = numSteps * LINEARDB3_MMAP_STEP_BYTES;
+
+    void *newMap = mmap( NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fileno( inDB->file ), 0 );
+    
+    if( newMap == MAP_FAILED ) {
+        printf( "lineardb3 failed to mmap %.0f bytes of data file\n",
+                (double)newSize );
+        return -1;
+        }
+    
+    inDB->mapData = (uint8_t*)newMap;
+    inDB->mapSize = newSize;
+    
+    return 0;
+#else
+    return -1;
+#endif
+    }
 
 
 
+static void unmapFile( LINEARDB3 *inDB ) {
+#ifdef LINEARDB3_MMAP_SUPPORTED
+    if( inDB->mapData != NULL ) {
+        msync( inDB->mapData, inDB->mapSize, MS_SYNC );
+        munmap( inDB->mapData, inDB->mapSize );
+        inDB->mapData = NULL;
+        inDB->mapSize = 0;
+        }
+#endif
+    }
 
-int LINEARDB3_open(
-    LINEARDB3 *inDB,
-    const char *inPath,
-    int inMode,
-    unsigned int inHashTableStartSize,
-    unsigned int inKeySize,
-    unsigned int inValueSize ) {
-    
-    inDB->recordBuffer = NULL;
-    inDB->maxOverflowDepth = 0;
 
-    inDB->numRecords = 0;
-    
-    inDB->maxLoad = maxLoadForOpenCalls;
+
+// in mmap mode, appends a new record at inFilePos, which must be the
+// end of the file
+// returns 0 on success, -1 on failure
+static int appendMappedRecord( LINEARDB3 *inDB, uint64_t inFilePos,
+                               const void *inKey, const void *inValue ) {
+#ifdef LINEARDB3_MMAP_SUPPORTED
     
+    memcpy( inDB->recordBuffer, inKey, inDB->keySize );
+    memcpy( &( inDB->recordBuffer[ inDB->keySize ] ), inValue,
+            inDB->valueSize );
 
-    inDB->file = fopen( inPath, "r+b" );
+    // writing past end of file through the map is not allowed
+    // extend file by writing record there directly
+    ssize_t numWritten = pwrite( fileno( inDB->file ), inDB->recordBuffer,
+                                 inDB->recordSizeBytes, (off_t)inFilePos );
     
-    if( inDB->file == NULL ) {
-        // doesn't exist yet
-        inDB->file = fopen( inPath, "w+b" );
+    if( numWritten != (ssize_t)inDB->recordSizeBytes ) {
+        return -1;
         }
+
+    uint64_t newFileSize = inFilePos + inDB->recordSizeBytes;
     
-    if( inDB->file == NULL ) {
-        return 1;
+    if( newFileSize > inDB->mapSize &&
+        mapFile( inDB, newFileSize ) != 0 ) {
+        // record is in file, carry on through stdio without map
+        printf( "lineardb3 falling back to stdio\n" );
+        
+        // force seek before next stdio access
+        inDB->lastOp = opWrite;
         }
-    
-    if( inHashTableStartSize < 2 ) {
-        inHashTableStartSize = 2;
+    return 0;
+#else
+    return -1;
+#endif
+    }
+
+
+
+
+static const char *indexMagicString = "Ld3i";
+
+// bump this whenever FingerprintBucket layout or index header changes
+#define LINEARDB3_INDEX_VERSION 1
+
+#define LINEARDB3_INDEX_NUM_FIELDS 15
+
+#define LINEARDB3_INDEX_SEED 0x6a09e667
+
+
+
+// hash of final record in data file
+// used to detect a data file that has been replaced or rewritten
+// without our index file being updated
+// returns 0 on failure
+static uint64_t hashLastRecord( LINEARDB3 *inDB, uint64_t inDataSize ) {
+    if( inDataSize < LINEARDB3_HEADER_SIZE + inDB->recordSizeBytes ) {
+        // no records, nothing to hash
+        return 1;
         }
     
-    inDB->hashTableSizeA = inHashTableStartSize;
-    inDB->hashTableSizeB = inHashTableStartSize;
+    uint64_t lastPos = inDataSize - inDB->recordSizeBytes;
     
-    inDB->keySize = inKeySize;
-    inDB->valueSize = inValueSize;
+    if( inDB->mapData != NULL ) {
+        return LINEARDB3_hash( &( inDB->mapData[ lastPos ] ), 
+                               inDB->recordSizeBytes );
+        }
     
-    // first byte in record is present flag
-    inDB->recordSizeBytes = getRecordSizeBytes( inKeySize, inValueSize );
+    if( fseeko( inDB->file, lastPos, SEEK_SET ) ) {
+        return 0;
+        }
+    inDB->lastOp = opRead;
     
-    inDB->recordBuffer = new uint8_t[ inDB->recordSizeBytes ];
+    if( fread( inDB->recordBuffer, inDB->recordSizeBytes, 1, 
+               inDB->file ) != 1 ) {
+        return 0;
+        }
+    return LINEARDB3_hash( inDB->recordBuffer, inDB->recordSizeBytes );
+    }
 
 
-    recomputeFingerprintMod( inDB );
 
-    inDB->hashTable = new PageManager;
-    inDB->overflowBuckets = new PageManager;
-    
+static void fillIndexFields( LINEARDB3 *inDB, uint32_t *outFields ) {
+    outFields[0] = LINEARDB3_INDEX_VERSION;
+    outFields[1] = inDB->keySize;
+    outFields[2] = inDB->valueSize;
+    outFields[3] = inDB->numRecords;
+    outFields[4] = inDB->hashTableSizeA;
+    outFields[5] = inDB->hashTableSizeB;
+    outFields[6] = inDB->fingerprintMod;
+    outFields[7] = inDB->maxOverflowDepth;
+    outFields[8] = inDB->hashTable->numBuckets;
+    outFields[9] = inDB->hashTable->numPages;
+    outFields[10] = inDB->hashTable->firstEmptyBucket;
+    outFields[11] = inDB->overflowBuckets->numBuckets;
+    outFields[12] = inDB->overflowBuckets->numPages;
+    outFields[13] = inDB->overflowBuckets->firstEmptyBucket;
+    outFields[14] = RECORDS_PER_BUCKET;
+    }
 
-    // does the file already contain a header
-    
-    // seek to the end to find out file size
 
-    if( fseeko( inDB->file, 0, SEEK_END ) ) {
-        return 1;
+
+// writes whole RAM hash table to inDB->indexPath
+// data file must be flushed before calling this
+// leaves no index file behind on failure
+static void writeIndexFile( LINEARDB3 *inDB ) {
+    if( inDB->indexPath == NULL || inDB->file == NULL ) {
+        return;
         }
     
+    if( fseeko( inDB->file, 0, SEEK_END ) ) {
+        return;
+        }
+    uint64_t dataSize = ftello( inDB->file );
     
+    uint64_t tailHash = hashLastRecord( inDB, dataSize );
     
-    if( ftello( inDB->file ) < LINEARDB3_HEADER_SIZE ) {
-        // file that doesn't even contain the header
-
+    if( tailHash == 0 ) {
+        return;
+        }
 
-        // write fresh header and hash table
+    char *tempPath = new char[ strlen( inDB->indexPath ) + 6 ];
+    sprintf( tempPath, "%s.temp", inDB->indexPath );
+    
+    FILE *f = fopen( tempPath, "wb" );
+    
+    if( f == NULL ) {
+        delete [] tempPath;
+        return;
+        }
+    
+    uint32_t fields[ LINEARDB3_INDEX_NUM_FIELDS ];
+    fillIndexFields( inDB, fields );
+    
+    uint64_t sizes[2] = { dataSize, tailHash };
+    
+    uint64_t checksum = MurmurHash64( fields, sizeof( fields ), 
+                                      LINEARDB3_INDEX_SEED );
+    checksum = MurmurHash64( sizes, sizeof( sizes ), checksum );
 
-        // rewrite header
+    char failed = false;
     
-        if( writeHeader( inDB ) != 0 ) {
-            return 1;
-            }
-        
-        inDB->lastOp = opWrite;
-        
-        initPageManager( inDB->hashTable, inDB->hashTableSizeA );
-        initPageManager( inDB->overflowBuckets, 2 );
+    if( fwrite( indexMagicString, 4, 1, f ) != 1 ||
+        fwrite( fields, sizeof( fields ), 1, f ) != 1 ||
+        fwrite( sizes, sizeof( sizes ), 1, f ) != 1 ) {
+        failed = true;
         }
-    else {
-        // read header
-        if( fseeko( inDB->file, 0, SEEK_SET ) ) {
-            return 1;
+    
+    PageManager *managers[2] = { inDB->hashTable, inDB->overflowBuckets };
+    
+    for( int m=0; m<2 && !failed; m++ ) {
+        for( uint32_t p=0; p<managers[m]->numPages; p++ ) {
+            BucketPage *page = managers[m]->pages[p];
+            
+            checksum = MurmurHash64( page, sizeof( BucketPage ), checksum );
+            
+            if( fwrite( page, sizeof( BucketPage ), 1, f ) != 1 ) {
+                failed = true;
+                break;
+                }
             }
-        
-        
-        int numRead;
-        
-        char magicBuffer[ 4 ];
-        
-        numRead = fread( magicBuffer, 3, 1, inDB->file );
+        }
+    
+    if( !failed &&
+        fwrite( &checksum, sizeof( checksum ), 1, f ) != 1 ) {
+        failed = true;
+        }
 
-        if( numRead != 1 ) {
-            return 1;
-            }
+    if( fclose( f ) != 0 ) {
+        failed = true;
+        }
+    
+    if( failed || rename( tempPath, inDB->indexPath ) != 0 ) {
+        remove( tempPath );
+        }
 
-        magicBuffer[3] = '\0';
-        
-        if( strcmp( magicBuffer, magicString ) != 0 ) {
-            printf( "lineardb3 magic string '%s' not found at start of  "
-                    "file header in %s\n", magicString, inPath );
-            return 1;
-            }
-        
+    delete [] tempPath;
+    }
 
-        uint32_t val32;
-        
-        numRead = fread( &val32, sizeof(uint32_t), 1, inDB->file );
-        
-        if( numRead != 1 ) {
-            return 1;
-            }
-        
-        if( val32 != inKeySize ) {
-            printf( "Requested lineardb3 key size of %u does not match "
-                    "size of %u in file header in %s\n", inKeySize, val32,
-                    inPath );
-            return 1;
-            }
-        
 
 
-        numRead = fread( &val32, sizeof(uint32_t), 1, inDB->file );
-        
-        if( numRead != 1 ) {
-            return 1;
+static void freePageArea( BucketPage **inPages, uint32_t inNumPages ) {
+    for( uint32_t p=0; p<inNumPages; p++ ) {
+        if( inPages[p] != NULL ) {
+            delete inPages[p];
             }
+        }
+    delete [] inPages;
+    }
+
+
+
+// reads inNumPages into a freshly allocated page area
+// sized the same way initPageManager would size it
+// returns NULL on failure
+static BucketPage **readPageArea( FILE *inFile, uint32_t inNumPages,
+                                  uint32_t *outAreaSize,
+                                  uint64_t *inOutChecksum ) {
+    uint32_t areaSize = 2 * inNumPages;
+    
+    if( areaSize < 2 ) {
+        areaSize = 2;
+        }
+    
+    BucketPage **pages = new BucketPage*[ areaSize ];
+    
+    for( uint32_t p=0; p<areaSize; p++ ) {
+        pages[p] = NULL;
+        }
+    
+    for( uint32_t p=0; p<inNumPages; p++ ) {
+        pages[p] = new BucketPage;
         
-        if( val32 != inValueSize ) {
-            printf( "Requested lineardb3 value size of %u does not match "
-                    "size of %u in file header in %s\n", inValueSize, val32,
-                    inPath );
-            return 1;
+        if( fread( pages[p], sizeof( BucketPage ), 1, inFile ) != 1 ) {
+            freePageArea( pages, areaSize );
+            return NULL;
             }
-        
+        *inOutChecksum = 
+            MurmurHash64( pages[p], sizeof( BucketPage ), *inOutChecksum );
+        }
+    
+    *outAreaSize = areaSize;
+    return pages;
+    }
 
-        // got here, header matches
 
 
-        // make sure hash table exists in file
-        if( fseeko( inDB->file, 0, SEEK_END ) ) {
-            return 1;
-            }
- 
-        uint64_t fileSize = ftello( inDB->file );
+// loads RAM hash table from index file, if index matches data file
+//
+// Index file is a flat copy of both page areas, so this is a few large
+// sequential reads instead of a rescan and re-hash of every record
+//
+// returns 0 on success, -1 if index missing, stale, or corrupt
+// (in which case inDB's hash table is left untouched)
+static int readIndexFile( LINEARDB3 *inDB, const char *inDataPath,
+                          uint64_t inDataSize ) {
+    
+    struct stat indexStat;
+    struct stat dataStat;
 
+    if( stat( inDB->indexPath, &indexStat ) != 0 ||
+        stat( inDataPath, &dataStat ) != 0 ) {
+        return -1;
+        }
+    
+    if( dataStat.st_mtime > indexStat.st_mtime ) {
+        // data file touched after index written
+        printf( "lineardb3 index file %s older than data file, "
+                "ignoring it\n", inDB->indexPath );
+        return -1;
+        }
+    
 
-        uint64_t numRecordsInFile = 
-            ( fileSize - LINEARDB3_HEADER_SIZE ) / inDB->recordSizeBytes;
+    FILE *f = fopen( inDB->indexPath, "rb" );
+    
+    if( f == NULL ) {
+        return -1;
+        }
+    
+    char magicBuffer[5];
+    uint32_t fields[ LINEARDB3_INDEX_NUM_FIELDS ];
+    uint64_t sizes[2];
+    
+    if( fread( magicBuffer, 4, 1, f ) != 1 ||
+        fread( fields, sizeof( fields ), 1, f ) != 1 ||
+        fread( sizes, sizeof( sizes ), 1, f ) != 1 ) {
+        fclose( f );
+        return -1;
+        }
+    
+    magicBuffer[4] = '\0';
+    
+    uint64_t expectedNumRecords = 
+        ( inDataSize - LINEARDB3_HEADER_SIZE ) / inDB->recordSizeBytes;
+    
+    if( strcmp( magicBuffer, indexMagicString ) != 0 ||
+        fields[0] != LINEARDB3_INDEX_VERSION ||
+        fields[1] != inDB->keySize ||
+        fields[2] != inDB->valueSize ||
+        fields[3] != expectedNumRecords ||
+        fields[14] != RECORDS_PER_BUCKET ||
+        sizes[0] != inDataSize ||
+        sizes[1] != hashLastRecord( inDB, inDataSize ) ) {
         
-        uint64_t expectedSize =
-            inDB->recordSizeBytes * numRecordsInFile + LINEARDB3_HEADER_SIZE;
+        printf( "lineardb3 index file %s does not match data file, "
+                "ignoring it\n", inDB->indexPath );
+        fclose( f );
+        return -1;
+        }
+    
+    uint64_t checksum = MurmurHash64( fields, sizeof( fields ), 
+                                      LINEARDB3_INDEX_SEED );
+    checksum = MurmurHash64( sizes, sizeof( sizes ), checksum );
+    
+    uint32_t tableAreaSize, overflowAreaSize;
+    
+    BucketPage **tablePages = readPageArea( f, fields[9], &tableAreaSize,
+                                            &checksum );
+    if( tablePages == NULL ) {
+        fclose( f );
+        return -1;
+        }
+    
+    BucketPage **overflowPages = readPageArea( f, fields[12], 
+                                               &overflowAreaSize,
+                                               &checksum );
+    if( overflowPages == NULL ) {
+        freePageArea( tablePages, tableAreaSize );
+        fclose( f );
+        return -1;
+        }
+    
+    uint64_t storedChecksum;
+    
+    if( fread( &storedChecksum, sizeof( storedChecksum ), 1, f ) != 1 ||
+        storedChecksum != checksum ) {
         
+        printf( "lineardb3 index file %s failed checksum, ignoring it\n",
+                inDB->indexPath );
+        freePageArea( tablePages, tableAreaSize );
+        freePageArea( overflowPages, overflowAreaSize );
+        fclose( f );
+        return -1;
+        }
+    
+    fclose( f );
+    
+    
+    inDB->numRecords = fields[3];
+    inDB->hashTableSizeA = fields[4];
+    inDB->hashTableSizeB = fields[5];
+    inDB->fingerprintMod = fields[6];
+    inDB->maxOverflowDepth = fields[7];
+    
+    inDB->hashTable->numBuckets = fields[8];
+    inDB->hashTable->numPages = fields[9];
+    inDB->hashTable->firstEmptyBucket = fields[10];
+    inDB->hashTable->pageAreaSize = tableAreaSize;
+    inDB->hashTable->pages = tablePages;
 
-        if( expectedSize != fileSize ) {
-            
-            printf( "Requested lineardb3 file %s does not contain a "
-                    "whole number of %d-byte records.  "
-                    "Assuming final record is garbage and truncating it.\n", 
-                    inPath, inDB->recordSizeBytes );
-        
-            char tempPath[200];
-            sprintf( tempPath, "%.190s%s", inPath, ".trunc" );
+    inDB->overflowBuckets->numBuckets = fields[11];
+    inDB->overflowBuckets->numPages = fields[12];
+    inDB->overflowBuckets->firstEmptyBucket = fields[13];
+    inDB->overflowBuckets->pageAreaSize = overflowAreaSize;
+    inDB->overflowBuckets->pages = overflowPages;
+    
+    return 0;
+    }
 
-            FILE *tempFile = fopen( tempPath, "wb" );
-            
-            if( tempFile == NULL ) {
-                printf( "Failed to open temp file %s for truncation\n",
-                        tempPath );
-                return 1;
-                }
-            
-            if( fseeko( inDB->file, 0, SEEK_SET ) ) {
-                return 1;
-                }
-            
-            unsigned char headerBuffer[ LINEARDB3_HEADER_SIZE ];
-            
-            int numRead = fread( headerBuffer, 
-                                 LINEARDB3_HEADER_SIZE, 1, inDB->file );
-            
-            if( numRead != 1 ) {
-                printf( "Failed to read header from lineardb3 file %s\n",
-                        inPath );
-                return 1;
-                }
-            int numWritten = fwrite( headerBuffer, 
-                                     LINEARDB3_HEADER_SIZE, 1, tempFile );
-            
-            if( numWritten != 1 ) {
-                printf( "Failed to write header to temp lineardb3 "
-                        "truncation file %s\n", tempPath );
-                return 1;
-                }
-                
 
-            for( uint64_t i=0; i<numRecordsInFile; i++ ) {
-                numRead = fread( inDB->recordBuffer, 
-                                 inDB->recordSizeBytes, 1, inDB->file );
-            
-                if( numRead != 1 ) {
-                    printf( "Failed to read record from lineardb3 file %s\n",
-                            inPath );
-                    return 1;
-                    }
-                
-                numWritten = fwrite( inDB->recordBuffer, 
-                                     inDB->recordSizeBytes, 1, tempFile );
-            
-                if( numWritten != 1 ) {
-                    printf( "Failed to record to temp lineardb3 "
-                            "truncation file %s\n", tempPath );
-                    return 1;
-                    }
-                }
 
-            fclose( inDB->file );
-            fclose( tempFile );
-            
-            if( rename( tempPath, inPath ) != 0 ) {
-                printf( "Failed overwrite lineardb3 file %s with "
-                        "truncation file %s\n", inPath, tempPath );
-                return 1;
-                }
 
-            inDB->file = fopen( inPath, "r+b" );
+// Holes journal file format:
+//
+// magic string (4 bytes)
+// uint32 limit, number of records in data file that are valid, or
+//        LINEARDB3_HOLES_NO_LIMIT
+// then a log of uint32 entries to end of file, each either:
+//    record index of a new hole, or
+//    LINEARDB3_HOLES_LIMIT_MARK, followed by a new limit, the number
+//        of holes that were filled, and the record index of each
+//
+// A limit is only in effect while compaction is about to truncate the
+// data file.  Records at or past it were moved into the filled holes,
+// and are ignored if we crash before truncation finishes.  Holes logged
+// before a limit, at or past it, are gone with the end of the file.
+//
+// Compaction appends a limit record before truncating, and another
+// with no limit after.  The journal is only written fresh, without
+// stale entries, on open.
 
-            if( inDB->file == NULL ) {
-                printf( "Failed to re-open lineardb3 file %s after "
-                        "trunctation\n", inPath );
-                return 1;
-                }
-            }
-        
-        
-        // now populate hash table
+static const char *holesMagicString = "Ld3h";
 
-        uint32_t minTableBuckets = 
-            LINEARDB3_getPerfectTableSize( inDB->maxLoad,
-                                           numRecordsInFile );
+#define LINEARDB3_HOLES_NO_LIMIT 0xFFFFFFFF
 
-        
-        inDB->hashTableSizeA = minTableBuckets;
-        inDB->hashTableSizeB = minTableBuckets;
-        
-        
-        recomputeFingerprintMod( inDB );
+// never a record index, since limit is one past the last index
+#define LINEARDB3_HOLES_LIMIT_MARK 0xFFFFFFFE
 
-        initPageManager( inDB->hashTable, inDB->hashTableSizeA );
-        initPageManager( inDB->overflowBuckets, 2 );
 
 
-        if( fseeko( inDB->file, LINEARDB3_HEADER_SIZE, SEEK_SET ) ) {
-            return 1;
-            }
-        
-        for( uint64_t i=0; i<numRecordsInFile; i++ ) {
-            int numRead = fread( inDB->recordBuffer, 
-                                 inDB->recordSizeBytes, 1, inDB->file );
-            
-            if( numRead != 1 ) {
-                printf( "Failed to read record from lineardb3 file\n" );
-                return 1;
-                }
+static char isHole( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    uint32_t byte = inFileIndex / 8;
+    
+    if( byte >= inDB->holeMapBytes ) {
+        return false;
+        }
+    return ( inDB->holeMap[ byte ] >> ( inFileIndex % 8 ) ) & 1;
+    }
 
-            // put only in RAM part of table
-            // note that this assumes that each key in the file is unique
-            // (it should be, because we generated the file on a previous run)
-            int result = 
-                LINEARDB3_getOrPut( inDB,
-                                    &( inDB->recordBuffer[0] ),
-                                    &( inDB->recordBuffer[inDB->keySize] ),
-                                    true, 
-                                    // ignore data file
-                                    // update ram only
-                                    // don't even verify keys in data file
-                                    // this preserves our fread position
-                                    true );
-            if( result != 0 ) {
-                printf( "Putting lineardb3 record in RAM hash table failed\n" );
-                return 1;
-                }
+
+
+static void setHoleBit( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    uint32_t byte = inFileIndex / 8;
+    
+    if( byte >= inDB->holeMapBytes ) {
+        uint32_t newBytes = 2 * inDB->holeMapBytes;
+        
+        if( newBytes <= byte ) {
+            newBytes = byte + 1024;
             }
         
-        inDB->lastOp = opRead;
+        uint8_t *newMap = new uint8_t[ newBytes ];
+        memset( newMap, 0, newBytes );
+        
+        if( inDB->holeMap != NULL ) {
+            memcpy( newMap, inDB->holeMap, inDB->holeMapBytes );
+            delete [] inDB->holeMap;
+            }
+        inDB->holeMap = newMap;
+        inDB->holeMapBytes = newBytes;
         }
     
-
-    
-
-
-    return 0;
+    inDB->holeMap[ byte ] |= (uint8_t)( 1 << ( inFileIndex % 8 ) );
     }
 
 
 
+static void clearHoleBit( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    inDB->holeMap[ inFileIndex / 8 ] &= 
+        (uint8_t)~( 1 << ( inFileIndex % 8 ) );
+    }
 
-void LINEARDB3_close( LINEARDB3 *inDB ) {
-    if( inDB->recordBuffer != NULL ) {
-        delete [] inDB->recordBuffer;
-        inDB->recordBuffer = NULL;
-        }    
 
 
-    freePageManager( inDB->hashTable );
-    freePageManager( inDB->overflowBuckets );
+// marks record as hole in RAM only
+static void addHole( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    setHoleBit( inDB, inFileIndex );
     
-    delete inDB->hashTable;
-    delete inDB->overflowBuckets;
-    
-
-    if( inDB->file != NULL ) {
-        fclose( inDB->file );
-        inDB->file = NULL;
+    if( inDB->holeStackSize == inDB->holeStackSpace ) {
+        uint32_t newSpace = 2 * inDB->holeStackSpace + 256;
+        
+        uint32_t *newStack = new uint32_t[ newSpace ];
+        
+        if( inDB->holeStack != NULL ) {
+            memcpy( newStack, inDB->holeStack, 
+                    inDB->holeStackSize * sizeof( uint32_t ) );
+            delete [] inDB->holeStack;
+            }
+        inDB->holeStack = newStack;
+        inDB->holeStackSpace = newSpace;
         }
+    
+    inDB->holeStack[ inDB->holeStackSize ] = inFileIndex;
+    inDB->holeStackSize++;
+    
+    inDB->numHoles++;
     }
 
 
 
+static void removeHole( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    clearHoleBit( inDB, inFileIndex );
+    inDB->numHoles--;
+    // leave stale entry in stack, skipped when popped
+    }
 
 
 
+static void closeHolesFile( LINEARDB3 *inDB ) {
+    if( inDB->holesFile != NULL ) {
+        fclose( inDB->holesFile );
+        inDB->holesFile = NULL;
+        }
+    }
 
 
-inline char keyComp( int inKeySize, const void *inKeyA, const void *inKeyB ) {
-    uint8_t *a = (uint8_t*)inKeyA;
-    uint8_t *b = (uint8_t*)inKeyB;
+
+// writes fresh journal listing all current holes, replacing old one
+// stale entries are dropped from holeStack along the way
+// leaves holesFile open for appending more holes
+// returns 0 on success, -1 on failure
+static int writeHolesFile( LINEARDB3 *inDB, uint32_t inLimit ) {
+    closeHolesFile( inDB );
     
-    for( int i=0; i<inKeySize; i++ ) {
-        if( a[i] != b[i] ) {
-            return false;
+    char *tempPath = new char[ strlen( inDB->holesPath ) + 6 ];
+    sprintf( tempPath, "%s.temp", inDB->holesPath );
+    
+    FILE *f = fopen( tempPath, "wb" );
+    
+    if( f == NULL ) {
+        delete [] tempPath;
+        return -1;
+        }
+    
+    int numWritten = fwrite( holesMagicString, 4, 1, f );
+    numWritten += fwrite( &inLimit, sizeof( uint32_t ), 1, f );
+    
+    int numExpected = 2;
+    
+    uint32_t newStackSize = 0;
+    
+    for( uint32_t i=0; i<inDB->holeStackSize; i++ ) {
+        uint32_t h = inDB->holeStack[i];
+        
+        if( isHole( inDB, h ) ) {
+            numWritten += fwrite( &h, sizeof( uint32_t ), 1, f );
+            numExpected++;
+            
+            inDB->holeStack[ newStackSize ] = h;
+            newStackSize++;
+            
+            // clear for now, so that duplicate entries are skipped
+            clearHoleBit( inDB, h );
             }
         }
-    return true;
+    
+    inDB->holeStackSize = newStackSize;
+    
+    for( uint32_t i=0; i<newStackSize; i++ ) {
+        setHoleBit( inDB, inDB->holeStack[i] );
+        }
+    
+    fclose( f );
+    
+    if( numWritten != numExpected ||
+        rename( tempPath, inDB->holesPath ) != 0 ) {
+        
+        remove( tempPath );
+        delete [] tempPath;
+        return -1;
+        }
+    
+    delete [] tempPath;
+    
+    inDB->holesFile = fopen( inDB->holesPath, "r+b" );
+    
+    if( inDB->holesFile == NULL ) {
+        return -1;
+        }
+    return 0;
     }
 
 
 
-
-static uint64_t getBinNumber( LINEARDB3 *inDB, uint32_t inFingerprint );
+// adds a newly-deleted record to journal
+// returns 0 on success, -1 on failure
+static int journalHole( LINEARDB3 *inDB, uint32_t inFileIndex ) {
+    if( inDB->holesFile == NULL ) {
+        // first hole, hole already in stack, so this will include it
+        return writeHolesFile( inDB, LINEARDB3_HOLES_NO_LIMIT );
+        }
+    
+    if( fseeko( inDB->holesFile, 0, SEEK_END ) ) {
+        return -1;
+        }
+    
+    int numWritten = 
+        fwrite( &inFileIndex, sizeof( uint32_t ), 1, inDB->holesFile );
+    
+    if( numWritten != 1 ) {
+        return -1;
+        }
+    return 0;
+    }
 
 
 
-typedef struct {
-        FingerprintBucket *nextBucket;
-        int nextRecord;
-    } BucketIterator;
+// adds limit record to end of journal, and flushes it
+// returns 0 on success, -1 on failure
+static int journalLimit( LINEARDB3 *inDB, uint32_t inLimit,
+                         uint32_t inNumFilled, uint32_t *inFilled ) {
+    
+    uint32_t header[3] = { LINEARDB3_HOLES_LIMIT_MARK, inLimit, inNumFilled };
+    
+    if( inDB->holesFile == NULL ||
+        fseeko( inDB->holesFile, 0, SEEK_END ) ||
+        fwrite( header, sizeof( uint32_t ), 3, inDB->holesFile ) != 3 ||
+        ( inNumFilled > 0 &&
+          fwrite( inFilled, sizeof( uint32_t ), inNumFilled,
+                  inDB->holesFile ) != inNumFilled ) ||
+        fflush( inDB->holesFile ) != 0 ) {
+        return -1;
+        }
+    return 0;
+    }
 
-    
 
 
-// Repeated calls to this function will insert a series of records
-// into an empty bucket and any necessary overflow chain buckets
-//
-// Assumes bucket/record pointed to by iterator is empty and at end of
-// chain (assumes this is a fresh series of inserts using an iterator
-// that started with an empty bucket).
-//
-// Updates iterator
-static void insertIntoBucket( LINEARDB3 *inDB,
-                              BucketIterator *inBucketIterator,
-                              uint32_t inFingerprint,
-                              uint32_t inFileIndex ) {
+// sets data file length to inNumRecords
+// returns 0 on success, -1 on failure
+static int truncateDataFile( LINEARDB3 *inDB, uint64_t inNumRecords ) {
+    uint64_t size = 
+        LINEARDB3_HEADER_SIZE + inNumRecords * inDB->recordSizeBytes;
     
-    if( inBucketIterator->nextRecord == RECORDS_PER_BUCKET ) {
-        inBucketIterator->nextBucket->overflowIndex = 
-            getFirstEmptyBucketIndex( inDB->overflowBuckets );
-        
-        inBucketIterator->nextRecord = 0;
-        inBucketIterator->nextBucket = 
-            getBucket( inDB->overflowBuckets, 
-                       inBucketIterator->nextBucket->overflowIndex );
+    // don't let buffered writes land past new end later
+    fflush( inDB->file );
+    
+#ifdef _WIN32
+    if( _chsize_s( _fileno( inDB->file ), size ) != 0 ) {
+        return -1;
         }
-    inBucketIterator->nextBucket->
-        fingerprints[ inBucketIterator->nextRecord ] = inFingerprint;
+#else
+    if( ftruncate( fileno( inDB->file ), size ) != 0 ) {
+        return -1;
+        }
+#endif
     
-    inBucketIterator->nextBucket->
-        fileIndex[ inBucketIterator->nextRecord ] = inFileIndex;
+    // force seek before next stdio access
+    inDB->lastOp = opWrite;
     
-    inBucketIterator->nextRecord++;
+    return 0;
     }
 
-                                            
 
 
-// uses method described here:
-// https://en.wikipedia.org/wiki/Linear_hashing
+// replays holes journal at inPath for a data file with 
+// inOutNumRecords records
 //
-// returns 0 on success, -1 on failure
+// inOutNumRecords is reduced if a limit is still in effect at the end 
+// of the journal
 //
-// This call may expand the table by more than one cell, until the table
-// is big enough that it's at or below the maxLoad
-static int expandTable( LINEARDB3 *inDB ) {
+// outHoleMap set to a new bit map of holes, inOutNumRecords / 8 + 1 bytes
+//
+// returns 1 if journal read, 0 if there's no journal or it's damaged
+static int replayHolesFile( const char *inPath, uint64_t *inOutNumRecords,
+                            uint8_t **outHoleMap ) {
+    FILE *f = fopen( inPath, "rb" );
     
-    // expand table one cell at a time until we are back at or below maxLoad
-    while( (double)( inDB->numRecords ) /
-           (double)( inDB->hashTableSizeB * RECORDS_PER_BUCKET ) 
-           > inDB->maxLoad ) {
-
-
-        uint32_t oldSplitPoint = 
-            inDB->hashTableSizeB - inDB->hashTableSizeA;
-
-
-        // we only need to redistribute records from this bucket
-        FingerprintBucket *oldBucket =
-            getBucket( inDB->hashTable, oldSplitPoint );
-
-        // add one bucket to end of of table
+    if( f == NULL ) {
+        return 0;
+        }
+    
+    char magicBuffer[ 5 ];
+    uint32_t headerLimit;
+    
+    int numRead = fread( magicBuffer, 4, 1, f );
+    numRead += fread( &headerLimit, sizeof( uint32_t ), 1, f );
+    
+    magicBuffer[4] = '\0';
+    
+    if( numRead != 2 || strcmp( magicBuffer, holesMagicString ) != 0 ||
+        fseeko( f, 0, SEEK_END ) ) {
+        printf( "lineardb3 holes journal %s is damaged, ignoring it\n",
+                inPath );
+        fclose( f );
+        return 0;
+        }
+    
+    uint64_t numEntries = ( ftello( f ) - 8 ) / sizeof( uint32_t );
+    
+    uint32_t *entries = new uint32_t[ numEntries + 1 ];
+    
+    if( fseeko( f, 8, SEEK_SET ) ||
+        fread( entries, sizeof( uint32_t ), numEntries, f ) != numEntries ) {
+        printf( "lineardb3 failed to read holes journal %s, ignoring it\n",
+                inPath );
+        delete [] entries;
+        fclose( f );
+        return 0;
+        }
+    
+    fclose( f );
+    
+    
+    // first pass finds where limit records start, and drops a torn one 
+    // at the end, which was never acted on
+    uint64_t numLimits = 0;
+    uint64_t i = 0;
+    
+    while( i < numEntries ) {
+        if( entries[i] != LINEARDB3_HOLES_LIMIT_MARK ) {
+            i++;
+            continue;
+            }
+        
+        if( i + 3 > numEntries || 
+            i + 3 + entries[ i + 2 ] > numEntries ) {
+            numEntries = i;
+            break;
+            }
+        numLimits++;
+        i += 3 + entries[ i + 2 ];
+        }
+    
+    // lowest limit from each limit record to end, so that a hole
+    // can be checked against every limit that came after it
+    uint32_t *laterMinLimit = new uint32_t[ numLimits + 1 ];
+    
+    uint32_t finalLimit = headerLimit;
+    
+    uint64_t l = 0;
+    i = 0;
+    
+    while( i < numEntries ) {
+        if( entries[i] == LINEARDB3_HOLES_LIMIT_MARK ) {
+            laterMinLimit[l] = entries[ i + 1 ];
+            finalLimit = entries[ i + 1 ];
+            l++;
+            i += 3 + entries[ i + 2 ];
+            }
+        else {
+            i++;
+            }
+        }
+    
+    laterMinLimit[ numLimits ] = LINEARDB3_HOLES_NO_LIMIT;
+    
+    for( l = numLimits; l > 0; l-- ) {
+        if( laterMinLimit[ l ] < laterMinLimit[ l - 1 ] ) {
+            laterMinLimit[ l - 1 ] = laterMinLimit[ l ];
+            }
+        }
+    
+    if( finalLimit < *inOutNumRecords ) {
+        // crashed during compaction, after records were moved
+        // into holes, but before file was truncated
+        *inOutNumRecords = finalLimit;
+        }
+    
+    uint64_t numRecords = *inOutNumRecords;
+    
+    uint64_t numBytes = numRecords / 8 + 1;
+    
+    uint8_t *holeMap = new uint8_t[ numBytes ];
+    memset( holeMap, 0, numBytes );
+    
+    // second pass, in order, since holes can be filled and then
+    // become holes again
+    l = 0;
+    i = 0;
+    
+    while( i < numEntries ) {
+        uint32_t h = entries[i];
+        
+        if( h == LINEARDB3_HOLES_LIMIT_MARK ) {
+            uint32_t numFilled = entries[ i + 2 ];
+            
+            for( uint32_t j=0; j<numFilled; j++ ) {
+                uint32_t filled = entries[ i + 3 + j ];
+                
+                if( filled < numRecords ) {
+                    holeMap[ filled / 8 ] &= 
+                        (uint8_t)~( 1 << ( filled % 8 ) );
+                    }
+                }
+            l++;
+            i += 3 + numFilled;
+            continue;
+            }
+        
+        if( h < numRecords && h < laterMinLimit[ l ] ) {
+            holeMap[ h / 8 ] |= (uint8_t)( 1 << ( h % 8 ) );
+            }
+        i++;
+        }
+    
+    delete [] laterMinLimit;
+    delete [] entries;
+    
+    *outHoleMap = holeMap;
+    return 1;
+    }
+
+
+
+// loads holes journal left behind by an unclean shutdown, if any
+// inOutNumRecordsInFile is reduced if journal says records past a 
+// certain point are no longer valid, and data file is truncated to match
+//
+// returns 1 if holes loaded, 0 if no journal, -1 on error
+static int readHolesFile( LINEARDB3 *inDB, 
+                          uint64_t *inOutNumRecordsInFile ) {
+    
+    uint64_t numRecords = *inOutNumRecordsInFile;
+    uint8_t *holeMap;
+    
+    if( replayHolesFile( inDB->holesPath, &numRecords, &holeMap ) == 0 ) {
+        return 0;
+        }
+    
+    if( numRecords < *inOutNumRecordsInFile ) {
+        if( truncateDataFile( inDB, numRecords ) != 0 ) {
+            delete [] holeMap;
+            return -1;
+            }
+        *inOutNumRecordsInFile = numRecords;
+        }
+    
+    for( uint64_t h=0; h<numRecords; h++ ) {
+        if( ( holeMap[ h / 8 ] >> ( h % 8 ) ) & 1 ) {
+            addHole( inDB, h );
+            }
+        }
+    
+    delete [] holeMap;
+    
+    printf( "lineardb3 found %u holes in journal %s\n", 
+            inDB->numHoles, inDB->holesPath );
+    
+    return 1;
+    }
+
+
+
+
+// if inIgnoreDataFile (which only applies if inPut is true), we completely
+// ignore the data file and don't touch it, updating the RAM hash table only,
+// and assuming all unique values on collision
+int LINEARDB3_getOrPut( LINEARDB3 *inDB, const void *inKey, void *inOutValue,
+                        char inPut, char inIgnoreDataFile = false );
+
+
+
+
+// picks fastest bucket probe for this CPU, unless already set
+static void initProbeMode();
+
+
+
+int LINEARDB3_open(
+    LINEARDB3 *inDB,
+    const char *inPath,
+    int inMode,
+    unsigned int inHashTableStartSize,
+    unsigned int inKeySize,
+    unsigned int inValueSize ) {
+    
+    initProbeMode();
+    
+    inDB->recordBuffer = NULL;
+    inDB->maxOverflowDepth = 0;
+
+    inDB->mapData = NULL;
+    inDB->mapSize = 0;
+
+    inDB->indexPath = new char[ strlen( inPath ) + 7 ];
+    sprintf( inDB->indexPath, "%s.index", inPath );
+
+    inDB->holesPath = new char[ strlen( inPath ) + 7 ];
+    sprintf( inDB->holesPath, "%s.holes", inPath );
+    inDB->holesFile = NULL;
+
+    inDB->holeMap = NULL;
+    inDB->holeMapBytes = 0;
+    inDB->holeStack = NULL;
+    inDB->holeStackSize = 0;
+    inDB->holeStackSpace = 0;
+
+    inDB->numRecords = 0;
+    inDB->numHoles = 0;
+    
+    inDB->maxLoad = maxLoadForOpenCalls;
+    
+
+    inDB->file = fopen( inPath, "r+b" );
+    
+    if( inDB->file == NULL ) {
+        // doesn't exist yet
+        inDB->file = fopen( inPath, "w+b" );
+        }
+    
+    if( inDB->file == NULL ) {
+        return 1;
+        }
+    
+    if( inHashTableStartSize < 2 ) {
+        inHashTableStartSize = 2;
+        }
+    
+    inDB->hashTableSizeA = inHashTableStartSize;
+    inDB->hashTableSizeB = inHashTableStartSize;
+    
+    inDB->keySize = inKeySize;
+    inDB->valueSize = inValueSize;
+    
+    // first byte in record is present flag
+    inDB->recordSizeBytes = getRecordSizeBytes( inKeySize, inValueSize );
+    
+    inDB->recordBuffer = new uint8_t[ inDB->recordSizeBytes ];
+
+
+    recomputeFingerprintMod( inDB );
+
+    inDB->hashTable = new PageManager;
+    inDB->overflowBuckets = new PageManager;
+    
+
+    // does the file already contain a header
+    
+    // seek to the end to find out file size
+
+    if( fseeko( inDB->file, 0, SEEK_END ) ) {
+        return 1;
+        }
+    
+    
+    
+    if( ftello( inDB->file ) < LINEARDB3_HEADER_SIZE ) {
+        // file that doesn't even contain the header
+
+
+        // write fresh header and hash table
+
+        // rewrite header
+    
+        if( writeHeader( inDB ) != 0 ) {
+            return 1;
+            }
+        
+        inDB->lastOp = opWrite;
+        
+        initPageManager( inDB->hashTable, inDB->hashTableSizeA );
+        initPageManager( inDB->overflowBuckets, 2 );
+        
+        if( useMmapForOpenCalls ) {
+            // header written through stdio above
+            fflush( inDB->file );
+            
+            if( mapFile( inDB, LINEARDB3_HEADER_SIZE ) != 0 ) {
+                printf( "lineardb3 falling back to stdio for %s\n", 
+                        inPath );
+                }
+            }
+        }
+    else {
+        // read header
+        if( fseeko( inDB->file, 0, SEEK_SET ) ) {
+            return 1;
+            }
+        
+        
+        int numRead;
+        
+        char magicBuffer[ 4 ];
+        
+        numRead = fread( magicBuffer, 3, 1, inDB->file );
+
+        if( numRead != 1 ) {
+            return 1;
+            }
+
+        magicBuffer[3] = '\0';
+        
+        if( strcmp( magicBuffer, magicString ) != 0 ) {
+            printf( "lineardb3 magic string '%s' not found at start of  "
+                    "file header in %s\n", magicString, inPath );
+            return 1;
+            }
+        
+
+        uint32_t val32;
+        
+        numRead = fread( &val32, sizeof(uint32_t), 1, inDB->file );
+        
+        if( numRead != 1 ) {
+            return 1;
+            }
+        
+        if( val32 != inKeySize ) {
+            printf( "Requested lineardb3 key size of %u does not match "
+                    "size of %u in file header in %s\n", inKeySize, val32,
+                    inPath );
+            return 1;
+            }
+        
+
+
+        numRead = fread( &val32, sizeof(uint32_t), 1, inDB->file );
+        
+        if( numRead != 1 ) {
+            return 1;
+            }
+        
+        if( val32 != inValueSize ) {
+            printf( "Requested lineardb3 value size of %u does not match "
+                    "size of %u in file header in %s\n", inValueSize, val32,
+                    inPath );
+            return 1;
+            }
+        
+
+        // got here, header matches
+
+
+        // make sure hash table exists in file
+        if( fseeko( inDB->file, 0, SEEK_END ) ) {
+            return 1;
+            }
+ 
+        uint64_t fileSize = ftello( inDB->file );
+
+
+        uint64_t numRecordsInFile = 
+            ( fileSize - LINEARDB3_HEADER_SIZE ) / inDB->recordSizeBytes;
+        
+        uint64_t expectedSize =
+            inDB->recordSizeBytes * numRecordsInFile + LINEARDB3_HEADER_SIZE;
+        
+
+        char truncated = false;
+        
+        if( expectedSize != fileSize ) {
+            truncated = true;
+            
+            printf( "Requested lineardb3 file %s does not contain a "
+                    "whole number of %d-byte records.  "
+                    "Assuming final record is garbage and truncating it.\n", 
+                    inPath, inDB->recordSizeBytes );
+        
+            char tempPath[200];
+            sprintf( tempPath, "%.190s%s", inPath, ".trunc" );
+
+            FILE *tempFile = fopen( tempPath, "wb" );
+            
+            if( tempFile == NULL ) {
+                printf( "Failed to open temp file %s for truncation\n",
+                        tempPath );
+                return 1;
+                }
+            
+            if( fseeko( inDB->file, 0, SEEK_SET ) ) {
+                return 1;
+                }
+            
+            unsigned char headerBuffer[ LINEARDB3_HEADER_SIZE ];
+            
+            int numRead = fread( headerBuffer, 
+                                 LINEARDB3_HEADER_SIZE, 1, inDB->file );
+            
+            if( numRead != 1 ) {
+                printf( "Failed to read header from lineardb3 file %s\n",
+                        inPath );
+                return 1;
+                }
+            int numWritten = fwrite( headerBuffer, 
+                                     LINEARDB3_HEADER_SIZE, 1, tempFile );
+            
+            if( numWritten != 1 ) {
+                printf( "Failed to write header to temp lineardb3 "
+                        "truncation file %s\n", tempPath );
+                return 1;
+                }
+                
+
+            for( uint64_t i=0; i<numRecordsInFile; i++ ) {
+                numRead = fread( inDB->recordBuffer, 
+                                 inDB->recordSizeBytes, 1, inDB->file );
+            
+                if( numRead != 1 ) {
+                    printf( "Failed to read record from lineardb3 file %s\n",
+                            inPath );
+                    return 1;
+                    }
+                
+                numWritten = fwrite( inDB->recordBuffer, 
+                                     inDB->recordSizeBytes, 1, tempFile );
+            
+                if( numWritten != 1 ) {
+                    printf( "Failed to record to temp lineardb3 "
+                            "truncation file %s\n", tempPath );
+                    return 1;
+                    }
+                }
+
+            fclose( inDB->file );
+            fclose( tempFile );
+            
+            if( rename( tempPath, inPath ) != 0 ) {
+                printf( "Failed overwrite lineardb3 file %s with "
+                        "truncation file %s\n", inPath, tempPath );
+                return 1;
+                }
+
+            inDB->file = fopen( inPath, "r+b" );
+
+            if( inDB->file == NULL ) {
+                printf( "Failed to re-open lineardb3 file %s after "
+                        "trunctation\n", inPath );
+                return 1;
+                }
+            }
+        
+        
+        // holes left by deleted records, if we didn't close cleanly
+        int holesResult = readHolesFile( inDB, &numRecordsInFile );
+        
+        if( holesResult == -1 ) {
+            return 1;
+            }
+        
+        
+        if( useMmapForOpenCalls ) {
+            // map before populating, so we can scan records
+            // straight out of the map
+            if( mapFile( inDB, fileSize ) != 0 ) {
+                printf( "lineardb3 falling back to stdio for %s\n", 
+                        inPath );
+                }
+            }
+        
+
+        // now populate hash table
+        
+        // index is never saved while there are holes, so any index
+        // found alongside a journal is stale
+        if( ! truncated && holesResult == 0 &&
+            readIndexFile( inDB, inPath, expectedSize ) == 0 ) {
+            // table loaded from saved index, no need to scan data file
+            numRecordsInFile = 0;
+            }
+        else {
+            uint32_t minTableBuckets = 
+                LINEARDB3_getPerfectTableSize( inDB->maxLoad,
+                                               numRecordsInFile );
+            
+            inDB->hashTableSizeA = minTableBuckets;
+            inDB->hashTableSizeB = minTableBuckets;
+            
+            recomputeFingerprintMod( inDB );
+            
+            initPageManager( inDB->hashTable, inDB->hashTableSizeA );
+            initPageManager( inDB->overflowBuckets, 2 );
+            }
+        
+        if( inDB->mapData == NULL &&
+            fseeko( inDB->file, LINEARDB3_HEADER_SIZE, SEEK_SET ) ) {
+            return 1;
+            }
+        
+        for( uint64_t i=0; i<numRecordsInFile; i++ ) {
+            uint8_t *record = inDB->recordBuffer;
+            
+            if( inDB->mapData != NULL ) {
+                record = &( inDB->mapData[ LINEARDB3_HEADER_SIZE + 
+                                           i * inDB->recordSizeBytes ] );
+                }
+            else {
+                int numRead = fread( inDB->recordBuffer, 
+                                     inDB->recordSizeBytes, 1, inDB->file );
+            
+                if( numRead != 1 ) {
+                    printf( "Failed to read record from lineardb3 file\n" );
+                    return 1;
+                    }
+                }
+            
+            if( isHole( inDB, inDB->numRecords ) ) {
+                // deleted record, keep its place in file, but leave
+                // it out of table
+                inDB->numRecords++;
+                continue;
+                }
+            
+            // put only in RAM part of table
+            // note that this assumes that each key in the file is unique
+            // (it should be, because we generated the file on a previous run)
+            int result = 
+                LINEARDB3_getOrPut( inDB,
+                                    &( record[0] ),
+                                    &( record[inDB->keySize] ),
+                                    true, 
+                                    // ignore data file
+                                    // update ram only
+                                    // don't even verify keys in data file
+                                    // this preserves our fread position
+                                    true );
+            if( result != 0 ) {
+                printf( "Putting lineardb3 record in RAM hash table failed\n" );
+                return 1;
+                }
+            }
+        
+        inDB->lastOp = opRead;
+        }
+    
+
+    // index file only valid until DB is changed
+    // it gets re-written on close
+    remove( inDB->indexPath );
+    
+    if( inDB->numHoles > 0 ) {
+        // fresh journal without stale entries or limit
+        if( writeHolesFile( inDB, LINEARDB3_HOLES_NO_LIMIT ) != 0 ) {
+            return 1;
+            }
+        }
+    else {
+        remove( inDB->holesPath );
+        }
+    
+
+    return 0;
+    }
+
+
+
+
+void LINEARDB3_close( LINEARDB3 *inDB ) {
+    
+    // fill all holes, so file is as small as possible, and
+    // index can be saved
+    while( inDB->numHoles > 0 ) {
+        if( LINEARDB3_compact( inDB, 100000 ) == -1 ) {
+            printf( "lineardb3 compaction failed on close, leaving "
+                    "holes journal %s\n", inDB->holesPath );
+            break;
+            }
+        }
+    
+    // all data writes must hit the file before index is written,
+    // so that the index isn't older than the data file
+    unmapFile( inDB );
+    
+    if( inDB->file != NULL ) {
+        fflush( inDB->file );
+        }
+    
+    closeHolesFile( inDB );
+    
+    if( inDB->numHoles == 0 ) {
+        writeIndexFile( inDB );
+        }
+    
+    if( inDB->indexPath != NULL ) {
+        delete [] inDB->indexPath;
+        inDB->indexPath = NULL;
+        }
+    
+    if( inDB->holesPath != NULL ) {
+        delete [] inDB->holesPath;
+        inDB->holesPath = NULL;
+        }
+    
+    if( inDB->holeMap != NULL ) {
+        delete [] inDB->holeMap;
+        inDB->holeMap = NULL;
+        inDB->holeMapBytes = 0;
+        }
+    
+    if( inDB->holeStack != NULL ) {
+        delete [] inDB->holeStack;
+        inDB->holeStack = NULL;
+        inDB->holeStackSize = 0;
+        inDB->holeStackSpace = 0;
+        }
+    
+    if( inDB->recordBuffer != NULL ) {
+        delete [] inDB->recordBuffer;
+        inDB->recordBuffer = NULL;
+        }    
+
+
+    freePageManager( inDB->hashTable );
+    freePageManager( inDB->overflowBuckets );
+    
+    delete inDB->hashTable;
+    delete inDB->overflowBuckets;
+    
+    if( inDB->file != NULL ) {
+        fclose( inDB->file );
+        inDB->file = NULL;
+        }
+    }
+
+
+
+void LINEARDB3_removeIndex( const char *inPath ) {
+    // .index and .holes are the same length
+    char *indexPath = new char[ strlen( inPath ) + 7 ];
+    sprintf( indexPath, "%s.index", inPath );
+    
+    remove( indexPath );
+    
+    sprintf( indexPath, "%s.holes", inPath );
+    
+    remove( indexPath );
+
+    delete [] indexPath;
+    }
+
+
+
+void LINEARDB3_sync( LINEARDB3 *inDB ) {
+    if( inDB->holesFile != NULL ) {
+        fflush( inDB->holesFile );
+        }
+#ifdef LINEARDB3_MMAP_SUPPORTED
+    if( inDB->mapData != NULL ) {
+        msync( inDB->mapData, inDB->mapSize, MS_ASYNC );
+        return;
+        }
+#endif
+    if( inDB->file != NULL ) {
+        fflush( inDB->file );
+        }
+    }
+
+
+
+
+
+
+
+
+inline char keyComp( int inKeySize, const void *inKeyA, const void *inKeyB ) {
+    uint8_t *a = (uint8_t*)inKeyA;
+    uint8_t *b = (uint8_t*)inKeyB;
+    
+    for( int i=0; i<inKeySize; i++ ) {
+        if( a[i] != b[i] ) {
+            return false;
+            }
+        }
+    return true;
+    }
+
+
+
+// Bucket probes compare all fingerprints in a bucket against inFingerprint
+// at once.
+//
+// Returns bit mask with bit i set if fingerprints[i] matches, and sets
+// outEmptyMask to bit mask of fingerprints that are 0.
+typedef uint32_t (*BucketProbe)( const FingerprintBucket *inBucket,
+                                 uint32_t inFingerprint,
+                                 uint32_t *outEmptyMask );
+
+
+
+static uint32_t probeScalar( const FingerprintBucket *inBucket,
+                             uint32_t inFingerprint,
+                             uint32_t *outEmptyMask ) {
+    uint32_t matchMask = 0;
+    uint32_t emptyMask = 0;
+    
+    for( int i=0; i<RECORDS_PER_BUCKET; i++ ) {
+        uint32_t binFP = inBucket->fingerprints[i];
+        
+        if( binFP == inFingerprint ) {
+            matchMask |= 1U << i;
+            }
+        else if( binFP == 0 ) {
+            emptyMask |= 1U << i;
+            }
+        }
+    
+    *outEmptyMask = emptyMask;
+    return matchMask;
+    }
+
+
+
+#ifdef LINEARDB3_SIMD_SUPPORTED
+
+#if RECORDS_PER_BUCKET % 4 == 0
+#define LINEARDB3_SSE2_PROBE
+
+static uint32_t probeSSE2( const FingerprintBucket *inBucket,
+                           uint32_t inFingerprint,
+                           uint32_t *outEmptyMask ) {
+    __m128i fp = _mm_set1_epi32( (int)inFingerprint );
+    __m128i zero = _mm_setzero_si128();
+    
+    uint32_t matchMask = 0;
+    uint32_t emptyMask = 0;
+    
+    for( int i=0; i<RECORDS_PER_BUCKET; i += 4 ) {
+        __m128i f = _mm_loadu_si128( 
+            (const __m128i*)&( inBucket->fingerprints[i] ) );
+        
+        matchMask |= (uint32_t)_mm_movemask_ps( 
+            _mm_castsi128_ps( _mm_cmpeq_epi32( f, fp ) ) ) << i;
+        emptyMask |= (uint32_t)_mm_movemask_ps( 
+            _mm_castsi128_ps( _mm_cmpeq_epi32( f, zero ) ) ) << i;
+        }
+    
+    *outEmptyMask = emptyMask;
+    return matchMask;
+    }
+
+#endif
+
+
+#if RECORDS_PER_BUCKET % 8 == 0
+#define LINEARDB3_AVX2_PROBE
+
+__attribute__(( target( "avx2" ) ))
+static uint32_t probeAVX2( const FingerprintBucket *inBucket,
+                           uint32_t inFingerprint,
+                           uint32_t *outEmptyMask ) {
+    __m256i fp = _mm256_set1_epi32( (int)inFingerprint );
+    __m256i zero = _mm256_setzero_si256();
+    
+    uint32_t matchMask = 0;
+    uint32_t emptyMask = 0;
+    
+    for( int i=0; i<RECORDS_PER_BUCKET; i += 8 ) {
+        __m256i f = _mm256_loadu_si256( 
+            (const __m256i*)&( inBucket->fingerprints[i] ) );
+        
+        matchMask |= (uint32_t)_mm256_movemask_ps( 
+            _mm256_castsi256_ps( _mm256_cmpeq_epi32( f, fp ) ) ) << i;
+        emptyMask |= (uint32_t)_mm256_movemask_ps( 
+            _mm256_castsi256_ps( _mm256_cmpeq_epi32( f, zero ) ) ) << i;
+        }
+    
+    *outEmptyMask = emptyMask;
+    return matchMask;
+    }
+
+#endif
+
+#endif
+
+
+
+static BucketProbe probeBucket = probeScalar;
+
+static int probeMode = LINEARDB3_PROBE_SCALAR;
+
+static char probeModeSet = false;
+
+
+
+int LINEARDB3_setProbeMode( int inMode ) {
+    probeModeSet = true;
+    
+    if( inMode == LINEARDB3_PROBE_AUTO ) {
+        inMode = LINEARDB3_PROBE_AVX2;
+        }
+    
+    #ifdef LINEARDB3_AVX2_PROBE
+    if( inMode == LINEARDB3_PROBE_AVX2 ) {
+        if( __builtin_cpu_supports( "avx2" ) ) {
+            probeBucket = probeAVX2;
+            probeMode = LINEARDB3_PROBE_AVX2;
+            return probeMode;
+            }
+        inMode = LINEARDB3_PROBE_SSE2;
+        }
+    #endif
+    
+    #ifdef LINEARDB3_SSE2_PROBE
+    if( inMode == LINEARDB3_PROBE_AVX2 || inMode == LINEARDB3_PROBE_SSE2 ) {
+        // SSE2 always present when LINEARDB3_SIMD_SUPPORTED
+        probeBucket = probeSSE2;
+        probeMode = LINEARDB3_PROBE_SSE2;
+        return probeMode;
+        }
+    #endif
+    
+    probeBucket = probeScalar;
+    probeMode = LINEARDB3_PROBE_SCALAR;
+    return probeMode;
+    }
+
+
+
+static void initProbeMode() {
+    if( ! probeModeSet ) {
+        LINEARDB3_setProbeMode( LINEARDB3_PROBE_AUTO );
+        }
+    }
+
+
+
+const char *LINEARDB3_getProbeModeName( int inMode ) {
+    switch( inMode ) {
+        case LINEARDB3_PROBE_AUTO:
+            return "auto";
+        case LINEARDB3_PROBE_SCALAR:
+            return "scalar";
+        case LINEARDB3_PROBE_SSE2:
+            return "SSE2";
+        case LINEARDB3_PROBE_AVX2:
+            return "AVX2";
+        }
+    return "unknown";
+    }
+
+
+
+// index of lowest set bit, inMask must not be 0
+static inline int lowestBitIndex( uint32_t inMask ) {
+    #ifdef __GNUC__
+    return __builtin_ctz( inMask );
+    #else
+    int i = 0;
+    while( ( inMask & 1 ) == 0 ) {
+        inMask >>= 1;
+        i++;
+        }
+    return i;
+    #endif
+    }
+
+
+
+// returns bit mask of slots in inBucket that might hold a record with
+// inFingerprint, which are fingerprint matches before the first empty slot
+// sets outFirstEmpty to index of first empty slot, or RECORDS_PER_BUCKET
+// if bucket is full
+static inline uint32_t getBucketCandidates( const FingerprintBucket *inBucket,
+                                            uint32_t inFingerprint,
+                                            int *outFirstEmpty ) {
+    uint32_t emptyMask;
+    uint32_t matchMask = probeBucket( inBucket, inFingerprint, &emptyMask );
+    
+    if( emptyMask == 0 ) {
+        *outFirstEmpty = RECORDS_PER_BUCKET;
+        return matchMask;
+        }
+    
+    // first empty slot ends the chain
+    int firstEmpty = lowestBitIndex( emptyMask );
+    
+    *outFirstEmpty = firstEmpty;
+    return matchMask & ( ( 1U << firstEmpty ) - 1 );
+    }
+
+
+
+
+static uint64_t getBinNumber( LINEARDB3 *inDB, uint32_t inFingerprint );
+
+
+
+typedef struct {
+        FingerprintBucket *nextBucket;
+        int nextRecord;
+    } BucketIterator;
+
+    
+
+
+// Repeated calls to this function will insert a series of records
+// into an empty bucket and any necessary overflow chain buckets
+//
+// Assumes bucket/record pointed to by iterator is empty and at end of
+// chain (assumes this is a fresh series of inserts using an iterator
+// that started with an empty bucket).
+//
+// Updates iterator
+static void insertIntoBucket( LINEARDB3 *inDB,
+                              BucketIterator *inBucketIterator,
+                              uint32_t inFingerprint,
+                              uint32_t inFileIndex ) {
+    
+    if( inBucketIterator->nextRecord == RECORDS_PER_BUCKET ) {
+        inBucketIterator->nextBucket->overflowIndex = 
+            getFirstEmptyBucketIndex( inDB->overflowBuckets );
+        
+        inBucketIterator->nextRecord = 0;
+        inBucketIterator->nextBucket = 
+            getBucket( inDB->overflowBuckets, 
+                       inBucketIterator->nextBucket->overflowIndex );
+        }
+    inBucketIterator->nextBucket->
+        fingerprints[ inBucketIterator->nextRecord ] = inFingerprint;
+    
+    inBucketIterator->nextBucket->
+        fileIndex[ inBucketIterator->nextRecord ] = inFileIndex;
+    
+    inBucketIterator->nextRecord++;
+    }
+
+                                            
+
+
+// uses method described here:
+// https://en.wikipedia.org/wiki/Linear_hashing
+//
+// returns 0 on success, -1 on failure
+//
+// This call may expand the table by more than one cell, until the table
+// is big enough that it's at or below the maxLoad
+static int expandTable( LINEARDB3 *inDB ) {
+    
+    // expand table one cell at a time until we are back at or below maxLoad
+    // holes aren't in table
+    while( (double)( inDB->numRecords - inDB->numHoles ) /
+           (double)( inDB->hashTableSizeB * RECORDS_PER_BUCKET ) 
+           > inDB->maxLoad ) {
+
+
+        uint32_t oldSplitPoint = 
+            inDB->hashTableSizeB - inDB->hashTableSizeA;
+
+
+        // we only need to redistribute records from this bucket
+        FingerprintBucket *oldBucket =
+            getBucket( inDB->hashTable, oldSplitPoint );
+
+        // add one bucket to end of of table
         FingerprintBucket *newBucket = addBucket( inDB->hashTable );
 
-        uint32_t oldBucketIndex = oldSplitPoint;
-        uint32_t newBucketIndex = inDB->hashTableSizeB;
+        uint32_t oldBucketIndex = oldSplitPoint;
+        uint32_t newBucketIndex = inDB->hashTableSizeB;
+
+        inDB->hashTableSizeB ++;
+
+
+        BucketIterator oldIter = { oldBucket, 0 };
+        BucketIterator newIter = { newBucket, 0 };
+        
+
+        // re-hash all cells at old split point, all the way down any
+        // overflow chain that's there
+        
+        FingerprintBucket *nextOldBucket = oldBucket;
+        
+        while( nextOldBucket != NULL ) {
+            // make a working copy 
+            FingerprintBucket tempBucket;
+            memcpy( &tempBucket, nextOldBucket, sizeof( FingerprintBucket ) );
+            
+            // clear the real bucket to make room for new inserts
+            // this clears the overflow index as well
+            memset( nextOldBucket, 0, sizeof( FingerprintBucket ) );
+            
+
+            for( int r=0; r<RECORDS_PER_BUCKET; r++ ) {
+                uint32_t fingerprint = tempBucket.fingerprints[ r ];
+                
+                if( fingerprint == 0 ) {
+                    // stop at first empty spot hit
+                    // remaining records empty too
+                    break;
+                    }
+                uint32_t fileIndex = tempBucket.fileIndex[ r ];
+                
+                uint64_t newBinNum = getBinNumber( inDB, fingerprint );
+                
+                BucketIterator *insertIterator;
+                
+                if( newBinNum == oldBucketIndex ) {
+                    insertIterator = &oldIter;
+                    }
+                else if( newBinNum == newBucketIndex ) {
+                    insertIterator = &newIter;
+                    }
+                else {
+                    // rehash doesn't hit either bucket?
+                    // should never happen
+                    return -1;
+                    }
+                
+                insertIntoBucket( inDB, insertIterator, 
+                                  fingerprint, fileIndex );
+                }
+            
+            if( tempBucket.overflowIndex != 0 ) {
+                // process next in overflow chain, reinserting those
+                // records next
+                nextOldBucket = getBucket( inDB->overflowBuckets, 
+                                           tempBucket.overflowIndex );
+                // we're going to clear it in next iteration of loop, 
+                // so report it as empty
+                markBucketEmpty( inDB->overflowBuckets,
+                                 tempBucket.overflowIndex );
+                }
+            else {
+                // end of chain
+                nextOldBucket = NULL;
+                }
+            }
+
+        
+        if( inDB->hashTableSizeB == inDB->hashTableSizeA * 2 ) {
+            // full round of expansion is done.
+            inDB->hashTableSizeA = inDB->hashTableSizeB;            
+            }
+        }
+    
+    return 0;
+    }
+
+
+
+
+static uint64_t getBinNumberFromHash( LINEARDB3 *inDB, uint64_t inHashVal ) {
+
+    uint64_t binNumberA = inHashVal % (uint64_t)( inDB->hashTableSizeA );
+    
+    uint64_t binNumberB = binNumberA;
+    
+
+
+    unsigned int splitPoint = inDB->hashTableSizeB - inDB->hashTableSizeA;
+    
+    
+    if( binNumberA < splitPoint ) {
+        // points before split can be mod'ed with double base table size
+
+        // binNumberB will always fit in hashTableSizeB, the expanded table
+        binNumberB = inHashVal % (uint64_t)( inDB->hashTableSizeA * 2 );
+        }
+    return binNumberB;
+    }
+
+
+
+static uint64_t getBinNumber( LINEARDB3 *inDB, uint32_t inFingerprint ) {
+    // fingerprint is such that it will always land in the same bin as
+    // full hash val
+    return getBinNumberFromHash( inDB, inFingerprint );
+    }
+
+
+
+static uint64_t getBinNumber( LINEARDB3 *inDB, const void *inKey,
+                              uint32_t *outFingerprint ) {
+    
+    uint64_t hashVal = LINEARDB3_hash( inKey, inDB->keySize );
+
+    *outFingerprint = hashVal % inDB->fingerprintMod;
+
+
+
+    if( *outFingerprint == 0 ) {
+        // forbid straight 0 as fingerprint value
+        // we use 0-fingerprints as not-present flags
+        // for the rare values that land on 0, we need to make sure
+        // main hash changes along with fingerprint
+        
+        if( hashVal < UINT64_MAX ) {
+            hashVal++;
+            }
+        else {
+            hashVal--;
+            }
+        
+        *outFingerprint = hashVal % inDB->fingerprintMod;
+        }
+    
+    
+    return getBinNumberFromHash( inDB, hashVal );
+    }
+
+
+
+
+// Consider getting/putting from inBucket at inRecIndex
+//
+// returns 0 if handled and done
+// returns -1 on error
+// returns 1 if guaranteed not found
+// returns 2 if bucket full and not found 
+static int LINEARDB3_considerFingerprintBucket( LINEARDB3 *inDB, 
+                                                const void *inKey, 
+                                                void *inOutValue,
+                                                uint32_t inFingerprint,
+                                                char inPut, 
+                                                char inIgnoreDataFile,
+                                                FingerprintBucket *inBucket,
+                                                int inRecIndex ) {       
+    int i = inRecIndex;
+    
+    uint32_t binFP = inBucket->fingerprints[ i ];
+        
+    char emptyRec = false;
+        
+    if( binFP == 0 ) {
+        emptyRec = true;
+            
+        if( inPut ) {
+            // set fingerprint and file pos for insert
+            binFP = inFingerprint;
+            inBucket->fingerprints[ i ] = inFingerprint;
+                
+            // will go at end of file
+            inBucket->fileIndex[ i ] = inDB->numRecords;
+                
+
+            inDB->numRecords++;
+
+            if( inIgnoreDataFile ) {
+                // finished non-file insert
+                return 0;
+                }
+            }
+        else {
+            return 1;
+            }
+        }
+        
+    if( binFP == inFingerprint ) {
+        // hit
+
+        if( inIgnoreDataFile ) {
+            // treat any fingerprint match as a collision
+            // assume all unique data if we're ignoring the data file
+            return 2;
+            }
+            
+        uint64_t filePosRec = 
+            LINEARDB3_HEADER_SIZE +
+            (uint64_t)inBucket->fileIndex[ i ] * 
+            inDB->recordSizeBytes;
+            
+        if( inDB->mapData != NULL ) {
+            // mmap mode, no seeking or reading needed
+            
+            if( !emptyRec && 
+                ! keyComp( inDB->keySize, 
+                           &( inDB->mapData[ filePosRec ] ), inKey ) ) {
+                // false match on non-empty rec because of fingerprint
+                // collision
+                return 2;
+                }
+            
+            if( inPut ) {
+                if( emptyRec ) {
+                    return appendMappedRecord( inDB, filePosRec,
+                                               inKey, inOutValue );
+                    }
+                memcpy( &( inDB->mapData[ filePosRec + inDB->keySize ] ),
+                        inOutValue, inDB->valueSize );
+                }
+            else {
+                memcpy( inOutValue, 
+                        &( inDB->mapData[ filePosRec + inDB->keySize ] ),
+                        inDB->valueSize );
+                }
+            return 0;
+            }
+        
+        if( !emptyRec ) {
+            
+            // read key to make sure it actually matches
+            
+            // never seek unless we have to
+            if( inDB->lastOp == opWrite || 
+                ftello( inDB->file ) != (off_t)filePosRec ) {
+
+                if( fseeko( inDB->file, filePosRec, SEEK_SET ) ) {
+                    return -1;
+                    }
+                }
+            
+            int numRead = fread( inDB->recordBuffer, inDB->keySize, 1,
+                                 inDB->file );
+            inDB->lastOp = opRead;
+    
+            if( numRead != 1 ) {
+                return -1;
+                }
+            if( ! keyComp( inDB->keySize, inDB->recordBuffer, inKey ) ) {
+                // false match on non-empty rec because of fingerprint
+                // collision
+                return 2;
+                }
+            }
+
+            
+        if( inPut ) {
+            if( emptyRec ) {
+
+                // don't seek unless we have to
+                // if we're doing a series of fresh inserts,
+                // the file pos is already waiting at the end of the file
+                // for us
+                if( inDB->lastOp == opRead ||
+                    ftello( inDB->file ) != (off_t)filePosRec ) {
+                    
+                    // no seeking done yet
+                    // go to end of file
+                    if( fseeko( inDB->file, 0, SEEK_END ) ) {
+                        return -1;
+                        }
+                    // make sure it matches where we've documented that
+                    // the record should go
+                    if( ftello( inDB->file ) != (off_t)filePosRec ) {
+                        return -1;
+                        }
+                    }
+                
+
+                
+                int numWritten = 
+                    fwrite( inKey, inDB->keySize, 1, inDB->file );
+                inDB->lastOp = opWrite;
+                
+                if( numWritten != 1 ) {
+                    return -1;
+                    }
+                }
+                
+            // else already seeked and read key of non-empty record
+            // ready to write value
+
+            // still need to seek here after reading before writing
+            // according to fopen docs
+            fseeko( inDB->file, 0, SEEK_CUR );
+            
+            int numWritten = fwrite( inOutValue, inDB->valueSize, 1, 
+                                     inDB->file );
+            inDB->lastOp = opWrite;
+    
+            if( numWritten != 1 ) {
+                return -1;
+                }
+            
+            // successful put    
+            return 0;
+            }
+        else {
+            // we don't need to seek here
+            // we know (!emptyRec), so we already seeked and
+            // read the key above
+            // ready to read value now
+                
+            int numRead = fread( inOutValue, inDB->valueSize, 1, 
+                                 inDB->file );
+            inDB->lastOp = opRead;
+            
+            if( numRead != 1 ) {
+                return -1;
+                }
+            return 0;
+            }
+        }
+    
+    // rec full but didn't match
+    return 2;
+    }
+
 
-        inDB->hashTableSizeB ++;
 
 
-        BucketIterator oldIter = { oldBucket, 0 };
-        BucketIterator newIter = { newBucket, 0 };
+
+// Consider getting/putting from all records in inBucket
+//
+// Only fingerprint matches are examined (reading their keys from the
+// data file), followed by the first empty slot, if any.
+//
+// return values same as LINEARDB3_considerFingerprintBucket
+static int LINEARDB3_considerBucket( LINEARDB3 *inDB,
+                                     const void *inKey,
+                                     void *inOutValue,
+                                     uint32_t inFingerprint,
+                                     char inPut,
+                                     char inIgnoreDataFile,
+                                     FingerprintBucket *inBucket ) {
+    int firstEmpty;
+    uint32_t candidates = 
+        getBucketCandidates( inBucket, inFingerprint, &firstEmpty );
+    
+    while( candidates != 0 ) {
+        int i = lowestBitIndex( candidates );
+        candidates &= candidates - 1;
         
+        int result = LINEARDB3_considerFingerprintBucket(
+            inDB, inKey, inOutValue,
+            inFingerprint,
+            inPut, inIgnoreDataFile,
+            inBucket, 
+            i );
+        
+        if( result < 2 ) {
+            return result;
+            }
+        // 2 means record didn't match, keep going
+        }
+    
+    if( firstEmpty < RECORDS_PER_BUCKET ) {
+        // insert here, or not found
+        return LINEARDB3_considerFingerprintBucket(
+            inDB, inKey, inOutValue,
+            inFingerprint,
+            inPut, inIgnoreDataFile,
+            inBucket, 
+            firstEmpty );
+        }
+    
+    return 2;
+    }
 
-        // re-hash all cells at old split point, all the way down any
-        // overflow chain that's there
+
+
+
+
+int LINEARDB3_getOrPut( LINEARDB3 *inDB, const void *inKey, void *inOutValue,
+                        char inPut, char inIgnoreDataFile ) {
+
+    uint32_t fingerprint;
+
+    uint64_t binNumber = getBinNumber( inDB, inKey, &fingerprint );
+
+    
+    unsigned int overflowDepth = 0;
+
+    FingerprintBucket *thisBucket = getBucket( inDB->hashTable, binNumber );
+
+
+    char skipToOverflow = false;
+
+    if( inPut && inIgnoreDataFile ) {
+        skipToOverflow = true;
+        }
+    
+    if( !skipToOverflow || thisBucket->overflowIndex == 0 ) {
+
+        int result = LINEARDB3_considerBucket(
+            inDB, inKey, inOutValue,
+            fingerprint,
+            inPut, inIgnoreDataFile,
+            thisBucket );
         
-        FingerprintBucket *nextOldBucket = oldBucket;
+        if( result < 2 ) {
+            return result;
+            }
+        // 2 means no record matched, keep going
+        }
+
+    
+    uint32_t thisBucketIndex = 0;
+    
+    while( thisBucket->overflowIndex > 0 ) {
+        // consider overflow
+        overflowDepth++;
+
+        if( overflowDepth > inDB->maxOverflowDepth ) {
+            inDB->maxOverflowDepth = overflowDepth;
+            }
         
-        while( nextOldBucket != NULL ) {
-            // make a working copy 
-            FingerprintBucket tempBucket;
-            memcpy( &tempBucket, nextOldBucket, sizeof( FingerprintBucket ) );
-            
-            // clear the real bucket to make room for new inserts
-            // this clears the overflow index as well
-            memset( nextOldBucket, 0, sizeof( FingerprintBucket ) );
+        
+        thisBucketIndex = thisBucket->overflowIndex;
+        
+        thisBucket = getBucket( inDB->overflowBuckets, thisBucketIndex );
+
+        if( !skipToOverflow || thisBucket->overflowIndex == 0 ) {
+
+            int result = LINEARDB3_considerBucket(
+                inDB, inKey, inOutValue,
+                fingerprint,
+                inPut, inIgnoreDataFile,
+                thisBucket );
+        
+            if( result < 2 ) {
+                return result;
+                }
+            // 2 means no record matched, keep going
+            }
+        }
+
+    
+    if( inPut && 
+        thisBucket->overflowIndex == 0 ) {
             
+        // reached end of overflow chain without finding place to put value
+        
+        // need to make a new overflow bucket
 
-            for( int r=0; r<RECORDS_PER_BUCKET; r++ ) {
-                uint32_t fingerprint = tempBucket.fingerprints[ r ];
-                
-                if( fingerprint == 0 ) {
-                    // stop at first empty spot hit
-                    // remaining records empty too
-                    break;
-                    }
-                uint32_t fileIndex = tempBucket.fileIndex[ r ];
-                
-                uint64_t newBinNum = getBinNumber( inDB, fingerprint );
-                
-                BucketIterator *insertIterator;
-                
-                if( newBinNum == oldBucketIndex ) {
-                    insertIterator = &oldIter;
-                    }
-                else if( newBinNum == newBucketIndex ) {
-                    insertIterator = &newIter;
+        overflowDepth++;
+
+        if( overflowDepth > inDB->maxOverflowDepth ) {
+            inDB->maxOverflowDepth = overflowDepth;
+            }
+        
+
+        thisBucket->overflowIndex = 
+            getFirstEmptyBucketIndex( inDB->overflowBuckets );
+
+        FingerprintBucket *newBucket = getBucket( inDB->overflowBuckets,
+                                                  thisBucket->overflowIndex );
+        newBucket->fingerprints[0] = fingerprint;
+
+        // will go at end of file
+        newBucket->fileIndex[0] = inDB->numRecords;
+        
+        
+        inDB->numRecords++;
+        
+        if( ! inIgnoreDataFile ) {
+
+            uint64_t filePosRec = 
+                LINEARDB3_HEADER_SIZE +
+                (uint64_t)newBucket->fileIndex[0] * 
+                inDB->recordSizeBytes;
+
+            if( inDB->mapData != NULL ) {
+                return appendMappedRecord( inDB, filePosRec,
+                                           inKey, inOutValue );
+                }
+            
+            // don't seek unless we have to
+            if( inDB->lastOp == opRead ||
+                ftello( inDB->file ) != (off_t)filePosRec ) {
+            
+                // go to end of file
+                if( fseeko( inDB->file, 0, SEEK_END ) ) {
+                    return -1;
                     }
-                else {
-                    // rehash doesn't hit either bucket?
-                    // should never happen
+            
+                // make sure it matches where we've documented that
+                // the record should go
+                if( ftello( inDB->file ) != (off_t)filePosRec ) {
                     return -1;
                     }
-                
-                insertIntoBucket( inDB, insertIterator, 
-                                  fingerprint, fileIndex );
                 }
             
-            if( tempBucket.overflowIndex != 0 ) {
-                // process next in overflow chain, reinserting those
-                // records next
-                nextOldBucket = getBucket( inDB->overflowBuckets, 
-                                           tempBucket.overflowIndex );
-                // we're going to clear it in next iteration of loop, 
-                // so report it as empty
-                markBucketEmpty( inDB->overflowBuckets,
-                                 tempBucket.overflowIndex );
-                }
-            else {
-                // end of chain
-                nextOldBucket = NULL;
+                
+            int numWritten = fwrite( inKey, inDB->keySize, 1, inDB->file );
+            inDB->lastOp = opWrite;
+
+            numWritten += fwrite( inOutValue, inDB->valueSize, 1, inDB->file );
+                
+            if( numWritten != 2 ) {
+                return -1;
                 }
+            return 0;
             }
+        
+
+        return 0;
+        }
+
+
+
+    // not found
+    return 1;
+    }
+
+
+
+int LINEARDB3_get( LINEARDB3 *inDB, const void *inKey, void *outValue ) {
+    return LINEARDB3_getOrPut( inDB, inKey, outValue, false, false );
+    }
+
+
+
+typedef struct {
+        uint32_t fileIndex;
+        int keyIndex;
+    } BatchCandidate;
+
+
+
+static int batchCandidateCompare( const void *inA, const void *inB ) {
+    uint32_t a = ( (const BatchCandidate*)inA )->fileIndex;
+    uint32_t b = ( (const BatchCandidate*)inB )->fileIndex;
+    
+    if( a < b ) {
+        return -1;
+        }
+    else if( a > b ) {
+        return 1;
+        }
+    return 0;
+    }
 
+
+
+// probes RAM table for every key, no file access
+// returns candidate list sorted by fileIndex, which must be destroyed
+// by caller
+static BatchCandidate *getBatchCandidates( LINEARDB3 *inDB, int inNumKeys,
+                                           const uint8_t *inKeys,
+                                           int *outNumCandidates ) {
+    
+    // usually one candidate per key, more on fingerprint collisions
+    int candidateSpace = inNumKeys + 16;
+    int numCandidates = 0;
+    BatchCandidate *candidates = new BatchCandidate[ candidateSpace ];
+    
+    for( int k=0; k<inNumKeys; k++ ) {
+        const uint8_t *key = &( inKeys[ k * inDB->keySize ] );
         
-        if( inDB->hashTableSizeB == inDB->hashTableSizeA * 2 ) {
-            // full round of expansion is done.
-            inDB->hashTableSizeA = inDB->hashTableSizeB;            
+        uint32_t fingerprint;
+        uint64_t binNumber = getBinNumber( inDB, key, &fingerprint );
+        
+        FingerprintBucket *thisBucket = 
+            getBucket( inDB->hashTable, binNumber );
+        
+        while( thisBucket != NULL ) {
+            int firstEmpty;
+            uint32_t bucketCandidates = 
+                getBucketCandidates( thisBucket, fingerprint, &firstEmpty );
+            
+            while( bucketCandidates != 0 ) {
+                int i = lowestBitIndex( bucketCandidates );
+                bucketCandidates &= bucketCandidates - 1;
+                
+                if( numCandidates == candidateSpace ) {
+                    BatchCandidate *oldCandidates = candidates;
+                    candidateSpace *= 2;
+                    candidates = new BatchCandidate[ candidateSpace ];
+                    memcpy( candidates, oldCandidates,
+                            numCandidates * sizeof( BatchCandidate ) );
+                    delete [] oldCandidates;
+                    }
+                candidates[ numCandidates ].fileIndex = 
+                    thisBucket->fileIndex[i];
+                candidates[ numCandidates ].keyIndex = k;
+                numCandidates++;
+                }
+            
+            // empty slot means rest of chain empty
+            if( firstEmpty < RECORDS_PER_BUCKET || 
+                thisBucket->overflowIndex == 0 ) {
+                thisBucket = NULL;
+                }
+            else {
+                thisBucket = getBucket( inDB->overflowBuckets, 
+                                        thisBucket->overflowIndex );
+                }
             }
         }
     
-    return 0;
+    qsort( candidates, numCandidates, sizeof( BatchCandidate ),
+           batchCandidateCompare );
+    
+    *outNumCandidates = numCandidates;
+    return candidates;
     }
 
 
 
-
-static uint64_t getBinNumberFromHash( LINEARDB3 *inDB, uint64_t inHashVal ) {
-
-    uint64_t binNumberA = inHashVal % (uint64_t)( inDB->hashTableSizeA );
-    
-    uint64_t binNumberB = binNumberA;
+// returns pointer to full record (key and value), either in mapped
+// file or in recordBuffer
+// returns NULL on I/O error
+static uint8_t *readBatchRecord( LINEARDB3 *inDB, uint64_t inFilePosRec ) {
+    if( inDB->mapData != NULL ) {
+        return &( inDB->mapData[ inFilePosRec ] );
+        }
     
-
-
-    unsigned int splitPoint = inDB->hashTableSizeB - inDB->hashTableSizeA;
+    // sorted order means we're usually already in the right
+    // place, or just skipping forward a bit
+    if( inDB->lastOp == opWrite || 
+        ftello( inDB->file ) != (off_t)inFilePosRec ) {
+        
+        if( fseeko( inDB->file, inFilePosRec, SEEK_SET ) ) {
+            return NULL;
+            }
+        }
     
+    int numRead = fread( inDB->recordBuffer, 
+                         inDB->recordSizeBytes, 1, inDB->file );
+    inDB->lastOp = opRead;
     
-    if( binNumberA < splitPoint ) {
-        // points before split can be mod'ed with double base table size
-
-        // binNumberB will always fit in hashTableSizeB, the expanded table
-        binNumberB = inHashVal % (uint64_t)( inDB->hashTableSizeA * 2 );
+    if( numRead != 1 ) {
+        return NULL;
         }
-    return binNumberB;
-    }
-
-
-
-static uint64_t getBinNumber( LINEARDB3 *inDB, uint32_t inFingerprint ) {
-    // fingerprint is such that it will always land in the same bin as
-    // full hash val
-    return getBinNumberFromHash( inDB, inFingerprint );
+    return inDB->recordBuffer;
     }
 
 
 
-static uint64_t getBinNumber( LINEARDB3 *inDB, const void *inKey,
-                              uint32_t *outFingerprint ) {
+int LINEARDB3_getBatch( LINEARDB3 *inDB, int inNumKeys,
+                        const void *inKeys, void *outValues,
+                        int *outResults ) {
+    
+    const uint8_t *keys = (const uint8_t*)inKeys;
+    uint8_t *values = (uint8_t*)outValues;
+    
+    for( int k=0; k<inNumKeys; k++ ) {
+        outResults[k] = 1;
+        }
+    
+    int numCandidates;
+    BatchCandidate *candidates = 
+        getBatchCandidates( inDB, inNumKeys, keys, &numCandidates );
     
-    uint64_t hashVal = LINEARDB3_hash( inKey, inDB->keySize );
-
-    *outFingerprint = hashVal % inDB->fingerprintMod;
-
-
 
-    if( *outFingerprint == 0 ) {
-        // forbid straight 0 as fingerprint value
-        // we use 0-fingerprints as not-present flags
-        // for the rare values that land on 0, we need to make sure
-        // main hash changes along with fingerprint
+    // now read candidates in file order
+    for( int c=0; c<numCandidates; c++ ) {
+        int k = candidates[c].keyIndex;
         
-        if( hashVal < UINT64_MAX ) {
-            hashVal++;
+        if( outResults[k] == 0 ) {
+            // already found through another candidate
+            continue;
             }
-        else {
-            hashVal--;
+        
+        uint64_t filePosRec = 
+            LINEARDB3_HEADER_SIZE +
+            (uint64_t)candidates[c].fileIndex * inDB->recordSizeBytes;
+        
+        uint8_t *record = readBatchRecord( inDB, filePosRec );
+        
+        if( record == NULL ) {
+            delete [] candidates;
+            return -1;
             }
         
-        *outFingerprint = hashVal % inDB->fingerprintMod;
+        if( keyComp( inDB->keySize, record, 
+                     &( keys[ k * inDB->keySize ] ) ) ) {
+            memcpy( &( values[ k * inDB->valueSize ] ),
+                    &( record[ inDB->keySize ] ), inDB->valueSize );
+            outResults[k] = 0;
+            }
         }
     
+    delete [] candidates;
     
-    return getBinNumberFromHash( inDB, hashVal );
+    return 0;
     }
 
 
 
-
-// Consider getting/putting from inBucket at inRecIndex
-//
-// returns 0 if handled and done
-// returns -1 on error
-// returns 1 if guaranteed not found
-// returns 2 if bucket full and not found 
-static int LINEARDB3_considerFingerprintBucket( LINEARDB3 *inDB, 
-                                                const void *inKey, 
-                                                void *inOutValue,
-                                                uint32_t inFingerprint,
-                                                char inPut, 
-                                                char inIgnoreDataFile,
-                                                FingerprintBucket *inBucket,
-                                                int inRecIndex ) {       
-    int i = inRecIndex;
+int LINEARDB3_putBatch( LINEARDB3 *inDB, int inNumKeys,
+                        const void *inKeys, const void *inValues ) {
     
-    uint32_t binFP = inBucket->fingerprints[ i ];
+    const uint8_t *keys = (const uint8_t*)inKeys;
+    const uint8_t *values = (const uint8_t*)inValues;
+    
+    char *written = new char[ inNumKeys ];
+    memset( written, false, inNumKeys );
+    
+    int numCandidates;
+    BatchCandidate *candidates = 
+        getBatchCandidates( inDB, inNumKeys, keys, &numCandidates );
+    
+    
+    // overwrite existing records in file order
+    for( int c=0; c<numCandidates; c++ ) {
+        int k = candidates[c].keyIndex;
         
-    char emptyRec = false;
+        if( written[k] ) {
+            continue;
+            }
         
-    if( binFP == 0 ) {
-        emptyRec = true;
-            
-        if( inPut ) {
-            // set fingerprint and file pos for insert
-            binFP = inFingerprint;
-            inBucket->fingerprints[ i ] = inFingerprint;
-                
-            // will go at end of file
-            inBucket->fileIndex[ i ] = inDB->numRecords;
-                
-
-            inDB->numRecords++;
-
-            if( inIgnoreDataFile ) {
-                // finished non-file insert
-                return 0;
-                }
+        uint64_t filePosRec = 
+            LINEARDB3_HEADER_SIZE +
+            (uint64_t)candidates[c].fileIndex * inDB->recordSizeBytes;
+        
+        uint8_t *record = readBatchRecord( inDB, filePosRec );
+        
+        if( record == NULL ) {
+            delete [] candidates;
+            delete [] written;
+            return -1;
             }
-        else {
-            return 1;
+        
+        if( ! keyComp( inDB->keySize, record, 
+                       &( keys[ k * inDB->keySize ] ) ) ) {
+            // fingerprint collision
+            continue;
             }
-        }
         
-    if( binFP == inFingerprint ) {
-        // hit
-
-        if( inIgnoreDataFile ) {
-            // treat any fingerprint match as a collision
-            // assume all unique data if we're ignoring the data file
-            return 2;
+        const uint8_t *value = &( values[ k * inDB->valueSize ] );
+        
+        if( inDB->mapData != NULL ) {
+            memcpy( &( record[ inDB->keySize ] ), value, inDB->valueSize );
             }
-            
-        uint64_t filePosRec = 
-            LINEARDB3_HEADER_SIZE +
-            inBucket->fileIndex[ i ] * 
-            inDB->recordSizeBytes;
-            
-        if( !emptyRec ) {
-            
-            // read key to make sure it actually matches
-            
-            // never seek unless we have to
-            if( inDB->lastOp == opWrite || 
-                ftello( inDB->file ) != (off_t)filePosRec ) {
-
-                if( fseeko( inDB->file, filePosRec, SEEK_SET ) ) {
-                    return -1;
-                    }
-                }
-            
-            int numRead = fread( inDB->recordBuffer, inDB->keySize, 1,
-                                 inDB->file );
-            inDB->lastOp = opRead;
-    
-            if( numRead != 1 ) {
+        else {
+            // skip back to value part of record we just read
+            if( fseeko( inDB->file, 
+                        filePosRec + inDB->keySize, SEEK_SET ) ) {
+                delete [] candidates;
+                delete [] written;
                 return -1;
                 }
-            if( ! keyComp( inDB->keySize, inDB->recordBuffer, inKey ) ) {
-                // false match on non-empty rec because of fingerprint
-                // collision
-                return 2;
-                }
-            }
-
-            
-        if( inPut ) {
-            if( emptyRec ) {
-
-                // don't seek unless we have to
-                // if we're doing a series of fresh inserts,
-                // the file pos is already waiting at the end of the file
-                // for us
-                if( inDB->lastOp == opRead ||
-                    ftello( inDB->file ) != (off_t)filePosRec ) {
-                    
-                    // no seeking done yet
-                    // go to end of file
-                    if( fseeko( inDB->file, 0, SEEK_END ) ) {
-                        return -1;
-                        }
-                    // make sure it matches where we've documented that
-                    // the record should go
-                    if( ftello( inDB->file ) != (off_t)filePosRec ) {
-                        return -1;
-                        }
-                    }
-                
-
-                
-                int numWritten = 
-                    fwrite( inKey, inDB->keySize, 1, inDB->file );
-                inDB->lastOp = opWrite;
-                
-                if( numWritten != 1 ) {
-                    return -1;
-                    }
-                }
-                
-            // else already seeked and read key of non-empty record
-            // ready to write value
-
-            // still need to seek here after reading before writing
-            // according to fopen docs
-            fseeko( inDB->file, 0, SEEK_CUR );
             
-            int numWritten = fwrite( inOutValue, inDB->valueSize, 1, 
-                                     inDB->file );
+            int numWritten = fwrite( value, inDB->valueSize, 1, inDB->file );
             inDB->lastOp = opWrite;
-    
+            
             if( numWritten != 1 ) {
+                delete [] candidates;
+                delete [] written;
                 return -1;
                 }
-            
-            // successful put    
-            return 0;
             }
-        else {
-            // we don't need to seek here
-            // we know (!emptyRec), so we already seeked and
-            // read the key above
-            // ready to read value now
-                
-            int numRead = fread( inOutValue, inDB->valueSize, 1, 
-                                 inDB->file );
-            inDB->lastOp = opRead;
-            
-            if( numRead != 1 ) {
-                return -1;
-                }
-            return 0;
+        written[k] = true;
+        }
+    
+    delete [] candidates;
+    
+    
+    // rest are new records, appended to end of file in batch order
+    for( int k=0; k<inNumKeys; k++ ) {
+        if( written[k] ) {
+            continue;
+            }
+        
+        int result = LINEARDB3_put( inDB, &( keys[ k * inDB->keySize ] ),
+                                    &( values[ k * inDB->valueSize ] ) );
+        if( result == -1 ) {
+            delete [] written;
+            return -1;
             }
         }
     
-    // rec full but didn't match
-    return 2;
+    delete [] written;
+    
+    return 0;
     }
 
 
 
+int LINEARDB3_put( LINEARDB3 *inDB, const void *inKey, const void *inValue ) {
+    int result = LINEARDB3_getOrPut( inDB, inKey, (void *)inValue, 
+                                     true, false );
 
+    if( result == -1 ) {
+        return result;
+        }
 
-int LINEARDB3_getOrPut( LINEARDB3 *inDB, const void *inKey, void *inOutValue,
-                        char inPut, char inIgnoreDataFile ) {
+    if( inDB->numRecords - inDB->numHoles > 
+        ( inDB->hashTableSizeB * RECORDS_PER_BUCKET ) * inDB->maxLoad ) {
+        
+        result = expandTable( inDB );
+        }
+    return result;
+    }
 
-    uint32_t fingerprint;
 
-    uint64_t binNumber = getBinNumber( inDB, inKey, &fingerprint );
 
+// checks whether record at inFileIndex has inKey
+// returns 1 if match, 0 if not, -1 on I/O error
+static int recordKeyMatches( LINEARDB3 *inDB, uint32_t inFileIndex,
+                             const void *inKey ) {
+    uint64_t filePosRec = 
+        LINEARDB3_HEADER_SIZE +
+        (uint64_t)inFileIndex * inDB->recordSizeBytes;
     
-    unsigned int overflowDepth = 0;
-
-    FingerprintBucket *thisBucket = getBucket( inDB->hashTable, binNumber );
-
-
-    char skipToOverflow = false;
-
-    if( inPut && inIgnoreDataFile ) {
-        skipToOverflow = true;
+    if( inDB->mapData != NULL ) {
+        return keyComp( inDB->keySize, 
+                        &( inDB->mapData[ filePosRec ] ), inKey );
         }
     
-    if( !skipToOverflow || thisBucket->overflowIndex == 0 )
-    for( int i=0; i<RECORDS_PER_BUCKET; i++ ) {
-
-        int result = LINEARDB3_considerFingerprintBucket(
-            inDB, inKey, inOutValue,
-            fingerprint,
-            inPut, inIgnoreDataFile,
-            thisBucket, 
-            i );
-        
-        if( result < 2 ) {
-            return result;
+    if( inDB->lastOp == opWrite || 
+        ftello( inDB->file ) != (off_t)filePosRec ) {
+        
+        if( fseeko( inDB->file, filePosRec, SEEK_SET ) ) {
+            return -1;
             }
-        // 2 means record didn't match, keep going
         }
+    
+    int numRead = fread( inDB->recordBuffer, inDB->keySize, 1, inDB->file );
+    inDB->lastOp = opRead;
+    
+    if( numRead != 1 ) {
+        return -1;
+        }
+    return keyComp( inDB->keySize, inDB->recordBuffer, inKey );
+    }
 
+
+
+int LINEARDB3_delete( LINEARDB3 *inDB, const void *inKey ) {
+    uint32_t fingerprint;
+    uint64_t binNumber = getBinNumber( inDB, inKey, &fingerprint );
     
+    FingerprintBucket *thisBucket = getBucket( inDB->hashTable, binNumber );
+    
+    // index of thisBucket in overflow area, or 0 for bucket in main table
     uint32_t thisBucketIndex = 0;
+    FingerprintBucket *prevBucket = NULL;
     
-    while( thisBucket->overflowIndex > 0 ) {
-        // consider overflow
-        overflowDepth++;
-
-        if( overflowDepth > inDB->maxOverflowDepth ) {
-            inDB->maxOverflowDepth = overflowDepth;
+    FingerprintBucket *foundBucket = NULL;
+    int foundSlot = -1;
+    
+    // last used slot in chain
+    FingerprintBucket *lastBucket = NULL;
+    FingerprintBucket *lastPrevBucket = NULL;
+    uint32_t lastBucketIndex = 0;
+    int lastSlot = -1;
+    
+    while( true ) {
+        int firstEmpty;
+        uint32_t candidates = 
+            getBucketCandidates( thisBucket, fingerprint, &firstEmpty );
+        
+        while( foundBucket == NULL && candidates != 0 ) {
+            int i = lowestBitIndex( candidates );
+            candidates &= candidates - 1;
+            
+            int match = 
+                recordKeyMatches( inDB, thisBucket->fileIndex[i], inKey );
+            
+            if( match == -1 ) {
+                return -1;
+                }
+            if( match ) {
+                foundBucket = thisBucket;
+                foundSlot = i;
+                }
             }
         
+        if( firstEmpty > 0 ) {
+            lastBucket = thisBucket;
+            lastPrevBucket = prevBucket;
+            lastBucketIndex = thisBucketIndex;
+            lastSlot = firstEmpty - 1;
+            }
         
-        thisBucketIndex = thisBucket->overflowIndex;
+        if( firstEmpty < RECORDS_PER_BUCKET || 
+            thisBucket->overflowIndex == 0 ) {
+            break;
+            }
         
+        prevBucket = thisBucket;
+        thisBucketIndex = thisBucket->overflowIndex;
         thisBucket = getBucket( inDB->overflowBuckets, thisBucketIndex );
-
-        if( !skipToOverflow || thisBucket->overflowIndex == 0 )
-        for( int i=0; i<RECORDS_PER_BUCKET; i++ ) {
-
-            int result = LINEARDB3_considerFingerprintBucket(
-                inDB, inKey, inOutValue,
-                fingerprint,
-                inPut, inIgnoreDataFile,
-                thisBucket, 
-                i );
-        
-            if( result < 2 ) {
-                return result;
-                }
-            // 2 means record didn't match, keep going
-            }
         }
-
     
-    if( inPut && 
-        thisBucket->overflowIndex == 0 ) {
-            
-        // reached end of overflow chain without finding place to put value
-        
-        // need to make a new overflow bucket
+    if( foundBucket == NULL ) {
+        return 1;
+        }
+    
+    uint32_t fileIndex = foundBucket->fileIndex[ foundSlot ];
+    
+    // instead of leaving a tombstone in the table, move the last
+    // record in the chain into this slot, so chain never has gaps and
+    // lookups don't get slower as records are deleted
+    foundBucket->fingerprints[ foundSlot ] = 
+        lastBucket->fingerprints[ lastSlot ];
+    foundBucket->fileIndex[ foundSlot ] = lastBucket->fileIndex[ lastSlot ];
+    
+    lastBucket->fingerprints[ lastSlot ] = 0;
+    lastBucket->fileIndex[ lastSlot ] = 0;
+    
+    if( lastSlot == 0 && lastPrevBucket != NULL ) {
+        // overflow bucket now empty, drop it from end of chain
+        lastPrevBucket->overflowIndex = 0;
+        markBucketEmpty( inDB->overflowBuckets, lastBucketIndex );
+        }
+    
+    
+    addHole( inDB, fileIndex );
+    
+    if( journalHole( inDB, fileIndex ) != 0 ) {
+        return -1;
+        }
+    
+    return 0;
+    }
 
-        overflowDepth++;
 
-        if( overflowDepth > inDB->maxOverflowDepth ) {
-            inDB->maxOverflowDepth = overflowDepth;
+
+// moves record in data file and points its table entry to new spot
+// returns 0 on success, -1 on failure
+static int moveRecord( LINEARDB3 *inDB, uint32_t inFromIndex, 
+                       uint32_t inToIndex ) {
+    
+    uint64_t fromPos = 
+        LINEARDB3_HEADER_SIZE + (uint64_t)inFromIndex * inDB->recordSizeBytes;
+    uint64_t toPos = 
+        LINEARDB3_HEADER_SIZE + (uint64_t)inToIndex * inDB->recordSizeBytes;
+    
+    uint8_t *record;
+    
+    if( inDB->mapData != NULL ) {
+        memcpy( &( inDB->mapData[ toPos ] ), &( inDB->mapData[ fromPos ] ),
+                inDB->recordSizeBytes );
+        record = &( inDB->mapData[ toPos ] );
+        }
+    else {
+        if( fseeko( inDB->file, fromPos, SEEK_SET ) ) {
+            return -1;
             }
+        int numRead = fread( inDB->recordBuffer, 
+                             inDB->recordSizeBytes, 1, inDB->file );
+        inDB->lastOp = opRead;
         
-
-        thisBucket->overflowIndex = 
-            getFirstEmptyBucketIndex( inDB->overflowBuckets );
-
-        FingerprintBucket *newBucket = getBucket( inDB->overflowBuckets,
-                                                  thisBucket->overflowIndex );
-        newBucket->fingerprints[0] = fingerprint;
-
-        // will go at end of file
-        newBucket->fileIndex[0] = inDB->numRecords;
+        if( numRead != 1 ) {
+            return -1;
+            }
         
+        if( fseeko( inDB->file, toPos, SEEK_SET ) ) {
+            return -1;
+            }
+        int numWritten = fwrite( inDB->recordBuffer, 
+                                 inDB->recordSizeBytes, 1, inDB->file );
+        inDB->lastOp = opWrite;
         
-        inDB->numRecords++;
+        if( numWritten != 1 ) {
+            return -1;
+            }
+        record = inDB->recordBuffer;
+        }
+    
+    
+    uint32_t fingerprint;
+    uint64_t binNumber = getBinNumber( inDB, record, &fingerprint );
+    
+    FingerprintBucket *thisBucket = getBucket( inDB->hashTable, binNumber );
+    
+    while( thisBucket != NULL ) {
+        int firstEmpty;
+        uint32_t candidates = 
+            getBucketCandidates( thisBucket, fingerprint, &firstEmpty );
         
-        if( ! inIgnoreDataFile ) {
-
-            uint64_t filePosRec = 
-                LINEARDB3_HEADER_SIZE +
-                newBucket->fileIndex[0] * 
-                inDB->recordSizeBytes;
-
-            // don't seek unless we have to
-            if( inDB->lastOp == opRead ||
-                ftello( inDB->file ) != (off_t)filePosRec ) {
-            
-                // go to end of file
-                if( fseeko( inDB->file, 0, SEEK_END ) ) {
-                    return -1;
-                    }
-            
-                // make sure it matches where we've documented that
-                // the record should go
-                if( ftello( inDB->file ) != (off_t)filePosRec ) {
-                    return -1;
-                    }
-                }
+        while( candidates != 0 ) {
+            int i = lowestBitIndex( candidates );
+            candidates &= candidates - 1;
             
-                
-            int numWritten = fwrite( inKey, inDB->keySize, 1, inDB->file );
-            inDB->lastOp = opWrite;
-
-            numWritten += fwrite( inOutValue, inDB->valueSize, 1, inDB->file );
-                
-            if( numWritten != 2 ) {
-                return -1;
+            if( thisBucket->fileIndex[i] == inFromIndex ) {
+                thisBucket->fileIndex[i] = inToIndex;
+                return 0;
                 }
-            return 0;
             }
         
-
-        return 0;
+        if( firstEmpty < RECORDS_PER_BUCKET || 
+            thisBucket->overflowIndex == 0 ) {
+            thisBucket = NULL;
+            }
+        else {
+            thisBucket = getBucket( inDB->overflowBuckets, 
+                                    thisBucket->overflowIndex );
+            }
         }
-
-
-
-    // not found
-    return 1;
-    }
-
-
-
-int LINEARDB3_get( LINEARDB3 *inDB, const void *inKey, void *outValue ) {
-    return LINEARDB3_getOrPut( inDB, inKey, outValue, false, false );
+    
+    // record in file not in table?
+    return -1;
     }
 
 
 
-int LINEARDB3_put( LINEARDB3 *inDB, const void *inKey, const void *inValue ) {
-    int result = LINEARDB3_getOrPut( inDB, inKey, (void *)inValue, 
-                                     true, false );
-
-    if( result == -1 ) {
-        return result;
+int LINEARDB3_compact( LINEARDB3 *inDB, int inMaxMoves ) {
+    if( inDB->numHoles == 0 ) {
+        return 0;
         }
-
-    if( inDB->numRecords > 
-        ( inDB->hashTableSizeB * RECORDS_PER_BUCKET ) * inDB->maxLoad ) {
+    
+    uint32_t newNumRecords = inDB->numRecords;
+    int numMoved = 0;
+    
+    // holes filled this time, for journal
+    uint32_t maxFilled = inDB->numHoles;
+    if( (uint32_t)inMaxMoves < maxFilled ) {
+        maxFilled = inMaxMoves;
+        }
+    uint32_t *filled = new uint32_t[ maxFilled + 1 ];
+    
+    while( inDB->numHoles > 0 ) {
+        uint32_t last = newNumRecords - 1;
         
-        result = expandTable( inDB );
+        if( isHole( inDB, last ) ) {
+            // hole at end, just drop it
+            removeHole( inDB, last );
+            newNumRecords--;
+            continue;
+            }
+        
+        if( numMoved >= inMaxMoves ) {
+            break;
+            }
+        
+        // there's a hole somewhere before last record
+        // skip stale stack entries to find it
+        uint32_t hole;
+        do {
+            inDB->holeStackSize--;
+            hole = inDB->holeStack[ inDB->holeStackSize ];
+            } while( ! isHole( inDB, hole ) );
+        
+        if( moveRecord( inDB, last, hole ) != 0 ) {
+            // put it back for next time
+            inDB->holeStackSize++;
+            delete [] filled;
+            return -1;
+            }
+        
+        removeHole( inDB, hole );
+        filled[ numMoved ] = hole;
+        newNumRecords--;
+        numMoved++;
         }
-    return result;
+    
+    if( newNumRecords == inDB->numRecords ) {
+        delete [] filled;
+        return numMoved;
+        }
+    
+    
+    // Order matters here for crash safety.
+    // Moved records must hit file before journal says that holes are
+    // filled.  Journal must say that records past newNumRecords are
+    // invalid before they are cut off, because the holes they were
+    // moved into are no longer listed as holes.
+    if( inDB->mapData == NULL ) {
+        fflush( inDB->file );
+        }
+    
+    int journalResult;
+    
+    if( inDB->holesFile != NULL ) {
+        journalResult = journalLimit( inDB, newNumRecords, numMoved, filled );
+        }
+    else {
+        // no journal to add to, write whole thing
+        journalResult = writeHolesFile( inDB, newNumRecords );
+        }
+    
+    delete [] filled;
+    
+    if( journalResult != 0 ) {
+        return -1;
+        }
+    
+    if( truncateDataFile( inDB, newNumRecords ) != 0 ) {
+        return -1;
+        }
+    
+    inDB->numRecords = newNumRecords;
+    
+    if( inDB->numHoles == 0 ) {
+        closeHolesFile( inDB );
+        remove( inDB->holesPath );
+        }
+    else {
+        // file is truncated now, so limit no longer needed
+        // (and would cut off records appended later)
+        if( journalLimit( inDB, LINEARDB3_HOLES_NO_LIMIT, 0, NULL ) != 0 ) {
+            return -1;
+            }
+        }
+    
+    return numMoved;
     }
 
 
@@ -1313,6 +3216,12 @@ int LINEARDB3_Iterator_next( LINEARDB3_Iterator *inDBi,
             return 0;
             }
 
+        if( isHole( db, inDBi->nextRecordIndex ) ) {
+            // deleted
+            inDBi->nextRecordIndex++;
+            continue;
+            }
+
 
         // fseek is needed here to make iterator safe to interleave
         // with other calls
@@ -1322,7 +3231,16 @@ int LINEARDB3_Iterator_next( LINEARDB3_Iterator *inDBi,
         
         uint64_t fileRecPos = 
             LINEARDB3_HEADER_SIZE + 
-            inDBi->nextRecordIndex * db->recordSizeBytes;
+            (uint64_t)inDBi->nextRecordIndex * db->recordSizeBytes;
+        
+        if( db->mapData != NULL ) {
+            memcpy( outKey, &( db->mapData[ fileRecPos ] ), db->keySize );
+            memcpy( outValue, &( db->mapData[ fileRecPos + db->keySize ] ),
+                    db->valueSize );
+            
+            inDBi->nextRecordIndex++;
+            return 1;
+            }
         
                     
         if( db->lastOp == opWrite ||
@@ -1365,7 +3283,7 @@ unsigned int LINEARDB3_getCurrentSize( LINEARDB3 *inDB ) {
 
 
 unsigned int LINEARDB3_getNumRecords( LINEARDB3 *inDB ) {
-    return inDB->numRecords;
+    return inDB->numRecords - inDB->numHoles;
     }
 
 
@@ -1381,3 +3299,104 @@ unsigned int LINEARDB3_getShrinkSize( LINEARDB3 *inDB,
 
     return minTableBuckets;
     }
+
+
+
+int LINEARDB3_Scanner_open( LINEARDB3_Scanner *inScanner,
+                            const char *inPath ) {
+    inScanner->holeMap = NULL;
+    inScanner->nextRecordIndex = 0;
+    inScanner->numRecords = 0;
+    
+    inScanner->file = fopen( inPath, "rb" );
+    
+    if( inScanner->file == NULL ) {
+        return -1;
+        }
+    
+    char magicBuffer[ 4 ];
+    uint32_t keySize, valueSize;
+    
+    int numRead = fread( magicBuffer, 3, 1, inScanner->file );
+    numRead += fread( &keySize, sizeof( uint32_t ), 1, inScanner->file );
+    numRead += fread( &valueSize, sizeof( uint32_t ), 1, inScanner->file );
+    
+    magicBuffer[3] = '\0';
+    
+    if( numRead != 3 || strcmp( magicBuffer, magicString ) != 0 ||
+        keySize == 0 || valueSize == 0 ||
+        fseeko( inScanner->file, 0, SEEK_END ) ) {
+        
+        fclose( inScanner->file );
+        return -1;
+        }
+    
+    inScanner->keySize = keySize;
+    inScanner->valueSize = valueSize;
+    
+    uint64_t fileSize = ftello( inScanner->file );
+    
+    // partial record at end ignored, same as open
+    uint64_t numRecords = 
+        ( fileSize - LINEARDB3_HEADER_SIZE ) / ( keySize + valueSize );
+    
+
+    char *holesPath = new char[ strlen( inPath ) + 7 ];
+    sprintf( holesPath, "%s.holes", inPath );
+    
+    // open would truncate to the same limit, and find the same holes
+    replayHolesFile( holesPath, &numRecords, &( inScanner->holeMap ) );
+    
+    delete [] holesPath;
+    
+    inScanner->numRecords = numRecords;
+    
+    if( fseeko( inScanner->file, LINEARDB3_HEADER_SIZE, SEEK_SET ) ) {
+        LINEARDB3_Scanner_close( inScanner );
+        return -1;
+        }
+    
+    return 0;
+    }
+
+
+
+int LINEARDB3_Scanner_next( LINEARDB3_Scanner *inScanner,
+                            void *outKey, void *outValue ) {
+    
+    while( inScanner->nextRecordIndex < inScanner->numRecords ) {
+        uint32_t i = inScanner->nextRecordIndex;
+        
+        inScanner->nextRecordIndex++;
+        
+        // records read in file order, so no seeking needed, even
+        // past holes
+        if( fread( outKey, inScanner->keySize, 1, inScanner->file ) != 1 ||
+            fread( outValue, inScanner->valueSize, 1, 
+                   inScanner->file ) != 1 ) {
+            return -1;
+            }
+        
+        if( inScanner->holeMap != NULL &&
+            ( inScanner->holeMap[ i / 8 ] >> ( i % 8 ) ) & 1 ) {
+            continue;
+            }
+        
+        return 1;
+        }
+    
+    return 0;
+    }
+
+
+
+void LINEARDB3_Scanner_close( LINEARDB3_Scanner *inScanner ) {
+    if( inScanner->file != NULL ) {
+        fclose( inScanner->file );
+        inScanner->file = NULL;
+        }
+    if( inScanner->holeMap != NULL ) {
+        delete [] inScanner->holeMap;
+        inScanner->holeMap = NULL;
+        }
+    }
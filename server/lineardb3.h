@@ -1,3 +1,6 @@
+#ifndef LINEARDB3_H_INCLUDED
+#define LINEARDB3_H_INCLUDED
+
 
 
 // some compilers require this to access UINT64_MAX
@@ -63,9 +66,14 @@ typedef struct {
         // load above this causes table to expand incrementally
         double maxLoad;
         
-        // number of inserted records in database
+        // number of records in data file, including holes
+        // left by deleted records
         uint32_t numRecords;
         
+        // number of deleted records in data file that haven't been
+        // filled by compaction yet (see LINEARDB3_compact)
+        uint32_t numHoles;
+        
 
         // for linear hashing table expansion
         // number of slots in base table
@@ -86,6 +94,15 @@ typedef struct {
         // for deciding when fseek is needed between reads and writes
         LastFileOp lastOp;
 
+        // start of memory-mapped file area, or NULL if this DB
+        // was not opened in mmap mode (see LINEARDB3_setUseMmap)
+        uint8_t *mapData;
+        
+        // size of mapped area in bytes
+        // this runs past the end of the file, so that appended records
+        // don't require a remap every time
+        uint64_t mapSize;
+
         // equal to the largest possible 32-bit table size, given
         // our current table size
         // used as mod for computing 32-bit hash fingerprints
@@ -105,6 +122,29 @@ typedef struct {
 
         LINEARDB3_PageManager *overflowBuckets;
         
+        // path of index file that the RAM hash table is saved to on close
+        // so it doesn't need to be rebuilt from data file on next open
+        char *indexPath;
+        
+        
+        // one bit per record in data file, set for holes
+        // NULL until first delete
+        uint8_t *holeMap;
+        uint32_t holeMapBytes;
+        
+        // holes waiting to be filled by compaction
+        // can also contain stale entries for holes that have already
+        // been filled or dropped off the end of the file.  The holeMap
+        // has the final word.
+        uint32_t *holeStack;
+        uint32_t holeStackSize;
+        uint32_t holeStackSpace;
+        
+        // journal of holes in data file, so that deleted records
+        // aren't brought back by a re-scan after a crash
+        // only exists while there are holes
+        char *holesPath;
+        FILE *holesFile;
 
     } LINEARDB3;
 
@@ -139,6 +179,67 @@ void LINEARDB3_setMaxLoad( double inMaxLoad );
 
 
 
+/**
+ * Set whether subsequent calls to LINEARDB3_open memory-map the data file.
+ *
+ * Defaults to false.
+ *
+ * In mmap mode, gets and in-place puts are plain memory copies into the
+ * mapped file, with no fseek/fread/fwrite syscalls.  New records are
+ * still appended to the file with a single write call, and the mapping
+ * is grown in large steps as the file grows.
+ *
+ * The on-disk format is the same in both modes, so a file written in one
+ * mode can be opened in the other.
+ *
+ * Ignored on platforms that don't support mmap.  If mapping a file
+ * fails, that DB falls back to stdio.
+ */
+void LINEARDB3_setUseMmap( char inUseMmap );
+
+
+/**
+ * True if mmap mode is on for DBs opened from here on, which is never
+ * the case on platforms that don't support it.
+ */
+char LINEARDB3_getUseMmap();
+
+
+
+
+#define LINEARDB3_PROBE_AUTO 0
+#define LINEARDB3_PROBE_SCALAR 1
+#define LINEARDB3_PROBE_SSE2 2
+#define LINEARDB3_PROBE_AVX2 3
+
+
+/**
+ * Set how the fingerprints in a bucket are checked during lookups.
+ *
+ * The SIMD modes compare all fingerprints in a bucket with one
+ * compare-and-movemask, and then only visit the slots that match.
+ * Keys are only read from the data file for those slots.
+ *
+ * Defaults to LINEARDB3_PROBE_AUTO, which picks the widest mode the CPU
+ * supports the first time a database is opened.  A requested mode that
+ * this CPU or build doesn't support falls back to the next narrower one.
+ *
+ * Takes effect immediately for all open databases.  Results are the
+ * same in every mode.
+ *
+ * @return the mode actually in use, never LINEARDB3_PROBE_AUTO
+ */
+int LINEARDB3_setProbeMode( int inMode );
+
+
+
+/**
+ * Get printable name of probe mode, for logging.
+ */
+const char *LINEARDB3_getProbeModeName( int inMode );
+
+
+
 
 /**
  * Open database
@@ -173,12 +274,51 @@ int LINEARDB3_open(
 /**
  * Close database
  *
+ * Any holes left by deleted records are compacted first.
+ *
+ * Also saves the RAM hash table to an index file next to the data file
+ * (path + ".index").  On the next open, if that index still matches
+ * the data file, it is loaded directly instead of re-scanning every
+ * record in the data file.  A missing, stale, or damaged index just
+ * falls back to the re-scan.
+ *
+ * The index file is removed on open, so it is only ever present after
+ * a clean close.
+ *
  * @param db Database struct
  */
 void LINEARDB3_close( LINEARDB3 *inDB );
 
 
 
+/**
+ * Remove saved index file and holes journal that go with data file at
+ * inPath, if any.
+ *
+ * Call this after deleting or replacing a closed data file, so a
+ * leftover index or journal isn't kept around.  A stale index is never
+ * used anyway, but it wastes disk space, and a stale journal would
+ * hide records in a new data file at the same path.
+ */
+void LINEARDB3_removeIndex( const char *inPath );
+
+
+
+/**
+ * Flush modified records to disk without closing database.
+ *
+ * In mmap mode, this schedules a write-back of all dirty mapped pages
+ * (msync) without waiting for it to finish.  Otherwise, it flushes the
+ * stdio buffer.
+ *
+ * LINEARDB3_close always does a full, blocking flush.
+ *
+ * @param db Database struct
+ */
+void LINEARDB3_sync( LINEARDB3 *inDB );
+
+
+
 /**
  * Get an entry
  *
@@ -191,6 +331,29 @@ int LINEARDB3_get( LINEARDB3 *inDB, const void *inKey, void *outValue );
 
 
 
+/**
+ * Get a batch of entries at once
+ *
+ * All keys are hashed and probed in the RAM table first, then the
+ * matching records are read from the data file in file-offset order,
+ * which turns a set of random reads into a mostly-sequential sweep.
+ *
+ * @param db Database struct
+ * @param inNumKeys number of keys in batch
+ * @param inKeys inNumKeys keys packed back-to-back (key_size bytes each)
+ * @param outValues buffer with room for inNumKeys values packed
+ *   back-to-back (value_size bytes each).  Slots for keys that are not
+ *   found are left untouched.
+ * @param outResults array of inNumKeys results, filled with 0 for each
+ *   key that is found, or 1 if not found
+ * @return -1 on I/O error, 0 on success
+ */
+int LINEARDB3_getBatch( LINEARDB3 *inDB, int inNumKeys,
+                        const void *inKeys, void *outValues,
+                        int *outResults );
+
+
+
 /**
  * Put an entry (overwriting it if it already exists)
  *
@@ -206,6 +369,66 @@ int LINEARDB3_put( LINEARDB3 *inDB, const void *inKey, const void *inValue );
 
 
 
+/**
+ * Put a batch of entries at once (overwriting any that already exist)
+ *
+ * Entries that already exist are overwritten in file-offset order,
+ * then new entries are appended to the end of the file in batch order.
+ *
+ * Keys in a batch should be distinct.  If a key is repeated, which of
+ * its values ends up in the database is undefined.
+ *
+ * @param db Database struct
+ * @param inNumKeys number of keys in batch
+ * @param inKeys inNumKeys keys packed back-to-back (key_size bytes each)
+ * @param inValues inNumKeys values packed back-to-back (value_size bytes
+ *   each)
+ * @return -1 on I/O error, 0 on success
+ */
+int LINEARDB3_putBatch( LINEARDB3 *inDB, int inNumKeys,
+                        const void *inKeys, const void *inValues );
+
+
+
+/**
+ * Delete an entry
+ *
+ * The entry is removed from the RAM hash table right away, and its
+ * record in the data file becomes a hole.  Holes are skipped by
+ * iterators, and filled in by LINEARDB3_compact.
+ *
+ * Holes are listed in a journal file next to the data file
+ * (path + ".holes"), so that a re-scan of the data file after a crash
+ * doesn't bring deleted records back.
+ *
+ * @param db Database struct
+ * @param key Key (key_size bytes)
+ * @return -1 on I/O error, 0 on success, 1 on not found
+ */
+int LINEARDB3_delete( LINEARDB3 *inDB, const void *inKey );
+
+
+
+/**
+ * Fill holes left by deleted records, and shrink the data file.
+ *
+ * Records from the end of the data file are moved into holes, and the
+ * file is truncated behind them.  Does at most inMaxMoves record moves,
+ * so it can be called a little bit at a time on a running database.
+ *
+ * LINEARDB3_close compacts fully.
+ *
+ * An iterator in progress may miss records that are moved while it
+ * is running.
+ *
+ * @param db Database struct
+ * @param inMaxMoves maximum number of records to move
+ * @return -1 on I/O error, or number of records moved
+ */
+int LINEARDB3_compact( LINEARDB3 *inDB, int inMaxMoves );
+
+
+
 /**
  * Cursor used for iterating over all entries in database
  */
@@ -266,7 +489,7 @@ unsigned int LINEARDB3_getCurrentSize( LINEARDB3 *inDB );
 
 
 /**
- * Number of records that have been inserted in the database.
+ * Number of records in the database, not counting deleted ones.
  */
 unsigned int LINEARDB3_getNumRecords( LINEARDB3 *inDB );
 
@@ -293,3 +516,52 @@ uint32_t LINEARDB3_getPerfectTableSize( double inMaxLoad,
  */
 unsigned int LINEARDB3_getShrinkSize( LINEARDB3 *inDB,
                                       unsigned int inNewNumRecords );
+
+
+
+/**
+ * Read-only walk through the records of a data file, without opening
+ * it as a database.
+ *
+ * The file must not be written to while it is being scanned (it must
+ * be closed, or frozen for a snapshot).  Records in the holes journal
+ * are skipped, the same way they would be if the file were opened.
+ *
+ * Safe to use from any thread, since it shares nothing with open
+ * databases.
+ */
+typedef struct {
+        FILE *file;
+
+        unsigned int keySize;
+        unsigned int valueSize;
+
+        uint32_t numRecords;
+        uint32_t nextRecordIndex;
+
+        // one bit per record, set for holes
+        // NULL if no holes journal
+        uint8_t *holeMap;
+    } LINEARDB3_Scanner;
+
+
+
+/**
+ * @return 0 on success, -1 if file can't be read or isn't a data file
+ */
+int LINEARDB3_Scanner_open( LINEARDB3_Scanner *inScanner,
+                            const char *inPath );
+
+
+/**
+ * @return 0 if there are no more records, -1 on error,
+ *         1 if outKey and outValue have been filled
+ */
+int LINEARDB3_Scanner_next( LINEARDB3_Scanner *inScanner,
+                            void *outKey, void *outValue );
+
+
+void LINEARDB3_Scanner_close( LINEARDB3_Scanner *inScanner );
+
+
+#endif
@@ -0,0 +1,233 @@
+// Microbenchmark for LINEARDB3 get/put throughput with each bucket
+// probe mode (see LINEARDB3_setProbeMode)
+//
+// Runs at the table loads we actually use:  0.5 is the LINEARDB3 default,
+// and 0.8 is what map.cpp sets for the map databases.
+//
+// Keys and values are shaped like map.db records (16-byte x,y,s,b key,
+// 4-byte value).
+
+
+#include "lineardb3.h"
+
+#include "dbCommon.h"
+#include "minorGems/system/Time.h"
+
+#include "minorGems/util/random/CustomRandomSource.h"
+
+#include <stdio.h>
+
+
+#define INSERT_SIZE 2000000
+
+#define LOOKUP_SIZE 2000000
+
+
+// mmap mode takes fseek/fread/fwrite out of the picture, so the numbers
+// show the cost of the RAM table probes
+#define USE_MMAP
+
+
+static double maxLoads[] = { 0.5, 0.8 };
+
+static int probeModes[] = { LINEARDB3_PROBE_SCALAR,
+                            LINEARDB3_PROBE_SSE2,
+                            LINEARDB3_PROBE_AVX2 };
+
+
+
+static const char *dbFileName = "benchTest.db";
+
+static unsigned char key[16];
+static unsigned char value[4];
+
+
+
+// same key sequence every time for a given seed
+// slot 0..3 at random spot in 4096x4096 area
+static void makeKey( CustomRandomSource *inSource, int inSlotOffset ) {
+    int x = inSource->getRandomBoundedInt( -2048, 2047 );
+    int y = inSource->getRandomBoundedInt( -2048, 2047 );
+    int s = inSource->getRandomBoundedInt( 0, 3 );
+
+    intQuadToKey( x, y, s + inSlotOffset, 0, key );
+    }
+
+
+
+static void printRate( const char *inLabel, int inCount, double inSeconds ) {
+    printf( "    %-16s %8.3f Mops/sec  (%d in %.3f sec)\n",
+            inLabel, inCount / inSeconds / 1000000.0, inCount, inSeconds );
+    }
+
+
+
+// returns checksum of values read, or -1 on failure
+static int runBench( double inMaxLoad ) {
+    LINEARDB3_setMaxLoad( inMaxLoad );
+
+    remove( dbFileName );
+    LINEARDB3_removeIndex( dbFileName );
+
+    LINEARDB3 db;
+
+    int error = LINEARDB3_open( &db, dbFileName, 0, 80000, 16, 4 );
+
+    if( error ) {
+        printf( "Failed to open %s\n", dbFileName );
+        return -1;
+        }
+
+
+    double startTime = Time::getCurrentTime();
+
+    CustomRandomSource putSource( 1731 );
+
+    for( int i=0; i<INSERT_SIZE; i++ ) {
+        makeKey( &putSource, 0 );
+        intToValue( i, value );
+
+        if( LINEARDB3_put( &db, key, value ) != 0 ) {
+            printf( "LINEARDB3_put failed\n" );
+            LINEARDB3_close( &db );
+            return -1;
+            }
+        }
+
+    printRate( "insert", INSERT_SIZE, Time::getCurrentTime() - startTime );
+
+
+
+    startTime = Time::getCurrentTime();
+
+    // same sequence, now overwriting existing records
+    CustomRandomSource overwriteSource( 1731 );
+
+    for( int i=0; i<INSERT_SIZE; i++ ) {
+        makeKey( &overwriteSource, 0 );
+        intToValue( INSERT_SIZE - i, value );
+
+        if( LINEARDB3_put( &db, key, value ) != 0 ) {
+            printf( "LINEARDB3_put failed\n" );
+            LINEARDB3_close( &db );
+            return -1;
+            }
+        }
+
+    printRate( "overwrite", INSERT_SIZE, Time::getCurrentTime() - startTime );
+
+
+
+    unsigned int checksum = 0;
+    int numHits = 0;
+
+    startTime = Time::getCurrentTime();
+
+    // different seed, but same key space, so most of these hit
+    CustomRandomSource hitSource( 9941 );
+
+    for( int i=0; i<LOOKUP_SIZE; i++ ) {
+        makeKey( &hitSource, 0 );
+
+        int result = LINEARDB3_get( &db, key, value );
+
+        if( result == 0 ) {
+            checksum += valueToInt( value );
+            numHits++;
+            }
+        else if( result == -1 ) {
+            printf( "LINEARDB3_get failed\n" );
+            LINEARDB3_close( &db );
+            return -1;
+            }
+        }
+
+    printRate( "get (mixed)", LOOKUP_SIZE,
+               Time::getCurrentTime() - startTime );
+    printf( "      (%d/%d hits)\n", numHits, LOOKUP_SIZE );
+
+
+    startTime = Time::getCurrentTime();
+
+    // slots never used in inserts above, so these all miss
+    CustomRandomSource missSource( 9941 );
+
+    for( int i=0; i<LOOKUP_SIZE; i++ ) {
+        makeKey( &missSource, 100 );
+
+        int result = LINEARDB3_get( &db, key, value );
+
+        if( result == 0 ) {
+            checksum += valueToInt( value );
+            }
+        else if( result == -1 ) {
+            printf( "LINEARDB3_get failed\n" );
+            LINEARDB3_close( &db );
+            return -1;
+            }
+        }
+
+    printRate( "get (miss)", LOOKUP_SIZE,
+               Time::getCurrentTime() - startTime );
+
+
+    printf( "    %u records, table size %u, max overflow depth %u\n",
+            db.numRecords, db.hashTableSizeB, db.maxOverflowDepth );
+
+    LINEARDB3_close( &db );
+
+    remove( dbFileName );
+    LINEARDB3_removeIndex( dbFileName );
+
+    return (int)( checksum & 0x7FFFFFFF );
+    }
+
+
+
+int main() {
+    #ifdef USE_MMAP
+    LINEARDB3_setUseMmap( true );
+    #endif
+
+    printf( "LINEARDB3 benchmark, %d inserts, %d lookups\n",
+            INSERT_SIZE, LOOKUP_SIZE );
+
+    int numLoads = sizeof( maxLoads ) / sizeof( double );
+    int numModes = sizeof( probeModes ) / sizeof( int );
+
+    for( int l=0; l<numLoads; l++ ) {
+
+        int firstChecksum = -1;
+
+        for( int m=0; m<numModes; m++ ) {
+
+            int mode = LINEARDB3_setProbeMode( probeModes[m] );
+
+            if( mode != probeModes[m] ) {
+                printf( "\nProbe mode %s not supported here, skipping\n",
+                        LINEARDB3_getProbeModeName( probeModes[m] ) );
+                continue;
+                }
+
+            printf( "\nmaxLoad %.2f, probe mode %s:\n", maxLoads[l],
+                    LINEARDB3_getProbeModeName( mode ) );
+
+            int checksum = runBench( maxLoads[l] );
+
+            if( checksum == -1 ) {
+                return 1;
+                }
+
+            if( firstChecksum == -1 ) {
+                firstChecksum = checksum;
+                }
+            else if( checksum != firstChecksum ) {
+                printf( "Checksum mismatch between probe modes "
+                        "(%d vs %d)\n", checksum, firstChecksum );
+                return 1;
+                }
+            }
+        }
+
+    return 0;
+    }
@@ -1,5 +1,5 @@
 #include "map.h"
-#include "HashTable.h"
+#include "FlatHashTable.h"
 #include "monument.h"
 #include "arcReport.h"
  
@@ -26,6 +26,9 @@
 //#include "stackdb.h"
 //#include "lineardb.h"
 #include "lineardb3.h"
+#include "dbWriteBuffer.h"
+#include "regiondb.h"
+#include "naturalMapFile.h"
  
 #include "minorGems/util/crc32.h"
  
@@ -101,6 +104,10 @@
 #define DB_getShrinkSize  LINEARDB3_getShrinkSize
 #define DB_getCurrentSize  LINEARDB3_getCurrentSize
 #define DB_getNumRecords LINEARDB3_getNumRecords
+#define DB_sync LINEARDB3_sync
+#define DB_getBatch LINEARDB3_getBatch
+#define DB_delete LINEARDB3_delete
+#define DB_compact LINEARDB3_compact
  
  
  
@@ -367,6 +374,114 @@ static char metaDBOpen = false;
 
 static DB persistentMapDB;
 static char persistentMapDBOpen = false;
+
+
+// one record per map cell, holding the cell's own object, contained count,
+// decay ETA, floor, and floor decay ETA (see TileRecord in dbCommon.h)
+// in place of those records in map.db, mapTime.db, floor.db, and 
+// floorTime.db
+// cells are grouped into region pages, so a chunk's cells are read
+// together (see regiondb.h)
+// only used if useMapTileDB setting is on
+static REGIONDB tileDB;
+static char tileDBOpen = false;
+static char useMapTileDB = false;
+
+
+// true if DB files are memory-mapped (mmapMapDB setting)
+static char mmapMapDB = false;
+
+// how often dirty pages of memory-mapped DBs are scheduled for write-back
+static double mmapCheckpointSeconds = 60;
+static double lastMmapCheckpointTime = 0;
+
+
+// write-back buffers in front of db, timeDB, and floorDB
+// (tileDB's page cache does its own write-back)
+// NULL if buffering is off (mapWriteBufferMaxRecords setting of 0)
+static DBWriteBuffer *dbWriteBuffer = NULL;
+static DBWriteBuffer *timeDBWriteBuffer = NULL;
+static DBWriteBuffer *floorDBWriteBuffer = NULL;
+
+// the rest are only buffered while a backup snapshot is being copied
+// (see beginMapSnapshot), NULL otherwise
+static DBWriteBuffer *floorTimeDBWriteBuffer = NULL;
+static DBWriteBuffer *biomeDBWriteBuffer = NULL;
+static DBWriteBuffer *eveDBWriteBuffer = NULL;
+static DBWriteBuffer *lookTimeDBWriteBuffer = NULL;
+
+// pending writes are pushed to the DBs this often, or sooner
+// if a buffer fills up
+static int mapWriteBufferMaxRecords = 8192;
+static double mapWriteBufferFlushSeconds = 0.5;
+static double lastMapWriteBufferFlushTime = 0;
+
+// records are moved into file space freed by deletes a few at a time,
+// along with each write buffer flush
+static int dbCompactRecordsPerStep = 200;
+
+// tileDB regions not looked at for this long are compressed into
+// mapTile.db.cold, 0 to never compress
+static int mapColdRegionSeconds = 0;
+
+// tileDB pages checked for coldness along with each write buffer flush
+#define COLD_REGION_PAGES_PER_STEP 16
+
+
+
+// true while the DB files are frozen for a backup snapshot
+static char mapSnapshotActive = false;
+
+// number of beginMapSnapshot calls not yet ended
+static int numMapSnapshotHolders = 0;
+
+
+
+// reads from buffered DBs go through this, so that writes
+// still pending in a write-back buffer are seen
+static int mapDBGet( DB *inDB, DBWriteBuffer *inBuffer,
+                     unsigned char *inKey, unsigned char *outValue ) {
+    if( inBuffer != NULL ) {
+        int pending = inBuffer->get( inKey, outValue );
+        if( pending != -1 ) {
+            // 1 means pending delete, which reads as not found
+            return pending;
+            }
+        }
+    return DB_get( inDB, inKey, outValue );
+    }
+ 
+ 
+ 
+static void mapDBPut( DB *inDB, DBWriteBuffer *inBuffer,
+                      unsigned char *inKey, unsigned char *inValue ) {
+    if( inBuffer != NULL ) {
+        if( inBuffer->put( inKey, inValue ) == -1 ) {
+            AppLog::error( "Error flushing map DB write buffer" );
+            }
+        }
+    else {
+        DB_put( inDB, inKey, inValue );
+        }
+    }
+ 
+ 
+ 
+// only for records where not-found reads back the same as the value
+// being cleared (0 times, 0 floors, 0 contained counts)
+static void mapDBDelete( DB *inDB, DBWriteBuffer *inBuffer,
+                         unsigned char *inKey ) {
+    if( inBuffer != NULL ) {
+        if( inBuffer->remove( inKey ) == -1 ) {
+            AppLog::error( "Error flushing map DB write buffer" );
+            }
+        }
+    else {
+        DB_delete( inDB, inKey );
+        }
+    }
+
+
     
 extern void restorePasswordRecord( int x, int y, unsigned char* passwordChars );
 extern void temp_passwordRecordTransfer();
@@ -427,25 +542,35 @@ typedef struct LiveDecayRecord {
         // Can be NULL if we don't care about the transition
         // associated with this decay (for contained item decay, for example)
         TransRecord *applicableTrans;
+        
+        // true for floor decay, which shares slot 0 with main object
+        char floor;
  
     } LiveDecayRecord;
  
  
  
 #include "minorGems/util/MinPriorityQueue.h"
+#include "TimingWheel.h"
  
-static MinPriorityQueue<LiveDecayRecord> liveDecayQueue;
+static TimingWheel<LiveDecayRecord> liveDecayQueue;
+
+
+// handle of each record in liveDecayQueue, so re-tracking replaces it
+// indexed as x, y, slot * 2 + floor, subCont
+static FlatHashTable<int> liveDecayQueueHandles( 1024, -1 );
  
  
 // for quick lookup of existing records in liveDecayQueue
 // store the eta time here
 // before storing a new record in the queue, we can check this hash
 // table to see whether it already exists
-static HashTable<timeSec_t> liveDecayRecordPresentHashTable( 1024 );
+static FlatHashTable<timeSec_t> liveDecayRecordPresentHashTable( 1024 );
  
 // times in seconds that a tracked live decay map cell or slot
 // was last looked at
-static HashTable<timeSec_t> liveDecayRecordLastLookTimeHashTable( 1024 );
+static FlatHashTable<timeSec_t>
+liveDecayRecordLastLookTimeHashTable( 1024 );
  
  
 typedef struct ContRecord {
@@ -460,7 +585,7 @@ static ContRecord defaultContRecord = { 0, 0 };
 // this allows us to update last look times without getting contained count
 // from map
 // indexed as x, y, 0, 0
-static HashTable<ContRecord>
+static FlatHashTable<ContRecord>
 liveDecayRecordLastLookTimeMaxContainedHashTable( 1024, defaultContRecord );
  
  
@@ -483,7 +608,7 @@ typedef struct MovementRecord {
  
 // clock time in fractional seconds of destination ETA
 // indexed as x, y, 0
-static HashTable<double> liveMovementEtaTimes( 1024, 0 );
+static FlatHashTable<double> liveMovementEtaTimes( 1024, 0 );
  
 static MinPriorityQueue<MovementRecord> liveMovements;
  
@@ -614,7 +739,7 @@ static int biomeDBGet( int inX, int inY,
     // look for changes to default in database
     intPairToKey( inX, inY, key );
    
-    int result = DB_get( &biomeDB, key, value );
+    int result = mapDBGet( &biomeDB, biomeDBWriteBuffer, key, value );
    
     if( result == 0 ) {
         // found
@@ -666,7 +791,7 @@ static void biomeDBPut( int inX, int inY, int inValue, int inSecondPlace,
         }
    
  
-    DB_put( &biomeDB, key, value );
+    mapDBPut( &biomeDB, biomeDBWriteBuffer, key, value );
     }
    
  
@@ -682,7 +807,7 @@ static int eveDBGet( const char *inEmail, int *outX, int *outY,
  
     emailToKey( inEmail, key );
    
-    int result = DB_get( &eveDB, key, value );
+    int result = mapDBGet( &eveDB, eveDBWriteBuffer, key, value );
    
     if( result == 0 ) {
         // found
@@ -711,7 +836,7 @@ static void eveDBPut( const char *inEmail, int inX, int inY, int inRadius ) {
     intToValue( inRadius, &( value[8] ) );
            
    
-    DB_put( &eveDB, key, value );
+    mapDBPut( &eveDB, eveDBWriteBuffer, key, value );
     }
  
  
@@ -859,99 +984,36 @@ static void biomePutCached( int inX, int inY, int inBiome, int inSecondPlace,
  
  
  
-// new code, topographic rings
-static int computeMapBiomeIndex( int inX, int inY,
-                                 int *outSecondPlaceIndex = NULL,
-                                 double *outSecondPlaceGap = NULL ) {
-       
-    int secondPlace = -1;
-   
-    double secondPlaceGap = 0;
- 
- 
-    int pickedBiome = biomeGetCached( inX, inY, &secondPlace, &secondPlaceGap );
-       
-    if( pickedBiome != -2 ) {
-        // hit cached
- 
-        if( outSecondPlaceIndex != NULL ) {
-            *outSecondPlaceIndex = secondPlace;
-            }
-        if( outSecondPlaceGap != NULL ) {
-            *outSecondPlaceGap = secondPlaceGap;
-            }
-   
-        return pickedBiome;
-        }
- 
-    // else cache miss
-    pickedBiome = -1;
-    
-    
-    // River generation
-    float roughness = 0.2; // 0.55
-    float scale = 8 * 4.8; // 12.8
-    float offset = 16; // 16
-    float width = 0.008; // 0.015
-    float boundaryThreshold = 0.40; // 0.40
-    float maskThreshold = 0.45; // 0.45
-    float maskScale = scale; // 12.8
-    
-    setXYRandomSeed( biomeRandSeedB, biomeRandSeedA );
+// River generation
+static const float riverRoughness = 0.2; // 0.55
+static const float riverScale = 8 * 4.8; // 12.8
+static const float riverOffset = 16; // 16
+static const float riverWidth = 0.008; // 0.015
+static const float riverBoundaryThreshold = 0.40; // 0.40
+static const float riverMaskThreshold = 0.45; // 0.45
+static const float riverMaskScale = riverScale; // 12.8
 
-    // First layer of noise, to get some curved contour lines
-    double randVal2 = 
-        ( getXYFractal2( inX, inY,
-                        roughness,
-                        scale ) );
-    
-    if( abs(randVal2 - boundaryThreshold) < width ) {
-        
-        // An attempt not to have a fixed offset
-        // which leads to what described below 
-        // float xOffset = 16 * sin( 2 * PI * inX / 1000 );
-        // float yOffset = 16 * cos( 2 * PI * inY / 1000 );
-        
-        float xOffset = offset;
-        float yOffset = offset;
-        
-        // Second layer of noise, to mask over the first layer
-        // so the curves do not go around to form rings/loops.
-        // Currently this layer is just an offset of the first layer
-        // this way the curves won't be too short.
-        // But this causes the curves to mostly go in one diagonal direction
-        randVal2 = 
-            ( getXYFractal2( inX + xOffset, inY + yOffset,
-                            roughness,
-                            maskScale ) );
+
+
+// noise values that biome generation needs at one cell
+// region generator computes these a row at a time
+typedef struct BiomeNoise {
+        // first river layer
+        double river;
         
-        if( randVal2 > maskThreshold ) {
-            pickedBiome = 0; // Ocean
-            
-            setXYRandomSeed( 63533 );
-            
-            // Thrid layer of noise, to get another set of curved contour lines
-            // These are the river crossings
-            double randVal3 = 
-                ( getXYFractal2( inX, inY,
-                                roughness,
-                                scale ) );
-            if( abs(randVal3 - boundaryThreshold) < width / 2 ) pickedBiome = 1; // ShallowRiver
-            
-            return pickedBiome;
-            }
-        }
- 
- 
-    // try topographical altitude mapping
+        double topo;
 
-    setXYRandomSeed( biomeRandSeedA, biomeRandSeedB );
+        // one per special biome, or NULL to compute them here
+        double *special;
+    } BiomeNoise;
 
-    double randVal = 
-        ( getXYFractal( inX, inY,
-                        0.55,
-                        0.83332 + 0.08333 * numBiomes ) );
- 
+
+
+// picks biome ring from topographic noise value
+static int getTopoBiomeIndex( double inTopoValue ) {
+    
+    double randVal = inTopoValue;
+    
     // push into range 0..1, based on sampled min/max values
     randVal -= 0.099668;
     randVal *= 1.268963;
@@ -1006,7 +1068,7 @@ static int computeMapBiomeIndex( int inX, int inY,
    
     float i = randVal * biomeTotalWeight;
    
-    pickedBiome = 0;
+    int pickedBiome = 0;
     while( pickedBiome < numBiomes &&
            i > biomeCumuWeights[pickedBiome] ) {
         pickedBiome++;
@@ -1017,6 +1079,108 @@ static int computeMapBiomeIndex( int inX, int inY,
    
  
  
+    return pickedBiome;
+    }
+
+
+
+// new code, topographic rings
+// inNoise can be NULL to compute noise values here
+//
+// outCacheable set to false for cells that should not be cached
+// (rivers)
+//
+// safe to call from any thread, only reads biome settings
+static int computeBiomeIndex( int inX, int inY, BiomeNoise *inNoise,
+                              int *outSecondPlaceIndex,
+                              double *outSecondPlaceGap,
+                              char *outCacheable ) {
+       
+    int secondPlace = -1;
+   
+    double secondPlaceGap = 0;
+    
+    *outSecondPlaceIndex = secondPlace;
+    *outSecondPlaceGap = secondPlaceGap;
+    *outCacheable = true;
+    
+    int pickedBiome = -1;
+    
+    
+    // First layer of noise, to get some curved contour lines
+    double randVal2;
+    
+    if( inNoise != NULL ) {
+        randVal2 = inNoise->river;
+        }
+    else {
+        setXYRandomSeed( biomeRandSeedB, biomeRandSeedA );
+        
+        randVal2 = 
+            ( getXYFractal2( inX, inY,
+                             riverRoughness,
+                             riverScale ) );
+        }
+    
+    if( abs(randVal2 - riverBoundaryThreshold) < riverWidth ) {
+        
+        // An attempt not to have a fixed offset
+        // which leads to what described below 
+        // float xOffset = 16 * sin( 2 * PI * inX / 1000 );
+        // float yOffset = 16 * cos( 2 * PI * inY / 1000 );
+        
+        float xOffset = riverOffset;
+        float yOffset = riverOffset;
+        
+        // Second layer of noise, to mask over the first layer
+        // so the curves do not go around to form rings/loops.
+        // Currently this layer is just an offset of the first layer
+        // this way the curves won't be too short.
+        // But this causes the curves to mostly go in one diagonal direction
+        setXYRandomSeed( biomeRandSeedB, biomeRandSeedA );
+        
+        randVal2 = 
+            ( getXYFractal2( inX + xOffset, inY + yOffset,
+                            riverRoughness,
+                            riverMaskScale ) );
+        
+        if( randVal2 > riverMaskThreshold ) {
+            pickedBiome = 0; // Ocean
+            
+            setXYRandomSeed( 63533 );
+            
+            // Thrid layer of noise, to get another set of curved contour lines
+            // These are the river crossings
+            double randVal3 = 
+                ( getXYFractal2( inX, inY,
+                                riverRoughness,
+                                riverScale ) );
+            if( abs(randVal3 - riverBoundaryThreshold) < riverWidth / 2 ) pickedBiome = 1; // ShallowRiver
+            
+            *outCacheable = false;
+            return pickedBiome;
+            }
+        }
+ 
+ 
+    // try topographical altitude mapping
+    double randVal;
+    
+    if( inNoise != NULL ) {
+        randVal = inNoise->topo;
+        }
+    else {
+        setXYRandomSeed( biomeRandSeedA, biomeRandSeedB );
+
+        randVal = 
+            ( getXYFractal( inX, inY,
+                            0.55,
+                            0.83332 + 0.08333 * numBiomes ) );
+        }
+    
+    pickedBiome = getTopoBiomeIndex( randVal );
+ 
+ 
     if( pickedBiome >= regularBiomeLimit && numSpecialBiomes > 0 ) {
         // special case:  on a peak, place a special biome here
  
@@ -1030,14 +1194,21 @@ static int computeMapBiomeIndex( int inX, int inY,
         for( int i=regularBiomeLimit; i<numBiomes; i++ ) {
             int biome = biomes[i];
         
-            setXYRandomSeed( biome * 263 + biomeRandSeedA + 38475,
-                             biomeRandSeedB );
-
-            double randVal = getXYFractal(  inX,
-                                            inY,
-                                            0.55,
-                                            2.4999 +
-                                            0.2499 * numSpecialBiomes );
+            double randVal;
+            
+            if( inNoise != NULL && inNoise->special != NULL ) {
+                randVal = inNoise->special[ i - regularBiomeLimit ];
+                }
+            else {
+                setXYRandomSeed( biome * 263 + biomeRandSeedA + 38475,
+                                 biomeRandSeedB );
+
+                randVal = getXYFractal(  inX,
+                                         inY,
+                                         0.55,
+                                         2.4999 +
+                                         0.2499 * numSpecialBiomes );
+                }
        
             if( randVal > maxValue ) {
                 if( maxValue != -10 ) {
@@ -1074,9 +1245,84 @@ static int computeMapBiomeIndex( int inX, int inY,
    
  
  
-    biomePutCached( inX, inY, pickedBiome, secondPlace, secondPlaceGap );
-   
+    *outSecondPlaceIndex = secondPlace;
+    *outSecondPlaceGap = secondPlaceGap;
+    
+    return pickedBiome;
+    }
+
+
+
+static int mapRegionBiomeLookup( int inX, int inY,
+                                 int *outSecondPlaceIndex,
+                                 double *outSecondPlaceGap );
+
+
+
+// pre-baked natural map, see bakeNaturalMap
+static NATURALMAP naturalMap;
+static char naturalMapOpen = false;
+
+
+// returns false if cell isn't baked, or if biome DB might change it
+static char naturalMapLookup( int inX, int inY, NATURALMAP_Cell *outCell ) {
+    if( ! naturalMapOpen ) {
+        return false;
+        }
+    
+    if( anyBiomesInDB &&
+        inX >= minBiomeXLoc && inX <= maxBiomeXLoc &&
+        inY >= minBiomeYLoc && inY <= maxBiomeYLoc ) {
+        return false;
+        }
+    
+    return NATURALMAP_get( &naturalMap, inX, inY, outCell );
+    }
+
+
+
+static int computeMapBiomeIndex( int inX, int inY,
+                                 int *outSecondPlaceIndex = NULL,
+                                 double *outSecondPlaceGap = NULL ) {
+       
+    int secondPlace = -1;
    
+    double secondPlaceGap = 0;
+    
+    
+    int pickedBiome = -2;
+    
+    NATURALMAP_Cell bakedCell;
+    
+    if( naturalMapLookup( inX, inY, &bakedCell ) ) {
+        pickedBiome = bakedCell.biome;
+        secondPlace = bakedCell.secondPlace;
+        secondPlaceGap = bakedCell.secondPlaceGap;
+        }
+    
+    if( pickedBiome == -2 ) {
+        pickedBiome = mapRegionBiomeLookup( inX, inY, 
+                                            &secondPlace, &secondPlaceGap );
+        }
+    
+    if( pickedBiome == -2 ) {
+        pickedBiome = 
+            biomeGetCached( inX, inY, &secondPlace, &secondPlaceGap );
+        }
+    
+    if( pickedBiome == -2 ) {
+        // else cache miss
+        char cacheable;
+        
+        pickedBiome = computeBiomeIndex( inX, inY, NULL,
+                                         &secondPlace, &secondPlaceGap,
+                                         &cacheable );
+        if( cacheable ) {
+            biomePutCached( inX, inY, pickedBiome, 
+                            secondPlace, secondPlaceGap );
+            }
+        }
+    
     if( outSecondPlaceIndex != NULL ) {
         *outSecondPlaceIndex = secondPlace;
         }
@@ -1348,33 +1594,54 @@ static void mapCacheInsert( int inX, int inY, int inID,
    
  
 static int getBaseMapCallCount = 0;
- 
- 
-static int getBaseMap( int inX, int inY, char *outGridPlacement = NULL ) {
-   
+
+
+
+// noise values that base map generation needs at one cell
+// region generator computes these a row at a time
+typedef struct BaseMapNoise {
+        double density;
+        
+        // checked against density
+        double presence;
+        
+        // picks one of biome's objects
+        double pick;
+        
+        // one per natural object in cell's biome, or NULL to compute
+        // them here
+        double *specialObject;
+    } BaseMapNoise;
+
+
+
+// procedurally-generated base map at a spot, given its biome
+// inNoise can be NULL to compute noise values here
+//
+// outDensityPassed set to true if an object from biome was considered
+// here (the cases where getBaseMap has always updated lastCheckedBiome)
+//
+// safe to call from any thread, only reads map settings
+static int computeBaseMap( int inX, int inY, 
+                           int inPickedBiome, int inSecondPlace,
+                           BaseMapNoise *inNoise,
+                           char *outGridPlacement,
+                           char *outDensityPassed ) {
+    
+    *outGridPlacement = false;
+    *outDensityPassed = false;
+    
     if( inX > xLimit || inX < -xLimit ||
         inY > yLimit || inY < -yLimit ) {
    
         return edgeObjectID;
         }
-   
-    int cachedID = mapCacheLookup( inX, inY, outGridPlacement );
-   
-    if( cachedID != -1 ) {
-        return cachedID;
-        }
-   
-    getBaseMapCallCount ++;
- 
- 
-    if( outGridPlacement != NULL ) {
-        *outGridPlacement = false;
-        }
-   
- 
+    
+    int pickedBiome = inPickedBiome;
+    int secondPlace = inSecondPlace;
+    
+
     // see if any of our grids apply
-    setXYRandomSeed( 9753 );
- 
     for( int g=0; g < gridPlacements.size(); g++ ) {
         MapGridPlacement *gp = gridPlacements.getElement( g );
  
@@ -1400,35 +1667,29 @@ static int getBaseMap( int inX, int inY, char *outGridPlacement = NULL ) {
             // hits this grid
  
             // make sure this biome is on the list for this object
-            int secondPlace;
-            double secondPlaceGap;
-       
-            int pickedBiome = getMapBiomeIndex( inX, inY, &secondPlace,
-                                                &secondPlaceGap );
-       
             if( pickedBiome == -1 ) {
-                mapCacheInsert( inX, inY, 0 );
                 return 0;
                 }
  
             if( gp->permittedBiomes.getElementIndex( pickedBiome ) != -1 ) {
-                mapCacheInsert( inX, inY, gp->id, true );
- 
-                if( outGridPlacement != NULL ) {
-                    *outGridPlacement = true;
-                    }
+                *outGridPlacement = true;
                 return gp->id;
                 }
             }    
         }
              
  
- 
-    setXYRandomSeed( 5379 );
-   
     // first step:  save rest of work if density tells us that
     // nothing is here anyway
-    double density = getXYFractal( inX, inY, 0.1, 0.25 );
+    double density;
+    
+    if( inNoise != NULL ) {
+        density = inNoise->density;
+        }
+    else {
+        setXYRandomSeed( 5379 );
+        density = getXYFractal( inX, inY, 0.1, 0.25 );
+        }
    
     // correction
     density = sigmoid( density, 0.1 );
@@ -1438,343 +1699,1448 @@ static int getBaseMap( int inX, int inY, char *outGridPlacement = NULL ) {
     // good for zoom in to map for teaser
     //density = 1;
    
-    setXYRandomSeed( 9877 );
-    int secondPlace;
-    double secondPlaceGap;
-    
-    int pickedBiome = getMapBiomeIndex( inX, inY, &secondPlace,
-                                                &secondPlaceGap );
-                                                
     if(biomes[pickedBiome] == 7 || biomes[pickedBiome] == 9){
         density = 1;
         
     }
-    setXYRandomSeed( 9877 );
-    if( getXYRandom( inX, inY ) < density ) {
- 
- 
- 
- 
-        // next step, pick top two biomes
-        int secondPlace;
-        double secondPlaceGap;
-       
-        int pickedBiome = getMapBiomeIndex( inX, inY, &secondPlace,
-                                            &secondPlaceGap );
-       
-        if( pickedBiome == -1 ) {
-            mapCacheInsert( inX, inY, 0 );
-            return 0;
-            }
-       
-        // only override if it's not already set
-        // if it's already set, then we're calling getBaseMap for neighboring
-        // map cells (wide, tall, moving objects, etc.)
-        // getBaseMap is always called for our cell in question first
-        // before examining neighboring cells if needed
-        if( lastCheckedBiome == -1 ) {    
-            lastCheckedBiome = biomes[pickedBiome];
-            lastCheckedBiomeX = inX;
-            lastCheckedBiomeY = inY;
-            }
+    
+    double presence;
+    
+    if( inNoise != NULL ) {
+        presence = inNoise->presence;
+        }
+    else {
+        setXYRandomSeed( 9877 );
+        presence = getXYRandom( inX, inY );
+        }
+    
+    if( presence >= density ) {
+        // nothing here
+        return 0;
+        }
+
        
- 
+    if( pickedBiome == -1 ) {
+        return 0;
+        }
+    
+    *outDensityPassed = true;
        
-        // randomly let objects from second place biome peek through
+
+    // randomly let objects from second place biome peek through
        
-        // if gap is 0, this should happen 50 percent of the time
+    // if gap is 0, this should happen 50 percent of the time
  
-        // if gap is 1.0, it should never happen
+    // if gap is 1.0, it should never happen
  
-        // larger values make second place less likely
-        //double secondPlaceReduction = 10.0;
+    // larger values make second place less likely
+    //double secondPlaceReduction = 10.0;
 
-        //printf( "Second place gap = %f, random(%d,%d)=%f\n", secondPlaceGap,
-        //        inX, inY, getXYRandom( 2087 + inX, 793 + inY ) );
+    //printf( "Second place gap = %f, random(%d,%d)=%f\n", secondPlaceGap,
+    //        inX, inY, getXYRandom( 2087 + inX, 793 + inY ) );
        
-        setXYRandomSeed( 348763 );
- 
-        int numObjects = naturalMapIDs[pickedBiome].size();
+    int numObjects = naturalMapIDs[pickedBiome].size();
  
-        if( numObjects == 0  ) {
-            mapCacheInsert( inX, inY, 0 );
-            return 0;
-            }
+    if( numObjects == 0  ) {
+        return 0;
+        }
  
    
  
-        // something present here
+    // something present here
  
        
-        // special object in this region is 10x more common than it
-        // would be otherwise
+    // special object in this region is 10x more common than it
+    // would be otherwise
  
  
-        int specialObjectIndex = -1;
-        double maxValue = -DBL_MAX;
+    int specialObjectIndex = -1;
+    double maxValue = -DBL_MAX;
        
  
-        for( int i=0; i<numObjects; i++ ) {
+    for( int i=0; i<numObjects; i++ ) {
         
+        double randVal;
+        
+        if( inNoise != NULL && inNoise->specialObject != NULL ) {
+            randVal = inNoise->specialObject[i];
+            }
+        else {
             setXYRandomSeed( 793 * i + 123 );
        
-            double randVal = getXYFractal(  inX,
-                                            inY,
-                                            0.3,
-                                            0.15 + 0.016666 * numObjects );
+            randVal = getXYFractal(  inX,
+                                     inY,
+                                     0.3,
+                                     0.15 + 0.016666 * numObjects );
+            }
  
-            if( randVal > maxValue ) {
-                maxValue = randVal;
-                specialObjectIndex = i;
+        if( randVal > maxValue ) {
+            maxValue = randVal;
+            specialObjectIndex = i;
             }
-            
         }
  
  
-        float oldSpecialChance =
-            naturalMapChances[pickedBiome].getElementDirect(
-                specialObjectIndex );
+    // weights with special object boosted
+    // (computed on the side, instead of changing naturalMapChances,
+    //  so that other threads can read it at the same time)
+    float oldSpecialChance =
+        naturalMapChances[pickedBiome].getElementDirect(
+            specialObjectIndex );
        
-        float newSpecialChance = oldSpecialChance * 10;
+    float newSpecialChance = oldSpecialChance * 10;
         
-        *( naturalMapChances[pickedBiome].getElement( specialObjectIndex ) )
-            = newSpecialChance;
-
-        float oldTotalChanceWeight = totalChanceWeight[pickedBiome];
+    float boostedTotalChanceWeight = totalChanceWeight[pickedBiome];
        
-        totalChanceWeight[pickedBiome] -= oldSpecialChance;
-        totalChanceWeight[pickedBiome] += newSpecialChance;
+    boostedTotalChanceWeight -= oldSpecialChance;
+    boostedTotalChanceWeight += newSpecialChance;
 
-        // pick one of our natural objects at random
+    // pick one of our natural objects at random
  
-        // pick value between 0 and total weight
-       
+    // pick value between 0 and total weight
+    double pick;
+    
+    if( inNoise != NULL ) {
+        pick = inNoise->pick;
+        }
+    else {
         setXYRandomSeed( 4593873 );
+        pick = getXYRandom( inX, inY );
+        }
        
-        double randValue =
-            totalChanceWeight[pickedBiome] * getXYRandom( inX, inY );
+    double randValue = boostedTotalChanceWeight * pick;
  
-        // walk through objects, summing weights, until one crosses threshold
-        int i = 0;
-        float weightSum = 0;        
+    // walk through objects, summing weights, until one crosses threshold
+    int i = 0;
+    float weightSum = 0;        
        
-        while( weightSum < randValue && i < numObjects ) {
-            
-            weightSum += naturalMapChances[pickedBiome].getElementDirect( i );            
-            i++;
+    while( weightSum < randValue && i < numObjects ) {
+        
+        if( i == specialObjectIndex ) {
+            weightSum += newSpecialChance;
             }
-        i--;
-       
+        else {
+            weightSum += 
+                naturalMapChances[pickedBiome].getElementDirect( i );
+            }
+        i++;
+        }
+    i--;
  
-        // restore chance of special object
-        *( naturalMapChances[pickedBiome].getElement( specialObjectIndex ) )
-            = oldSpecialChance;
  
-        totalChanceWeight[pickedBiome] = oldTotalChanceWeight;
-
-            if( i >= 0 ) {
-                int returnID = naturalMapIDs[pickedBiome].getElementDirect( i );
+    if( i >= 0 ) {
+        int returnID = naturalMapIDs[pickedBiome].getElementDirect( i );
                
-                if( pickedBiome == secondPlace ) {
-                    // object peeking through from second place biome
-     
-                    // make sure it's not a moving object (animal)
-                    // those are locked to their target biome only
-                    TransRecord *t = getPTrans( -1, returnID );
-                    if( t != NULL && t->move != 0 ) {
-                        // put empty tile there instead
-                        returnID = 0;
-                        }
-                    }
+        if( pickedBiome == secondPlace ) {
+            // object peeking through from second place biome
      
-                mapCacheInsert( inX, inY, returnID );
-                return returnID;
+            // make sure it's not a moving object (animal)
+            // those are locked to their target biome only
+            TransRecord *t = getTrans( -1, returnID );
+            if( t != NULL && t->move != 0 ) {
+                // put empty tile there instead
+                returnID = 0;
                 }
-            else {
-                mapCacheInsert( inX, inY, 0 );
-                return 0;
-            }
-            
-    } else {
-        if( biomes[pickedBiome] != 7 && biomes[pickedBiome] != 9 ){
-            mapCacheInsert( inX, inY, 0 );
-            return 0;
             }
+        
+        return returnID;
         }
     
+    return 0;
     }
+
+
+
+static int mapRegionLookup( int inX, int inY, char *outGridPlacement );
+
+static void requestMapRegion( int inX, int inY );
+
  
- 
- 
- 
- 
- 
- 
- 
- 
- 
- 
-#include "minorGems/graphics/Image.h"
-#include "minorGems/graphics/converters/TGAImageConverter.h"
-#include "minorGems/io/file/File.h"
-#include "minorGems/system/Time.h"
- 
-void outputMapImage() {
-   
-    // output a chunk of the map as an image
- 
-    int w =  708;
-    int h = 708;
-   
-    Image objIm( w, h, 3, true );
-    Image biomeIm( w, h, 3, true );
+static int getBaseMap( int inX, int inY, char *outGridPlacement = NULL ) {
    
-    SimpleVector<Color> objColors;
-    SimpleVector<Color> biomeColors;
-    SimpleVector<int> objCounts;
+    if( inX > xLimit || inX < -xLimit ||
+        inY > yLimit || inY < -yLimit ) {
    
-    int totalCounts = 0;
- 
-    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
-        Color *c = Color::makeColorFromHSV( (float)i / allNaturalMapIDs.size(),
-                                            1, 1 );
-        objColors.push_back( *c );
- 
-        objCounts.push_back( 0 );
-       
-        delete c;
-        }
- 
-    SimpleVector<int> biomeCounts;
-    int totalBiomeCount = 0;
- 
-    for( int j=0; j<numBiomes; j++ ) {        
-        biomeCounts.push_back( 0 );
-       
-        Color *c;
-       
-        int biomeNumber = biomes[j];
- 
-        switch( biomeNumber ) {
-            case 0:
-                c = new Color( 0, 0.8, .1 );
-                break;
-            case 1:
-                c = new Color( 0.4, 0.2, 0.7 );
-                break;
-            case 2:
-                c = new Color( 1, .8, 0 );
-                break;
-            case 3:
-                c = new Color( 0.6, 0.6, 0.6 );
-                break;
-            case 4:
-                c = new Color( 1, 1, 1 );
-                break;
-            case 5:
-                c = new Color( 0.7, 0.6, 0.0 );
-                break;
-            case 6:
-                c = new Color( 0.0, 0.5, 0.0 );
-                break;
-            default:
-                c = Color::makeColorFromHSV( (float)j / numBiomes, 1, 1 );
-            }
-       
-        biomeColors.push_back( *c );
-        delete c;
+        return edgeObjectID;
         }
-   
-    /*
-    double startTime = Time::getCurrentTime();
-    for( int y = 0; y<h; y++ ) {
-       
-        for( int x = 0; x<w; x++ ) {
-            // discard id output
-            // just invoking this to time it
-            getBaseMap( x, y );
+    
+    NATURALMAP_Cell bakedCell;
+    
+    if( naturalMapLookup( inX, inY, &bakedCell ) ) {
+        if( outGridPlacement != NULL ) {
+            *outGridPlacement = bakedCell.gridPlacement;
             }
+        return bakedCell.baseMap;
         }
    
-    printf( "Generating %d map spots took %f sec\n",
-            w * h, Time::getCurrentTime() - startTime );
-    //exit(0);
+    int cachedID = mapCacheLookup( inX, inY, outGridPlacement );
    
-    */
- 
- 
-    for( int y = 0; y<h; y++ ) {
-       
-        for( int x = 0; x<w; x++ ) {
- 
-            /*
-            // raw rand output and correlation test
-            uint32_t xHit = xxTweakedHash2D( x, y );
-            uint32_t yHit = xxTweakedHash2D( x+1, y+1 );
-            //uint32_t xHit = getXYRandom_test( x, y );
-            //uint32_t yHit = getXYRandom_test( x+1, y );
-           
-            xHit = xHit % w;
-            yHit = yHit % h;
-           
-            double val = xxTweakedHash2D( x, y ) * oneOverIntMax;
-           
-            Color c = im.getColor( yHit * w + xHit );
-            c.r += 0.1;
-            c.g += 0.1;
-            c.b += 0.1;
-           
-            im.setColor( yHit * w + xHit, c );
-             
-            c.r = val;
-            c.g = val;
-            c.b = val;
-           
-            //im.setColor( y * w + x, c );
-            */
-           
-           
-            int id = getBaseMap( x - h/2, - ( y - h/2 ) );
-           
-            int biomeInd = getMapBiomeIndex( x - h/2, -( y - h/2 ) );
- 
-            if( id > 0 ) {
-                for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
-                    if( allNaturalMapIDs.getElementDirect(i) == id ) {
-                        objIm.setColor( y * w + x,
-                                     objColors.getElementDirect( i ) );
-                       
-                        (* objCounts.getElement( i ) )++;
-                        totalCounts++;
-                        break;
-                        }
-                    }
-                }
-           
-            biomeIm.setColor( y * w + x,
-                              biomeColors.getElementDirect( biomeInd ) );
-            ( *( biomeCounts.getElement( biomeInd ) ) ) ++;
-            totalBiomeCount++;
-            }
+    if( cachedID != -1 ) {
+        return cachedID;
         }
- 
- 
-    const char *biomeNames[] = { "Grass ",
-                                 "Swamp ",
-                                 "Yellow",
-                                 "Gray  ",
-                                 "Snow  ",
-                                 "Desert",
-                                 "Jungle",
-                                 "DeepWater",
-                                 "Flower",
-                                 "ShallowWater"
-                                 };    
- 
-    for( int j=0; j<numBiomes; j++ ) {
-        const char *name = "unknwn";
-       
-        if( biomes[j] < 7 ) {
+    
+    cachedID = mapRegionLookup( inX, inY, outGridPlacement );
+    
+    if( cachedID != -1 ) {
+        return cachedID;
+        }
+    
+    // region isn't generated yet
+    // do this one cell now, and have workers generate the rest
+    requestMapRegion( inX, inY );
+    
+    getBaseMapCallCount ++;
+    
+    
+    int secondPlace;
+    double secondPlaceGap;
+    
+    int pickedBiome = getMapBiomeIndex( inX, inY, &secondPlace,
+                                        &secondPlaceGap );
+    
+    char gridPlacement;
+    char densityPassed;
+    
+    int result = computeBaseMap( inX, inY, pickedBiome, secondPlace, NULL,
+                                 &gridPlacement, &densityPassed );
+
+    // only override if it's not already set
+    // if it's already set, then we're calling getBaseMap for neighboring
+    // map cells (wide, tall, moving objects, etc.)
+    // getBaseMap is always called for our cell in question first
+    // before examining neighboring cells if needed
+    if( densityPassed && lastCheckedBiome == -1 ) {    
+        lastCheckedBiome = biomes[pickedBiome];
+        lastCheckedBiomeX = inX;
+        lastCheckedBiomeY = inY;
+        }
+    
+    mapCacheInsert( inX, inY, result, gridPlacement );
+    
+    if( outGridPlacement != NULL ) {
+        *outGridPlacement = gridPlacement;
+        }
+    
+    return result;
+    }
+
+
+
+// Whole regions of base map and biomes, generated in one pass
+//
+// Noise is computed a row at a time, which is several times faster than
+// one cell at a time, and results are kept in an LRU of regions.
+// Worker threads generate regions ahead of players as they move.
+
+#include "minorGems/system/Thread.h"
+#include "minorGems/system/MutexLock.h"
+#include "minorGems/system/BinarySemaphore.h"
+
+
+#define MAP_REGION_BITS 5
+#define MAP_REGION_SIZE ( 1 << MAP_REGION_BITS )
+#define MAP_REGION_CELLS ( MAP_REGION_SIZE * MAP_REGION_SIZE )
+
+
+typedef struct MapRegion {
+        // region coordinates, cell coordinates shifted by MAP_REGION_BITS
+        int regionX, regionY;
+        
+        // cells in rows
+        int baseMap[ MAP_REGION_CELLS ];
+        char gridPlacement[ MAP_REGION_CELLS ];
+        
+        short biome[ MAP_REGION_CELLS ];
+        short secondPlace[ MAP_REGION_CELLS ];
+        double secondPlaceGap[ MAP_REGION_CELLS ];
+        
+        // LRU list, indices into mapRegions, -1 at ends
+        int newer, older;
+    } MapRegion;
+
+
+
+// same cell value computations as one cell at a time, but with noise
+// values computed in rows
+//
+// safe to call from any thread
+static void generateMapRegion( int inRegionX, int inRegionY, 
+                               MapRegion *outRegion ) {
+    
+    outRegion->regionX = inRegionX;
+    outRegion->regionY = inRegionY;
+
+    int startX = inRegionX * MAP_REGION_SIZE;
+    int startY = inRegionY * MAP_REGION_SIZE;
+    
+    double river[ MAP_REGION_SIZE ];
+    double topo[ MAP_REGION_SIZE ];
+    
+    double *special = new double[ numSpecialBiomes * MAP_REGION_SIZE + 1 ];
+    double *cellSpecial = new double[ numSpecialBiomes + 1 ];
+    
+    double density[ MAP_REGION_SIZE ];
+    double presence[ MAP_REGION_SIZE ];
+    double pick[ MAP_REGION_SIZE ];
+    
+    int maxNumObjects = 0;
+    for( int b=0; b<numBiomes; b++ ) {
+        if( naturalMapIDs[b].size() > maxNumObjects ) {
+            maxNumObjects = naturalMapIDs[b].size();
+            }
+        }
+    
+    double *objectRows = new double[ maxNumObjects * MAP_REGION_SIZE + 1 ];
+    double *cellObjects = new double[ maxNumObjects + 1 ];
+    
+    char objectsNeeded[ MAP_REGION_SIZE ];
+    
+
+    for( int dy=0; dy<MAP_REGION_SIZE; dy++ ) {
+        int y = startY + dy;
+        
+        int rowStart = dy * MAP_REGION_SIZE;
+        
+
+        // biomes
+        setXYRandomSeed( biomeRandSeedB, biomeRandSeedA );
+        getXYFractal2Row( startX, y, MAP_REGION_SIZE,
+                          riverRoughness, riverScale, river );
+        
+        setXYRandomSeed( biomeRandSeedA, biomeRandSeedB );
+        getXYFractalRow( startX, y, MAP_REGION_SIZE,
+                         0.55, 0.83332 + 0.08333 * numBiomes, topo );
+        
+        char anyPeaks = false;
+        
+        if( numSpecialBiomes > 0 ) {
+            for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+                if( getTopoBiomeIndex( topo[dx] ) >= regularBiomeLimit ) {
+                    anyPeaks = true;
+                    break;
+                    }
+                }
+            }
+        
+        if( anyPeaks ) {
+            for( int i=regularBiomeLimit; i<numBiomes; i++ ) {
+                int biome = biomes[i];
+                
+                setXYRandomSeed( biome * 263 + biomeRandSeedA + 38475,
+                                 biomeRandSeedB );
+                
+                getXYFractalRow( startX, y, MAP_REGION_SIZE,
+                                 0.55, 2.4999 + 0.2499 * numSpecialBiomes,
+                                 &( special[ ( i - regularBiomeLimit ) *
+                                             MAP_REGION_SIZE ] ) );
+                }
+            }
+        
+        for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+            BiomeNoise noise = { river[dx], topo[dx], NULL };
+            
+            if( anyPeaks ) {
+                for( int s=0; s<numSpecialBiomes; s++ ) {
+                    cellSpecial[s] = special[ s * MAP_REGION_SIZE + dx ];
+                    }
+                noise.special = cellSpecial;
+                }
+            
+            int secondPlace;
+            double secondPlaceGap;
+            char cacheable;
+            
+            int c = rowStart + dx;
+            
+            outRegion->biome[c] = 
+                computeBiomeIndex( startX + dx, y, &noise,
+                                   &secondPlace, &secondPlaceGap,
+                                   &cacheable );
+            outRegion->secondPlace[c] = secondPlace;
+            outRegion->secondPlaceGap[c] = secondPlaceGap;
+            }
+        
+        
+        // base map
+        setXYRandomSeed( 5379 );
+        getXYFractalRow( startX, y, MAP_REGION_SIZE, 0.1, 0.25, density );
+
+        setXYRandomSeed( 9877 );
+        getXYRandomRow( startX, y, MAP_REGION_SIZE, presence );
+        
+        setXYRandomSeed( 4593873 );
+        getXYRandomRow( startX, y, MAP_REGION_SIZE, pick );
+        
+
+        // which cells will pick a natural object
+        // (a guess, computeBaseMap makes the real decision, and computes
+        //  anything we didn't here)
+        for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+            int b = outRegion->biome[ rowStart + dx ];
+            
+            double d = sigmoid( density[dx], 0.1 ) * .4;
+            
+            if( biomes[b] == 7 || biomes[b] == 9 ) {
+                d = 1;
+                }
+            
+            objectsNeeded[dx] = 
+                ( presence[dx] < d && naturalMapIDs[b].size() > 0 );
+            }
+        
+        // object noise for each biome that needs it in this row
+        for( int b=0; b<numBiomes; b++ ) {
+            int numObjects = naturalMapIDs[b].size();
+            
+            int numCells = 0;
+            for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+                if( objectsNeeded[dx] && 
+                    outRegion->biome[ rowStart + dx ] == b ) {
+                    numCells++;
+                    }
+                }
+            
+            if( numCells == 0 ) {
+                continue;
+                }
+
+            // a whole row costs about as much as 4 single cells
+            char useRows = ( numCells >= 4 );
+            
+            if( useRows ) {
+                for( int i=0; i<numObjects; i++ ) {
+                    setXYRandomSeed( 793 * i + 123 );
+                    getXYFractalRow( startX, y, MAP_REGION_SIZE,
+                                     0.3, 0.15 + 0.016666 * numObjects,
+                                     &( objectRows[ i * MAP_REGION_SIZE ] ) );
+                    }
+                }
+            
+            for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+                if( ! objectsNeeded[dx] || 
+                    outRegion->biome[ rowStart + dx ] != b ) {
+                    continue;
+                    }
+                
+                BaseMapNoise noise = 
+                    { density[dx], presence[dx], pick[dx], NULL };
+                
+                if( useRows ) {
+                    for( int i=0; i<numObjects; i++ ) {
+                        cellObjects[i] = 
+                            objectRows[ i * MAP_REGION_SIZE + dx ];
+                        }
+                    noise.specialObject = cellObjects;
+                    }
+                
+                int c = rowStart + dx;
+                char densityPassed;
+                
+                outRegion->baseMap[c] = 
+                    computeBaseMap( startX + dx, y, 
+                                    outRegion->biome[c],
+                                    outRegion->secondPlace[c],
+                                    &noise, 
+                                    &( outRegion->gridPlacement[c] ),
+                                    &densityPassed );
+                }
+            }
+
+        // rest of cells
+        for( int dx=0; dx<MAP_REGION_SIZE; dx++ ) {
+            if( objectsNeeded[dx] ) {
+                continue;
+                }
+            
+            BaseMapNoise noise = 
+                { density[dx], presence[dx], pick[dx], NULL };
+
+            int c = rowStart + dx;
+            char densityPassed;
+            
+            outRegion->baseMap[c] = 
+                computeBaseMap( startX + dx, y, 
+                                outRegion->biome[c],
+                                outRegion->secondPlace[c],
+                                &noise, 
+                                &( outRegion->gridPlacement[c] ),
+                                &densityPassed );
+            }
+        }
+    
+    delete [] special;
+    delete [] cellSpecial;
+    delete [] objectRows;
+    delete [] cellObjects;
+    }
+
+
+
+// LRU of generated regions, owned by main thread
+static MapRegion **mapRegions = NULL;
+static int numMapRegions = 0;
+static int maxMapRegions = 0;
+
+static int newestMapRegion = -1;
+static int oldestMapRegion = -1;
+
+// index into mapRegions, keyed by regionX, regionY
+static FlatHashTable<int> mapRegionIndex( 1024, -1 );
+
+// repeated lookups in same region skip hash table and LRU update
+static int lastMapRegion = -1;
+
+
+
+// regions overlapping biomes stored in biome DB (test maps, tutorials)
+// aren't generated in regions, since those biomes change what base map
+// objects are picked
+static char isMapRegionAllowed( int inRegionX, int inRegionY ) {
+    if( maxMapRegions == 0 ) {
+        return false;
+        }
+    
+    if( ! anyBiomesInDB ) {
+        return true;
+        }
+    
+    int startX = inRegionX * MAP_REGION_SIZE;
+    int startY = inRegionY * MAP_REGION_SIZE;
+    int endX = startX + MAP_REGION_SIZE - 1;
+    int endY = startY + MAP_REGION_SIZE - 1;
+    
+    if( endX < minBiomeXLoc || startX > maxBiomeXLoc ||
+        endY < minBiomeYLoc || startY > maxBiomeYLoc ) {
+        return true;
+        }
+    return false;
+    }
+
+
+
+// true if every cell in region is in baked natural map, so there's no
+// need to generate it
+static char isMapRegionBaked( int inRegionX, int inRegionY ) {
+    if( ! naturalMapOpen ) {
+        return false;
+        }
+    
+    int r = naturalMap.radius;
+    
+    int startX = inRegionX * MAP_REGION_SIZE;
+    int startY = inRegionY * MAP_REGION_SIZE;
+    int endX = startX + MAP_REGION_SIZE - 1;
+    int endY = startY + MAP_REGION_SIZE - 1;
+    
+    return startX >= -r && endX <= r && startY >= -r && endY <= r;
+    }
+
+
+
+static void unlinkMapRegion( int inIndex ) {
+    MapRegion *r = mapRegions[ inIndex ];
+    
+    if( r->newer != -1 ) {
+        mapRegions[ r->newer ]->older = r->older;
+        }
+    else {
+        newestMapRegion = r->older;
+        }
+
+    if( r->older != -1 ) {
+        mapRegions[ r->older ]->newer = r->newer;
+        }
+    else {
+        oldestMapRegion = r->newer;
+        }
+    }
+
+
+
+static void linkMapRegionNewest( int inIndex ) {
+    MapRegion *r = mapRegions[ inIndex ];
+    
+    r->newer = -1;
+    r->older = newestMapRegion;
+    
+    if( newestMapRegion != -1 ) {
+        mapRegions[ newestMapRegion ]->newer = inIndex;
+        }
+    newestMapRegion = inIndex;
+    
+    if( oldestMapRegion == -1 ) {
+        oldestMapRegion = inIndex;
+        }
+    }
+
+
+
+// returns index of region, or -1 if not generated
+static int findMapRegion( int inRegionX, int inRegionY ) {
+    if( anyBiomesInDB && ! isMapRegionAllowed( inRegionX, inRegionY ) ) {
+        // biomes were put into DB here after region was generated
+        return -1;
+        }
+    
+    if( lastMapRegion != -1 ) {
+        MapRegion *r = mapRegions[ lastMapRegion ];
+        
+        if( r->regionX == inRegionX && r->regionY == inRegionY ) {
+            return lastMapRegion;
+            }
+        }
+    
+    if( maxMapRegions == 0 ) {
+        return -1;
+        }
+
+    char found;
+    int index = mapRegionIndex.lookup( inRegionX, inRegionY, 0, 0, &found );
+    
+    if( ! found ) {
+        return -1;
+        }
+    
+    if( index != newestMapRegion ) {
+        unlinkMapRegion( index );
+        linkMapRegionNewest( index );
+        }
+    
+    lastMapRegion = index;
+    
+    return index;
+    }
+
+
+
+// takes ownership of inRegion
+static void addMapRegion( MapRegion *inRegion ) {
+    int index;
+    
+    if( numMapRegions < maxMapRegions ) {
+        index = numMapRegions;
+        numMapRegions++;
+        }
+    else {
+        // reuse oldest
+        index = oldestMapRegion;
+        
+        MapRegion *old = mapRegions[ index ];
+        
+        unlinkMapRegion( index );
+        mapRegionIndex.remove( old->regionX, old->regionY, 0, 0 );
+        
+        delete old;
+        
+        if( lastMapRegion == index ) {
+            lastMapRegion = -1;
+            }
+        }
+    
+    mapRegions[ index ] = inRegion;
+    
+    linkMapRegionNewest( index );
+    
+    mapRegionIndex.insert( inRegion->regionX, inRegion->regionY, 0, 0, 
+                           index );
+    }
+
+
+
+static int mapRegionLookup( int inX, int inY, char *outGridPlacement ) {
+    int index = findMapRegion( inX >> MAP_REGION_BITS, 
+                               inY >> MAP_REGION_BITS );
+    
+    if( index == -1 ) {
+        return -1;
+        }
+    
+    int c = 
+        ( inY & ( MAP_REGION_SIZE - 1 ) ) * MAP_REGION_SIZE +
+        ( inX & ( MAP_REGION_SIZE - 1 ) );
+    
+    MapRegion *r = mapRegions[ index ];
+    
+    if( outGridPlacement != NULL ) {
+        *outGridPlacement = r->gridPlacement[c];
+        }
+    return r->baseMap[c];
+    }
+
+
+
+// returns -2 if not generated
+static int mapRegionBiomeLookup( int inX, int inY,
+                                 int *outSecondPlaceIndex,
+                                 double *outSecondPlaceGap ) {
+    int index = findMapRegion( inX >> MAP_REGION_BITS, 
+                               inY >> MAP_REGION_BITS );
+    
+    if( index == -1 ) {
+        return -2;
+        }
+    
+    int c = 
+        ( inY & ( MAP_REGION_SIZE - 1 ) ) * MAP_REGION_SIZE +
+        ( inX & ( MAP_REGION_SIZE - 1 ) );
+    
+    MapRegion *r = mapRegions[ index ];
+    
+    *outSecondPlaceIndex = r->secondPlace[c];
+    *outSecondPlaceGap = r->secondPlaceGap[c];
+
+    return r->biome[c];
+    }
+
+
+
+// worker threads
+
+static MutexLock mapGenLock;
+static BinarySemaphore mapGenSemaphore;
+
+// these are guarded by mapGenLock
+static char mapGenStopSignal = false;
+static SimpleVector<GridPos> mapGenRequests;
+static SimpleVector<MapRegion*> mapGenResults;
+
+// regions requested or being generated, owned by main thread
+static FlatHashTable<char> mapGenPending( 1024, false );
+
+
+// most requests queued at once, oldest dropped past this
+#define MAP_GEN_MAX_REQUESTS 512
+
+
+class MapGenThread : public Thread {
+    public:
+        
+        virtual void run() {
+            
+            while( true ) {
+                GridPos p;
+                char found = false;
+                char moreLeft = false;
+                
+                mapGenLock.lock();
+                
+                if( mapGenStopSignal ) {
+                    mapGenLock.unlock();
+                    break;
+                    }
+                
+                int numRequests = mapGenRequests.size();
+                
+                if( numRequests > 0 ) {
+                    // newest requests first, player is probably still
+                    // heading there
+                    p = mapGenRequests.getElementDirect( numRequests - 1 );
+                    mapGenRequests.deleteElement( numRequests - 1 );
+                    found = true;
+                    moreLeft = ( numRequests > 1 );
+                    }
+
+                mapGenLock.unlock();
+                
+                if( ! found ) {
+                    // time out now and then to check stop signal
+                    mapGenSemaphore.wait( 1000 );
+                    continue;
+                    }
+                
+                if( moreLeft ) {
+                    // wake another worker to help
+                    mapGenSemaphore.signal();
+                    }
+                
+                MapRegion *r = new MapRegion;
+                
+                generateMapRegion( p.x, p.y, r );
+
+                mapGenLock.lock();
+                mapGenResults.push_back( r );
+                mapGenLock.unlock();
+                }
+            }
+        
+    };
+
+
+static SimpleVector<MapGenThread*> mapGenThreads;
+
+
+
+static void requestMapRegionByIndex( int inRegionX, int inRegionY ) {
+    if( mapGenThreads.size() == 0 ) {
+        return;
+        }
+    
+    char found;
+    mapGenPending.lookup( inRegionX, inRegionY, 0, 0, &found );
+    
+    if( found ) {
+        return;
+        }
+    
+    if( findMapRegion( inRegionX, inRegionY ) != -1 ||
+        ! isMapRegionAllowed( inRegionX, inRegionY ) ||
+        isMapRegionBaked( inRegionX, inRegionY ) ) {
+        return;
+        }
+    
+    mapGenPending.insert( inRegionX, inRegionY, 0, 0, true );
+    
+    GridPos p = { inRegionX, inRegionY };
+    
+    mapGenLock.lock();
+    
+    mapGenRequests.push_back( p );
+    
+    if( mapGenRequests.size() > MAP_GEN_MAX_REQUESTS ) {
+        GridPos oldP = mapGenRequests.getElementDirect( 0 );
+        mapGenRequests.deleteElement( 0 );
+        
+        mapGenPending.remove( oldP.x, oldP.y, 0, 0 );
+        }
+    
+    mapGenLock.unlock();
+    
+    mapGenSemaphore.signal();
+    }
+
+
+
+static void requestMapRegion( int inX, int inY ) {
+    requestMapRegionByIndex( inX >> MAP_REGION_BITS, inY >> MAP_REGION_BITS );
+    }
+
+
+
+// moves finished regions from workers into LRU
+static void collectMapRegions() {
+    if( mapGenThreads.size() == 0 ) {
+        return;
+        }
+    
+    SimpleVector<MapRegion*> results;
+    
+    mapGenLock.lock();
+    results.push_back_other( &mapGenResults );
+    mapGenResults.deleteAll();
+    mapGenLock.unlock();
+    
+    for( int i=0; i<results.size(); i++ ) {
+        MapRegion *r = results.getElementDirect( i );
+        
+        mapGenPending.remove( r->regionX, r->regionY, 0, 0 );
+        
+        if( findMapRegion( r->regionX, r->regionY ) != -1 ||
+            ! isMapRegionAllowed( r->regionX, r->regionY ) ) {
+            // generated on main thread in the mean time,
+            // or biome DB changed
+            delete r;
+            }
+        else {
+            addMapRegion( r );
+            }
+        }
+    }
+
+
+
+void generateMapRegions( int inStartX, int inStartY, 
+                         int inWidth, int inHeight ) {
+    collectMapRegions();
+
+    int startRX = inStartX >> MAP_REGION_BITS;
+    int startRY = inStartY >> MAP_REGION_BITS;
+    int endRX = ( inStartX + inWidth - 1 ) >> MAP_REGION_BITS;
+    int endRY = ( inStartY + inHeight - 1 ) >> MAP_REGION_BITS;
+    
+    for( int ry = startRY; ry <= endRY; ry++ ) {
+        for( int rx = startRX; rx <= endRX; rx++ ) {
+            if( findMapRegion( rx, ry ) == -1 &&
+                isMapRegionAllowed( rx, ry ) &&
+                ! isMapRegionBaked( rx, ry ) ) {
+                
+                MapRegion *r = new MapRegion;
+                
+                generateMapRegion( rx, ry, r );
+                addMapRegion( r );
+                }
+            }
+        }
+    }
+
+
+
+void prefetchMapRegions( int inStartX, int inStartY, 
+                         int inWidth, int inHeight ) {
+    if( mapGenThreads.size() == 0 ) {
+        return;
+        }
+    
+    int startRX = inStartX >> MAP_REGION_BITS;
+    int startRY = inStartY >> MAP_REGION_BITS;
+    int endRX = ( inStartX + inWidth - 1 ) >> MAP_REGION_BITS;
+    int endRY = ( inStartY + inHeight - 1 ) >> MAP_REGION_BITS;
+    
+    for( int ry = startRY; ry <= endRY; ry++ ) {
+        for( int rx = startRX; rx <= endRX; rx++ ) {
+            requestMapRegionByIndex( rx, ry );
+            }
+        }
+    }
+
+
+
+static void initMapRegions() {
+    maxMapRegions = 
+        SettingsManager::getIntSetting( "mapRegionCacheSize", 1024 );
+    
+    if( maxMapRegions < 0 ) {
+        maxMapRegions = 0;
+        }
+    else if( maxMapRegions > 0 && maxMapRegions < 16 ) {
+        // enough for any chunk, with room to spare
+        maxMapRegions = 16;
+        }
+    
+    mapRegions = new MapRegion*[ maxMapRegions + 1 ];
+    numMapRegions = 0;
+    newestMapRegion = -1;
+    oldestMapRegion = -1;
+    lastMapRegion = -1;
+    
+    mapRegionIndex.clear();
+    mapGenPending.clear();
+    
+    int numThreads = 0;
+    
+    if( maxMapRegions > 0 ) {
+        numThreads = SettingsManager::getIntSetting( "mapGenThreads", 1 );
+        }
+    
+    mapGenStopSignal = false;
+    
+    for( int i=0; i<numThreads; i++ ) {
+        MapGenThread *t = new MapGenThread;
+        t->start();
+        mapGenThreads.push_back( t );
+        }
+    
+    AppLog::infoF( "Caching up to %d map regions of %dx%d, with %d "
+                   "generator threads", maxMapRegions,
+                   MAP_REGION_SIZE, MAP_REGION_SIZE, numThreads );
+    }
+
+
+
+static void freeMapRegions() {
+    mapGenLock.lock();
+    mapGenStopSignal = true;
+    mapGenLock.unlock();
+    
+    for( int i=0; i<mapGenThreads.size(); i++ ) {
+        mapGenSemaphore.signal();
+        }
+    for( int i=0; i<mapGenThreads.size(); i++ ) {
+        MapGenThread *t = mapGenThreads.getElementDirect( i );
+        t->join();
+        delete t;
+        }
+    mapGenThreads.deleteAll();
+    
+    for( int i=0; i<mapGenResults.size(); i++ ) {
+        delete mapGenResults.getElementDirect( i );
+        }
+    mapGenResults.deleteAll();
+    mapGenRequests.deleteAll();
+    mapGenPending.clear();
+    
+    for( int i=0; i<numMapRegions; i++ ) {
+        delete mapRegions[i];
+        }
+    if( mapRegions != NULL ) {
+        delete [] mapRegions;
+        mapRegions = NULL;
+        }
+    numMapRegions = 0;
+    maxMapRegions = 0;
+    newestMapRegion = -1;
+    oldestMapRegion = -1;
+    lastMapRegion = -1;
+    mapRegionIndex.clear();
+    }
+
+
+
+
+
+
+
+// Pre-baked natural map, read before generating cells live
+//
+// Baked with bakeNaturalMap, which generates the same regions as above
+// and writes them to naturalMap.bin.  Baked cells are the raw generated
+// ones, so cells where biome DB has biomes still go through live
+// generation.
+
+
+// bump whenever base map or biome generation code changes, so
+// old files are ignored
+#define NATURAL_MAP_GENERATOR_VERSION 1
+
+static const char *naturalMapFileName = "naturalMap.bin";
+
+
+static void appendFingerprintBytes( SimpleVector<unsigned char> *inBytes,
+                                    const void *inData, int inLength ) {
+    inBytes->appendArray( (unsigned char*)inData, inLength );
+    }
+
+
+static void appendFingerprintInt( SimpleVector<unsigned char> *inBytes,
+                                  int inV ) {
+    unsigned char v[4];
+    intToValue( inV, v );
+    inBytes->appendArray( v, 4 );
+    }
+
+
+static void appendFingerprintFloat( SimpleVector<unsigned char> *inBytes,
+                                    float inV ) {
+    // weights only ever come from settings files, so same value
+    // gives same bits
+    appendFingerprintBytes( inBytes, &inV, sizeof( inV ) );
+    }
+
+
+
+// covers everything that base map and biome generation reads
+static uint32_t computeNaturalMapFingerprint() {
+    SimpleVector<unsigned char> bytes;
+    
+    appendFingerprintInt( &bytes, NATURAL_MAP_GENERATOR_VERSION );
+    
+    appendFingerprintInt( &bytes, biomeRandSeedA );
+    appendFingerprintInt( &bytes, biomeRandSeedB );
+    appendFingerprintInt( &bytes, xLimit );
+    appendFingerprintInt( &bytes, yLimit );
+    appendFingerprintInt( &bytes, edgeObjectID );
+    
+    appendFingerprintInt( &bytes, numBiomes );
+    appendFingerprintInt( &bytes, regularBiomeLimit );
+    appendFingerprintInt( &bytes, numSpecialBiomes );
+    appendFingerprintFloat( &bytes, biomeTotalWeight );
+    
+    for( int b=0; b<numBiomes; b++ ) {
+        appendFingerprintInt( &bytes, biomes[b] );
+        appendFingerprintFloat( &bytes, biomeCumuWeights[b] );
+        appendFingerprintFloat( &bytes, totalChanceWeight[b] );
+        
+        int numObjects = naturalMapIDs[b].size();
+        
+        appendFingerprintInt( &bytes, numObjects );
+        
+        for( int i=0; i<numObjects; i++ ) {
+            int id = naturalMapIDs[b].getElementDirect( i );
+            
+            appendFingerprintInt( &bytes, id );
+            appendFingerprintFloat( 
+                &bytes, naturalMapChances[b].getElementDirect( i ) );
+            
+            // animals don't peek through from second place biome
+            TransRecord *t = getTrans( -1, id );
+            appendFingerprintInt( &bytes, ( t != NULL && t->move != 0 ) );
+            }
+        }
+    
+    appendFingerprintInt( &bytes, gridPlacements.size() );
+    
+    for( int g=0; g<gridPlacements.size(); g++ ) {
+        MapGridPlacement *gp = gridPlacements.getElement( g );
+        
+        appendFingerprintInt( &bytes, gp->id );
+        appendFingerprintInt( &bytes, gp->spacing );
+        appendFingerprintInt( &bytes, gp->phase );
+        appendFingerprintInt( &bytes, gp->wiggleScale );
+        appendFingerprintInt( &bytes, gp->permittedBiomes.size() );
+        
+        for( int i=0; i<gp->permittedBiomes.size(); i++ ) {
+            appendFingerprintInt( &bytes, 
+                                  gp->permittedBiomes.getElementDirect( i ) );
+            }
+        }
+    
+    unsigned char *data = bytes.getElementArray();
+    
+    uint32_t fingerprint = crc32( data, bytes.size() );
+    
+    delete [] data;
+    
+    return fingerprint;
+    }
+
+
+
+static void initNaturalMap() {
+    naturalMapOpen = false;
+    
+    if( ! SettingsManager::getIntSetting( "useNaturalMapFile", 1 ) ) {
+        return;
+        }
+    
+    if( NATURALMAP_open( &naturalMap, naturalMapFileName ) != 0 ) {
+        AppLog::info( "No pre-baked natural map found" );
+        return;
+        }
+    
+    if( naturalMap.fingerprint != computeNaturalMapFingerprint() ) {
+        AppLog::warningF( 
+            "Pre-baked natural map %s is stale (map seed or object data "
+            "have changed), ignoring it.  Run 'OneLifeServer "
+            "bakeNaturalMap' to re-bake it.", naturalMapFileName );
+        
+        NATURALMAP_close( &naturalMap );
+        return;
+        }
+    
+    naturalMapOpen = true;
+    
+    AppLog::infoF( "Using pre-baked natural map out to radius %d",
+                   naturalMap.radius );
+    }
+
+
+
+static void freeNaturalMap() {
+    if( naturalMapOpen ) {
+        NATURALMAP_close( &naturalMap );
+        naturalMapOpen = false;
+        }
+    }
+
+
+
+int bakeNaturalMap( int inRadius ) {
+    if( inRadius < 0 ) {
+        inRadius = barrierRadius;
+        }
+
+    // don't read from old file while making new one
+    freeNaturalMap();
+    
+    NATURALMAP bake;
+    
+    if( NATURALMAP_create( &bake, naturalMapFileName, inRadius,
+                           computeNaturalMapFingerprint() ) != 0 ) {
+        return -1;
+        }
+    
+    printf( "Baking natural map out to radius %d into %s\n", 
+            inRadius, naturalMapFileName );
+    
+    double startTime = Time::getCurrentTime();
+    
+    MapRegion *region = new MapRegion;
+    
+    NATURALMAP_Cell *cells = new NATURALMAP_Cell[ MAP_REGION_CELLS ];
+    
+    int endRegion = bake.minRegion + bake.regionsWide;
+    
+    char failed = false;
+    
+    for( int ry = bake.minRegion; ry < endRegion && !failed; ry++ ) {
+        for( int rx = bake.minRegion; rx < endRegion && !failed; rx++ ) {
+            
+            generateMapRegion( rx, ry, region );
+            
+            for( int c=0; c<MAP_REGION_CELLS; c++ ) {
+                cells[c].baseMap = region->baseMap[c];
+                cells[c].gridPlacement = region->gridPlacement[c];
+                cells[c].biome = region->biome[c];
+                cells[c].secondPlace = region->secondPlace[c];
+                cells[c].secondPlaceGap = region->secondPlaceGap[c];
+                }
+            
+            if( NATURALMAP_addRegion( &bake, cells ) != 0 ) {
+                failed = true;
+                }
+            }
+        
+        printf( "    %d/%d rows of regions\n", 
+                ry - bake.minRegion + 1, bake.regionsWide );
+        }
+    
+    delete region;
+    delete [] cells;
+    
+    if( failed ) {
+        NATURALMAP_close( &bake );
+        printf( "Baking natural map failed\n" );
+        return -1;
+        }
+    
+    if( NATURALMAP_finish( &bake ) != 0 ) {
+        printf( "Failed to save %s\n", naturalMapFileName );
+        return -1;
+        }
+    
+    printf( "Baked %d cells in %.2f sec\n",
+            ( 2 * inRadius + 1 ) * ( 2 * inRadius + 1 ),
+            Time::getCurrentTime() - startTime );
+    
+    initNaturalMap();
+    
+    return 0;
+    }
+
+
+
+// compares baked cells to cells generated one at a time
+int checkNaturalMap( int inNumSamples ) {
+    if( ! naturalMapOpen ) {
+        printf( "No usable pre-baked natural map to check\n" );
+        return -1;
+        }
+    
+    int r = naturalMap.radius;
+    
+    printf( "Checking %d cells of pre-baked natural map (radius %d) "
+            "against live generation\n", inNumSamples, r );
+    
+    // same cells every run
+    CustomRandomSource sampleSource( 7283 );
+    
+    int numMismatched = 0;
+    
+    for( int i=0; i<inNumSamples; i++ ) {
+        int x, y;
+        
+        if( i < 4 ) {
+            // always check corners
+            x = ( i & 1 ) ? r : -r;
+            y = ( i & 2 ) ? r : -r;
+            }
+        else {
+            x = sampleSource.getRandomBoundedInt( -r, r );
+            y = sampleSource.getRandomBoundedInt( -r, r );
+            }
+        
+        NATURALMAP_Cell baked;
+        
+        if( ! NATURALMAP_get( &naturalMap, x, y, &baked ) ) {
+            printf( "    %d,%d missing from baked map\n", x, y );
+            numMismatched++;
+            continue;
+            }
+        
+        int secondPlace;
+        double secondPlaceGap;
+        char cacheable;
+        
+        int biome = computeBiomeIndex( x, y, NULL, 
+                                       &secondPlace, &secondPlaceGap,
+                                       &cacheable );
+        
+        char gridPlacement;
+        char densityPassed;
+        
+        int id = computeBaseMap( x, y, biome, secondPlace, NULL,
+                                 &gridPlacement, &densityPassed );
+        
+        if( baked.baseMap != id ||
+            baked.gridPlacement != gridPlacement ||
+            baked.biome != biome ||
+            baked.secondPlace != secondPlace ||
+            baked.secondPlaceGap != secondPlaceGap ) {
+            
+            if( numMismatched < 20 ) {
+                printf( "    %d,%d baked object %d biome %d (%d, %f), "
+                        "live object %d biome %d (%d, %f)\n",
+                        x, y, 
+                        baked.baseMap, baked.biome, 
+                        baked.secondPlace, baked.secondPlaceGap,
+                        id, biome, secondPlace, secondPlaceGap );
+                }
+            numMismatched++;
+            }
+        }
+    
+    printf( "%d of %d cells mismatched\n", numMismatched, inNumSamples );
+    
+    if( numMismatched > 0 ) {
+        return -1;
+        }
+    return 0;
+    }
+
+
+
+
+
+#include "minorGems/graphics/Image.h"
+#include "minorGems/graphics/converters/TGAImageConverter.h"
+#include "minorGems/io/file/File.h"
+#include "minorGems/system/Time.h"
+ 
+void outputMapImage() {
+   
+    // output a chunk of the map as an image
+ 
+    int w =  708;
+    int h = 708;
+   
+    Image objIm( w, h, 3, true );
+    Image biomeIm( w, h, 3, true );
+   
+    SimpleVector<Color> objColors;
+    SimpleVector<Color> biomeColors;
+    SimpleVector<int> objCounts;
+   
+    int totalCounts = 0;
+ 
+    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
+        Color *c = Color::makeColorFromHSV( (float)i / allNaturalMapIDs.size(),
+                                            1, 1 );
+        objColors.push_back( *c );
+ 
+        objCounts.push_back( 0 );
+       
+        delete c;
+        }
+ 
+    SimpleVector<int> biomeCounts;
+    int totalBiomeCount = 0;
+ 
+    for( int j=0; j<numBiomes; j++ ) {        
+        biomeCounts.push_back( 0 );
+       
+        Color *c;
+       
+        int biomeNumber = biomes[j];
+ 
+        switch( biomeNumber ) {
+            case 0:
+                c = new Color( 0, 0.8, .1 );
+                break;
+            case 1:
+                c = new Color( 0.4, 0.2, 0.7 );
+                break;
+            case 2:
+                c = new Color( 1, .8, 0 );
+                break;
+            case 3:
+                c = new Color( 0.6, 0.6, 0.6 );
+                break;
+            case 4:
+                c = new Color( 1, 1, 1 );
+                break;
+            case 5:
+                c = new Color( 0.7, 0.6, 0.0 );
+                break;
+            case 6:
+                c = new Color( 0.0, 0.5, 0.0 );
+                break;
+            default:
+                c = Color::makeColorFromHSV( (float)j / numBiomes, 1, 1 );
+            }
+       
+        biomeColors.push_back( *c );
+        delete c;
+        }
+   
+    /*
+    double startTime = Time::getCurrentTime();
+    for( int y = 0; y<h; y++ ) {
+       
+        for( int x = 0; x<w; x++ ) {
+            // discard id output
+            // just invoking this to time it
+            getBaseMap( x, y );
+            }
+        }
+   
+    printf( "Generating %d map spots took %f sec\n",
+            w * h, Time::getCurrentTime() - startTime );
+    //exit(0);
+   
+    */
+ 
+ 
+    for( int y = 0; y<h; y++ ) {
+       
+        for( int x = 0; x<w; x++ ) {
+ 
+            /*
+            // raw rand output and correlation test
+            uint32_t xHit = xxTweakedHash2D( x, y );
+            uint32_t yHit = xxTweakedHash2D( x+1, y+1 );
+            //uint32_t xHit = getXYRandom_test( x, y );
+            //uint32_t yHit = getXYRandom_test( x+1, y );
+           
+            xHit = xHit % w;
+            yHit = yHit % h;
+           
+            double val = xxTweakedHash2D( x, y ) * oneOverIntMax;
+           
+            Color c = im.getColor( yHit * w + xHit );
+            c.r += 0.1;
+            c.g += 0.1;
+            c.b += 0.1;
+           
+            im.setColor( yHit * w + xHit, c );
+             
+            c.r = val;
+            c.g = val;
+            c.b = val;
+           
+            //im.setColor( y * w + x, c );
+            */
+           
+           
+            int id = getBaseMap( x - h/2, - ( y - h/2 ) );
+           
+            int biomeInd = getMapBiomeIndex( x - h/2, -( y - h/2 ) );
+ 
+            if( id > 0 ) {
+                for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
+                    if( allNaturalMapIDs.getElementDirect(i) == id ) {
+                        objIm.setColor( y * w + x,
+                                     objColors.getElementDirect( i ) );
+                       
+                        (* objCounts.getElement( i ) )++;
+                        totalCounts++;
+                        break;
+                        }
+                    }
+                }
+           
+            biomeIm.setColor( y * w + x,
+                              biomeColors.getElementDirect( biomeInd ) );
+            ( *( biomeCounts.getElement( biomeInd ) ) ) ++;
+            totalBiomeCount++;
+            }
+        }
+ 
+ 
+    const char *biomeNames[] = { "Grass ",
+                                 "Swamp ",
+                                 "Yellow",
+                                 "Gray  ",
+                                 "Snow  ",
+                                 "Desert",
+                                 "Jungle",
+                                 "DeepWater",
+                                 "Flower",
+                                 "ShallowWater"
+                                 };    
+ 
+    for( int j=0; j<numBiomes; j++ ) {
+        const char *name = "unknwn";
+       
+        if( biomes[j] < 7 ) {
             name = biomeNames[ biomes[j] ];
             }
         int c = biomeCounts.getElementDirect( j );
@@ -1784,404 +3150,1091 @@ void outputMapImage() {
         }
  
  
-   
-    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
-        ObjectRecord *obj = getObject( allNaturalMapIDs.getElementDirect( i ) );
-       
-        int count = objCounts.getElementDirect( i );
-       
-        printf(
-            "%d\t%-30s  (actual=%f, expected=%f\n",
-            objCounts.getElementDirect( i ),
-            obj->description,
-            count / (double)totalCounts,
-            obj->mapChance / allNaturalMapIDs.size() );
-        }
+   
+    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
+        ObjectRecord *obj = getObject( allNaturalMapIDs.getElementDirect( i ) );
+       
+        int count = objCounts.getElementDirect( i );
+       
+        printf(
+            "%d\t%-30s  (actual=%f, expected=%f\n",
+            objCounts.getElementDirect( i ),
+            obj->description,
+            count / (double)totalCounts,
+            obj->mapChance / allNaturalMapIDs.size() );
+        }
+ 
+    // rough legend in corner
+    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
+        if( i < h ) {
+            objIm.setColor( i * w + 0, objColors.getElementDirect( i ) );
+            }
+        }
+   
+ 
+    File tgaFile( NULL, "mapOut.tga" );
+    FileOutputStream tgaStream( &tgaFile );
+   
+    TGAImageConverter converter;
+   
+    converter.formatImage( &objIm, &tgaStream );
+ 
+ 
+    File tgaBiomeFile( NULL, "mapBiomeOut.tga" );
+    FileOutputStream tgaBiomeStream( &tgaBiomeFile );
+   
+    converter.formatImage( &biomeIm, &tgaBiomeStream );
+   
+    exit(0);
+    }
+ 
+ 
+ 
+ 
+void outputBiomeFractals() {
+    for( int scale = 1; scale <=4; scale *= 2 ) {
+       
+        for( int b=0; b<numBiomes; b++ ) {
+            int biome = biomes[ b ];
+           
+            setXYRandomSeed( biome * 263 + 723 );
+ 
+            int r = 100 * scale;
+           
+            Image outIm( r * 2, r * 2, 4 );
+           
+            for( int y=-r; y<r; y++ ) {
+                for( int x=-r; x<r; x++ ) {
+                   
+                    double v = getXYFractal(  x,
+                                              y,
+                                              0.55,
+                                              scale );
+                    Color c( v, v, v, 1 );
+ 
+                    int imX = x + r;
+                    int imY = y + r;
+                   
+                    outIm.setColor( imY * 2 * r  + imX, c );
+                    }
+                }
+           
+            char *name = autoSprintf( "fractal_b%d_s%d.tga",
+                                      biome, scale );
+           
+            File tgaFile( NULL, name );
+           
+            FileOutputStream tgaStream( &tgaFile );
+   
+            TGAImageConverter converter;
+   
+            converter.formatImage( &outIm, &tgaStream );
+            printf( "Outputting file %s\n", name );
+           
+            delete [] name;
+            }
+        }      
+    }
+ 
+ 
+ 
+ 
+ 
+ 
+int *getContainedRaw( int inX, int inY, int *outNumContained,
+                      int inSubCont = 0 );
+ 
+void setMapObjectRaw( int inX, int inY, int inID );
+ 
+static void dbPut( int inX, int inY, int inSlot, int inValue,
+                   int inSubCont = 0 );
+ 
+ 
+ 
+ 
+void writeRecentPlacements() {
+    FILE *placeFile = fopen( "recentPlacements.txt", "w" );
+    if( placeFile != NULL ) {
+        for( int i=0; i<NUM_RECENT_PLACEMENTS; i++ ) {
+            fprintf( placeFile, "%d,%d %d\n", recentPlacements[i].pos.x,
+                     recentPlacements[i].pos.y,
+                     recentPlacements[i].depth );
+            }
+        fprintf( placeFile, "nextPlacementIndex=%d\n", nextPlacementIndex );
+       
+        fclose( placeFile );
+        }
+    }
+ 
+ 
+ 
+static void writeEveRadius() {
+    FILE *eveRadFile = fopen( "eveRadius.txt", "w" );
+    if( eveRadFile != NULL ) {
+       
+        fprintf( eveRadFile, "%d", eveRadius );
+ 
+        fclose( eveRadFile );
+        }
+    }
+ 
+ 
+ 
+void doubleEveRadius() {
+    if( eveRadius < 1024 ) {
+        eveRadius *= 2;
+        writeEveRadius();
+        }
+    }
+ 
+ 
+ 
+void resetEveRadius() {
+    eveRadius = eveRadiusStart;
+    writeEveRadius();
+    }
+ 
+ 
+ 
+void clearRecentPlacements() {
+    for( int i=0; i<NUM_RECENT_PLACEMENTS; i++ ) {
+        recentPlacements[i].pos.x = 0;
+        recentPlacements[i].pos.y = 0;
+        recentPlacements[i].depth = 0;
+        }
+ 
+    writeRecentPlacements();
+    }
+ 
  
-    // rough legend in corner
-    for( int i=0; i<allNaturalMapIDs.size(); i++ ) {
-        if( i < h ) {
-            objIm.setColor( i * w + 0, objColors.getElementDirect( i ) );
-            }
-        }
-   
  
-    File tgaFile( NULL, "mapOut.tga" );
-    FileOutputStream tgaStream( &tgaFile );
+ 
+void printBiomeSamples() {
+    int *biomeSamples = new int[ numBiomes ];
    
-    TGAImageConverter converter;
+    for( int i=0; i<numBiomes; i++ ) {
+        biomeSamples[i] = 0;
+        }
    
-    converter.formatImage( &objIm, &tgaStream );
+    JenkinsRandomSource sampleRandSource;
  
+    int numSamples = 10000;
  
-    File tgaBiomeFile( NULL, "mapBiomeOut.tga" );
-    FileOutputStream tgaBiomeStream( &tgaBiomeFile );
-   
-    converter.formatImage( &biomeIm, &tgaBiomeStream );
+    int range = 2000;
+ 
+    for( int i=0; i<numSamples; i++ ) {
+        int x = sampleRandSource.getRandomBoundedInt( -range, range );
+        int y = sampleRandSource.getRandomBoundedInt( -range, range );
+       
+        biomeSamples[ computeMapBiomeIndex( x, y ) ] ++;
+        }
    
-    exit(0);
+    for( int i=0; i<numBiomes; i++ ) {
+        printf( "Biome %d:  %d (%.2f)\n",
+                biomes[ i ], biomeSamples[i],
+                biomeSamples[i] / (double)numSamples );
+        }
     }
+
+
+
+int printObjectSamples( int inXCenter, int inYCenter ) {
+    int objectToCount = 2285;
+   
+    JenkinsRandomSource sampleRandSource;
  
+    int numSamples = 0;
+
+    int rangeX = 354;
+    int rangeY = 354;
+
+    int count = 0;
+    
+    for( int y=-rangeY; y<=rangeY; y++ ) {
+        for( int x=-rangeX; x<=rangeX; x++ ) {
+            int obj = getMapObjectRaw( x  + inXCenter, y + inYCenter );
+            
+            
+            if( obj == objectToCount ) {
+                count++;
+                }
+            numSamples++;
+            }
+        }
+    
+
+    int rangeSize = (rangeX + rangeX + 1 ) * ( rangeY + rangeY + 1 );
+
+    float sampleFraction = 
+        numSamples / 
+        ( float ) rangeSize;
+   
+    printf( "Counted %d objects in %d/%d samples, expect %d total\n",
+            count, numSamples, rangeSize, (int)( count / sampleFraction ) );
+    
+    return count;
+    }
  
  
  
-void outputBiomeFractals() {
-    for( int scale = 1; scale <=4; scale *= 2 ) {
-       
-        for( int b=0; b<numBiomes; b++ ) {
-            int biome = biomes[ b ];
-           
-            setXYRandomSeed( biome * 263 + 723 );
  
-            int r = 100 * scale;
-           
-            Image outIm( r * 2, r * 2, 4 );
-           
-            for( int y=-r; y<r; y++ ) {
-                for( int x=-r; x<r; x++ ) {
-                   
-                    double v = getXYFractal(  x,
-                                              y,
-                                              0.55,
-                                              scale );
-                    Color c( v, v, v, 1 );
  
-                    int imX = x + r;
-                    int imY = y + r;
-                   
-                    outIm.setColor( imY * 2 * r  + imX, c );
-                    }
+// optimization:
+// cache dbGet results in RAM
+//
+// set-associative, so a few busy tiles that hash to the same set don't
+// keep evicting each other
+// each set holds MAP_CACHE_WAYS records, and when a set is full, a
+// CLOCK sweep through it evicts a record that hasn't been used since
+// the hand last passed
+//
+// one table holds each tile's object, contained count, decay ETA, floor,
+// floor decay ETA, and blocking state together, another holds other
+// slots (contained items and their decay ETAs)
+//
+// sized by mapTileCacheEntries and mapSlotCacheEntries settings
+
+#define MAP_CACHE_WAYS 8
+
+// bits of validFlags, one for each cached field
+#define TC_OBJECT 0x01
+#define TC_NUM_CONT 0x02
+#define TC_ETA 0x04
+#define TC_FLOOR 0x08
+#define TC_FLOOR_ETA 0x10
+#define TC_BLOCKING 0x20
+
+typedef struct TileCacheRecord {
+        int x, y;
+        int object;
+        int numContained;
+        int floor;
+        timeSec_t etaDecay;
+        timeSec_t floorEtaDecay;
+        char blocking;
+        
+        // 0 if record unused
+        unsigned char validFlags;
+        // CLOCK reference bit
+        char used;
+    } TileCacheRecord;
+
+
+// bits of validFlags
+#define SC_VALUE 0x01
+#define SC_TIME 0x02
+
+typedef struct SlotCacheRecord {
+        int x, y, slot, subCont;
+        int value;
+        timeSec_t timeVal;
+        
+        // 0 if record unused
+        unsigned char validFlags;
+        // CLOCK reference bit
+        char used;
+    } SlotCacheRecord;
+
+
+typedef struct MapCacheStats {
+        double hits;
+        double misses;
+        double evictions;
+    } MapCacheStats;
+
+
+// numSets * MAP_CACHE_WAYS records, sets stored contiguously
+static TileCacheRecord *tileCache = NULL;
+static uint32_t tileCacheSetMask = 0;
+// one CLOCK hand per set
+static unsigned char *tileCacheHands = NULL;
+static MapCacheStats tileCacheStats;
+
+static SlotCacheRecord *slotCache = NULL;
+static uint32_t slotCacheSetMask = 0;
+static unsigned char *slotCacheHands = NULL;
+static MapCacheStats slotCacheStats;
+
+
+// log cache stats this often
+#define MAP_CACHE_STATS_SECONDS 3600
+static double lastMapCacheStatsTime = 0;
+
+
+
+// power of 2 number of sets, holding at least inNumEntries records
+static uint32_t computeNumCacheSets( int inNumEntries ) {
+    uint32_t numSets = 1;
+    
+    while( numSets * MAP_CACHE_WAYS < (uint32_t)inNumEntries ) {
+        numSets *= 2;
+        }
+    return numSets;
+    }
+
+
+
+static uint32_t computeCacheSet( int inKeyA, int inKeyB,
+                                 int inKeyC, int inKeyD, 
+                                 uint32_t inSetMask ) {
+    uint32_t hashKey = (uint32_t)inKeyA * CACHE_PRIME_A +
+        (uint32_t)inKeyB * CACHE_PRIME_B +
+        (uint32_t)inKeyC * CACHE_PRIME_C +
+        (uint32_t)inKeyD * CACHE_PRIME_D;
+    
+    // low bits of neighboring tiles are too similar without this
+    hashKey ^= hashKey >> 15;
+    hashKey *= 2246822519U;
+    hashKey ^= hashKey >> 13;
+
+    return hashKey & inSetMask;
+    }
+
+
+
+static void freeDBCaches() {
+    if( tileCache != NULL ) {
+        delete [] tileCache;
+        delete [] tileCacheHands;
+        tileCache = NULL;
+        tileCacheHands = NULL;
+        }
+    if( slotCache != NULL ) {
+        delete [] slotCache;
+        delete [] slotCacheHands;
+        slotCache = NULL;
+        slotCacheHands = NULL;
+        }
+    }
+
+
+
+static void initDBCaches() {
+    freeDBCaches();
+    
+    uint32_t numTileSets = computeNumCacheSets(
+        SettingsManager::getIntSetting( "mapTileCacheEntries", 131072 ) );
+    
+    uint32_t numSlotSets = computeNumCacheSets(
+        SettingsManager::getIntSetting( "mapSlotCacheEntries", 131072 ) );
+    
+    tileCacheSetMask = numTileSets - 1;
+    tileCache = new TileCacheRecord[ numTileSets * MAP_CACHE_WAYS ];
+    tileCacheHands = new unsigned char[ numTileSets ];
+    
+    memset( tileCache, 0, 
+            numTileSets * MAP_CACHE_WAYS * sizeof( TileCacheRecord ) );
+    memset( tileCacheHands, 0, numTileSets );
+    
+    slotCacheSetMask = numSlotSets - 1;
+    slotCache = new SlotCacheRecord[ numSlotSets * MAP_CACHE_WAYS ];
+    slotCacheHands = new unsigned char[ numSlotSets ];
+    
+    memset( slotCache, 0, 
+            numSlotSets * MAP_CACHE_WAYS * sizeof( SlotCacheRecord ) );
+    memset( slotCacheHands, 0, numSlotSets );
+    
+    MapCacheStats blankStats = { 0, 0, 0 };
+    tileCacheStats = blankStats;
+    slotCacheStats = blankStats;
+    
+    lastMapCacheStatsTime = Time::getCurrentTime();
+    
+    AppLog::infoF( "Map tile cache has %d entries, slot cache has %d "
+                   "(%d-way)",
+                   numTileSets * MAP_CACHE_WAYS, numSlotSets * MAP_CACHE_WAYS,
+                   MAP_CACHE_WAYS );
+    }
+
+
+
+static void logMapCacheStatsLine( const char *inName, MapCacheStats *inStats ) {
+    double lookups = inStats->hits + inStats->misses;
+    
+    double hitRate = 0;
+    if( lookups > 0 ) {
+        hitRate = inStats->hits / lookups;
+        }
+    
+    AppLog::infoF( "Map %s cache:  %.0f hits, %.0f misses (%.1f%% hit), "
+                   "%.0f evictions",
+                   inName, inStats->hits, inStats->misses, 100 * hitRate,
+                   inStats->evictions );
+    }
+
+
+
+static void logMapCacheStats() {
+    logMapCacheStatsLine( "tile", &tileCacheStats );
+    logMapCacheStatsLine( "slot", &slotCacheStats );
+    }
+
+
+
+// NULL if not present
+static TileCacheRecord *tileCacheLookup( int inX, int inY ) {
+    TileCacheRecord *set = 
+        &( tileCache[ computeCacheSet( inX, inY, 0, 0, tileCacheSetMask ) 
+                      * MAP_CACHE_WAYS ] );
+    
+    for( int i=0; i<MAP_CACHE_WAYS; i++ ) {
+        TileCacheRecord *r = &( set[i] );
+        if( r->validFlags != 0 && r->x == inX && r->y == inY ) {
+            return r;
+            }
+        }
+    return NULL;
+    }
+
+
+
+// finds or adds record for tile, evicting another if needed
+static TileCacheRecord *tileCacheInsert( int inX, int inY ) {
+    uint32_t setIndex = computeCacheSet( inX, inY, 0, 0, tileCacheSetMask );
+    
+    TileCacheRecord *set = &( tileCache[ setIndex * MAP_CACHE_WAYS ] );
+    
+    TileCacheRecord *empty = NULL;
+    
+    for( int i=0; i<MAP_CACHE_WAYS; i++ ) {
+        TileCacheRecord *r = &( set[i] );
+        if( r->validFlags == 0 ) {
+            if( empty == NULL ) {
+                empty = r;
                 }
-           
-            char *name = autoSprintf( "fractal_b%d_s%d.tga",
-                                      biome, scale );
-           
-            File tgaFile( NULL, name );
-           
-            FileOutputStream tgaStream( &tgaFile );
-   
-            TGAImageConverter converter;
+            }
+        else if( r->x == inX && r->y == inY ) {
+            // written to or filled in, counts as a use
+            r->used = true;
+            return r;
+            }
+        }
+    
+    if( empty == NULL ) {
+        // CLOCK, give each recently used record a second chance
+        unsigned char hand = tileCacheHands[ setIndex ];
+        
+        while( set[ hand ].used ) {
+            set[ hand ].used = false;
+            hand = ( hand + 1 ) % MAP_CACHE_WAYS;
+            }
+        empty = &( set[ hand ] );
+        tileCacheHands[ setIndex ] = ( hand + 1 ) % MAP_CACHE_WAYS;
+        
+        tileCacheStats.evictions++;
+        }
+    
+    empty->x = inX;
+    empty->y = inY;
+    empty->validFlags = 0;
+    empty->used = true;
+    
+    return empty;
+    }
+
+
+
+// returns record if field inFlag is cached for tile, NULL on miss
+static TileCacheRecord *tileCacheGet( int inX, int inY, 
+                                      unsigned char inFlag ) {
+    TileCacheRecord *r = tileCacheLookup( inX, inY );
+    
+    if( r != NULL && ( r->validFlags & inFlag ) ) {
+        r->used = true;
+        tileCacheStats.hits++;
+        return r;
+        }
+    tileCacheStats.misses++;
+    return NULL;
+    }
+
+
+
+static void tileCacheClearField( int inX, int inY, unsigned char inFlag ) {
+    TileCacheRecord *r = tileCacheLookup( inX, inY );
+    
+    if( r != NULL ) {
+        // record is freed if no fields left
+        r->validFlags &= ~inFlag;
+        }
+    }
+
+
+
+// tile cache holds slot 0 and NUM_CONT_SLOT values, and DECAY_SLOT time,
+// with subCont 0
+static char isTileCacheSlot( int inSlot, int inSubCont ) {
+    return inSubCont == 0 && ( inSlot == 0 || inSlot == NUM_CONT_SLOT );
+    }
+
+
+
+// NULL if not present
+static SlotCacheRecord *slotCacheLookup( int inX, int inY, 
+                                         int inSlot, int inSubCont ) {
+    SlotCacheRecord *set = 
+        &( slotCache[ computeCacheSet( inX, inY, inSlot, inSubCont, 
+                                       slotCacheSetMask ) 
+                      * MAP_CACHE_WAYS ] );
+    
+    for( int i=0; i<MAP_CACHE_WAYS; i++ ) {
+        SlotCacheRecord *r = &( set[i] );
+        if( r->validFlags != 0 && r->x == inX && r->y == inY &&
+            r->slot == inSlot && r->subCont == inSubCont ) {
+            return r;
+            }
+        }
+    return NULL;
+    }
+
+
+
+// finds or adds record, evicting another if needed
+static SlotCacheRecord *slotCacheInsert( int inX, int inY, 
+                                         int inSlot, int inSubCont ) {
+    uint32_t setIndex = computeCacheSet( inX, inY, inSlot, inSubCont,
+                                         slotCacheSetMask );
+    
+    SlotCacheRecord *set = &( slotCache[ setIndex * MAP_CACHE_WAYS ] );
+    
+    SlotCacheRecord *empty = NULL;
+    
+    for( int i=0; i<MAP_CACHE_WAYS; i++ ) {
+        SlotCacheRecord *r = &( set[i] );
+        if( r->validFlags == 0 ) {
+            if( empty == NULL ) {
+                empty = r;
+                }
+            }
+        else if( r->x == inX && r->y == inY &&
+                 r->slot == inSlot && r->subCont == inSubCont ) {
+            r->used = true;
+            return r;
+            }
+        }
+    
+    if( empty == NULL ) {
+        unsigned char hand = slotCacheHands[ setIndex ];
+        
+        while( set[ hand ].used ) {
+            set[ hand ].used = false;
+            hand = ( hand + 1 ) % MAP_CACHE_WAYS;
+            }
+        empty = &( set[ hand ] );
+        slotCacheHands[ setIndex ] = ( hand + 1 ) % MAP_CACHE_WAYS;
+        
+        slotCacheStats.evictions++;
+        }
+    
+    empty->x = inX;
+    empty->y = inY;
+    empty->slot = inSlot;
+    empty->subCont = inSubCont;
+    empty->validFlags = 0;
+    empty->used = true;
+    
+    return empty;
+    }
+
+
+
+// returns record if field inFlag is cached, NULL on miss
+static SlotCacheRecord *slotCacheGet( int inX, int inY, 
+                                      int inSlot, int inSubCont,
+                                      unsigned char inFlag ) {
+    SlotCacheRecord *r = slotCacheLookup( inX, inY, inSlot, inSubCont );
+    
+    if( r != NULL && ( r->validFlags & inFlag ) ) {
+        r->used = true;
+        slotCacheStats.hits++;
+        return r;
+        }
+    slotCacheStats.misses++;
+    return NULL;
+    }
+ 
    
-            converter.formatImage( &outIm, &tgaStream );
-            printf( "Outputting file %s\n", name );
-           
-            delete [] name;
+ 
+ 
+// returns -2 on miss
+static int dbGetCached( int inX, int inY, int inSlot, int inSubCont ) {
+    if( isTileCacheSlot( inSlot, inSubCont ) ) {
+        if( inSlot == 0 ) {
+            TileCacheRecord *r = tileCacheGet( inX, inY, TC_OBJECT );
+            if( r != NULL ) {
+                return r->object;
+                }
             }
-        }      
+        else {
+            TileCacheRecord *r = tileCacheGet( inX, inY, TC_NUM_CONT );
+            if( r != NULL ) {
+                return r->numContained;
+                }
+            }
+        return -2;
+        }
+    
+    SlotCacheRecord *r = slotCacheGet( inX, inY, inSlot, inSubCont, 
+                                       SC_VALUE );
+    if( r != NULL ) {
+        return r->value;
+        }
+    return -2;
     }
  
  
  
+static void dbPutCached( int inX, int inY, int inSlot, int inSubCont,
+                        int inValue ) {
+    if( isTileCacheSlot( inSlot, inSubCont ) ) {
+        unsigned char flag = TC_NUM_CONT;
+        if( inSlot == 0 ) {
+            flag = TC_OBJECT;
+            }
+        
+        if( inValue == -2 ) {
+            tileCacheClearField( inX, inY, flag );
+            return;
+            }
+        
+        TileCacheRecord *r = tileCacheInsert( inX, inY );
+        
+        if( inSlot == 0 ) {
+            r->object = inValue;
+            }
+        else {
+            r->numContained = inValue;
+            }
+        r->validFlags |= flag;
+        return;
+        }
+    
+    if( inValue == -2 ) {
+        SlotCacheRecord *r = slotCacheLookup( inX, inY, inSlot, inSubCont );
+        if( r != NULL ) {
+            r->validFlags &= ~SC_VALUE;
+            }
+        return;
+        }
+    
+    SlotCacheRecord *r = slotCacheInsert( inX, inY, inSlot, inSubCont );
+    r->value = inValue;
+    r->validFlags |= SC_VALUE;
+    }
  
  
  
-int *getContainedRaw( int inX, int inY, int *outNumContained,
-                      int inSubCont = 0 );
- 
-void setMapObjectRaw( int inX, int inY, int inID );
  
-static void dbPut( int inX, int inY, int inSlot, int inValue,
-                   int inSubCont = 0 );
  
+// returns -2 on miss
+static int dbFloorGetCached( int inX, int inY ) {
+    TileCacheRecord *r = tileCacheGet( inX, inY, TC_FLOOR );
+    
+    if( r != NULL ) {
+        return r->floor;
+        }
+    return -2;
+    }
  
  
  
-void writeRecentPlacements() {
-    FILE *placeFile = fopen( "recentPlacements.txt", "w" );
-    if( placeFile != NULL ) {
-        for( int i=0; i<NUM_RECENT_PLACEMENTS; i++ ) {
-            fprintf( placeFile, "%d,%d %d\n", recentPlacements[i].pos.x,
-                     recentPlacements[i].pos.y,
-                     recentPlacements[i].depth );
-            }
-        fprintf( placeFile, "nextPlacementIndex=%d\n", nextPlacementIndex );
-       
-        fclose( placeFile );
+static void dbFloorPutCached( int inX, int inY, int inValue ) {
+    if( inValue == -2 ) {
+        tileCacheClearField( inX, inY, TC_FLOOR );
+        return;
         }
+    
+    TileCacheRecord *r = tileCacheInsert( inX, inY );
+    r->floor = inValue;
+    r->validFlags |= TC_FLOOR;
     }
  
  
  
-static void writeEveRadius() {
-    FILE *eveRadFile = fopen( "eveRadius.txt", "w" );
-    if( eveRadFile != NULL ) {
-       
-        fprintf( eveRadFile, "%d", eveRadius );
  
-        fclose( eveRadFile );
+ 
+// returns 1 on miss
+static double dbTimeGetCached( int inX, int inY, int inSlot, int inSubCont ) {
+    if( inSlot == DECAY_SLOT && inSubCont == 0 ) {
+        TileCacheRecord *r = tileCacheGet( inX, inY, TC_ETA );
+        if( r != NULL ) {
+            return r->etaDecay;
+            }
+        return 1;
+        }
+    
+    SlotCacheRecord *r = slotCacheGet( inX, inY, inSlot, inSubCont, 
+                                       SC_TIME );
+    if( r != NULL ) {
+        return r->timeVal;
         }
+    return 1;
     }
  
  
  
-void doubleEveRadius() {
-    if( eveRadius < 1024 ) {
-        eveRadius *= 2;
-        writeEveRadius();
+static void dbTimePutCached( int inX, int inY, int inSlot, int inSubCont,
+                         timeSec_t inValue ) {
+    if( inSlot == DECAY_SLOT && inSubCont == 0 ) {
+        if( inValue == 1 ) {
+            tileCacheClearField( inX, inY, TC_ETA );
+            return;
+            }
+        TileCacheRecord *r = tileCacheInsert( inX, inY );
+        r->etaDecay = inValue;
+        r->validFlags |= TC_ETA;
+        return;
+        }
+    
+    if( inValue == 1 ) {
+        SlotCacheRecord *r = slotCacheLookup( inX, inY, inSlot, inSubCont );
+        if( r != NULL ) {
+            r->validFlags &= ~SC_TIME;
+            }
+        return;
         }
+    
+    SlotCacheRecord *r = slotCacheInsert( inX, inY, inSlot, inSubCont );
+    r->timeVal = inValue;
+    r->validFlags |= SC_TIME;
     }
  
  
  
-void resetEveRadius() {
-    eveRadius = eveRadiusStart;
-    writeEveRadius();
-    }
- 
  
  
-void clearRecentPlacements() {
-    for( int i=0; i<NUM_RECENT_PLACEMENTS; i++ ) {
-        recentPlacements[i].pos.x = 0;
-        recentPlacements[i].pos.y = 0;
-        recentPlacements[i].depth = 0;
+// returns 1 on miss
+static timeSec_t dbFloorTimeGetCached( int inX, int inY ) {
+    TileCacheRecord *r = tileCacheGet( inX, inY, TC_FLOOR_ETA );
+    
+    if( r != NULL ) {
+        return r->floorEtaDecay;
         }
- 
-    writeRecentPlacements();
+    return 1;
     }
  
  
  
- 
-void printBiomeSamples() {
-    int *biomeSamples = new int[ numBiomes ];
-   
-    for( int i=0; i<numBiomes; i++ ) {
-        biomeSamples[i] = 0;
+static void dbFloorTimePutCached( int inX, int inY, timeSec_t inValue ) {
+    if( inValue == 1 ) {
+        tileCacheClearField( inX, inY, TC_FLOOR_ETA );
+        return;
         }
-   
-    JenkinsRandomSource sampleRandSource;
+    
+    TileCacheRecord *r = tileCacheInsert( inX, inY );
+    r->floorEtaDecay = inValue;
+    r->validFlags |= TC_FLOOR_ETA;
+    }
  
-    int numSamples = 10000;
  
-    int range = 2000;
  
-    for( int i=0; i<numSamples; i++ ) {
-        int x = sampleRandSource.getRandomBoundedInt( -range, range );
-        int y = sampleRandSource.getRandomBoundedInt( -range, range );
-       
-        biomeSamples[ computeMapBiomeIndex( x, y ) ] ++;
-        }
-   
-    for( int i=0; i<numBiomes; i++ ) {
-        printf( "Biome %d:  %d (%.2f)\n",
-                biomes[ i ], biomeSamples[i],
-                biomeSamples[i] / (double)numSamples );
-        }
-    }
-
-
-
-int printObjectSamples( int inXCenter, int inYCenter ) {
-    int objectToCount = 2285;
-   
-    JenkinsRandomSource sampleRandSource;
  
-    int numSamples = 0;
-
-    int rangeX = 354;
-    int rangeY = 354;
-
-    int count = 0;
+ 
+// returns -1 on miss
+static char blockingGetCached( int inX, int inY ) {
+    TileCacheRecord *r = tileCacheGet( inX, inY, TC_BLOCKING );
     
-    for( int y=-rangeY; y<=rangeY; y++ ) {
-        for( int x=-rangeX; x<=rangeX; x++ ) {
-            int obj = getMapObjectRaw( x  + inXCenter, y + inYCenter );
-            
-            
-            if( obj == objectToCount ) {
-                count++;
-                }
-            numSamples++;
-            }
+    if( r != NULL ) {
+        return r->blocking;
         }
-    
-
-    int rangeSize = (rangeX + rangeX + 1 ) * ( rangeY + rangeY + 1 );
-
-    float sampleFraction = 
-        numSamples / 
-        ( float ) rangeSize;
-   
-    printf( "Counted %d objects in %d/%d samples, expect %d total\n",
-            count, numSamples, rangeSize, (int)( count / sampleFraction ) );
-    
-    return count;
+    return -1;
     }
  
  
  
+static void blockingPutCached( int inX, int inY, char inBlocking ) {
+    TileCacheRecord *r = tileCacheInsert( inX, inY );
+    r->blocking = inBlocking;
+    r->validFlags |= TC_BLOCKING;
+    }
  
  
-// optimization:
-// cache dbGet results in RAM
+static void blockingClearCached( int inX, int inY ) {
+    tileCacheClearField( inX, inY, TC_BLOCKING );
+    }
  
-// 2.6 MB of RAM for this.
-#define DB_CACHE_SIZE 131072
  
-typedef struct DBCacheRecord {
-        int x, y, slot, subCont;
-        int value;
-    } DBCacheRecord;
-   
-static DBCacheRecord dbCache[ DB_CACHE_SIZE ];
  
+static void flushWriteBuffer( DBWriteBuffer *inBuffer ) {
+    if( inBuffer != NULL && inBuffer->flush() == -1 ) {
+        AppLog::error( "Error flushing map DB write buffer" );
+        }
+    }
  
  
-static int computeDBCacheHash( int inKeyA, int inKeyB,
-                               int inKeyC, int inKeyD ) {
-   
-    int hashKey = ( inKeyA * CACHE_PRIME_A +
-                    inKeyB * CACHE_PRIME_B +
-                    inKeyC * CACHE_PRIME_C +
-                    inKeyD * CACHE_PRIME_D ) % DB_CACHE_SIZE;
-    if( hashKey < 0 ) {
-        hashKey += DB_CACHE_SIZE;
+ 
+// pushes all pending writes through to the DB files
+// must be called before iterating through db, timeDB, or floorDB
+static void flushMapWriteBuffers() {
+    flushWriteBuffer( dbWriteBuffer );
+    flushWriteBuffer( timeDBWriteBuffer );
+    flushWriteBuffer( floorDBWriteBuffer );
+    flushWriteBuffer( floorTimeDBWriteBuffer );
+    flushWriteBuffer( biomeDBWriteBuffer );
+    flushWriteBuffer( eveDBWriteBuffer );
+    flushWriteBuffer( lookTimeDBWriteBuffer );
+    
+    if( tileDBOpen && REGIONDB_flush( &tileDB ) == -1 ) {
+        AppLog::error( "Error flushing mapTile.db pages" );
         }
-    return hashKey;
     }
-
-
-
-static int computeBLCacheHash( int inKeyA, int inKeyB ) {
+ 
+ 
+ 
+// flushes, logs stats, and destroys buffer
+static void closeWriteBuffer( const char *inDBName, 
+                              DBWriteBuffer **inBuffer ) {
+    DBWriteBuffer *b = *inBuffer;
     
-    int hashKey = ( inKeyA * CACHE_PRIME_A + 
-                    inKeyB * CACHE_PRIME_B ) % DB_CACHE_SIZE;
-    if( hashKey < 0 ) {
-        hashKey += DB_CACHE_SIZE;
+    if( b == NULL ) {
+        return;
         }
-    return hashKey;
+    
+    flushWriteBuffer( b );
+    
+    AppLog::infoF( "%s write buffer:  %.0f puts, %.0f coalesced, "
+                   "%.0f written in %.0f flushes",
+                   inDBName,
+                   (double)b->getNumPuts(), (double)b->getNumCoalesced(),
+                   (double)b->getNumWritten(), (double)b->getNumFlushes() );
+    
+    delete b;
+    *inBuffer = NULL;
     }
 
-
-
-typedef struct DBTimeCacheRecord {
-        int x, y, slot, subCont;
-        timeSec_t timeVal;
-    } DBTimeCacheRecord;
-   
-static DBTimeCacheRecord dbTimeCache[ DB_CACHE_SIZE ];
  
  
+// true if this map.db slot is stored in tileDB instead
+static char isTileDBSlot( int inSlot, int inSubCont ) {
+    return useMapTileDB && inSubCont == 0 &&
+        ( inSlot == 0 || inSlot == NUM_CONT_SLOT );
+    }
  
-typedef struct BlockingCacheRecord {
-        int x, y;
-        // -1 if not present
-        char blocking;
-    } BlockingCacheRecord;
-   
-static BlockingCacheRecord blockingCache[ DB_CACHE_SIZE ];
  
  
+// true if this mapTime.db slot is stored in tileDB instead
+static char isTileDBTimeSlot( int inSlot, int inSubCont ) {
+    return useMapTileDB && inSubCont == 0 && inSlot == DECAY_SLOT;
+    }
  
  
  
-static void initDBCaches() {
-    DBCacheRecord blankRecord = { 0, 0, 0, 0, -2 };
-    for( int i=0; i<DB_CACHE_SIZE; i++ ) {
-        dbCache[i] = blankRecord;
-        }
-    // 1 for empty (because 0 is a valid value)
-    DBTimeCacheRecord blankTimeRecord = { 0, 0, 0, 0, 1 };
-    for( int i=0; i<DB_CACHE_SIZE; i++ ) {
-        dbTimeCache[i] = blankTimeRecord;
-        }
-    // -1 for empty
-    BlockingCacheRecord blankBlockingRecord = { 0, 0, -1 };
-    for( int i=0; i<DB_CACHE_SIZE; i++ ) {
-        blockingCache[i] = blankBlockingRecord;
-        }
+static void tilePutCached( int inX, int inY, TileRecord *inRecord ) {
+    dbPutCached( inX, inY, 0, 0, inRecord->object );
+    dbPutCached( inX, inY, NUM_CONT_SLOT, 0, inRecord->numContained );
+    dbTimePutCached( inX, inY, DECAY_SLOT, 0, inRecord->etaDecay );
+    dbFloorPutCached( inX, inY, inRecord->floor );
+    dbFloorTimePutCached( inX, inY, inRecord->floorEtaDecay );
     }
  
-   
- 
  
-// returns -2 on miss
-static int dbGetCached( int inX, int inY, int inSlot, int inSubCont ) {
-    DBCacheRecord r =
-        dbCache[ computeDBCacheHash( inX, inY, inSlot, inSubCont ) ];
  
-    if( r.x == inX && r.y == inY &&
-        r.slot == inSlot && r.subCont == inSubCont &&
-        r.value != -2 ) {
-        return r.value;
+// fills outRecord with not-set fields if cell has no record
+static void tileDBGet_noCache( int inX, int inY, TileRecord *outRecord ) {
+    unsigned char value[ TILE_RECORD_SIZE ];
+    
+    if( REGIONDB_get( &tileDB, inX, inY, value ) == 0 ) {
+        valueToTileRecord( value, outRecord );
         }
     else {
-        return -2;
+        clearTileRecord( outRecord );
         }
     }
  
  
  
-static void dbPutCached( int inX, int inY, int inSlot, int inSubCont,
-                        int inValue ) {
-    DBCacheRecord r = { inX, inY, inSlot, inSubCont, inValue };
-   
-    dbCache[ computeDBCacheHash( inX, inY, inSlot, inSubCont ) ] = r;
+// one lookup gets everything about a cell, so all of the per-DB
+// caches are filled from it
+static void tileDBGet( int inX, int inY, TileRecord *outRecord ) {
+    tileDBGet_noCache( inX, inY, outRecord );
+    tilePutCached( inX, inY, outRecord );
     }
  
  
  
- 
- 
-// returns 1 on miss
-static double dbTimeGetCached( int inX, int inY, int inSlot, int inSubCont ) {
-    DBTimeCacheRecord r =
-        dbTimeCache[ computeDBCacheHash( inX, inY, inSlot, inSubCont ) ];
- 
-    if( r.x == inX && r.y == inY &&
-        r.slot == inSlot && r.subCont == inSubCont &&
-        r.timeVal != 1 ) {
-        return r.timeVal;
+// caller updates caches
+static void tileDBPut( int inX, int inY, TileRecord *inRecord ) {
+    unsigned char value[ TILE_RECORD_SIZE ];
+    
+    int error;
+    
+    if( isTileRecordEmpty( inRecord ) ) {
+        error = REGIONDB_delete( &tileDB, inX, inY );
         }
     else {
-        return 1;
+        tileRecordToValue( inRecord, value );
+        error = REGIONDB_put( &tileDB, inX, inY, value );
+        }
+    
+    if( error == -1 ) {
+        AppLog::error( "Error writing to mapTile.db" );
         }
     }
  
  
  
-static void dbTimePutCached( int inX, int inY, int inSlot, int inSubCont,
-                         timeSec_t inValue ) {
-    DBTimeCacheRecord r = { inX, inY, inSlot, inSubCont, inValue };
-   
-    dbTimeCache[ computeDBCacheHash( inX, inY, inSlot, inSubCont ) ] = r;
+// region version of tileDBGet, filling caches for every cell in
+// rectangle that isn't already cached
+// the rectangle's region pages are read in one pass first
+static void tileDBGetRegion( int inXStart, int inYStart, 
+                             int inWidth, int inHeight ) {
+    char pagesLoaded = false;
+    
+    for( int y=inYStart; y<inYStart + inHeight; y++ ) {
+        for( int x=inXStart; x<inXStart + inWidth; x++ ) {
+            
+            if( dbGetCached( x, y, 0, 0 ) != -2 &&
+                dbGetCached( x, y, NUM_CONT_SLOT, 0 ) != -2 &&
+                dbTimeGetCached( x, y, DECAY_SLOT, 0 ) != 1 &&
+                dbFloorGetCached( x, y ) != -2 &&
+                dbFloorTimeGetCached( x, y ) != 1 ) {
+                continue;
+                }
+            
+            if( ! pagesLoaded ) {
+                if( REGIONDB_loadRect( &tileDB, inXStart, inYStart,
+                                       inWidth, inHeight ) == -1 ) {
+                    AppLog::error( "Error reading from mapTile.db" );
+                    }
+                pagesLoaded = true;
+                }
+            
+            TileRecord r;
+            tileDBGet( x, y, &r );
+            }
+        }
     }
  
  
  
+// look times are kept per 100x100 block, so a region's corners cover
+// every block it touches
+static char isColdTileDBRegion( int inXStart, int inYStart, int inSize ) {
+    timeSec_t cutoff = MAP_TIMESEC - mapColdRegionSeconds;
+    
+    int xEnd = inXStart + inSize - 1;
+    int yEnd = inYStart + inSize - 1;
+    
+    return 
+        dbLookTimeGet( inXStart, inYStart ) < cutoff &&
+        dbLookTimeGet( xEnd, inYStart ) < cutoff &&
+        dbLookTimeGet( inXStart, yEnd ) < cutoff &&
+        dbLookTimeGet( xEnd, yEnd ) < cutoff;
+    }
+ 
  
  
-// returns -1 on miss
-static char blockingGetCached( int inX, int inY ) {
-    BlockingCacheRecord r =
-        blockingCache[ computeBLCacheHash( inX, inY ) ];
-
-    if( r.x == inX && r.y == inY &&
-        r.blocking != -1 ) {
-        return r.blocking;
+static void logTileDBStats() {
+    double hotColdRatio = 0;
+    
+    if( tileDB.numColdRegions > 0 ) {
+        hotColdRatio = (double)tileDB.numPages / tileDB.numColdRegions;
         }
-    else {
-        return -1;
+    
+    double thawMS = 0;
+    
+    if( tileDB.numThaws > 0 ) {
+        thawMS = 1000 * tileDB.thawSeconds / tileDB.numThaws;
         }
+    
+    AppLog::infoF( "mapTile.db:  %u hot pages, %u cold regions "
+                   "(hot/cold %.2f) in %.0f compressed bytes, "
+                   "%.0f frozen, %.0f thawed (%.3f ms each), "
+                   "%.0f page reads, %.0f page writes",
+                   tileDB.numPages, tileDB.numColdRegions, hotColdRatio,
+                   (double)tileDB.coldBytes,
+                   (double)tileDB.numFreezes, (double)tileDB.numThaws,
+                   thawMS,
+                   (double)tileDB.numPageReads, 
+                   (double)tileDB.numPageWrites );
     }
  
  
  
-static void blockingPutCached( int inX, int inY, char inBlocking ) {
-    BlockingCacheRecord r = { inX, inY, inBlocking };
-    
-    blockingCache[ computeBLCacheHash( inX, inY ) ] = r;
+// walks through map.db records
+// if useMapTileDB is on, it then walks through tileDB, returning each
+// cell's object and contained count as if they were map.db records
+// (slot 0 and NUM_CONT_SLOT with b=0)
+typedef struct MapDBIterator {
+        DB_Iterator dbi;
+        
+        char inTileDB;
+        REGIONDB_Iterator tileDBi;
+        
+        // contained count of last tile returned, still to be returned
+        // -1 if none
+        int pendingNumContained;
+        int pendingX, pendingY;
+    } MapDBIterator;
+ 
+ 
+ 
+static void mapDBIteratorInit( MapDBIterator *inIt ) {
+    DB_Iterator_init( &db, &( inIt->dbi ) );
+    inIt->inTileDB = false;
+    inIt->pendingNumContained = -1;
     }
  
  
-static void blockingClearCached( int inX, int inY ) {
-   
-    BlockingCacheRecord *r =
-        &( blockingCache[ computeBLCacheHash( inX, inY ) ] );
-
-    if( r->x == inX && r->y == inY ) {
-        r->blocking = -1;
+ 
+// key and value in map.db format
+// returns same values as DB_Iterator_next
+static int mapDBIteratorNext( MapDBIterator *inIt, 
+                              unsigned char *outKey, 
+                              unsigned char *outValue ) {
+    
+    if( inIt->pendingNumContained != -1 ) {
+        intQuadToKey( inIt->pendingX, inIt->pendingY, NUM_CONT_SLOT, 0,
+                      outKey );
+        intToValue( inIt->pendingNumContained, outValue );
+        inIt->pendingNumContained = -1;
+        return 1;
+        }
+    
+    if( ! inIt->inTileDB ) {
+        int result = DB_Iterator_next( &( inIt->dbi ), outKey, outValue );
+        
+        if( result != 0 || ! useMapTileDB ) {
+            return result;
+            }
+        
+        // end of map.db, on to tiles
+        REGIONDB_Iterator_init( &tileDB, &( inIt->tileDBi ) );
+        inIt->inTileDB = true;
+        }
+    
+    unsigned char tileValue[ TILE_RECORD_SIZE ];
+    
+    while( true ) {
+        int x, y;
+        
+        int result = REGIONDB_Iterator_next( &( inIt->tileDBi ), 
+                                             &x, &y, tileValue );
+        
+        if( result <= 0 ) {
+            return result;
+            }
+        
+        TileRecord r;
+        valueToTileRecord( tileValue, &r );
+        
+        if( r.object != -1 ) {
+            intQuadToKey( x, y, 0, 0, outKey );
+            intToValue( r.object, outValue );
+            
+            if( r.numContained != -1 ) {
+                inIt->pendingNumContained = r.numContained;
+                inIt->pendingX = x;
+                inIt->pendingY = y;
+                }
+            return 1;
+            }
+        else if( r.numContained != -1 ) {
+            intQuadToKey( x, y, NUM_CONT_SLOT, 0, outKey );
+            intToValue( r.numContained, outValue );
+            return 1;
+            }
+        // else floor-only cell, nothing to return
         }
     }
  
@@ -2247,10 +4300,12 @@ int cleanMap() {
    
     skipTrackingMapChanges = true;
    
-    DB_Iterator dbi;
+    flushMapWriteBuffers();
    
+    MapDBIterator dbi;
    
-    DB_Iterator_init( &db, &dbi );
+   
+    mapDBIteratorInit( &dbi );
    
     unsigned char key[16];
    
@@ -2272,7 +4327,7 @@ int cleanMap() {
     int totalNumContained = 0;
     int numContainedCleared = 0;
    
-    while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
+    while( mapDBIteratorNext( &dbi, key, value ) > 0 ) {
         totalDBRecordCount++;
        
         int s = valueToInt( &( key[8] ) );
@@ -2767,6 +4822,9 @@ static void deleteFileByName( const char *inFileName ) {
     if( f.exists() ) {
         f.remove();
         }
+    
+    // saved hash table index, if this was a DB file
+    LINEARDB3_removeIndex( inFileName );
     }
  
  
@@ -3050,6 +5108,12 @@ void reseedMap( char inForceFresh ) {
  
  
  
+static void buildEtaRegions();
+static void freeEtaRegions();
+static void freeMapScans();
+
+
+
 char initMap() {
  
     reseedMap( false );
@@ -3251,6 +5315,43 @@ char initMap() {
         }
  
     LINEARDB3_setMaxLoad( 0.80 );
+    
+    // map DB files into memory instead of using fseek/fread/fwrite
+    // on-disk format is the same either way
+    mmapMapDB = SettingsManager::getIntSetting( "mmapMapDB", 0 );
+    mmapCheckpointSeconds = 
+        SettingsManager::getIntSetting( "mmapCheckpointSeconds", 60 );
+    
+    LINEARDB3_setUseMmap( mmapMapDB );
+    
+    if( mmapMapDB && ! LINEARDB3_getUseMmap() ) {
+        AppLog::info( "mmapMapDB.ini flag set, but memory-mapping isn't "
+                      "supported here, using stdio for DB files." );
+        mmapMapDB = false;
+        }
+    
+    if( mmapMapDB ) {
+        AppLog::info( "mmapMapDB.ini flag set, memory-mapping DB files." );
+        }
+    
+    // hold puts to map, mapTime, and floor DBs in RAM, and push them
+    // out in batches
+    mapWriteBufferMaxRecords =
+        SettingsManager::getIntSetting( "mapWriteBufferMaxRecords", 8192 );
+    mapWriteBufferFlushSeconds =
+        SettingsManager::getDoubleSetting( "mapWriteBufferFlushSeconds", 
+                                           0.5 );
+    
+    dbCompactRecordsPerStep =
+        SettingsManager::getIntSetting( "dbCompactRecordsPerStep", 200 );
+    
+    mapColdRegionSeconds =
+        SettingsManager::getIntSetting( "mapColdRegionSeconds", 0 );
+    
+    // keep each cell's own object, floor, and ETAs in one mapTile.db record
+    // existing map files must be converted with mapTileConvert when
+    // switching this on or off
+    useMapTileDB = SettingsManager::getIntSetting( "useMapTileDB", 0 );
    
     if( ! skipLookTimeCleanup ) {
         DB lookTimeDB_old;
@@ -3378,6 +5479,7 @@ char initMap() {
  
             tempDBFile.copy( &lookTimeDBFile );
             tempDBFile.remove();
+            LINEARDB3_removeIndex( lookTimeDBName_temp );
             }
         else {
             DB_close( &lookTimeDB_old );
@@ -3590,6 +5692,39 @@ char initMap() {
  
  
  
+    if( useMapTileDB ) {
+        // opened before map.db, because dbShrinkMode 2 looks up
+        // cell objects when shrinking the other DBs
+        int cachedPages = 
+            SettingsManager::getIntSetting( "mapTileCachedPages", 2048 );
+        
+        error = REGIONDB_open_modeSwitch( &tileDB,
+                                          "mapTile.db",
+                                          TILE_RECORD_SIZE, // see TileRecord
+                                          cachedPages );
+        
+        if( error ) {
+            AppLog::errorF( "Error %d opening map tile RegionDB", error );
+            return false;
+            }
+        
+        tileDBOpen = true;
+        
+        AppLog::infoF( "mapTile.db holds %u cells, caching up to %d pages",
+                       REGIONDB_getNumRecords( &tileDB ), cachedPages );
+        logTileDBStats();
+        }
+    else {
+        File tileDBFile( NULL, "mapTile.db" );
+        
+        if( tileDBFile.exists() ) {
+            AppLog::error( "mapTile.db exists, but useMapTileDB is off.  "
+                           "Run 'mapTileConvert split' first." );
+            return false;
+            }
+        }
+    
+ 
     // note that the various decay ETA slots in map.db
     // are define but unused, because we store times separately
     // in mapTime.db
@@ -3631,6 +5766,30 @@ char initMap() {
         }
    
     dbOpen = true;
+    
+    if( useMapTileDB && 
+        REGIONDB_getNumRecords( &tileDB ) == 0 && 
+        DB_getNumRecords( &db ) > 0 ) {
+        // map.db can still hold contained objects on natural cells,
+        // but cell objects themselves mean it was never converted
+        DB_Iterator dbi;
+        DB_Iterator_init( &db, &dbi );
+        
+        unsigned char key[16];
+        unsigned char value[4];
+        
+        while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
+            int s = valueToInt( &( key[8] ) );
+            int b = valueToInt( &( key[12] ) );
+            
+            if( s == 0 && b == 0 ) {
+                AppLog::error( "useMapTileDB is on, but map.db has not been "
+                               "converted.  Run 'mapTileConvert merge' "
+                               "first." );
+                return false;
+                }
+            }
+        }
  
  
  
@@ -3748,6 +5907,20 @@ char initMap() {
    
     floorDBOpen = true;
  
+    
+    if( mapWriteBufferMaxRecords > 0 ) {
+        dbWriteBuffer = new DBWriteBuffer( &db, mapWriteBufferMaxRecords );
+        timeDBWriteBuffer = 
+            new DBWriteBuffer( &timeDB, mapWriteBufferMaxRecords );
+        floorDBWriteBuffer = 
+            new DBWriteBuffer( &floorDB, mapWriteBufferMaxRecords );
+        
+        AppLog::infoF( "Buffering up to %d map DB writes, flushing every "
+                       "%.2f seconds", 
+                       mapWriteBufferMaxRecords, mapWriteBufferFlushSeconds );
+        }
+    lastMapWriteBufferFlushTime = Time::getCurrentTime();
+ 
  
  
     error = DB_open_modeSwitch( &floorTimeDB,
@@ -4124,6 +6297,13 @@ char initMap() {
  
     //outputBiomeFractals();
  
+    
+    buildEtaRegions();
+    
+    initNaturalMap();
+    
+    initMapRegions();
+    
            
     setupMapChangeLogFile();
  
@@ -4206,6 +6386,14 @@ static void rememberDummy( FILE *inFile, int inX, int inY,
  
  
 void freeMap( char inSkipCleanup ) {
+    // stop generator threads before anything they read is freed
+    freeMapRegions();
+    
+    // and map scan thread, which also holds a snapshot
+    freeMapScans();
+    
+    freeNaturalMap();
+    
     if( mapChangeLogFile != NULL ) {
         fclose( mapChangeLogFile );
         mapChangeLogFile = NULL;
@@ -4215,6 +6403,14 @@ void freeMap( char inSkipCleanup ) {
  
     skipTrackingMapChanges = true;
    
+    if( mapSnapshotActive ) {
+        // release no matter how many holders are left
+        numMapSnapshotHolders = 1;
+        endMapSnapshot();
+        }
+    
+    flushMapWriteBuffers();
+   
     if( lookTimeDBOpen ) {
         DB_close( &lookTimeDB );
         lookTimeDBOpen = false;
@@ -4231,10 +6427,10 @@ void freeMap( char inSkipCleanup ) {
         // and their IDs may change in the future, so they're
         // not safe to store in the map between server runs.
        
-        DB_Iterator dbi;
+        MapDBIterator dbi;
    
    
-        DB_Iterator_init( &db, &dbi );
+        mapDBIteratorInit( &dbi );
    
         unsigned char key[16];
    
@@ -4264,7 +6460,7 @@ void freeMap( char inSkipCleanup ) {
            
             FILE *dummyFile = fopen( "mapDummyRecall.txt", "w" );
            
-            while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
+            while( mapDBIteratorNext( &dbi, key, value ) > 0 ) {
        
                 int s = valueToInt( &( key[8] ) );
                 int b = valueToInt( &( key[12] ) );
@@ -4405,17 +6601,20 @@ void freeMap( char inSkipCleanup ) {
             AppLog::info( "Skipping running normal map clean." );
             }
        
+        closeWriteBuffer( "map.db", &dbWriteBuffer );
        
         DB_close( &db );
         dbOpen = false;
         }
     else if( dbOpen ) {
         // just close with no cleanup
+        closeWriteBuffer( "map.db", &dbWriteBuffer );
         DB_close( &db );
         dbOpen = false;
         }
    
     if( timeDBOpen ) {
+        closeWriteBuffer( "mapTime.db", &timeDBWriteBuffer );
         DB_close( &timeDB );
         timeDBOpen = false;
         }
@@ -4427,6 +6626,7 @@ void freeMap( char inSkipCleanup ) {
  
  
     if( floorDBOpen ) {
+        closeWriteBuffer( "floor.db", &floorDBWriteBuffer );
         DB_close( &floorDB );
         floorDBOpen = false;
         }
@@ -4435,6 +6635,12 @@ void freeMap( char inSkipCleanup ) {
         DB_close( &floorTimeDB );
         floorTimeDBOpen = false;
         }
+    
+    if( tileDBOpen ) {
+        logTileDBStats();
+        REGIONDB_close( &tileDB );
+        tileDBOpen = false;
+        }
  
  
     if( graveDBOpen ) {
@@ -4457,6 +6663,11 @@ void freeMap( char inSkipCleanup ) {
         DB_close( &persistentMapDB );
         persistentMapDBOpen = false;
         }
+    
+    logMapCacheStats();
+    freeDBCaches();
+    
+    freeEtaRegions();
    
  
     writeEveRadius();
@@ -4476,6 +6687,7 @@ void freeMap( char inSkipCleanup ) {
     allNaturalMapIDs.deleteAll();
  
     liveDecayQueue.clear();
+    liveDecayQueueHandles.clear();
     liveDecayRecordPresentHashTable.clear();
     liveDecayRecordLastLookTimeHashTable.clear();
     liveMovementEtaTimes.clear();
@@ -4511,6 +6723,8 @@ void wipeMapFiles() {
     deleteFileByName( "lookTime.db" );
     deleteFileByName( "map.db" );
     deleteFileByName( "mapTime.db" );
+    deleteFileByName( "mapTile.db" );
+    deleteFileByName( "mapTile.db.cold" );
     deleteFileByName( "playerStats.db" );
     deleteFileByName( "meta.db" );
     }
@@ -4529,6 +6743,16 @@ static int dbGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
        
         return cachedVal;
         }
+    
+    if( isTileDBSlot( inSlot, inSubCont ) ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        
+        if( inSlot == 0 ) {
+            return r.object;
+            }
+        return r.numContained;
+        }
    
  
     unsigned char key[16];
@@ -4537,7 +6761,7 @@ static int dbGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
     // look for changes to default in database
     intQuadToKey( inX, inY, inSlot, inSubCont, key );
    
-    int result = DB_get( &db, key, value );
+    int result = mapDBGet( &db, dbWriteBuffer, key, value );
    
    
    
@@ -4559,6 +6783,16 @@ static int dbGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
  
 // returns -1 if not found
 int dbGet_noCache( int inX, int inY, int inSlot, int inSubCont = 0 ) {
+    
+    if( isTileDBSlot( inSlot, inSubCont ) ) {
+        TileRecord r;
+        tileDBGet_noCache( inX, inY, &r );
+        
+        if( inSlot == 0 ) {
+            return r.object;
+            }
+        return r.numContained;
+        }
  
     unsigned char key[16];
     unsigned char value[4];
@@ -4566,7 +6800,7 @@ int dbGet_noCache( int inX, int inY, int inSlot, int inSubCont = 0 ) {
     // look for changes to default in database
     intQuadToKey( inX, inY, inSlot, inSubCont, key );
    
-    int result = DB_get( &db, key, value );
+    int result = mapDBGet( &db, dbWriteBuffer, key, value );
    
    
    
@@ -4593,6 +6827,12 @@ static timeSec_t dbTimeGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
        
         return cachedVal;
         }
+    
+    if( isTileDBTimeSlot( inSlot, inSubCont ) ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        return r.etaDecay;
+        }
  
    
     unsigned char key[16];
@@ -4601,7 +6841,7 @@ static timeSec_t dbTimeGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
     // look for changes to default in database
     intQuadToKey( inX, inY, inSlot, inSubCont, key );
    
-    int result = DB_get( &timeDB, key, value );
+    int result = mapDBGet( &timeDB, timeDBWriteBuffer, key, value );
    
     timeSec_t timeVal;
    
@@ -4621,43 +6861,382 @@ static timeSec_t dbTimeGet( int inX, int inY, int inSlot, int inSubCont = 0 ) {
  
  
 static int dbFloorGet( int inX, int inY ) {
+    
+    int cachedVal = dbFloorGetCached( inX, inY );
+    if( cachedVal != -2 ) {
+        
+        return cachedVal;
+        }
+    
+    if( useMapTileDB ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        return r.floor;
+        }
+    
     unsigned char key[9];
     unsigned char value[4];
  
     // look for changes to default in database
     intPairToKey( inX, inY, key );
    
-    int result = DB_get( &floorDB, key, value );
+    int result = mapDBGet( &floorDB, floorDBWriteBuffer, key, value );
    
+    int returnVal;
+    
     if( result == 0 ) {
         // found
-        int returnVal = valueToInt( value );
-       
-        return returnVal;
+        returnVal = valueToInt( value );
         }
     else {
-        return -1;
+        returnVal = -1;
+        }
+    
+    dbFloorPutCached( inX, inY, returnVal );
+    
+    return returnVal;
+    }
+ 
+ 
+ 
+ 
+// Region versions of dbGet, dbTimeGet, and dbFloorGet
+//
+// These look up every cell in a rectangle with one batched DB call,
+// which reads the matching records in file order instead of doing a
+// random read per cell.
+//
+// Results are stored in the DB caches, so that the per-cell gets that
+// follow are cache hits.  Cells that are already cached are not re-read,
+// and writes still pending in a write-back buffer take precedence over
+// the DB file.
+//
+// outValues can be NULL if only the caches need to be warmed up.
+// Otherwise, it is filled in row-major order with the same values
+// that the per-cell get would return.
+//
+// With useMapTileDB, slots kept in tileDB are read with tileDBGetRegion,
+// which fills the caches for all of them at once.
+static void dbGetRegion( int inXStart, int inYStart, 
+                         int inWidth, int inHeight,
+                         int inSlot, int inSubCont, int *outValues ) {
+    
+    int numCells = inWidth * inHeight;
+    
+    if( isTileDBSlot( inSlot, inSubCont ) ) {
+        tileDBGetRegion( inXStart, inYStart, inWidth, inHeight );
+        
+        if( outValues != NULL ) {
+            for( int i=0; i<numCells; i++ ) {
+                outValues[i] = dbGet( inXStart + i % inWidth,
+                                      inYStart + i / inWidth,
+                                      inSlot, inSubCont );
+                }
+            }
+        return;
+        }
+    
+    int *missIndices = new int[ numCells ];
+    unsigned char *keys = new unsigned char[ numCells * 16 ];
+    
+    int numMisses = 0;
+    
+    for( int i=0; i<numCells; i++ ) {
+        int x = inXStart + i % inWidth;
+        int y = inYStart + i / inWidth;
+        
+        int cachedVal = dbGetCached( x, y, inSlot, inSubCont );
+        
+        if( cachedVal != -2 ) {
+            if( outValues != NULL ) {
+                outValues[i] = cachedVal;
+                }
+            }
+        else {
+            intQuadToKey( x, y, inSlot, inSubCont, &( keys[ numMisses * 16 ] ) );
+            missIndices[ numMisses ] = i;
+            numMisses++;
+            }
+        }
+    
+    if( numMisses > 0 ) {
+        unsigned char *values = new unsigned char[ numMisses * 4 ];
+        int *results = new int[ numMisses ];
+        
+        int error = DB_getBatch( &db, numMisses, keys, values, results );
+        
+        // writes still pending in buffer are newer than DB file
+        if( ! error && dbWriteBuffer != NULL ) {
+            for( int m=0; m<numMisses; m++ ) {
+                int pending = 
+                    dbWriteBuffer->get( &( keys[ m * 16 ] ), 
+                                        &( values[ m * 4 ] ) );
+                if( pending != -1 ) {
+                    // 1 for pending delete, reads as not found
+                    results[m] = pending;
+                    }
+                }
+            }
+        
+        for( int m=0; m<numMisses; m++ ) {
+            int i = missIndices[m];
+            int x = inXStart + i % inWidth;
+            int y = inYStart + i / inWidth;
+            
+            int val;
+            
+            if( error ) {
+                val = dbGet( x, y, inSlot, inSubCont );
+                }
+            else {
+                if( results[m] == 0 ) {
+                    val = valueToInt( &( values[ m * 4 ] ) );
+                    }
+                else {
+                    val = -1;
+                    }
+                dbPutCached( x, y, inSlot, inSubCont, val );
+                }
+            
+            if( outValues != NULL ) {
+                outValues[i] = val;
+                }
+            }
+        delete [] values;
+        delete [] results;
+        }
+    
+    delete [] missIndices;
+    delete [] keys;
+    }
+ 
+ 
+ 
+static void dbTimeGetRegion( int inXStart, int inYStart, 
+                             int inWidth, int inHeight,
+                             int inSlot, int inSubCont, 
+                             timeSec_t *outValues ) {
+    
+    int numCells = inWidth * inHeight;
+    
+    if( isTileDBTimeSlot( inSlot, inSubCont ) ) {
+        tileDBGetRegion( inXStart, inYStart, inWidth, inHeight );
+        
+        if( outValues != NULL ) {
+            for( int i=0; i<numCells; i++ ) {
+                outValues[i] = dbTimeGet( inXStart + i % inWidth,
+                                          inYStart + i / inWidth,
+                                          inSlot, inSubCont );
+                }
+            }
+        return;
+        }
+    
+    int *missIndices = new int[ numCells ];
+    unsigned char *keys = new unsigned char[ numCells * 16 ];
+    
+    int numMisses = 0;
+    
+    for( int i=0; i<numCells; i++ ) {
+        int x = inXStart + i % inWidth;
+        int y = inYStart + i / inWidth;
+        
+        timeSec_t cachedVal = dbTimeGetCached( x, y, inSlot, inSubCont );
+        
+        if( cachedVal != 1 ) {
+            if( outValues != NULL ) {
+                outValues[i] = cachedVal;
+                }
+            }
+        else {
+            intQuadToKey( x, y, inSlot, inSubCont, &( keys[ numMisses * 16 ] ) );
+            missIndices[ numMisses ] = i;
+            numMisses++;
+            }
+        }
+    
+    if( numMisses > 0 ) {
+        unsigned char *values = new unsigned char[ numMisses * 8 ];
+        int *results = new int[ numMisses ];
+        
+        int error = DB_getBatch( &timeDB, numMisses, keys, values, results );
+        
+        // writes still pending in buffer are newer than DB file
+        if( ! error && timeDBWriteBuffer != NULL ) {
+            for( int m=0; m<numMisses; m++ ) {
+                int pending = 
+                    timeDBWriteBuffer->get( &( keys[ m * 16 ] ), 
+                                            &( values[ m * 8 ] ) );
+                if( pending != -1 ) {
+                    // 1 for pending delete, reads as not found
+                    results[m] = pending;
+                    }
+                }
+            }
+        
+        for( int m=0; m<numMisses; m++ ) {
+            int i = missIndices[m];
+            int x = inXStart + i % inWidth;
+            int y = inYStart + i / inWidth;
+            
+            timeSec_t val;
+            
+            if( error ) {
+                val = dbTimeGet( x, y, inSlot, inSubCont );
+                }
+            else {
+                if( results[m] == 0 ) {
+                    val = valueToTime( &( values[ m * 8 ] ) );
+                    }
+                else {
+                    val = 0;
+                    }
+                dbTimePutCached( x, y, inSlot, inSubCont, val );
+                }
+            
+            if( outValues != NULL ) {
+                outValues[i] = val;
+                }
+            }
+        delete [] values;
+        delete [] results;
+        }
+    
+    delete [] missIndices;
+    delete [] keys;
+    }
+ 
+ 
+ 
+static void dbFloorGetRegion( int inXStart, int inYStart, 
+                              int inWidth, int inHeight, int *outValues ) {
+    
+    int numCells = inWidth * inHeight;
+    
+    if( useMapTileDB ) {
+        tileDBGetRegion( inXStart, inYStart, inWidth, inHeight );
+        
+        if( outValues != NULL ) {
+            for( int i=0; i<numCells; i++ ) {
+                outValues[i] = dbFloorGet( inXStart + i % inWidth,
+                                           inYStart + i / inWidth );
+                }
+            }
+        return;
+        }
+    
+    int *missIndices = new int[ numCells ];
+    unsigned char *keys = new unsigned char[ numCells * 8 ];
+    
+    int numMisses = 0;
+    
+    for( int i=0; i<numCells; i++ ) {
+        int x = inXStart + i % inWidth;
+        int y = inYStart + i / inWidth;
+        
+        int cachedVal = dbFloorGetCached( x, y );
+        
+        if( cachedVal != -2 ) {
+            if( outValues != NULL ) {
+                outValues[i] = cachedVal;
+                }
+            }
+        else {
+            intPairToKey( x, y, &( keys[ numMisses * 8 ] ) );
+            missIndices[ numMisses ] = i;
+            numMisses++;
+            }
+        }
+    
+    if( numMisses > 0 ) {
+        unsigned char *values = new unsigned char[ numMisses * 4 ];
+        int *results = new int[ numMisses ];
+        
+        int error = DB_getBatch( &floorDB, numMisses, keys, values, results );
+        
+        // writes still pending in buffer are newer than DB file
+        if( ! error && floorDBWriteBuffer != NULL ) {
+            for( int m=0; m<numMisses; m++ ) {
+                int pending = 
+                    floorDBWriteBuffer->get( &( keys[ m * 8 ] ), 
+                                             &( values[ m * 4 ] ) );
+                if( pending != -1 ) {
+                    // 1 for pending delete, reads as not found
+                    results[m] = pending;
+                    }
+                }
+            }
+        
+        for( int m=0; m<numMisses; m++ ) {
+            int i = missIndices[m];
+            int x = inXStart + i % inWidth;
+            int y = inYStart + i / inWidth;
+            
+            int val;
+            
+            if( error ) {
+                val = dbFloorGet( x, y );
+                }
+            else {
+                if( results[m] == 0 ) {
+                    val = valueToInt( &( values[ m * 4 ] ) );
+                    }
+                else {
+                    val = -1;
+                    }
+                dbFloorPutCached( x, y, val );
+                }
+            
+            if( outValues != NULL ) {
+                outValues[i] = val;
+                }
+            }
+        delete [] values;
+        delete [] results;
         }
+    
+    delete [] missIndices;
+    delete [] keys;
     }
  
  
  
 // returns 0 if not found
 static timeSec_t dbFloorTimeGet( int inX, int inY ) {
+    
+    timeSec_t cachedVal = dbFloorTimeGetCached( inX, inY );
+    if( cachedVal != 1 ) {
+        
+        return cachedVal;
+        }
+    
+    if( useMapTileDB ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        return r.floorEtaDecay;
+        }
+    
     unsigned char key[8];
     unsigned char value[8];
  
     intPairToKey( inX, inY, key );
    
-    int result = DB_get( &floorTimeDB, key, value );
+    int result = mapDBGet( &floorTimeDB, floorTimeDBWriteBuffer, key,
+                           value );
    
+    timeSec_t timeVal;
+    
     if( result == 0 ) {
         // found
-        return valueToTime( value );
+        timeVal = valueToTime( value );
         }
     else {
-        return 0;
+        timeVal = 0;
         }
+    
+    dbFloorTimePutCached( inX, inY, timeVal );
+    
+    return timeVal;
     }
  
  
@@ -4669,7 +7248,7 @@ timeSec_t dbLookTimeGet( int inX, int inY ) {
  
     intPairToKey( inX/100, inY/100, key );
    
-    int result = DB_get( &lookTimeDB, key, value );
+    int result = mapDBGet( &lookTimeDB, lookTimeDBWriteBuffer, key, value );
    
     if( result == 0 ) {
         // found
@@ -4755,7 +7334,30 @@ static void dbPut( int inX, int inY, int inSlot, int inValue,
     intToValue( inValue, value );
            
    
-    DB_put( &db, key, value );
+    if( isTileDBSlot( inSlot, inSubCont ) ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        
+        if( inSlot == 0 ) {
+            r.object = inValue;
+            }
+        else if( inValue == 0 ) {
+            // emptied container, same as not set
+            r.numContained = -1;
+            }
+        else {
+            r.numContained = inValue;
+            }
+        tileDBPut( inX, inY, &r );
+        }
+    else if( inSlot == NUM_CONT_SLOT && inValue == 0 ) {
+        // emptied container, same as no record
+        // (but never delete slot 0, where no record means natural object)
+        mapDBDelete( &db, dbWriteBuffer, key );
+        }
+    else {
+        mapDBPut( &db, dbWriteBuffer, key, value );
+        }
  
     dbPutCached( inX, inY, inSlot, inSubCont, inValue );
     }
@@ -4764,6 +7366,282 @@ static void dbPut( int inX, int inY, int inSlot, int inValue,
  
  
  
+// Earliest ETA of anything (object, floor, or contained) in each
+// ETA_REGION_SIZE square of cells, so that look-ins can skip whole
+// regions where nothing will decay soon.
+//
+// Built from the time DBs in initMap.  After that, a put with an earlier
+// ETA lowers its region's earliest ETA.  Any other put may have replaced
+// the earliest one, so it marks the region loose instead, and a loose
+// region is re-read the next time that its earliest ETA looks due.
+//
+// Regions with no record have no ETAs at all.
+
+#define ETA_REGION_BITS 4
+#define ETA_REGION_SIZE ( 1 << ETA_REGION_BITS )
+
+
+typedef struct EtaRegionRecord {
+        timeSec_t earliestETA;
+        
+        // true if earliestETA may be earlier than any ETA in region
+        char loose;
+    } EtaRegionRecord;
+
+static EtaRegionRecord defaultEtaRegionRecord = { 0, false };
+
+static FlatHashTable<EtaRegionRecord> 
+etaRegions( 1024, defaultEtaRegionRecord );
+
+// every region is treated as due until built
+static char etaRegionsBuilt = false;
+
+
+// regions that look-ins skipped or scanned
+// (only counting regions with cells that weren't looked at recently)
+static double etaRegionsSkipped = 0;
+static double etaRegionsScanned = 0;
+// loose regions re-read
+static double etaRegionsRescanned = 0;
+
+
+
+static void noteRegionETA( int inX, int inY, timeSec_t inETA ) {
+    if( ! etaRegionsBuilt ) {
+        // all ETAs get picked up when built
+        return;
+        }
+    
+    EtaRegionRecord *r = 
+        etaRegions.lookupPointer( inX >> ETA_REGION_BITS, 
+                                  inY >> ETA_REGION_BITS, 0, 0 );
+    
+    if( inETA == 0 ) {
+        // ETA removed
+        if( r != NULL ) {
+            r->loose = true;
+            }
+        return;
+        }
+    
+    if( r == NULL ) {
+        EtaRegionRecord newRecord = { inETA, false };
+        
+        etaRegions.insert( inX >> ETA_REGION_BITS, inY >> ETA_REGION_BITS,
+                           0, 0, newRecord );
+        }
+    else if( inETA < r->earliestETA ) {
+        r->earliestETA = inETA;
+        }
+    else {
+        r->loose = true;
+        }
+    }
+
+
+
+// for building from DB values
+static void lowerRegionETA( int inX, int inY, timeSec_t inETA ) {
+    if( inETA == 0 ) {
+        return;
+        }
+    
+    EtaRegionRecord *r = 
+        etaRegions.lookupPointer( inX >> ETA_REGION_BITS, 
+                                  inY >> ETA_REGION_BITS, 0, 0 );
+    
+    if( r == NULL ) {
+        EtaRegionRecord newRecord = { inETA, false };
+        
+        etaRegions.insert( inX >> ETA_REGION_BITS, inY >> ETA_REGION_BITS,
+                           0, 0, newRecord );
+        }
+    else if( inETA < r->earliestETA ) {
+        r->earliestETA = inETA;
+        }
+    }
+
+
+
+static void buildEtaRegions() {
+    double startTime = Time::getCurrentTime();
+    
+    etaRegions.clear();
+    etaRegionsBuilt = false;
+    
+    // iterators read DB files directly
+    flushMapWriteBuffers();
+    
+    unsigned char key[16];
+    unsigned char value[8];
+    
+    int numRecords = 0;
+    
+    // mapTime.db holds object and contained ETAs, and floorTime.db holds
+    // floor ETAs, except for those kept in mapTile.db
+    // (stale records for slots that are gone just make regions loose)
+    DB_Iterator dbi;
+    
+    DB_Iterator_init( &timeDB, &dbi );
+    
+    while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
+        lowerRegionETA( valueToInt( key ), valueToInt( &( key[4] ) ),
+                        valueToTime( value ) );
+        numRecords++;
+        }
+    
+    DB_Iterator_init( &floorTimeDB, &dbi );
+    
+    while( DB_Iterator_next( &dbi, key, value ) > 0 ) {
+        lowerRegionETA( valueToInt( key ), valueToInt( &( key[4] ) ),
+                        valueToTime( value ) );
+        numRecords++;
+        }
+    
+    if( useMapTileDB ) {
+        REGIONDB_Iterator tileDBi;
+        REGIONDB_Iterator_init( &tileDB, &tileDBi );
+        
+        unsigned char tileValue[ TILE_RECORD_SIZE ];
+        int x, y;
+        
+        while( REGIONDB_Iterator_next( &tileDBi, &x, &y, tileValue ) > 0 ) {
+            TileRecord r;
+            valueToTileRecord( tileValue, &r );
+            
+            lowerRegionETA( x, y, r.etaDecay );
+            lowerRegionETA( x, y, r.floorEtaDecay );
+            numRecords++;
+            }
+        }
+    
+    etaRegionsBuilt = true;
+    
+    AppLog::infoF( "Built earliest ETAs for %d %dx%d regions from %d "
+                   "records in %.2f sec",
+                   etaRegions.getNumElements(), 
+                   ETA_REGION_SIZE, ETA_REGION_SIZE,
+                   numRecords, Time::getCurrentTime() - startTime );
+    }
+
+
+
+static void lowerContainedETAs( int inX, int inY, int inSubCont,
+                                timeSec_t *ioEarliest ) {
+    int numCont = getNumContained( inX, inY, inSubCont );
+    
+    for( int c=0; c<numCont; c++ ) {
+        timeSec_t eta = getSlotEtaDecay( inX, inY, c, inSubCont );
+        
+        if( eta != 0 && ( *ioEarliest == 0 || eta < *ioEarliest ) ) {
+            *ioEarliest = eta;
+            }
+        
+        if( inSubCont == 0 && getContained( inX, inY, c ) < 0 ) {
+            lowerContainedETAs( inX, inY, c + 1, ioEarliest );
+            }
+        }
+    }
+
+
+
+// re-reads every ETA in a loose region
+static void rescanEtaRegion( int inRegionX, int inRegionY ) {
+    etaRegionsRescanned++;
+    
+    int xStart = inRegionX * ETA_REGION_SIZE;
+    int yStart = inRegionY * ETA_REGION_SIZE;
+    
+    // batched reads into caches
+    dbTimeGetRegion( xStart, yStart, ETA_REGION_SIZE, ETA_REGION_SIZE,
+                     DECAY_SLOT, 0, NULL );
+    dbGetRegion( xStart, yStart, ETA_REGION_SIZE, ETA_REGION_SIZE,
+                 NUM_CONT_SLOT, 0, NULL );
+    
+    timeSec_t earliest = 0;
+    
+    for( int y=yStart; y<yStart + ETA_REGION_SIZE; y++ ) {
+        for( int x=xStart; x<xStart + ETA_REGION_SIZE; x++ ) {
+            timeSec_t etas[2] = { getEtaDecay( x, y ),
+                                  getFloorEtaDecay( x, y ) };
+            
+            for( int i=0; i<2; i++ ) {
+                if( etas[i] != 0 && 
+                    ( earliest == 0 || etas[i] < earliest ) ) {
+                    earliest = etas[i];
+                    }
+                }
+            
+            lowerContainedETAs( x, y, 0, &earliest );
+            }
+        }
+    
+    if( earliest == 0 ) {
+        etaRegions.remove( inRegionX, inRegionY, 0, 0 );
+        }
+    else {
+        EtaRegionRecord r = { earliest, false };
+        etaRegions.insert( inRegionX, inRegionY, 0, 0, r );
+        }
+    }
+
+
+
+// true if something in region might decay before inTime
+static char isEtaRegionDue( int inRegionX, int inRegionY, 
+                            timeSec_t inTime ) {
+    if( ! etaRegionsBuilt ) {
+        return true;
+        }
+    
+    EtaRegionRecord *r = 
+        etaRegions.lookupPointer( inRegionX, inRegionY, 0, 0 );
+    
+    if( r == NULL || r->earliestETA >= inTime ) {
+        return false;
+        }
+    
+    if( ! r->loose ) {
+        return true;
+        }
+    
+    rescanEtaRegion( inRegionX, inRegionY );
+    
+    r = etaRegions.lookupPointer( inRegionX, inRegionY, 0, 0 );
+    
+    return r != NULL && r->earliestETA < inTime;
+    }
+
+
+
+static void logEtaRegionStats() {
+    double total = etaRegionsSkipped + etaRegionsScanned;
+    
+    double skipRate = 0;
+    if( total > 0 ) {
+        skipRate = etaRegionsSkipped / total;
+        }
+    
+    AppLog::infoF( "Look-in ETA regions:  %.0f skipped, %.0f scanned "
+                   "(%.1f%% skipped), %.0f loose regions re-read, "
+                   "%d regions with ETAs",
+                   etaRegionsSkipped, etaRegionsScanned, 100 * skipRate,
+                   etaRegionsRescanned, etaRegions.getNumElements() );
+    }
+
+
+
+static void freeEtaRegions() {
+    logEtaRegionStats();
+    
+    etaRegions.clear();
+    etaRegionsBuilt = false;
+    }
+
+
+
+
+
 static void dbTimePut( int inX, int inY, int inSlot, timeSec_t inTime,
                        int inSubCont = 0 ) {
     // ETA decay changes don't get reported as map changes    
@@ -4776,9 +7654,23 @@ static void dbTimePut( int inX, int inY, int inSlot, timeSec_t inTime,
     timeToValue( inTime, value );
            
    
-    DB_put( &timeDB, key, value );
+    if( isTileDBTimeSlot( inSlot, inSubCont ) ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        r.etaDecay = inTime;
+        tileDBPut( inX, inY, &r );
+        }
+    else if( inTime == 0 ) {
+        // no decay, same as no record
+        mapDBDelete( &timeDB, timeDBWriteBuffer, key );
+        }
+    else {
+        mapDBPut( &timeDB, timeDBWriteBuffer, key, value );
+        }
  
     dbTimePutCached( inX, inY, inSlot, inSubCont, inTime );
+    
+    noteRegionETA( inX, inY, inTime );
     }
  
  
@@ -4819,7 +7711,27 @@ static void dbFloorPut( int inX, int inY, int inValue ) {
     intToValue( inValue, value );
            
    
-    DB_put( &floorDB, key, value );
+    if( useMapTileDB ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        
+        if( inValue == 0 ) {
+            r.floor = -1;
+            }
+        else {
+            r.floor = inValue;
+            }
+        tileDBPut( inX, inY, &r );
+        }
+    else if( inValue == 0 ) {
+        // floor removed, same as no record
+        mapDBDelete( &floorDB, floorDBWriteBuffer, key );
+        }
+    else {
+        mapDBPut( &floorDB, floorDBWriteBuffer, key, value );
+        }
+    
+    dbFloorPutCached( inX, inY, inValue );
     }
  
  
@@ -4835,7 +7747,22 @@ static void dbFloorTimePut( int inX, int inY, timeSec_t inTime ) {
     timeToValue( inTime, value );
            
    
-    DB_put( &floorTimeDB, key, value );
+    if( useMapTileDB ) {
+        TileRecord r;
+        tileDBGet( inX, inY, &r );
+        r.floorEtaDecay = inTime;
+        tileDBPut( inX, inY, &r );
+        }
+    else if( inTime == 0 ) {
+        mapDBDelete( &floorTimeDB, floorTimeDBWriteBuffer, key );
+        }
+    else {
+        mapDBPut( &floorTimeDB, floorTimeDBWriteBuffer, key, value );
+        }
+    
+    dbFloorTimePutCached( inX, inY, inTime );
+    
+    noteRegionETA( inX, inY, inTime );
     }
  
  
@@ -4851,7 +7778,7 @@ void dbLookTimePut( int inX, int inY, timeSec_t inTime ) {
     timeToValue( inTime, value );
            
    
-    DB_put( &lookTimeDB, key, value );
+    mapDBPut( &lookTimeDB, lookTimeDBWriteBuffer, key, value );
     }
  
  
@@ -4874,19 +7801,19 @@ static char isDecayTransAlwaysLiveTracked( TransRecord *inTrans ) {
 // slot is 0 for main map cell, or higher for container slots
 static void trackETA( int inX, int inY, int inSlot, timeSec_t inETA,
                       int inSubCont = 0,
-                      TransRecord *inApplicableTrans = NULL ) {
+                      TransRecord *inApplicableTrans = NULL,
+                      char inFloor = false ) {
    
     timeSec_t timeLeft = inETA - MAP_TIMESEC;
        
     if( timeLeft < maxSecondsForActiveDecayTracking ) {
         // track it live
            
-        // duplicates okay
-        // we'll deal with them when they ripen
-        // (we check the true ETA stored in map before acting
+        // a cell or slot already in queue is moved to new ETA
+        // (we still check the true ETA stored in map before acting
         //   on one stored in this queue)
         LiveDecayRecord r = { inX, inY, inSlot, inETA, inSubCont,
-                              inApplicableTrans };
+                              inApplicableTrans, inFloor };
            
         char exists;
         timeSec_t existingETA =
@@ -4895,8 +7822,21 @@ static void trackETA( int inX, int inY, int inSlot, timeSec_t inETA,
                                                     &exists );
  
         if( !exists || existingETA != inETA ) {
-           
-            liveDecayQueue.insert( r, inETA );
+            
+            char handleFound;
+            int handle = 
+                liveDecayQueueHandles.lookup( inX, inY, inSlot * 2 + inFloor,
+                                              inSubCont, &handleFound );
+            
+            if( handleFound ) {
+                *( liveDecayQueue.getItem( handle ) ) = r;
+                liveDecayQueue.reschedule( handle, inETA );
+                }
+            else {
+                handle = liveDecayQueue.insert( r, inETA );
+                liveDecayQueueHandles.insert( inX, inY, inSlot * 2 + inFloor,
+                                              inSubCont, handle );
+                }
            
             liveDecayRecordPresentHashTable.insert( inX, inY, inSlot,
                                                     inSubCont, inETA );
@@ -5175,6 +8115,41 @@ static void changeContained( int inX, int inY, int inSlotNumber,
 
  
  
+// inID's decay, due at inETA, is part of a decay chain
+// applies whole chain up to now in one step
+static int catchUpDecayObject( int inX, int inY, int inID, 
+                               timeSec_t inETA ) {
+    
+    double secondsLeft;
+    
+    int newID = getDecayChainResult( getDecayChainNext( inID ),
+                                     MAP_TIMESEC - inETA,
+                                     &secondsLeft );
+    
+    setMapObjectRaw( inX, inY, newID );
+    
+    timeSec_t mapETA = 0;
+    
+    if( secondsLeft > 0 ) {
+        // add some random variation to avoid lock-step
+        // especially after a server restart
+        double tweakedSeconds =
+            randSource.getRandomBoundedDouble( secondsLeft * 0.9,
+                                               secondsLeft );
+        
+        if( secondsLeft - tweakedSeconds > 5.0 )
+            tweakedSeconds = secondsLeft - 5.0;
+        
+        mapETA = MAP_TIMESEC + tweakedSeconds;
+        }
+    
+    setEtaDecay( inX, inY, mapETA, getTrans( -1, newID ) );
+    
+    return newID;
+    }
+
+
+
 int checkDecayObject( int inX, int inY, int inID ) {
     if( inID == 0 ) {
         return inID;
@@ -5204,6 +8179,15 @@ int checkDecayObject( int inX, int inY, int inID ) {
    
     if( mapETA != 0 ) {
        
+        if( mapETA <= MAP_TIMESEC &&
+            getDecayChainNext( inID ) != -1 ) {
+            
+            // a decay that always has the same result
+            // skip over any others that have happened since, in case
+            // no one has been watching
+            return catchUpDecayObject( inX, inY, inID, mapETA );
+            }
+        
         if( mapETA <= MAP_TIMESEC ) {
            
             // object in map has decayed (eta expired)
@@ -6166,7 +9150,43 @@ void checkDecayContained( int inX, int inY, int inSubCont ) {
    
         if( mapETA != 0 ) {
        
-            if( mapETA <= MAP_TIMESEC ) {
+            if( mapETA <= MAP_TIMESEC &&
+                ! isSubCont &&
+                ! isInContTrans( containerID ) &&
+                getDecayChainNext( oldID ) != -1 ) {
+                
+                // a decay that always has the same result, with no
+                // containment transitions to consider
+                // skip over any others that have happened since
+                
+                float stretch = 
+                    getMapContainerTimeStretch( inX, inY, inSubCont );
+                
+                double secondsLeft;
+                
+                newID = getDecayChainResult( getDecayChainNext( oldID ),
+                                             ( MAP_TIMESEC - mapETA ) * 
+                                             stretch,
+                                             &secondsLeft );
+                
+                if( newID != oldID ) {
+                    change = true;
+                    }
+                
+                mapETA = 0;
+                
+                if( secondsLeft > 0 ) {
+                    double tweakedSeconds =
+                        randSource.getRandomBoundedDouble( secondsLeft * 0.9,
+                                                           secondsLeft );
+
+                    if( secondsLeft - tweakedSeconds > 5.0 )
+                        tweakedSeconds = secondsLeft - 5.0;
+
+                    mapETA = MAP_TIMESEC + tweakedSeconds / stretch;
+                    }
+                }
+            else if( mapETA <= MAP_TIMESEC ) {
            
                 // object in container slot has decayed (eta expired)
                
@@ -6433,17 +9453,30 @@ void checkDecayContained( int inX, int inY, int inSubCont ) {
  
  
  
-int getTweakedBaseMap( int inX, int inY ) {
+typedef int ( *BaseMapFunction )( int inX, int inY, 
+                                  char *outGridPlacement );
+
+typedef int ( *BiomeIndexFunction )( int inX, int inY );
+
+
+
+static int getMapBiomeIndexOnly( int inX, int inY ) {
+    return getMapBiomeIndex( inX, inY );
+    }
+
+
+
+// base map with neighbor-based tweaks applied, reading base map and biome
+// through the given functions
+static int tweakBaseMap( int inX, int inY, BaseMapFunction inGetBaseMap,
+                         BiomeIndexFunction inGetBiomeIndex ) {
    
     // nothing in map
     char wasGridPlacement = false;
        
-    int result = getBaseMap( inX, inY, &wasGridPlacement );
+    int result = inGetBaseMap( inX, inY, &wasGridPlacement );
     
-    int secondPlace;
-    double secondPlaceGap;
-
-    int pickedBiome = getMapBiomeIndex( inX, inY, &secondPlace, &secondPlaceGap );
+    int pickedBiome = inGetBiomeIndex( inX, inY );
     if( biomes[pickedBiome] == 7 || biomes[pickedBiome] == 9 ) return result;
     
  
@@ -6458,7 +9491,7 @@ int getTweakedBaseMap( int inX, int inY ) {
                  dx <= ( o->rightBlockingRadius + maxR ); dx++ ) {
                    
                 if( dx != 0 ) {
-                    int nID = getBaseMap( inX + dx, inY );
+                    int nID = inGetBaseMap( inX + dx, inY, NULL );
                        
                     if( nID > 0 ) {
                         ObjectRecord *nO = getObject( nID );
@@ -6518,13 +9551,13 @@ int getTweakedBaseMap( int inX, int inY ) {
             // midline measure just to keep the map the same
  
             // south
-            int sID = getBaseMap( inX, inY - 1 );
+            int sID = inGetBaseMap( inX, inY - 1, NULL );
                        
             if( sID > 0 && getObjectHeight( sID ) >= 2 ) {
                 return 0;
                 }
                
-            int s2ID = getBaseMap( inX, inY - 2 );
+            int s2ID = inGetBaseMap( inX, inY - 2, NULL );
                        
             if( s2ID > 0 && getObjectHeight( s2ID ) >= 3 ) {
                 return 0;
@@ -6533,6 +9566,12 @@ int getTweakedBaseMap( int inX, int inY ) {
         }
     return result;
     }
+
+
+
+int getTweakedBaseMap( int inX, int inY ) {
+    return tweakBaseMap( inX, inY, &getBaseMap, &getMapBiomeIndexOnly );
+    }
  
  
  
@@ -6604,6 +9643,20 @@ int getMapObjectRaw( int inX, int inY ) {
  
 void lookAtRegion( int inXStart, int inYStart, int inXEnd, int inYEnd ) {
     timeSec_t currentTime = MAP_TIMESEC;
+    
+    // ETA regions overlapping look region
+    // 0 until checked, then 1 to skip or 2 to scan
+    int regionXStart = inXStart >> ETA_REGION_BITS;
+    int regionYStart = inYStart >> ETA_REGION_BITS;
+    int regionsWide = ( inXEnd >> ETA_REGION_BITS ) - regionXStart + 1;
+    int regionsHigh = ( inYEnd >> ETA_REGION_BITS ) - regionYStart + 1;
+    
+    if( regionsWide < 1 || regionsHigh < 1 ) {
+        return;
+        }
+    
+    char *regionStates = new char[ regionsWide * regionsHigh ];
+    memset( regionStates, 0, regionsWide * regionsHigh );
    
     for( int y=inYStart; y<=inYEnd; y++ ) {
         for( int x=inXStart; x<=inXEnd; x++ ) {
@@ -6612,12 +9665,36 @@ void lookAtRegion( int inXStart, int inYStart, int inXEnd, int inYEnd ) {
             if( ! lookTimeTracking.checkExists( x, y, currentTime ) ) {
                
                 // we haven't looked at this spot in a while
+                
+                char *regionState = 
+                    &( regionStates[ 
+                           ( ( y >> ETA_REGION_BITS ) - regionYStart ) * 
+                           regionsWide +
+                           ( x >> ETA_REGION_BITS ) - regionXStart ] );
+                
+                if( *regionState == 0 ) {
+                    if( isEtaRegionDue( x >> ETA_REGION_BITS, 
+                                        y >> ETA_REGION_BITS,
+                                        currentTime + 
+                                        maxSecondsForActiveDecayTracking ) ) {
+                        *regionState = 2;
+                        etaRegionsScanned++;
+                        }
+                    else {
+                        *regionState = 1;
+                        etaRegionsSkipped++;
+                        }
+                    }
                
                 // see if any decays apply
                 // if so, get that part of the tile once to re-trigger
                 // live tracking
  
-                timeSec_t floorEtaDecay = getFloorEtaDecay( x, y );
+                timeSec_t floorEtaDecay = 0;
+                
+                if( *regionState == 2 ) {
+                    floorEtaDecay = getFloorEtaDecay( x, y );
+                    }
                
                 if( floorEtaDecay != 0 &&
                     floorEtaDecay <
@@ -6628,7 +9705,11 @@ void lookAtRegion( int inXStart, int inYStart, int inXEnd, int inYEnd ) {
                
                    
  
-                timeSec_t etaDecay = getEtaDecay( x, y );
+                timeSec_t etaDecay = 0;
+                
+                if( *regionState == 2 ) {
+                    etaDecay = getEtaDecay( x, y );
+                    }
                
                 int objID = 0;
                
@@ -6700,6 +9781,8 @@ void lookAtRegion( int inXStart, int inYStart, int inXEnd, int inYEnd ) {
                 }
             }
         }
+    
+    delete [] regionStates;
     }
  
  
@@ -6800,6 +9883,22 @@ unsigned char *getChunkMessage( int inStartX, int inStartY,
     dbLookTimePut( inStartX, endY, curTime );
     dbLookTimePut( endX, inStartY, curTime );
     dbLookTimePut( endX, endY, curTime );
+    
+    // pull objects, their decay times, container counts, and floors
+    // for the whole chunk into the DB caches with batched reads
+    // the per-cell calls below then hit the cache instead of doing a
+    // random read for each cell
+    // (with useMapTileDB, the first of these reads all of them, and the
+    //  rest find every cell cached already)
+    dbGetRegion( inStartX, inStartY, inWidth, inHeight, 0, 0, NULL );
+    dbTimeGetRegion( inStartX, inStartY, inWidth, inHeight, 
+                     DECAY_SLOT, 0, NULL );
+    dbGetRegion( inStartX, inStartY, inWidth, inHeight, 
+                 NUM_CONT_SLOT, 0, NULL );
+    dbFloorGetRegion( inStartX, inStartY, inWidth, inHeight, NULL );
+    
+    // base map and biomes for whole chunk, a row at a time
+    generateMapRegions( inStartX, inStartY, inWidth, inHeight );
    
     for( int y=inStartY; y<endY; y++ ) {
         int chunkY = y - inStartY;
@@ -8432,7 +11531,8 @@ void setFloorEtaDecay( int inX, int inY, timeSec_t inAbsoluteTimeInSeconds,
                        TransRecord *inApplicableTrans ) {
     dbFloorTimePut( inX, inY, inAbsoluteTimeInSeconds );
     if( inAbsoluteTimeInSeconds != 0 ) {
-        trackETA( inX, inY, 0, inAbsoluteTimeInSeconds, 0, inApplicableTrans );
+        trackETA( inX, inY, 0, inAbsoluteTimeInSeconds, 0, inApplicableTrans,
+                  true );
         }
     }
  
@@ -8446,13 +11546,13 @@ timeSec_t getFloorEtaDecay( int inX, int inY ) {
  
  
 double getNextDecayDelta() {
-    if( liveDecayQueue.size() == 0 ) {
+    timeSec_t minTime;
+    
+    if( ! liveDecayQueue.getNextETA( &minTime ) ) {
         return -1;
         }
    
     timeSec_t curTime = MAP_TIMESEC;
- 
-    timeSec_t minTime = liveDecayQueue.checkMinPriority();
    
    
     if( minTime <= curTime ) {
@@ -8511,21 +11611,288 @@ static void cleanMaxContainedHashTable( int inX, int inY ) {
  
  
  
+static void checkpointMapDBs() {
+    flushMapWriteBuffers();
+    
+    if( dbOpen ) {
+        DB_sync( &db );
+        }
+    if( timeDBOpen ) {
+        DB_sync( &timeDB );
+        }
+    if( biomeDBOpen ) {
+        DB_sync( &biomeDB );
+        }
+    if( floorDBOpen ) {
+        DB_sync( &floorDB );
+        }
+    if( floorTimeDBOpen ) {
+        DB_sync( &floorTimeDB );
+        }
+    if( tileDBOpen ) {
+        REGIONDB_flush( &tileDB );
+        }
+    if( lookTimeDBOpen ) {
+        DB_sync( &lookTimeDB );
+        }
+    if( persistentMapDBOpen ) {
+        DB_sync( &persistentMapDB );
+        }
+    }
+ 
+ 
+ 
+ 
+typedef struct SnapshotDBRecord {
+        const char *fileName;
+        DB *db;
+        char *isOpen;
+        DBWriteBuffer **buffer;
+        // true if buffer only exists for the length of the snapshot
+        char tempBuffer;
+    } SnapshotDBRecord;
+
+
+static SnapshotDBRecord snapshotDBs[] = {
+    { "lookTime.db", &lookTimeDB, &lookTimeDBOpen, 
+      &lookTimeDBWriteBuffer, false },
+    { "map.db", &db, &dbOpen, &dbWriteBuffer, false },
+    { "mapTime.db", &timeDB, &timeDBOpen, &timeDBWriteBuffer, false },
+    { "biome.db", &biomeDB, &biomeDBOpen, &biomeDBWriteBuffer, false },
+    { "eve.db", &eveDB, &eveDBOpen, &eveDBWriteBuffer, false },
+    { "floor.db", &floorDB, &floorDBOpen, &floorDBWriteBuffer, false },
+    { "floorTime.db", &floorTimeDB, &floorTimeDBOpen, 
+      &floorTimeDBWriteBuffer, false } };
+
+#define NUM_SNAPSHOT_DBS \
+    (int)( sizeof( snapshotDBs ) / sizeof( SnapshotDBRecord ) )
+
+
+
+static void addSnapshotFile( SimpleVector<char*> *outFileNames,
+                             const char *inFileName ) {
+    File f( NULL, inFileName );
+    
+    if( f.exists() ) {
+        outFileNames->push_back( stringDuplicate( inFileName ) );
+        }
+    }
+
+
+
+static void addSnapshotFiles( SimpleVector<char*> *outFileNames ) {
+    for( int i=0; i<NUM_SNAPSHOT_DBS; i++ ) {
+        SnapshotDBRecord *r = &( snapshotDBs[i] );
+        
+        if( ! *( r->isOpen ) ) {
+            continue;
+            }
+        
+        addSnapshotFile( outFileNames, r->fileName );
+        
+        // journal of empty slots is part of DB state
+        // index file is not, it's rebuilt when missing
+        char *holesName = autoSprintf( "%s.holes", r->fileName );
+        addSnapshotFile( outFileNames, holesName );
+        delete [] holesName;
+        }
+    
+    if( tileDBOpen && tileDB.holdWrites ) {
+        addSnapshotFile( outFileNames, "mapTile.db" );
+        addSnapshotFile( outFileNames, "mapTile.db.cold" );
+        }
+    }
+
+
+
+char beginMapSnapshot( SimpleVector<char*> *outFileNames ) {
+    if( mapSnapshotActive ) {
+        // already frozen for another holder
+        numMapSnapshotHolders++;
+        addSnapshotFiles( outFileNames );
+        return true;
+        }
+    
+    // everything written so far goes into the snapshot
+    flushMapWriteBuffers();
+    
+    for( int i=0; i<NUM_SNAPSHOT_DBS; i++ ) {
+        SnapshotDBRecord *r = &( snapshotDBs[i] );
+        
+        if( ! *( r->isOpen ) ) {
+            continue;
+            }
+        
+        if( *( r->buffer ) == NULL ) {
+            *( r->buffer ) = new DBWriteBuffer( r->db, 
+                                                mapWriteBufferMaxRecords );
+            r->tempBuffer = true;
+            }
+        
+        ( *( r->buffer ) )->setHold( true );
+        
+        DB_sync( r->db );
+        }
+    
+    if( tileDBOpen ) {
+        if( REGIONDB_holdWrites( &tileDB, true ) == -1 ) {
+            AppLog::error( "Failed to hold mapTile.db writes for snapshot" );
+            }
+        }
+    
+    addSnapshotFiles( outFileNames );
+    
+    mapSnapshotActive = true;
+    numMapSnapshotHolders = 1;
+    
+    AppLog::infoF( "Map DB files frozen for snapshot (%d files)",
+                   outFileNames->size() );
+    
+    return true;
+    }
+
+
+
+void endMapSnapshot() {
+    if( ! mapSnapshotActive ) {
+        return;
+        }
+    
+    numMapSnapshotHolders--;
+    
+    if( numMapSnapshotHolders > 0 ) {
+        return;
+        }
+    
+    int numHeld = 0;
+    
+    for( int i=0; i<NUM_SNAPSHOT_DBS; i++ ) {
+        SnapshotDBRecord *r = &( snapshotDBs[i] );
+        
+        DBWriteBuffer *b = *( r->buffer );
+        
+        if( b == NULL ) {
+            continue;
+            }
+        
+        numHeld += b->getNumPending();
+        
+        b->setHold( false );
+        flushWriteBuffer( b );
+        
+        if( r->tempBuffer ) {
+            delete b;
+            *( r->buffer ) = NULL;
+            r->tempBuffer = false;
+            }
+        }
+    
+    int numHeldPages = 0;
+    
+    if( tileDBOpen ) {
+        numHeldPages = tileDB.numDeltaPages;
+        
+        if( REGIONDB_holdWrites( &tileDB, false ) == -1 ) {
+            AppLog::error( "Failed to write held mapTile.db pages" );
+            }
+        }
+    
+    mapSnapshotActive = false;
+    
+    AppLog::infoF( "Map DB snapshot released, wrote %d held records "
+                   "and %d held mapTile.db pages", 
+                   numHeld, numHeldPages );
+    }
+
+
+
+char isMapSnapshotActive() {
+    return mapSnapshotActive;
+    }
+
+
+
+
 void stepMap( SimpleVector<MapChangeRecord> *inMapChanges,
               SimpleVector<ChangePosition> *inChangePosList ) {
    
     timeSec_t curTime = MAP_TIMESEC;
+    
+    // regions that generator threads finished since last step
+    collectMapRegions();
+ 
+    if( mmapMapDB ) {
+        double wallTime = Time::getCurrentTime();
+        
+        if( wallTime - lastMmapCheckpointTime > mmapCheckpointSeconds ) {
+            // kernel writes dirty pages back eventually anyway, but
+            // don't leave them hanging for too long
+            checkpointMapDBs();
+            lastMmapCheckpointTime = wallTime;
+            }
+        }
+    
+    double flushWallTime = Time::getCurrentTime();
+    
+    // repeated puts to same tile between flushes only hit the
+    // DB file once
+    if( flushWallTime - lastMapWriteBufferFlushTime > 
+        mapWriteBufferFlushSeconds ) {
+        // flush is a no-op if buffering is off
+        flushMapWriteBuffers();
+        
+        // after flush, so that buffered deletes get compacted too
+        // files must not move while a snapshot is being copied
+        if( dbCompactRecordsPerStep > 0 && ! mapSnapshotActive ) {
+            DB_compact( &db, dbCompactRecordsPerStep );
+            DB_compact( &timeDB, dbCompactRecordsPerStep );
+            DB_compact( &floorDB, dbCompactRecordsPerStep );
+            DB_compact( &floorTimeDB, dbCompactRecordsPerStep );
+            
+            if( tileDBOpen ) {
+                // pages hold many records each
+                REGIONDB_compact( &tileDB, 
+                                  dbCompactRecordsPerStep / 
+                                  REGIONDB_CELLS_PER_REGION + 1 );
+                }
+            }
+        
+        if( tileDBOpen && mapColdRegionSeconds > 0 && ! mapSnapshotActive ) {
+            // frozen pages are emptied, and dropped by compaction above
+            // on later steps
+            uint32_t oldCursor = tileDB.freezeCursor;
+            
+            if( REGIONDB_freeze( &tileDB, COLD_REGION_PAGES_PER_STEP,
+                                 isColdTileDBRegion ) == -1 ) {
+                AppLog::error( "Error freezing cold mapTile.db regions" );
+                }
+            
+            if( tileDB.freezeCursor < oldCursor ) {
+                // finished a pass through file
+                logTileDBStats();
+                }
+            }
+        lastMapWriteBufferFlushTime = flushWallTime;
+        }
+    
+    if( flushWallTime - lastMapCacheStatsTime > MAP_CACHE_STATS_SECONDS ) {
+        logMapCacheStats();
+        logEtaRegionStats();
+        lastMapCacheStatsTime = flushWallTime;
+        }
  
    
     lookTimeTracking.cleanStale( curTime - noLookCountAsStaleSeconds );
  
  
-    while( liveDecayQueue.size() > 0 &&
-           liveDecayQueue.checkMinPriority() <= curTime ) {
+    LiveDecayRecord r;
+    
+    while( liveDecayQueue.popDue( curTime, &r ) ) {
        
         // another expired
- 
-        LiveDecayRecord r = liveDecayQueue.removeMin();        
+        
+        liveDecayQueueHandles.remove( r.x, r.y, r.slot * 2 + r.floor,
+                                      r.subCont );
  
         char storedFound;
         timeSec_t storedETA =
@@ -9270,453 +12637,1146 @@ void mapEveDeath( const char *inEmail, double inAge, GridPos inDeathMapPos ) {
     pY = inDeathMapPos.y;
    
  
-    printf( "Remembering Eve's camp in database (%d,%d) r=%d for %s\n",
-            pX, pY, pR, inEmail );
+    printf( "Remembering Eve's camp in database (%d,%d) r=%d for %s\n",
+            pX, pY, pR, inEmail );
+   
+    eveDBPut( inEmail, pX, pY, pR );
+    }
+ 
+ 
+ 
+ 
+static unsigned int nextLoadID = 0;
+ 
+ 
+char loadTutorialStart( TutorialLoadProgress *inTutorialLoad,
+                        const char *inMapFileName, int inX, int inY ) {
+ 
+    // don't open file yet, because we don't want to have the same
+    // file open in parallel
+   
+    // save info to open file on first step, which is called one player at a
+    // time
+    inTutorialLoad->uniqueLoadID = nextLoadID++;
+    inTutorialLoad->fileOpened = false;
+    inTutorialLoad->file = NULL;
+    inTutorialLoad->mapFileName = stringDuplicate( inMapFileName );
+    inTutorialLoad->x = inX;
+    inTutorialLoad->y = inY;
+    inTutorialLoad->startTime = Time::getCurrentTime();
+    inTutorialLoad->stepCount = 0;
+ 
+    return true;
+    }
+ 
+ 
+ 
+ 
+char loadTutorialStep( TutorialLoadProgress *inTutorialLoad,
+                       double inTimeLimitSec ) {
+ 
+    if( ! inTutorialLoad->fileOpened ) {
+        // first step, open file
+       
+        char returnVal = false;
+       
+        // only try opening it once
+        inTutorialLoad->fileOpened = true;
+       
+        File tutorialFolder( NULL, "tutorialMaps" );
+ 
+        if( tutorialFolder.exists() && tutorialFolder.isDirectory() ) {
+       
+            File *mapFile = tutorialFolder.getChildFile(
+                inTutorialLoad->mapFileName );
+           
+            if( mapFile->exists() &&  ! mapFile->isDirectory() ) {
+                char *fileName = mapFile->getFullFileName();
+               
+                FILE *file = fopen( fileName, "r" );
+               
+                if( file != NULL ) {
+                    inTutorialLoad->file = file;
+                   
+                    returnVal = true;
+                    }
+               
+                delete [] fileName;
+                }
+            delete mapFile;
+            }
+       
+        delete [] inTutorialLoad->mapFileName;
+       
+        return returnVal;
+        }
+   
+ 
+    // else file already open
+ 
+    if( inTutorialLoad->file == NULL ) {
+        // none left
+        return false;
+        }
+ 
+    char moreLeft = loadIntoMapFromFile( inTutorialLoad->file,
+                                         inTutorialLoad->x, inTutorialLoad->y,
+                                         inTimeLimitSec );
+ 
+    inTutorialLoad->stepCount++;
+   
+ 
+    if( ! moreLeft ) {
+        fclose( inTutorialLoad->file );
+        inTutorialLoad->file = NULL;
+        }
+    return moreLeft;
+    }
+ 
+ 
+ 
+ 
+ 
+ 
+ 
+ 
+char getMetadata( int inMapID, unsigned char *inBuffer ) {
+    int metaID = extractMetadataID( inMapID );
+   
+    if( metaID == 0 ) {
+        return false;
+        }
+ 
+    // look up in metadata DB
+    unsigned char key[4];    
+    intToValue( metaID, key );
+    int result = DB_get( &metaDB, key, inBuffer );
+ 
+    if( result == 0 ) {
+        return true;
+        }
+ 
+    return false;
+    }
+ 
+   
+ 
+ 
+// returns full map ID with embedded metadata ID for new metadata record
+int addMetadata( int inObjectID, unsigned char *inBuffer ) {
+    int metaID = getNewMetadataID();
+   
+    int mapID = packMetadataID( inObjectID, metaID );
+   
+    // insert into metadata DB
+    unsigned char key[4];    
+    intToValue( metaID, key );
+    DB_put( &metaDB, key, inBuffer );
+ 
    
-    eveDBPut( inEmail, pX, pY, pR );
+    return mapID;
     }
  
  
  
  
-static unsigned int nextLoadID = 0;
+static double distSquared( GridPos inA, GridPos inB ) {
+    double xDiff = (double)inA.x - (double)inB.x;
+    double yDiff = (double)inA.y - (double)inB.y;
+   
+    return xDiff * xDiff + yDiff * yDiff;
+    }
  
  
-char loadTutorialStart( TutorialLoadProgress *inTutorialLoad,
-                        const char *inMapFileName, int inX, int inY ) {
  
-    // don't open file yet, because we don't want to have the same
-    // file open in parallel
-   
-    // save info to open file on first step, which is called one player at a
-    // time
-    inTutorialLoad->uniqueLoadID = nextLoadID++;
-    inTutorialLoad->fileOpened = false;
-    inTutorialLoad->file = NULL;
-    inTutorialLoad->mapFileName = stringDuplicate( inMapFileName );
-    inTutorialLoad->x = inX;
-    inTutorialLoad->y = inY;
-    inTutorialLoad->startTime = Time::getCurrentTime();
-    inTutorialLoad->stepCount = 0;
  
-    return true;
+void removeLandingPos( GridPos inPos ) {
+    for( int i=0; i<flightLandingPos.size(); i++ ) {
+        if( equal( inPos, flightLandingPos.getElementDirect( i ) ) ) {
+            flightLandingPos.deleteElement( i );
+            persistentMapDBPut( inPos.x, inPos.y, 2, "\0" );
+            return;
+            }
+        }
     }
  
  
+char isInDir( GridPos inPos, GridPos inOtherPos, doublePair inDir ) {
+    double dX = (double)inOtherPos.x - (double)inPos.x;
+    double dY = (double)inOtherPos.y - (double)inPos.y;
+   
+    if( inDir.x > 0 && dX > 0 ) {
+        return true;
+        }
+    if( inDir.x < 0 && dX < 0 ) {
+        return true;
+        }
+    if( inDir.y > 0 && dY > 0 ) {
+        return true;
+        }
+    if( inDir.y < 0 && dY < 0 ) {
+        return true;
+        }
+    return false;
+    }
  
  
-char loadTutorialStep( TutorialLoadProgress *inTutorialLoad,
-                       double inTimeLimitSec ) {
  
-    if( ! inTutorialLoad->fileOpened ) {
-        // first step, open file
-       
-        char returnVal = false;
-       
-        // only try opening it once
-        inTutorialLoad->fileOpened = true;
-       
-        File tutorialFolder( NULL, "tutorialMaps" );
+GridPos getNextCloseLandingPos( GridPos inCurPos,
+                                doublePair inDir,
+                                char *outFound ) {
+   
+    int closestIndex = -1;
+    GridPos closestPos;
+    double closestDist = DBL_MAX;
+   
+    for( int i=0; i<flightLandingPos.size(); i++ ) {
+        GridPos thisPos = flightLandingPos.getElementDirect( i );
+ 
+        if( tooClose( inCurPos, thisPos, 250 ) ) {
+            // don't consider landing at spots closer than 250,250 manhattan
+            // to takeoff spot
+            continue;
+            }
  
-        if( tutorialFolder.exists() && tutorialFolder.isDirectory() ) {
        
-            File *mapFile = tutorialFolder.getChildFile(
-                inTutorialLoad->mapFileName );
+        if( isInDir( inCurPos, thisPos, inDir ) ) {
+            double dist = distSquared( inCurPos, thisPos );
            
-            if( mapFile->exists() &&  ! mapFile->isDirectory() ) {
-                char *fileName = mapFile->getFullFileName();
-               
-                FILE *file = fopen( fileName, "r" );
+            if( dist < closestDist ) {
+                // check if this is still a valid landing pos
+                int oID = getMapObject( thisPos.x, thisPos.y );
                
-                if( file != NULL ) {
-                    inTutorialLoad->file = file;
+                if( oID <=0 ||
+                    ! getObject( oID )->isFlightLanding ) {
                    
-                    returnVal = true;
+                    // not even a valid landing pos anymore
+                    flightLandingPos.deleteElement( i );
+                    persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
+                    i--;
+                    continue;
                     }
-               
-                delete [] fileName;
+                closestDist = dist;
+                closestPos = thisPos;
+                closestIndex = i;
                 }
-            delete mapFile;
+            }
+        }
+   
+    if( closestIndex == -1 ) {
+        *outFound = false;
+        }
+    else {
+        *outFound = true;
+        }
+   
+    return closestPos;
+    }
+
+
+
+
+GridPos getClosestLandingPos( GridPos inTargetPos, char *outFound ) {
+
+    int closestIndex = -1;
+    GridPos closestPos;
+    double closestDist = DBL_MAX;
+    
+    for( int i=0; i<flightLandingPos.size(); i++ ) {
+        GridPos thisPos = flightLandingPos.getElementDirect( i );
+
+        if( !tooClose( inTargetPos, thisPos, 250 ) ) {
+            // don't consider landing at spots further than 250,250 manhattan
+            // to target landing spot
+            continue;
+            }
+        
+        double dist = distSquared( inTargetPos, thisPos );
+        
+        if( dist < closestDist ) {
+            // check if this is still a valid landing pos
+            int oID = getMapObject( thisPos.x, thisPos.y );
+            
+            if( oID <=0 ||
+                ! getObject( oID )->isFlightLanding ) {
+                
+                // not even a valid landing pos anymore
+                flightLandingPos.deleteElement( i );
+                persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
+                i--;
+                continue;
+                }
+            closestDist = dist;
+            closestPos = thisPos;
+            closestIndex = i;
+            }
+        }
+    
+    if( closestIndex == -1 ) {
+        *outFound = false;
+        }
+    else {
+        *outFound = true;
+        }
+    
+    return closestPos;
+    }
+
+                
+
+
+
+GridPos getNextFlightLandingPos( int inCurrentX, int inCurrentY, 
+                                 doublePair inDir, 
+                                 int *outFlightOutcomeFlag,
+                                 int inRadiusLimit ) {
+    int closestIndex = -1;
+    GridPos closestPos;
+    double closestDist = DBL_MAX;
+ 
+    GridPos curPos = { inCurrentX, inCurrentY };
+ 
+    char useLimit = false;
+   
+    if( abs( inCurrentX ) <= inRadiusLimit &&
+        abs( inCurrentY ) <= inRadiusLimit ) {
+        useLimit = true;
+        }
+       
+       
+ 
+    for( int i=0; i<flightLandingPos.size(); i++ ) {
+        GridPos thisPos = flightLandingPos.getElementDirect( i );
+       
+        if( useLimit &&
+            ( abs( thisPos.x ) > inRadiusLimit ||
+              abs( thisPos.x ) > inRadiusLimit ) ) {
+            // out of bounds destination
+            continue;
             }
        
-        delete [] inTutorialLoad->mapFileName;
+             
+        double dist = distSquared( curPos, thisPos );
        
-        return returnVal;
+        if( dist < closestDist ) {
+           
+            // check if this is still a valid landing pos
+            int oID = getMapObject( thisPos.x, thisPos.y );
+           
+            if( oID <=0 ||
+                ! getObject( oID )->isFlightLanding ) {
+               
+                // not even a valid landing pos anymore
+                flightLandingPos.deleteElement( i );
+                persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
+                i--;
+                continue;
+                }
+            closestDist = dist;
+            closestPos = thisPos;
+            closestIndex = i;
+            }
         }
+ 
    
+    if( closestIndex != -1 && flightLandingPos.size() > 1 ) {
+        // found closest, and there's more than one
+        // look for next valid position in chosen direction
  
-    // else file already open
+       
+        char found = false;
+       
+        GridPos nextPos = getNextCloseLandingPos( curPos, inDir, &found );
+       
+        if( found ) {
+            *outFlightOutcomeFlag = 1;
+            return nextPos;
+            }
  
-    if( inTutorialLoad->file == NULL ) {
-        // none left
-        return false;
+        // if we got here, we never found a nextPos that was valid
+        // closestPos is only option
+        *outFlightOutcomeFlag = 3;
+        return closestPos;
+        }
+    else if( closestIndex != -1 && flightLandingPos.size() == 1 ) {
+        // land at closest, only option
+        *outFlightOutcomeFlag = 2;
+        return closestPos;
         }
+   
+    // got here, no place to land
  
-    char moreLeft = loadIntoMapFromFile( inTutorialLoad->file,
-                                         inTutorialLoad->x, inTutorialLoad->y,
-                                         inTimeLimitSec );
- 
-    inTutorialLoad->stepCount++;
+    // crash them at next Eve location
    
+    int eveX, eveY;
  
-    if( ! moreLeft ) {
-        fclose( inTutorialLoad->file );
-        inTutorialLoad->file = NULL;
+    SimpleVector<GridPos> otherPeoplePos;
+   
+    getEvePosition( "dummyPlaneCrashEmail@test.com", 0, &eveX, &eveY,
+                    &otherPeoplePos, false );
+   
+    GridPos returnVal = { eveX, eveY };
+   
+    if( inRadiusLimit > 0 &&
+        ( abs( eveX ) >= inRadiusLimit ||
+          abs( eveY ) >= inRadiusLimit ) ) {
+        // even Eve pos is out of bounds
+        // stick them in center
+        returnVal.x = 0;
+        returnVal.y = 0;
         }
-    return moreLeft;
-    }
- 
- 
+   
+         
  
  
+    *outFlightOutcomeFlag = 0;
+    
+    return returnVal;
+    }
  
  
  
+int getGravePlayerID( int inX, int inY ) {
+    unsigned char key[9];
+    unsigned char value[4];
  
-char getMetadata( int inMapID, unsigned char *inBuffer ) {
-    int metaID = extractMetadataID( inMapID );
+    // look for changes to default in database
+    intPairToKey( inX, inY, key );
+   
+    int result = DB_get( &graveDB, key, value );
    
-    if( metaID == 0 ) {
-        return false;
-        }
- 
-    // look up in metadata DB
-    unsigned char key[4];    
-    intToValue( metaID, key );
-    int result = DB_get( &metaDB, key, inBuffer );
- 
     if( result == 0 ) {
-        return true;
+        // found
+        int returnVal = valueToInt( value );
+       
+        return returnVal;
+        }
+    else {
+        return 0;
         }
- 
-    return false;
     }
  
-   
- 
  
-// returns full map ID with embedded metadata ID for new metadata record
-int addMetadata( int inObjectID, unsigned char *inBuffer ) {
-    int metaID = getNewMetadataID();
-   
-    int mapID = packMetadataID( inObjectID, metaID );
+void setGravePlayerID( int inX, int inY, int inPlayerID ) {
+    unsigned char key[8];
+    unsigned char value[4];
    
-    // insert into metadata DB
-    unsigned char key[4];    
-    intToValue( metaID, key );
-    DB_put( &metaDB, key, inBuffer );
  
+    intPairToKey( inX, inY, key );
+    intToValue( inPlayerID, value );
+           
    
-    return mapID;
+    DB_put( &graveDB, key, value );
     }
  
  
  
  
-static double distSquared( GridPos inA, GridPos inB ) {
-    double xDiff = (double)inA.x - (double)inB.x;
-    double yDiff = (double)inA.y - (double)inB.y;
-   
-    return xDiff * xDiff + yDiff * yDiff;
-    }
- 
- 
  
  
-void removeLandingPos( GridPos inPos ) {
-    for( int i=0; i<flightLandingPos.size(); i++ ) {
-        if( equal( inPos, flightLandingPos.getElementDirect( i ) ) ) {
-            flightLandingPos.deleteElement( i );
-            persistentMapDBPut( inPos.x, inPos.y, 2, "\0" );
-            return;
-            }
-        }
+// Long-term culling and object counts run on a background thread that
+// reads the map DB files directly, while they are frozen for a snapshot
+// (see beginMapSnapshot).
+//
+// The thread walks the whole map store in one pass, and sends back
+// culling decisions as a list of edits.  The main thread checks each
+// edit against the live map before applying it, a few at a time, since
+// the map may have changed after the snapshot was taken.
+
+
+
+// cells near the biome DB area, where base map depends on DB contents,
+// and base map must come from main thread
+typedef struct BiomeDBArea {
+        char any;
+        int minX, maxX, minY, maxY;
+    } BiomeDBArea;
+
+
+
+static void getBiomeDBArea( BiomeDBArea *outArea ) {
+    outArea->any = anyBiomesInDB;
+    
+    // tweaks look at neighbors out to twice max wide radius, plus
+    // short objects two cells south
+    int margin = 2 * getMaxWideRadius() + 2;
+    
+    outArea->minX = minBiomeXLoc - margin;
+    outArea->maxX = maxBiomeXLoc + margin;
+    outArea->minY = minBiomeYLoc - margin;
+    outArea->maxY = maxBiomeYLoc + margin;
     }
- 
- 
-char isInDir( GridPos inPos, GridPos inOtherPos, doublePair inDir ) {
-    double dX = (double)inOtherPos.x - (double)inPos.x;
-    double dY = (double)inOtherPos.y - (double)inPos.y;
-   
-    if( inDir.x > 0 && dX > 0 ) {
-        return true;
-        }
-    if( inDir.x < 0 && dX < 0 ) {
-        return true;
-        }
-    if( inDir.y > 0 && dY > 0 ) {
-        return true;
-        }
-    if( inDir.y < 0 && dY < 0 ) {
-        return true;
-        }
-    return false;
+
+
+
+static char isNearBiomeDBArea( int inX, int inY, BiomeDBArea *inArea ) {
+    return inArea->any &&
+        inX >= inArea->minX && inX <= inArea->maxX &&
+        inY >= inArea->minY && inY <= inArea->maxY;
     }
- 
- 
- 
-GridPos getNextCloseLandingPos( GridPos inCurPos,
-                                doublePair inDir,
-                                char *outFound ) {
-   
-    int closestIndex = -1;
-    GridPos closestPos;
-    double closestDist = DBL_MAX;
+
+
+
+// base map without any caches, safe to call from any thread
+// wrong for cells in biome DB area
+static int scanBaseMap( int inX, int inY, char *outGridPlacement ) {
+    if( inX > xLimit || inX < -xLimit ||
+        inY > yLimit || inY < -yLimit ) {
    
-    for( int i=0; i<flightLandingPos.size(); i++ ) {
-        GridPos thisPos = flightLandingPos.getElementDirect( i );
- 
-        if( tooClose( inCurPos, thisPos, 250 ) ) {
-            // don't consider landing at spots closer than 250,250 manhattan
-            // to takeoff spot
-            continue;
-            }
- 
-       
-        if( isInDir( inCurPos, thisPos, inDir ) ) {
-            double dist = distSquared( inCurPos, thisPos );
-           
-            if( dist < closestDist ) {
-                // check if this is still a valid landing pos
-                int oID = getMapObject( thisPos.x, thisPos.y );
-               
-                if( oID <=0 ||
-                    ! getObject( oID )->isFlightLanding ) {
-                   
-                    // not even a valid landing pos anymore
-                    flightLandingPos.deleteElement( i );
-                    persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
-                    i--;
-                    continue;
-                    }
-                closestDist = dist;
-                closestPos = thisPos;
-                closestIndex = i;
-                }
+        return edgeObjectID;
+        }
+    
+    NATURALMAP_Cell bakedCell;
+    
+    if( naturalMapOpen && 
+        NATURALMAP_get( &naturalMap, inX, inY, &bakedCell ) ) {
+        
+        if( outGridPlacement != NULL ) {
+            *outGridPlacement = bakedCell.gridPlacement;
             }
+        return bakedCell.baseMap;
         }
-   
-    if( closestIndex == -1 ) {
-        *outFound = false;
+    
+    int secondPlace;
+    double secondPlaceGap;
+    char cacheable;
+        
+    int pickedBiome = computeBiomeIndex( inX, inY, NULL, 
+                                         &secondPlace, &secondPlaceGap,
+                                         &cacheable );
+    char gridPlacement;
+    char densityPassed;
+    
+    int result = computeBaseMap( inX, inY, pickedBiome, secondPlace, NULL,
+                                 &gridPlacement, &densityPassed );
+    
+    if( outGridPlacement != NULL ) {
+        *outGridPlacement = gridPlacement;
         }
-    else {
-        *outFound = true;
+    return result;
+    }
+
+
+
+// safe to call from any thread
+// wrong for cells in biome DB area
+static int scanBiomeIndex( int inX, int inY ) {
+    NATURALMAP_Cell bakedCell;
+    
+    if( naturalMapOpen && 
+        NATURALMAP_get( &naturalMap, inX, inY, &bakedCell ) ) {
+        return bakedCell.biome;
         }
-   
-    return closestPos;
+    
+    int secondPlace;
+    double secondPlaceGap;
+    char cacheable;
+    
+    return computeBiomeIndex( inX, inY, NULL, &secondPlace, &secondPlaceGap,
+                              &cacheable );
     }
 
 
 
+typedef struct MapCullEdit {
+        int x, y;
+        
+        // object or floor in snapshot
+        int id;
+        
+        // natural object to put back, or -1 if main thread must find it
+        // unused for floors
+        int wildID;
+        
+        char isFloor;
+    } MapCullEdit;
+
+
+
+// edits are handed over to main thread in batches of this size
+#define CULL_EDIT_BATCH 256
 
-GridPos getClosestLandingPos( GridPos inTargetPos, char *outFound ) {
+// records between checks of the stop flag
+#define MAP_SCAN_STOP_CHECK 4096
+
+
+
+class MapScanThread : public Thread {
+    public:
+        
+        // inCountPositions can be NULL if no object count is wanted
+        MapScanThread( char inCull, double inCurTime, int inCullSeconds,
+                       SimpleVector<int> *inNoCullItemList,
+                       int inMaxEdits,
+                       SimpleVector<GridPos> *inCountPositions )
+                : mCull( inCull ), mCurTime( inCurTime ),
+                  mCullSeconds( inCullSeconds ),
+                  mMaxEdits( inMaxEdits ),
+                  mCount( inCountPositions != NULL ),
+                  mUseTileDB( useMapTileDB && tileDBOpen ),
+                  mScanMapDB( dbOpen ),
+                  mScanFloorDB( floorDBOpen ),
+                  mScanLookTimeDB( lookTimeDBOpen ),
+                  mBarrierOn( barrierOn ), 
+                  mBarrierRadius( barrierRadius ),
+                  mLookTimes( 1024, 0 ),
+                  mCountObjects( 1024, -1 ),
+                  mNumEditsFound( 0 ),
+                  mNumRecordsSeen( 0 ),
+                  mDone( false ),
+                  mFailed( false ),
+                  mStopRequested( false ) {
+            
+            mNoCullItemList.push_back_other( inNoCullItemList );
+            
+            if( inCountPositions != NULL ) {
+                mCountPositions.push_back_other( inCountPositions );
+                }
+            
+            getBiomeDBArea( &mBiomeDBArea );
+            }
+        
+        
+        
+        virtual void run() {
+            char failed = false;
+            
+            if( mCull ) {
+                // without look times, everything would look stale
+                failed = ! mScanLookTimeDB || ! loadLookTimes();
+                }
+            
+            for( int i=0; i<mCountPositions.size(); i++ ) {
+                GridPos p = mCountPositions.getElementDirect( i );
+                mCountObjects.insert( p.x, p.y, 0, 0, -1 );
+                }
+            
+            if( ! failed && mScanMapDB ) {
+                failed = ! scanMapDB();
+                }
+            
+            if( ! failed && mUseTileDB ) {
+                failed = ! scanTileDB();
+                }
+            else if( ! failed && mCull && mScanFloorDB ) {
+                failed = ! scanFloorDB();
+                }
+            
+            if( ! failed && mCount ) {
+                countObjects();
+                }
+            
+            flushEdits();
+            
+            mLock.lock();
+            mFailed = failed;
+            mDone = true;
+            mLock.unlock();
+            }
+        
+        
+        
+        char isDone() {
+            mLock.lock();
+            char done = mDone;
+            mLock.unlock();
+            return done;
+            }
+        
+
+        // only meaningful once done
+        char isFailed() {
+            mLock.lock();
+            char failed = mFailed;
+            mLock.unlock();
+            return failed;
+            }
+        
+
+        // thread stops early at next check
+        void requestStop() {
+            mLock.lock();
+            mStopRequested = true;
+            mLock.unlock();
+            }
+        
+        
+        // moves edits found so far into outEdits
+        void takeEdits( SimpleVector<MapCullEdit> *outEdits ) {
+            mLock.lock();
+            outEdits->push_back_other( &mEdits );
+            mEdits.deleteAll();
+            mLock.unlock();
+            }
+        
+        
+        // these are only safe to call once done
+        
+        int getNumRecordsSeen() {
+            return mNumRecordsSeen;
+            }
 
-    int closestIndex = -1;
-    GridPos closestPos;
-    double closestDist = DBL_MAX;
-    
-    for( int i=0; i<flightLandingPos.size(); i++ ) {
-        GridPos thisPos = flightLandingPos.getElementDirect( i );
+        int getNumEditsFound() {
+            return mNumEditsFound;
+            }
+        
+        // moves results into outputs
+        void takeCounts( SimpleVector<int> *outIDs, 
+                         SimpleVector<int> *outCounts,
+                         SimpleVector<GridPos> *outUncounted ) {
+            outIDs->push_back_other( &mCountIDs );
+            outCounts->push_back_other( &mCounts );
+            outUncounted->push_back_other( &mUncounted );
+            }
+        
+        
+    protected:
+        
+        char shouldStop() {
+            mLock.lock();
+            char stop = mStopRequested;
+            mLock.unlock();
+            return stop;
+            }
 
-        if( !tooClose( inTargetPos, thisPos, 250 ) ) {
-            // don't consider landing at spots further than 250,250 manhattan
-            // to target landing spot
-            continue;
+        
+        // one new record seen
+        // returns false if scan should stop
+        char stepRecord() {
+            mNumRecordsSeen++;
+            
+            if( mNumRecordsSeen % MAP_SCAN_STOP_CHECK == 0 &&
+                shouldStop() ) {
+                return false;
+                }
+            return true;
             }
         
-        double dist = distSquared( inTargetPos, thisPos );
         
-        if( dist < closestDist ) {
-            // check if this is still a valid landing pos
-            int oID = getMapObject( thisPos.x, thisPos.y );
+        
+        char loadLookTimes() {
+            LINEARDB3_Scanner s;
             
-            if( oID <=0 ||
-                ! getObject( oID )->isFlightLanding ) {
+            if( LINEARDB3_Scanner_open( &s, "lookTime.db" ) == -1 ) {
+                return false;
+                }
+            
+            unsigned char key[8];
+            unsigned char value[8];
+            
+            int result;
+            
+            while( ( result = LINEARDB3_Scanner_next( &s, key, value ) ) 
+                   > 0 ) {
                 
-                // not even a valid landing pos anymore
-                flightLandingPos.deleteElement( i );
-                persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
-                i--;
-                continue;
+                mLookTimes.insert( valueToInt( key ), 
+                                   valueToInt( &( key[4] ) ), 0, 0,
+                                   valueToTime( value ) );
                 }
-            closestDist = dist;
-            closestPos = thisPos;
-            closestIndex = i;
+            
+            LINEARDB3_Scanner_close( &s );
+            
+            return ( result == 0 );
             }
-        }
-    
-    if( closestIndex == -1 ) {
-        *outFound = false;
-        }
-    else {
-        *outFound = true;
-        }
-    
-    return closestPos;
-    }
-
+        
+        
+        
+        char isStale( int inX, int inY ) {
+            char found;
+            
+            // look times kept per 100x100 block, see dbLookTimeGet
+            timeSec_t lastLookTime = 
+                mLookTimes.lookup( inX / 100, inY / 100, 0, 0, &found );
+            
+            if( ! found ) {
+                lastLookTime = 0;
+                }
+            
+            return ( mCurTime - lastLookTime > mCullSeconds );
+            }
+        
+        
+        
+        void addEdit( int inX, int inY, int inID, int inWildID, 
+                      char inIsFloor ) {
+            MapCullEdit e = { inX, inY, inID, inWildID, inIsFloor };
+            
+            mPendingEdits.push_back( e );
+            mNumEditsFound++;
+            
+            if( mPendingEdits.size() >= CULL_EDIT_BATCH ) {
+                flushEdits();
+                }
+            }
+        
+        
+        void flushEdits() {
+            if( mPendingEdits.size() == 0 ) {
+                return;
+                }
+            mLock.lock();
+            mEdits.push_back_other( &mPendingEdits );
+            mLock.unlock();
+            
+            mPendingEdits.deleteAll();
+            }
+        
+        
+        
+        void processObject( int inX, int inY, int inID ) {
+            if( mCount ) {
+                int *countObject = 
+                    mCountObjects.lookupPointer( inX, inY, 0, 0 );
                 
-
-
-
-GridPos getNextFlightLandingPos( int inCurrentX, int inCurrentY, 
-                                 doublePair inDir, 
-                                 int *outFlightOutcomeFlag,
-                                 int inRadiusLimit ) {
-    int closestIndex = -1;
-    GridPos closestPos;
-    double closestDist = DBL_MAX;
- 
-    GridPos curPos = { inCurrentX, inCurrentY };
- 
-    char useLimit = false;
-   
-    if( abs( inCurrentX ) <= inRadiusLimit &&
-        abs( inCurrentY ) <= inRadiusLimit ) {
-        useLimit = true;
-        }
-       
-       
- 
-    for( int i=0; i<flightLandingPos.size(); i++ ) {
-        GridPos thisPos = flightLandingPos.getElementDirect( i );
-       
-        if( useLimit &&
-            ( abs( thisPos.x ) > inRadiusLimit ||
-              abs( thisPos.x ) > inRadiusLimit ) ) {
-            // out of bounds destination
-            continue;
+                if( countObject != NULL ) {
+                    *countObject = inID;
+                    }
+                }
+            
+            // consider 0-values too, where map has been cleared by 
+            // players, but a natural object should be there
+            if( ! mCull || inID < 0 || mNumEditsFound >= mMaxEdits ||
+                ! isStale( inX, inY ) ||
+                mNoCullItemList.getElementIndex( inID ) != -1 ) {
+                return;
+                }
+            
+            int wildID = -1;
+            
+            if( ! isNearBiomeDBArea( inX, inY, &mBiomeDBArea ) ) {
+                wildID = tweakBaseMap( inX, inY, 
+                                       &scanBaseMap, &scanBiomeIndex );
+            
+                if( wildID == inID ) {
+                    // already in wild state
+                    return;
+                    }
+                }
+            
+            addEdit( inX, inY, inID, wildID, false );
             }
-       
-             
-        double dist = distSquared( curPos, thisPos );
-       
-        if( dist < closestDist ) {
-           
-            // check if this is still a valid landing pos
-            int oID = getMapObject( thisPos.x, thisPos.y );
-           
-            if( oID <=0 ||
-                ! getObject( oID )->isFlightLanding ) {
-               
-                // not even a valid landing pos anymore
-                flightLandingPos.deleteElement( i );
-                persistentMapDBPut( thisPos.x, thisPos.y, 2, "\0" );
-                i--;
-                continue;
+        
+        
+        
+        void processFloor( int inX, int inY, int inID ) {
+            if( ! mCull || inID <= 0 || mNumEditsFound >= mMaxEdits ||
+                ! isStale( inX, inY ) ||
+                mNoCullItemList.getElementIndex( inID ) != -1 ) {
+                return;
                 }
-            closestDist = dist;
-            closestPos = thisPos;
-            closestIndex = i;
+            addEdit( inX, inY, inID, -1, true );
             }
-        }
- 
-   
-    if( closestIndex != -1 && flightLandingPos.size() > 1 ) {
-        // found closest, and there's more than one
-        // look for next valid position in chosen direction
- 
-       
-        char found = false;
-       
-        GridPos nextPos = getNextCloseLandingPos( curPos, inDir, &found );
+        
+        
+        
+        char scanMapDB() {
+            LINEARDB3_Scanner s;
+            
+            if( LINEARDB3_Scanner_open( &s, "map.db" ) == -1 ) {
+                return false;
+                }
+            
+            unsigned char key[16];
+            unsigned char value[4];
+            
+            int result;
+            
+            while( ( result = LINEARDB3_Scanner_next( &s, key, value ) ) 
+                   > 0 ) {
+                
+                if( ! stepRecord() ) {
+                    break;
+                    }
+                
+                int slot = valueToInt( &( key[8] ) );
+                int b = valueToInt( &( key[12] ) );
        
-        if( found ) {
-            *outFlightOutcomeFlag = 1;
-            return nextPos;
+                if( slot == 0 && b == 0 ) {
+                    // main object
+                    processObject( valueToInt( key ), 
+                                   valueToInt( &( key[4] ) ),
+                                   valueToInt( value ) );
+                    }
+                }
+            
+            LINEARDB3_Scanner_close( &s );
+            
+            return ( result >= 0 );
             }
- 
-        // if we got here, we never found a nextPos that was valid
-        // closestPos is only option
-        *outFlightOutcomeFlag = 3;
-        return closestPos;
-        }
-    else if( closestIndex != -1 && flightLandingPos.size() == 1 ) {
-        // land at closest, only option
-        *outFlightOutcomeFlag = 2;
-        return closestPos;
-        }
-   
-    // got here, no place to land
- 
-    // crash them at next Eve location
-   
-    int eveX, eveY;
- 
-    SimpleVector<GridPos> otherPeoplePos;
-   
-    getEvePosition( "dummyPlaneCrashEmail@test.com", 0, &eveX, &eveY,
-                    &otherPeoplePos, false );
-   
-    GridPos returnVal = { eveX, eveY };
-   
-    if( inRadiusLimit > 0 &&
-        ( abs( eveX ) >= inRadiusLimit ||
-          abs( eveY ) >= inRadiusLimit ) ) {
-        // even Eve pos is out of bounds
-        // stick them in center
-        returnVal.x = 0;
-        returnVal.y = 0;
+        
+        
+        
+        char scanTileDB() {
+            REGIONDB_Scanner s;
+            
+            if( REGIONDB_Scanner_open( &s, "mapTile.db", 
+                                       TILE_RECORD_SIZE ) == -1 ) {
+                return false;
+                }
+            
+            unsigned char value[ TILE_RECORD_SIZE ];
+            
+            int x, y;
+            int result;
+            
+            while( ( result = REGIONDB_Scanner_next( &s, &x, &y, value ) ) 
+                   > 0 ) {
+                
+                if( ! stepRecord() ) {
+                    break;
+                    }
+                
+                TileRecord r;
+                valueToTileRecord( value, &r );
+                
+                if( r.object != -1 ) {
+                    processObject( x, y, r.object );
+                    }
+                if( r.floor != -1 ) {
+                    processFloor( x, y, r.floor );
+                    }
+                }
+            
+            REGIONDB_Scanner_close( &s );
+            
+            return ( result >= 0 );
+            }
+        
+        
+        
+        char scanFloorDB() {
+            LINEARDB3_Scanner s;
+            
+            if( LINEARDB3_Scanner_open( &s, "floor.db" ) == -1 ) {
+                return false;
+                }
+            
+            unsigned char key[8];
+            unsigned char value[4];
+            
+            int result;
+            
+            while( ( result = LINEARDB3_Scanner_next( &s, key, value ) ) 
+                   > 0 ) {
+                
+                if( ! stepRecord() ) {
+                    break;
+                    }
+                
+                processFloor( valueToInt( key ), valueToInt( &( key[4] ) ),
+                              valueToInt( value ) );
+                }
+            
+            LINEARDB3_Scanner_close( &s );
+            
+            return ( result >= 0 );
+            }
+        
+        
+        
+        void countObjects() {
+            // index into mCountIDs for each ID
+            FlatHashTable<int> idIndex( 1024, -1 );
+            
+            for( int i=0; i<mCountPositions.size(); i++ ) {
+                GridPos p = mCountPositions.getElementDirect( i );
+                
+                char found;
+                int id = mCountObjects.lookup( p.x, p.y, 0, 0, &found );
+                
+                if( id == -1 ) {
+                    // not in map DB, natural object
+                    
+                    if( ( mBarrierOn &&
+                          ( abs( p.x ) == mBarrierRadius ||
+                            abs( p.y ) == mBarrierRadius ) ) ||
+                        isNearBiomeDBArea( p.x, p.y, &mBiomeDBArea ) ) {
+                        // barrier and biome DB can only be read
+                        // on main thread
+                        mUncounted.push_back( p );
+                        continue;
+                        }
+                    
+                    id = tweakBaseMap( p.x, p.y, 
+                                       &scanBaseMap, &scanBiomeIndex );
+                    }
+                
+                if( id <= 0 ) {
+                    continue;
+                    }
+                
+                int index = idIndex.lookup( id, 0, 0, 0, &found );
+                
+                if( found ) {
+                    ( *( mCounts.getElement( index ) ) ) ++;
+                    }
+                else {
+                    idIndex.insert( id, 0, 0, 0, mCountIDs.size() );
+                    mCountIDs.push_back( id );
+                    mCounts.push_back( 1 );
+                    }
+                }
+            }
+        
+        
+        
+        // set before start, read-only after
+        char mCull;
+        double mCurTime;
+        int mCullSeconds;
+        int mMaxEdits;
+        char mCount;
+        char mUseTileDB;
+        char mScanMapDB;
+        char mScanFloorDB;
+        char mScanLookTimeDB;
+        char mBarrierOn;
+        int mBarrierRadius;
+        BiomeDBArea mBiomeDBArea;
+        SimpleVector<int> mNoCullItemList;
+        SimpleVector<GridPos> mCountPositions;
+        
+        // only touched by thread
+        FlatHashTable<timeSec_t> mLookTimes;
+        FlatHashTable<int> mCountObjects;
+        SimpleVector<MapCullEdit> mPendingEdits;
+        SimpleVector<int> mCountIDs;
+        SimpleVector<int> mCounts;
+        SimpleVector<GridPos> mUncounted;
+        int mNumEditsFound;
+        int mNumRecordsSeen;
+        
+        // shared, protected by mLock
+        MutexLock mLock;
+        SimpleVector<MapCullEdit> mEdits;
+        char mDone;
+        char mFailed;
+        char mStopRequested;
+    };
+
+
+
+static MapScanThread *mapScanThread = NULL;
+
+static double mapScanStartTime = 0;
+
+// start of last cull pass
+static double lastCullPassTime = 0;
+
+// count positions waiting for next pass
+static SimpleVector<GridPos> mapCountPositions;
+static char mapCountWaiting = false;
+
+// true if pass that is running has a count
+static char mapCountRunning = false;
+
+// results of last finished count
+static char mapCountDone = false;
+static SimpleVector<int> mapCountIDs;
+static SimpleVector<int> mapCountCounts;
+static SimpleVector<GridPos> mapCountUncounted;
+
+
+// edits taken from thread, applied a few per step
+static SimpleVector<MapCullEdit> cullEdits;
+static int nextCullEdit = 0;
+
+static int numCullEditsTaken = 0;
+static int numCullEditsApplied = 0;
+
+
+
+static void takeCullEdits() {
+    if( nextCullEdit == cullEdits.size() ) {
+        cullEdits.deleteAll();
+        nextCullEdit = 0;
         }
-   
-         
- 
- 
-    *outFlightOutcomeFlag = 0;
     
-    return returnVal;
+    int oldSize = cullEdits.size();
+    
+    mapScanThread->takeEdits( &cullEdits );
+    
+    numCullEditsTaken += cullEdits.size() - oldSize;
     }
- 
- 
- 
-int getGravePlayerID( int inX, int inY ) {
-    unsigned char key[9];
-    unsigned char value[4];
- 
-    // look for changes to default in database
-    intPairToKey( inX, inY, key );
-   
-    int result = DB_get( &graveDB, key, value );
-   
-    if( result == 0 ) {
-        // found
-        int returnVal = valueToInt( value );
-       
-        return returnVal;
+
+
+
+static void stopMapScan() {
+    if( mapScanThread == NULL ) {
+        return;
         }
-    else {
-        return 0;
+    mapScanThread->requestStop();
+    mapScanThread->join();
+    
+    delete mapScanThread;
+    mapScanThread = NULL;
+    
+    endMapSnapshot();
+    }
+
+
+
+static void freeMapScans() {
+    stopMapScan();
+    
+    cullEdits.deleteAll();
+    nextCullEdit = 0;
+    numCullEditsTaken = 0;
+    numCullEditsApplied = 0;
+    
+    mapCountPositions.deleteAll();
+    mapCountWaiting = false;
+    mapCountRunning = false;
+    }
+
+
+
+char startMapObjectCount( SimpleVector<GridPos> *inPositions ) {
+    if( mapCountWaiting || mapCountRunning ) {
+        return false;
         }
+    
+    mapCountPositions.deleteAll();
+    mapCountPositions.push_back_other( inPositions );
+    mapCountWaiting = true;
+    mapCountDone = false;
+    
+    mapCountIDs.deleteAll();
+    mapCountCounts.deleteAll();
+    mapCountUncounted.deleteAll();
+    
+    return true;
     }
- 
- 
-void setGravePlayerID( int inX, int inY, int inPlayerID ) {
-    unsigned char key[8];
-    unsigned char value[4];
-   
- 
-    intPairToKey( inX, inY, key );
-    intToValue( inPlayerID, value );
-           
-   
-    DB_put( &graveDB, key, value );
+
+
+
+char getMapObjectCountResult( SimpleVector<int> *outIDs, 
+                              SimpleVector<int> *outCounts,
+                              SimpleVector<GridPos> *outUncounted ) {
+    if( ! mapCountDone ) {
+        return false;
+        }
+    mapCountDone = false;
+    
+    outIDs->push_back_other( &mapCountIDs );
+    outCounts->push_back_other( &mapCountCounts );
+    outUncounted->push_back_other( &mapCountUncounted );
+    
+    mapCountIDs.deleteAll();
+    mapCountCounts.deleteAll();
+    mapCountUncounted.deleteAll();
+    
+    return true;
     }
- 
- 
- 
- 
- 
- 
-static char tileCullingIteratorSet = false;
-static DB_Iterator tileCullingIterator;
- 
-static char floorCullingIteratorSet = false;
-static DB_Iterator floorCullingIterator;
- 
+
+
+
 static double lastSettingsLoadTime = 0;
 static double settingsLoadInterval = 5 * 60;
  
-static int numTilesExaminedPerCullStep = 10;
+static int longTermCullEditsPerStep = 200;
+static int longTermCullPassSeconds = 3600;
+static int maxLongTermCullEditsPerPass = 1000000;
 static int longTermCullingSeconds = 3600 * 12;
  
 static int minActivePlayersForLongTermCulling = 15;
@@ -9724,11 +13784,163 @@ static int minActivePlayersForLongTermCulling = 15;
  
  
 static SimpleVector<int> noCullItemList;
- 
- 
-static int numTilesSeenByIterator = 0;
-static int numFloorsSeenByIterator = 0;
- 
+
+
+
+// collects finished pass, and starts a new one if one is due
+static void stepMapScans( char inCullWanted ) {
+    
+    double curTime = Time::getCurrentTime();
+    
+    if( mapScanThread != NULL ) {
+        
+        // edits come over while pass is still running
+        if( nextCullEdit == cullEdits.size() ) {
+            takeCullEdits();
+            }
+        
+        if( ! mapScanThread->isDone() ) {
+            return;
+            }
+        
+        mapScanThread->join();
+        
+        // held writes go out now, edits that are left are applied
+        // against live map, so they don't need the snapshot
+        endMapSnapshot();
+        
+        takeCullEdits();
+        
+        if( mapScanThread->isFailed() ) {
+            AppLog::error( "Map scan failed to read snapshot files" );
+            }
+        
+        AppLog::infoF( "Map scan went through %d records in %.1f sec, "
+                       "found %d tiles to cull",
+                       mapScanThread->getNumRecordsSeen(),
+                       curTime - mapScanStartTime,
+                       mapScanThread->getNumEditsFound() );
+        
+        if( mapCountRunning ) {
+            mapScanThread->takeCounts( &mapCountIDs, &mapCountCounts,
+                                       &mapCountUncounted );
+            mapCountRunning = false;
+            mapCountDone = true;
+            }
+        
+        delete mapScanThread;
+        mapScanThread = NULL;
+        }
+    
+    
+    char cullDue = 
+        inCullWanted &&
+        curTime - lastCullPassTime > longTermCullPassSeconds &&
+        // don't find new edits until old ones are applied
+        nextCullEdit == cullEdits.size();
+    
+    if( ! cullDue && ! mapCountWaiting ) {
+        return;
+        }
+    
+    SimpleVector<char*> fileNames;
+    
+    if( ! beginMapSnapshot( &fileNames ) ) {
+        fileNames.deallocateStringElements();
+        return;
+        }
+    // thread opens files itself
+    fileNames.deallocateStringElements();
+    
+    
+    if( cullDue ) {
+        lastCullPassTime = curTime;
+        }
+    
+    mapScanThread = 
+        new MapScanThread( cullDue, curTime, longTermCullingSeconds,
+                           &noCullItemList, maxLongTermCullEditsPerPass,
+                           mapCountWaiting ? &mapCountPositions : NULL );
+    
+    mapCountRunning = mapCountWaiting;
+    mapCountWaiting = false;
+    mapCountPositions.deleteAll();
+    
+    mapScanStartTime = curTime;
+    
+    mapScanThread->start();
+    }
+
+
+
+static void applyCullEdit( MapCullEdit *inEdit, double inCurTime ) {
+    int x = inEdit->x;
+    int y = inEdit->y;
+    
+    // map may have changed since snapshot
+    
+    if( inCurTime - dbLookTimeGet( x, y ) <= longTermCullingSeconds ) {
+        // looked at since
+        return;
+        }
+    
+    if( noCullItemList.getElementIndex( inEdit->id ) != -1 ) {
+        // list changed since
+        return;
+        }
+    
+    if( inEdit->isFloor ) {
+        if( dbFloorGet( x, y ) == inEdit->id ) {
+            setMapFloor( x, y, 0 );
+            numCullEditsApplied++;
+            }
+        return;
+        }
+    
+    if( dbGet( x, y, 0 ) != inEdit->id ) {
+        return;
+        }
+    
+    int wildTile = inEdit->wildID;
+    
+    BiomeDBArea area;
+    getBiomeDBArea( &area );
+    
+    if( wildTile == -1 || isNearBiomeDBArea( x, y, &area ) ) {
+        wildTile = getTweakedBaseMap( x, y );
+        
+        if( wildTile == inEdit->id ) {
+            return;
+            }
+        }
+    
+    // NOTE that we don't check/clear container slots for
+    // already-wild tiles.  So a natural container
+    // (if one is ever
+    // added to the game, like a hidey-hole cave) will
+    // keep its items even after that part of the map
+    // is culled.  Seems like okay behavior.
+    
+    clearAllContained( x, y );
+    
+    // put proc-genned map value in there
+    setMapObject( x, y, wildTile );
+    
+    if( wildTile != 0 &&
+        getObject( wildTile )->permanent ) {
+        // something nautural occurs here
+        // this "breaks" any remaining floor
+        // (which may be cull-proof on its own below).
+        // this will effectively leave gaps in roads
+        // with trees growing through, etc.
+        setMapFloor( x, y, 0 );
+        }
+    
+    numCullEditsApplied++;
+    }
+
+
+
 void stepMapLongTermCulling( int inNumCurrentPlayers ) {
  
     double curTime = Time::getCurrentTime();
@@ -9737,9 +13949,15 @@ void stepMapLongTermCulling( int inNumCurrentPlayers ) {
        
         lastSettingsLoadTime = curTime;
        
-        numTilesExaminedPerCullStep =
+        longTermCullEditsPerStep =
+            SettingsManager::getIntSetting(
+                "longTermCullEditsPerStep", 200 );
+        longTermCullPassSeconds =
             SettingsManager::getIntSetting(
-                "numTilesExaminedPerCullStep", 10 );
+                "longTermCullPassSeconds", 3600 );
+        maxLongTermCullEditsPerPass =
+            SettingsManager::getIntSetting(
+                "maxLongTermCullEditsPerPass", 1000000 );
         longTermCullingSeconds =
             SettingsManager::getIntSetting(
                 "longTermNoLookCullSeconds", 3600 * 12 );
@@ -9762,153 +13980,44 @@ void stepMapLongTermCulling( int inNumCurrentPlayers ) {
         barrierRadius = SettingsManager::getIntSetting( "barrierRadius", 250 );
         barrierOn = SettingsManager::getIntSetting( "barrierOn", 1 );
         }
- 
- 
-    if( ! longTermCullEnabled ||
-        minActivePlayersForLongTermCulling > inNumCurrentPlayers ) {
+    
+    char cullWanted = 
+        longTermCullEnabled &&
+        minActivePlayersForLongTermCulling <= inNumCurrentPlayers;
+    
+    // object counts run even when culling doesn't
+    stepMapScans( cullWanted );
+    
+    if( ! cullWanted ) {
         return;
         }
- 
-   
-    if( !tileCullingIteratorSet ) {
-        DB_Iterator_init( &db, &tileCullingIterator );
-        tileCullingIteratorSet = true;
-        numTilesSeenByIterator = 0;
+    
+    int numLeft = cullEdits.size() - nextCullEdit;
+    
+    if( numLeft == 0 ) {
+        return;
         }
- 
-    unsigned char tileKey[16];
-    unsigned char floorKey[8];
-    unsigned char value[4];
- 
- 
-    for( int i=0; i<numTilesExaminedPerCullStep; i++ ) {        
-        int result =
-            DB_Iterator_next( &tileCullingIterator, tileKey, value );
- 
-        if( result <= 0 ) {
-            // restart the iterator back at the beginning
-            DB_Iterator_init( &db, &tileCullingIterator );
-            if( numTilesSeenByIterator != 0 ) {
-                AppLog::infoF( "Map cull iterated through %d tile db entries.",
-                               numTilesSeenByIterator );
-                }
-            numTilesSeenByIterator = 0;
-            // end loop when we reach end of list, so we don't cycle through
-            // a short iterator list too quickly.
-            break;
-            }
-        else {
-            numTilesSeenByIterator ++;
-            }
- 
-       
-        int tileID = valueToInt( value );
-       
-        // consider 0-values too, where map has been cleared by players, but
-        // a natural object should be there
-        if( tileID >= 0 ) {
-            // next value
- 
-            int s = valueToInt( &( tileKey[8] ) );
-            int b = valueToInt( &( tileKey[12] ) );
-       
-            if( s == 0 && b == 0 ) {
-                // main object
-                int x = valueToInt( tileKey );
-                int y = valueToInt( &( tileKey[4] ) );
-               
-                int wildTile = getTweakedBaseMap( x, y );
-               
-                if( wildTile != tileID ) {
-                    // tile differs from natural tile
-                    // don't keep checking/resetting tiles that are already
-                    // in wild state
-                   
-                    // NOTE that we don't check/clear container slots for
-                    // already-wild tiles.  So a natural container
-                    // (if one is ever
-                    // added to the game, like a hidey-hole cave) will
-                    // keep its items even after that part of the map
-                    // is culled.  Seems like okay behavior.
- 
-                    timeSec_t lastLookTime = dbLookTimeGet( x, y );
- 
-                    if( curTime - lastLookTime > longTermCullingSeconds ) {
-                        // stale
-                   
-                        if( noCullItemList.getElementIndex( tileID ) == -1 ) {
-                            // not on our no-cull list
-                            clearAllContained( x, y );
-                           
-                            // put proc-genned map value in there
-                            setMapObject( x, y, wildTile );
- 
-                            if( wildTile != 0 &&
-                                getObject( wildTile )->permanent ) {
-                                // something nautural occurs here
-                                // this "breaks" any remaining floor
-                                // (which may be cull-proof on its own below).
-                                // this will effectively leave gaps in roads
-                                // with trees growing through, etc.
-                                setMapFloor( x, y, 0 );
-                                }                            
-                            }
-                        }
-                    }
-                }
-            }
+    
+    int numToApply = longTermCullEditsPerStep;
+    
+    if( numToApply > numLeft ) {
+        numToApply = numLeft;
         }
-   
-   
- 
-    if( !floorCullingIteratorSet ) {
-        DB_Iterator_init( &floorDB, &floorCullingIterator );
-        floorCullingIteratorSet = true;
-        numFloorsSeenByIterator = 0;
+    
+    for( int i=0; i<numToApply; i++ ) {
+        applyCullEdit( cullEdits.getElement( nextCullEdit ), curTime );
+        nextCullEdit++;
         }
-   
- 
-    for( int i=0; i<numTilesExaminedPerCullStep; i++ ) {        
-        int result =
-            DB_Iterator_next( &floorCullingIterator, floorKey, value );
- 
-        if( result <= 0 ) {
-            // restart the iterator back at the beginning
-            DB_Iterator_init( &floorDB, &floorCullingIterator );
-            if( numFloorsSeenByIterator != 0 ) {
-                AppLog::infoF( "Map cull iterated through %d floor db entries.",
-                               numFloorsSeenByIterator );
-                }
-            numFloorsSeenByIterator = 0;
-            // end loop now, avoid re-cycling through a short list
-            // in same step
-            break;
-            }
-        else {
-            numFloorsSeenByIterator ++;
-            }
-       
-       
-        int floorID = valueToInt( value );
-       
-        if( floorID > 0 ) {
-            // next value
-           
-            int x = valueToInt( floorKey );
-            int y = valueToInt( &( floorKey[4] ) );
-               
-            timeSec_t lastLookTime = dbLookTimeGet( x, y );
- 
-            if( curTime - lastLookTime > longTermCullingSeconds ) {
-                // stale
- 
-                if( noCullItemList.getElementIndex( floorID ) == -1 ) {
-                    // not on our no-cull list
-                   
-                    setMapFloor( x, y, 0 );
-                    }
-                }
-            }
+    
+    if( nextCullEdit == cullEdits.size() && mapScanThread == NULL ) {
+        AppLog::infoF( "Map cull applied %d of %d edits, rest changed "
+                       "since snapshot", 
+                       numCullEditsApplied, numCullEditsTaken );
+        
+        cullEdits.deleteAll();
+        nextCullEdit = 0;
+        numCullEditsTaken = 0;
+        numCullEditsApplied = 0;
         }
     }
 
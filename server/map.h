@@ -43,6 +43,22 @@ char initMap();
 void freeMap( char inSkipCleanup = false );
 
 
+
+// pre-generates natural map and biomes out to inRadius (or barrierRadius
+// if -1) around 0,0 into naturalMap.bin, which initMap loads and uses
+// before generating cells live, as long as map seed and object data
+// haven't changed since
+// must be called after initMap
+// returns 0 on success, -1 on failure
+int bakeNaturalMap( int inRadius = -1 );
+
+
+// compares inNumSamples random cells of loaded naturalMap.bin to live
+// generation, printing any that don't match
+// returns 0 if all match, -1 otherwise
+int checkNaturalMap( int inNumSamples );
+
+
 // loads seed from file, or generates a new one and saves it to file
 void reseedMap( char inForceFresh );
 
@@ -53,6 +69,32 @@ void wipeMapFiles();
 
 
 
+// freezes the map .db files on disk at the current state, so they
+// can be copied for a consistent backup while the server keeps running
+//
+// writes from here on are held in RAM until endMapSnapshot
+//
+// names of the files to copy (relative to the server folder) are
+// added to outFileNames, and must be destroyed by caller
+//
+// a snapshot that is already active can be shared, in which case the
+// files stay frozen at the state they were in when it began
+//
+// returns true on success
+char beginMapSnapshot( SimpleVector<char*> *outFileNames );
+
+
+// each beginMapSnapshot must be matched with a call to endMapSnapshot
+//
+// writes everything held since beginMapSnapshot out to the .db files
+// once the last holder ends its snapshot
+void endMapSnapshot();
+
+
+char isMapSnapshotActive();
+
+
+
 // make Eve placement radius bigger
 void doubleEveRadius();
 
@@ -86,6 +128,18 @@ unsigned char *getChunkMessage( int inStartX, int inStartY,
                                 int *outMessageLength );
 
 
+// generates base map and biomes for a rectangle now, in whole regions
+// (getChunkMessage does this for its chunk)
+void generateMapRegions( int inStartX, int inStartY, 
+                         int inWidth, int inHeight );
+
+
+// asks generator threads to generate base map and biomes for a rectangle
+// in the background, ahead of a getChunkMessage call for it
+void prefetchMapRegions( int inStartX, int inStartY, 
+                         int inWidth, int inHeight );
+
+
 // sets the player responsible for subsequent map changes
 // meant to track who set down an object
 // should be set to -1 (default) except for object set-down
@@ -319,10 +373,33 @@ void setGravePlayerID( int inX, int inY, int inPlayerID );
 
 
 // culling regions of map that haven't been seen in a long time
+//
+// stale tiles are found by a background pass over a snapshot of the
+// map DB files, and culled a few per call
+//
+// also runs the passes for startMapObjectCount, even if culling is off
 void stepMapLongTermCulling( int inNumCurrentPlayers );
 
 
 
+// counts objects at a list of map positions in the next background
+// pass over a map snapshot
+//
+// returns false if a count is already waiting or running
+char startMapObjectCount( SimpleVector<GridPos> *inPositions );
+
+
+// returns true once a count started by startMapObjectCount is done,
+// adding one entry to outIDs and outCounts for each object ID seen
+//
+// positions that can't be read from the snapshot (barrier, or near
+// biome DB area) are added to outUncounted, to be checked by caller
+char getMapObjectCountResult( SimpleVector<int> *outIDs, 
+                              SimpleVector<int> *outCounts,
+                              SimpleVector<GridPos> *outUncounted );
+
+
+
 // looks for deadly object that is crossing inPos
 // passes out moving object's destination
 int getDeadlyMovingMapObject( int inPosX, int inPosY,
@@ -0,0 +1,364 @@
+// Moves each map cell's own records between mapTile.db and the separate
+// map.db, mapTime.db, floor.db, and floorTime.db files
+// (see useMapTileDB setting and TileRecord in dbCommon.h)
+//
+// Run in the server folder, with the server shut down.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#include "lineardb3.h"
+#include "regiondb.h"
+#include "dbCommon.h"
+
+
+// same slots as in map.cpp
+#define DECAY_SLOT 1
+#define NUM_CONT_SLOT 2
+
+
+
+void usage() {
+    printf( "Usage:\n" );
+    printf( "mapTileConvert merge\n" );
+    printf( "    moves cell records into mapTile.db, "
+            "before turning useMapTileDB on\n\n" );
+    printf( "mapTileConvert split\n" );
+    printf( "    moves cell records back out of mapTile.db, "
+            "before turning useMapTileDB off\n\n" );
+
+    exit( 1 );
+    }
+
+
+
+static LINEARDB3 mapDB;
+static LINEARDB3 timeDB;
+static LINEARDB3 floorDB;
+static LINEARDB3 floorTimeDB;
+static REGIONDB tileDB;
+
+
+
+static void openDB( LINEARDB3 *inDB, const char *inPath,
+                    int inKeySize, int inValueSize ) {
+    int error = LINEARDB3_open( inDB,
+                                inPath,
+                                0,
+                                80000,
+                                inKeySize,
+                                inValueSize );
+    if( error ) {
+        printf( "mapTileConvert: Failed to open %s\n", inPath );
+        exit( 1 );
+        }
+    }
+
+
+
+static void getTile( int inX, int inY, TileRecord *outRecord ) {
+    unsigned char value[ TILE_RECORD_SIZE ];
+
+    if( REGIONDB_get( &tileDB, inX, inY, value ) == 0 ) {
+        valueToTileRecord( value, outRecord );
+        }
+    else {
+        clearTileRecord( outRecord );
+        }
+    }
+
+
+
+static void putTile( int inX, int inY, TileRecord *inRecord ) {
+    unsigned char value[ TILE_RECORD_SIZE ];
+
+    int error;
+
+    if( isTileRecordEmpty( inRecord ) ) {
+        error = REGIONDB_delete( &tileDB, inX, inY );
+        }
+    else {
+        tileRecordToValue( inRecord, value );
+        error = REGIONDB_put( &tileDB, inX, inY, value );
+        }
+
+    if( error == -1 ) {
+        printf( "mapTileConvert: Failed to write to mapTile.db\n" );
+        exit( 1 );
+        }
+    }
+
+
+
+// true if map.db or mapTime.db record belongs in mapTile.db
+static char isTileSlot( unsigned char *inKey, int inTileSlot ) {
+    int s = valueToInt( &( inKey[8] ) );
+    int b = valueToInt( &( inKey[12] ) );
+
+    return b == 0 && ( s == inTileSlot || ( inTileSlot == 0 && 
+                                            s == NUM_CONT_SLOT ) );
+    }
+
+
+
+// removes merged records from a source DB
+// inTileSlot is 0 for map.db, DECAY_SLOT for mapTime.db, and -1 for
+// floor.db and floorTime.db, where every record is merged
+static void removeMerged( LINEARDB3 *inDB, int inTileSlot ) {
+    unsigned char key[16];
+    unsigned char value[8];
+
+    LINEARDB3_Iterator dbi;
+
+    LINEARDB3_Iterator_init( inDB, &dbi );
+
+    while( LINEARDB3_Iterator_next( &dbi, key, value ) > 0 ) {
+        if( inTileSlot == -1 || isTileSlot( key, inTileSlot ) ) {
+            LINEARDB3_delete( inDB, key );
+            }
+        }
+    }
+
+
+
+// tile records are all written to file before any source records are
+// deleted, so it is safe to run merge again after an interrupted run
+static void merge() {
+    unsigned char key[16];
+    unsigned char value[8];
+
+    LINEARDB3_Iterator dbi;
+
+    int count = 0;
+
+    printf( "Merging cell objects and contained counts from map.db...\n" );
+
+    LINEARDB3_Iterator_init( &mapDB, &dbi );
+
+    while( LINEARDB3_Iterator_next( &dbi, key, value ) > 0 ) {
+        if( ! isTileSlot( key, 0 ) ) {
+            // contained objects stay in map.db
+            continue;
+            }
+
+        int s = valueToInt( &( key[8] ) );
+
+        int x = valueToInt( key );
+        int y = valueToInt( &( key[4] ) );
+        int v = valueToInt( value );
+
+        TileRecord r;
+        getTile( x, y, &r );
+
+        if( s == 0 ) {
+            r.object = v;
+            }
+        else if( v > 0 ) {
+            r.numContained = v;
+            }
+
+        putTile( x, y, &r );
+        count++;
+        }
+    printf( "...%d records\n\n", count );
+
+
+    printf( "Merging cell decay ETAs from mapTime.db...\n" );
+    count = 0;
+
+    LINEARDB3_Iterator_init( &timeDB, &dbi );
+
+    while( LINEARDB3_Iterator_next( &dbi, key, value ) > 0 ) {
+        if( ! isTileSlot( key, DECAY_SLOT ) ) {
+            continue;
+            }
+
+        int x = valueToInt( key );
+        int y = valueToInt( &( key[4] ) );
+
+        TileRecord r;
+        getTile( x, y, &r );
+        r.etaDecay = valueToTime( value );
+        putTile( x, y, &r );
+        count++;
+        }
+    printf( "...%d records\n\n", count );
+
+
+    printf( "Merging floors from floor.db...\n" );
+    count = 0;
+
+    LINEARDB3_Iterator_init( &floorDB, &dbi );
+
+    while( LINEARDB3_Iterator_next( &dbi, key, value ) > 0 ) {
+        int x = valueToInt( key );
+        int y = valueToInt( &( key[4] ) );
+        int v = valueToInt( value );
+
+        TileRecord r;
+        getTile( x, y, &r );
+
+        if( v > 0 ) {
+            r.floor = v;
+            }
+        putTile( x, y, &r );
+        count++;
+        }
+    printf( "...%d records\n\n", count );
+
+
+    printf( "Merging floor decay ETAs from floorTime.db...\n" );
+    count = 0;
+
+    LINEARDB3_Iterator_init( &floorTimeDB, &dbi );
+
+    while( LINEARDB3_Iterator_next( &dbi, key, value ) > 0 ) {
+        int x = valueToInt( key );
+        int y = valueToInt( &( key[4] ) );
+
+        TileRecord r;
+        getTile( x, y, &r );
+        r.floorEtaDecay = valueToTime( value );
+        putTile( x, y, &r );
+        count++;
+        }
+    printf( "...%d records\n\n", count );
+
+    if( REGIONDB_flush( &tileDB ) == -1 ) {
+        printf( "mapTileConvert: Failed to flush mapTile.db\n" );
+        exit( 1 );
+        }
+
+    printf( "mapTile.db now holds %u cells in %u region pages\n\n",
+            REGIONDB_getNumRecords( &tileDB ), tileDB.numPages );
+
+    printf( "Removing merged records...\n\n" );
+
+    removeMerged( &mapDB, 0 );
+    removeMerged( &timeDB, DECAY_SLOT );
+    removeMerged( &floorDB, -1 );
+    removeMerged( &floorTimeDB, -1 );
+    }
+
+
+
+// separate records are written before tile record is deleted, so it is
+// safe to run split again after an interrupted run
+static void split() {
+    unsigned char tileKey[8];
+    unsigned char tileValue[ TILE_RECORD_SIZE ];
+
+    unsigned char key[16];
+    unsigned char value[8];
+
+    REGIONDB_Iterator dbi;
+
+    int count = 0;
+
+    printf( "Splitting mapTile.db records back out...\n" );
+
+    REGIONDB_Iterator_init( &tileDB, &dbi );
+
+    int x, y;
+
+    while( REGIONDB_Iterator_next( &dbi, &x, &y, tileValue ) > 0 ) {
+        intPairToKey( x, y, tileKey );
+
+        TileRecord r;
+        valueToTileRecord( tileValue, &r );
+
+        if( r.object != -1 ) {
+            intQuadToKey( x, y, 0, 0, key );
+            intToValue( r.object, value );
+            LINEARDB3_put( &mapDB, key, value );
+            }
+        if( r.numContained != -1 ) {
+            intQuadToKey( x, y, NUM_CONT_SLOT, 0, key );
+            intToValue( r.numContained, value );
+            LINEARDB3_put( &mapDB, key, value );
+            }
+        if( r.etaDecay != 0 ) {
+            intQuadToKey( x, y, DECAY_SLOT, 0, key );
+            timeToValue( r.etaDecay, value );
+            LINEARDB3_put( &timeDB, key, value );
+            }
+        if( r.floor != -1 ) {
+            intToValue( r.floor, value );
+            LINEARDB3_put( &floorDB, tileKey, value );
+            }
+        if( r.floorEtaDecay != 0 ) {
+            timeToValue( r.floorEtaDecay, value );
+            LINEARDB3_put( &floorTimeDB, tileKey, value );
+            }
+
+        // deletes only reach file when page is written back, after
+        // the puts above
+        REGIONDB_delete( &tileDB, x, y );
+        count++;
+        }
+
+    printf( "...%d cells\n\n", count );
+    }
+
+
+
+int main( int inNumArgs, char **inArgs ) {
+
+    if( inNumArgs != 2 ) {
+        usage();
+        }
+
+    char doMerge = false;
+
+    if( strcmp( inArgs[1], "merge" ) == 0 ) {
+        doMerge = true;
+        }
+    else if( strcmp( inArgs[1], "split" ) != 0 ) {
+        usage();
+        }
+
+    // same as server
+    LINEARDB3_setMaxLoad( 0.80 );
+
+    openDB( &mapDB, "map.db", 16, 4 );
+    openDB( &timeDB, "mapTime.db", 16, 8 );
+    openDB( &floorDB, "floor.db", 8, 4 );
+    openDB( &floorTimeDB, "floorTime.db", 8, 8 );
+
+    if( REGIONDB_open( &tileDB, "mapTile.db", TILE_RECORD_SIZE, 1024 ) ) {
+        printf( "mapTileConvert: Failed to open mapTile.db\n" );
+        exit( 1 );
+        }
+
+    if( doMerge ) {
+        merge();
+        }
+    else {
+        split();
+        }
+
+    // closing compacts away the space freed by deletes
+    printf( "Closing and compacting DB files...\n" );
+
+    LINEARDB3_close( &mapDB );
+    LINEARDB3_close( &timeDB );
+    LINEARDB3_close( &floorDB );
+    LINEARDB3_close( &floorTimeDB );
+
+    unsigned int numTiles = REGIONDB_getNumRecords( &tileDB );
+
+    REGIONDB_close( &tileDB );
+
+    if( ! doMerge && numTiles == 0 ) {
+        // server refuses to start with useMapTileDB off while it exists
+        remove( "mapTile.db" );
+        remove( "mapTile.db.cold" );
+        }
+
+    printf( "...done\n" );
+
+    return 0;
+    }
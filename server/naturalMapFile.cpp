@@ -0,0 +1,363 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "naturalMapFile.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define fseeko fseeko64
+#define ftello ftello64
+#else
+#define NATURALMAP_MMAP_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+
+static const char *magicString = "Nmap";
+
+#define NATURALMAP_VERSION 1
+
+// magic, version, radius, fingerprint, region size, record size,
+// padded out
+#define HEADER_SIZE 64
+
+// uint16 baseMap, uint8 biome, uint8 secondPlace + 1,
+// uint8 secondPlaceGap * GAP_SCALE, uint8 flags
+#define RECORD_SIZE 6
+
+#define REGION_BYTES ( NATURALMAP_CELLS_PER_REGION * RECORD_SIZE )
+
+// second place gaps are a few fixed values (0, 0.1), and must come back
+// out exactly
+#define GAP_SCALE 200.0
+
+#define FLAG_GRID_PLACEMENT 1
+
+
+
+static void putUInt32( uint32_t inV, uint8_t *outBytes ) {
+    outBytes[0] = inV & 0xFF;
+    outBytes[1] = ( inV >> 8 ) & 0xFF;
+    outBytes[2] = ( inV >> 16 ) & 0xFF;
+    outBytes[3] = ( inV >> 24 ) & 0xFF;
+    }
+
+
+
+static uint32_t getUInt32( uint8_t *inBytes ) {
+    return
+        (uint32_t)inBytes[0] |
+        (uint32_t)inBytes[1] << 8 |
+        (uint32_t)inBytes[2] << 16 |
+        (uint32_t)inBytes[3] << 24;
+    }
+
+
+
+// regions covering -inRadius..inRadius
+static void setRegionRange( NATURALMAP *inMap, int inRadius ) {
+    inMap->radius = inRadius;
+    inMap->minRegion = ( -inRadius ) >> NATURALMAP_REGION_BITS;
+
+    int maxRegion = inRadius >> NATURALMAP_REGION_BITS;
+
+    inMap->regionsWide = maxRegion - inMap->minRegion + 1;
+    }
+
+
+
+static void clearMap( NATURALMAP *inMap ) {
+    inMap->radius = -1;
+    inMap->fingerprint = 0;
+    inMap->minRegion = 0;
+    inMap->regionsWide = 0;
+    inMap->data = NULL;
+    inMap->dataLength = 0;
+    inMap->mapped = false;
+    inMap->cells = NULL;
+    inMap->file = NULL;
+    inMap->path = NULL;
+    inMap->tempPath = NULL;
+    inMap->numRegionsWritten = 0;
+    }
+
+
+
+int NATURALMAP_open( NATURALMAP *inMap, const char *inPath ) {
+    clearMap( inMap );
+
+    FILE *f = fopen( inPath, "rb" );
+
+    if( f == NULL ) {
+        return -1;
+        }
+
+    uint8_t header[ HEADER_SIZE ];
+
+    if( fread( header, HEADER_SIZE, 1, f ) != 1 ||
+        memcmp( header, magicString, 4 ) != 0 ||
+        getUInt32( &( header[4] ) ) != NATURALMAP_VERSION ||
+        getUInt32( &( header[16] ) ) != NATURALMAP_REGION_SIZE ||
+        getUInt32( &( header[20] ) ) != RECORD_SIZE ) {
+
+        printf( "naturalMap:  %s is not a version %d natural map file\n",
+                inPath, NATURALMAP_VERSION );
+        fclose( f );
+        return -1;
+        }
+
+    int radius = (int)getUInt32( &( header[8] ) );
+
+    if( radius < 0 ) {
+        fclose( f );
+        return -1;
+        }
+
+    setRegionRange( inMap, radius );
+    inMap->fingerprint = getUInt32( &( header[12] ) );
+
+    uint64_t numRegions =
+        (uint64_t)inMap->regionsWide * (uint64_t)inMap->regionsWide;
+
+    inMap->dataLength = HEADER_SIZE + numRegions * REGION_BYTES;
+
+    fseeko( f, 0, SEEK_END );
+
+    if( (uint64_t)ftello( f ) < inMap->dataLength ) {
+        printf( "naturalMap:  %s is truncated\n", inPath );
+        fclose( f );
+        clearMap( inMap );
+        return -1;
+        }
+
+#ifdef NATURALMAP_MMAP_SUPPORTED
+    void *newMap = mmap( NULL, inMap->dataLength, PROT_READ, MAP_SHARED,
+                         fileno( f ), 0 );
+
+    if( newMap != MAP_FAILED ) {
+        inMap->data = (uint8_t*)newMap;
+        inMap->mapped = true;
+        }
+#endif
+
+    if( inMap->data == NULL ) {
+        // no mmap, read whole thing into RAM
+        inMap->data = new uint8_t[ inMap->dataLength ];
+
+        fseeko( f, 0, SEEK_SET );
+
+        if( fread( inMap->data, inMap->dataLength, 1, f ) != 1 ) {
+            printf( "naturalMap:  failed to read %s\n", inPath );
+            delete [] inMap->data;
+            fclose( f );
+            clearMap( inMap );
+            return -1;
+            }
+        }
+
+    // mapping stays valid after file closed
+    fclose( f );
+
+    inMap->cells = &( inMap->data[ HEADER_SIZE ] );
+
+    return 0;
+    }
+
+
+
+char NATURALMAP_get( NATURALMAP *inMap, int inX, int inY,
+                     NATURALMAP_Cell *outCell ) {
+
+    if( inMap->cells == NULL ||
+        inX > inMap->radius || inX < -inMap->radius ||
+        inY > inMap->radius || inY < -inMap->radius ) {
+        return false;
+        }
+
+    int rx = ( inX >> NATURALMAP_REGION_BITS ) - inMap->minRegion;
+    int ry = ( inY >> NATURALMAP_REGION_BITS ) - inMap->minRegion;
+
+    int c =
+        ( inY & ( NATURALMAP_REGION_SIZE - 1 ) ) * NATURALMAP_REGION_SIZE +
+        ( inX & ( NATURALMAP_REGION_SIZE - 1 ) );
+
+    uint8_t *r = &( inMap->cells[
+                        ( (uint64_t)ry * inMap->regionsWide + rx ) *
+                        REGION_BYTES +
+                        c * RECORD_SIZE ] );
+
+    outCell->baseMap = r[0] | r[1] << 8;
+    outCell->biome = r[2];
+    outCell->secondPlace = (int)r[3] - 1;
+    outCell->secondPlaceGap = r[4] / GAP_SCALE;
+    outCell->gridPlacement = ( r[5] & FLAG_GRID_PLACEMENT ) != 0;
+
+    return true;
+    }
+
+
+
+void NATURALMAP_close( NATURALMAP *inMap ) {
+    if( inMap->data != NULL ) {
+#ifdef NATURALMAP_MMAP_SUPPORTED
+        if( inMap->mapped ) {
+            munmap( inMap->data, inMap->dataLength );
+            }
+        else {
+            delete [] inMap->data;
+            }
+#else
+        delete [] inMap->data;
+#endif
+        }
+
+    if( inMap->file != NULL ) {
+        // never finished
+        fclose( inMap->file );
+        remove( inMap->tempPath );
+        }
+
+    if( inMap->path != NULL ) {
+        delete [] inMap->path;
+        }
+    if( inMap->tempPath != NULL ) {
+        delete [] inMap->tempPath;
+        }
+
+    clearMap( inMap );
+    }
+
+
+
+int NATURALMAP_create( NATURALMAP *inMap, const char *inPath,
+                       int inRadius, uint32_t inFingerprint ) {
+    clearMap( inMap );
+
+    if( inRadius < 0 ) {
+        return -1;
+        }
+
+    setRegionRange( inMap, inRadius );
+    inMap->fingerprint = inFingerprint;
+
+    int pathLength = strlen( inPath );
+
+    inMap->path = new char[ pathLength + 1 ];
+    strcpy( inMap->path, inPath );
+
+    inMap->tempPath = new char[ pathLength + 6 ];
+    sprintf( inMap->tempPath, "%s.temp", inPath );
+
+    inMap->file = fopen( inMap->tempPath, "wb" );
+
+    if( inMap->file == NULL ) {
+        printf( "naturalMap:  failed to open %s for writing\n",
+                inMap->tempPath );
+        NATURALMAP_close( inMap );
+        return -1;
+        }
+
+    uint8_t header[ HEADER_SIZE ];
+    memset( header, 0, HEADER_SIZE );
+
+    memcpy( header, magicString, 4 );
+    putUInt32( NATURALMAP_VERSION, &( header[4] ) );
+    putUInt32( (uint32_t)inRadius, &( header[8] ) );
+    putUInt32( inFingerprint, &( header[12] ) );
+    putUInt32( NATURALMAP_REGION_SIZE, &( header[16] ) );
+    putUInt32( RECORD_SIZE, &( header[20] ) );
+
+    if( fwrite( header, HEADER_SIZE, 1, inMap->file ) != 1 ) {
+        NATURALMAP_close( inMap );
+        return -1;
+        }
+
+    return 0;
+    }
+
+
+
+int NATURALMAP_addRegion( NATURALMAP *inMap, NATURALMAP_Cell *inCells ) {
+    if( inMap->file == NULL ) {
+        return -1;
+        }
+
+    uint8_t region[ REGION_BYTES ];
+
+    for( int c=0; c<NATURALMAP_CELLS_PER_REGION; c++ ) {
+        NATURALMAP_Cell *cell = &( inCells[c] );
+
+        int gap = lrint( cell->secondPlaceGap * GAP_SCALE );
+
+        if( cell->baseMap < 0 || cell->baseMap > 0xFFFF ||
+            cell->biome < 0 || cell->biome > 0xFF ||
+            cell->secondPlace < -1 || cell->secondPlace > 0xFE ||
+            gap < 0 || gap > 0xFF ||
+            gap / GAP_SCALE != cell->secondPlaceGap ) {
+
+            printf( "naturalMap:  cell doesn't fit in record "
+                    "(object %d, biome %d, second place %d, gap %f)\n",
+                    cell->baseMap, cell->biome, cell->secondPlace,
+                    cell->secondPlaceGap );
+            return -1;
+            }
+
+        uint8_t *r = &( region[ c * RECORD_SIZE ] );
+
+        r[0] = cell->baseMap & 0xFF;
+        r[1] = ( cell->baseMap >> 8 ) & 0xFF;
+        r[2] = cell->biome;
+        r[3] = cell->secondPlace + 1;
+        r[4] = gap;
+        r[5] = cell->gridPlacement ? FLAG_GRID_PLACEMENT : 0;
+        }
+
+    if( fwrite( region, REGION_BYTES, 1, inMap->file ) != 1 ) {
+        printf( "naturalMap:  failed to write to %s\n", inMap->tempPath );
+        return -1;
+        }
+
+    inMap->numRegionsWritten++;
+
+    return 0;
+    }
+
+
+
+int NATURALMAP_finish( NATURALMAP *inMap ) {
+    if( inMap->file == NULL ) {
+        return -1;
+        }
+
+    char failed = false;
+
+    if( inMap->numRegionsWritten !=
+        inMap->regionsWide * inMap->regionsWide ) {
+        printf( "naturalMap:  only %d of %d regions written\n",
+                inMap->numRegionsWritten,
+                inMap->regionsWide * inMap->regionsWide );
+        failed = true;
+        }
+
+    if( fclose( inMap->file ) != 0 ) {
+        failed = true;
+        }
+    inMap->file = NULL;
+
+    if( failed || rename( inMap->tempPath, inMap->path ) != 0 ) {
+        remove( inMap->tempPath );
+        failed = true;
+        }
+
+    NATURALMAP_close( inMap );
+
+    if( failed ) {
+        return -1;
+        }
+    return 0;
+    }
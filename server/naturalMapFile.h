@@ -0,0 +1,108 @@
+#ifndef NATURAL_MAP_FILE_H_INCLUDED
+#define NATURAL_MAP_FILE_H_INCLUDED
+
+
+
+// Pre-baked natural map:  the base map object and biome for every cell
+// in a square around 0,0, as generated from a given map seed and
+// object data.
+//
+// Cells are stored in NATURALMAP_REGION_SIZE x NATURALMAP_REGION_SIZE
+// regions, each region contiguous in the file, regions in rows from
+// the bottom-left corner.  The file is memory-mapped and read in place.
+//
+// A fingerprint of everything that went into generating the cells is
+// stored in the header, so that stale files can be detected and
+// ignored.
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+// must match region size used when baking
+#define NATURALMAP_REGION_BITS 5
+#define NATURALMAP_REGION_SIZE ( 1 << NATURALMAP_REGION_BITS )
+
+#define NATURALMAP_CELLS_PER_REGION \
+    ( NATURALMAP_REGION_SIZE * NATURALMAP_REGION_SIZE )
+
+
+
+typedef struct {
+        int baseMap;
+        char gridPlacement;
+
+        int biome;
+        // -1 for none
+        int secondPlace;
+        double secondPlaceGap;
+    } NATURALMAP_Cell;
+
+
+
+typedef struct {
+        int radius;
+        uint32_t fingerprint;
+
+        // in regions, covering -radius..radius
+        int minRegion;
+        int regionsWide;
+
+        // whole file
+        uint8_t *data;
+        uint64_t dataLength;
+        char mapped;
+
+        // start of first region in data
+        uint8_t *cells;
+
+        // when writing
+        FILE *file;
+        char *path;
+        char *tempPath;
+        int numRegionsWritten;
+    } NATURALMAP;
+
+
+
+// returns 0 on success, -1 on failure
+// fails if file doesn't exist or isn't a natural map file
+int NATURALMAP_open( NATURALMAP *inMap, const char *inPath );
+
+
+// returns false if x,y is outside baked radius
+char NATURALMAP_get( NATURALMAP *inMap, int inX, int inY,
+                     NATURALMAP_Cell *outCell );
+
+
+// for reading or writing
+void NATURALMAP_close( NATURALMAP *inMap );
+
+
+
+// starts a new file, written to a temp file that replaces inPath
+// in NATURALMAP_finish
+//
+// regions must then be added in file order, bottom row first, left
+// to right, starting at region inMap->minRegion, inMap->minRegion
+//
+// returns 0 on success, -1 on failure
+int NATURALMAP_create( NATURALMAP *inMap, const char *inPath,
+                       int inRadius, uint32_t inFingerprint );
+
+
+// inCells in rows, NATURALMAP_CELLS_PER_REGION of them
+//
+// returns 0 on success, -1 on failure, including cells that don't fit
+// in a file record
+int NATURALMAP_addRegion( NATURALMAP *inMap, NATURALMAP_Cell *inCells );
+
+
+// returns 0 on success, -1 on failure
+// closes inMap either way
+int NATURALMAP_finish( NATURALMAP *inMap );
+
+
+
+#endif
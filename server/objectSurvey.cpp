@@ -37,6 +37,12 @@ static int nextFinalPosToAdd = 0;
 static SimpleVector<GridPos> mapPosToCheck;
 
 
+// most map positions are counted by a background pass over a map
+// snapshot, the rest are checked here in batches
+static char mapCountStarted = false;
+static char mapCountFinished = false;
+
+
 static int mapPosBatch = 100;
 
 
@@ -64,6 +70,19 @@ static SurveyRecord *findRecord( int inID ) {
     return NULL;
     }
 
+
+
+static void addToRecord( int inID, int inCount ) {
+    SurveyRecord *r = findRecord( inID );
+    if( r != NULL ) {
+        r->count += inCount;
+        }
+    else {
+        SurveyRecord newRec = { inID, inCount };
+        objectSurveyRecords.push_back( newRec );
+        }
+    }
+
     
 
 
@@ -137,6 +156,45 @@ void stepObjectSurvey() {
             }
 
         
+        if( ! mapCountStarted ) {
+            if( mapPosToCheck.size() == 0 ) {
+                // no players, nothing to count
+                mapCountStarted = true;
+                mapCountFinished = true;
+                }
+            else if( startMapObjectCount( &mapPosToCheck ) ) {
+                mapCountStarted = true;
+                mapPosToCheck.deleteAll();
+                }
+            return;
+            }
+        
+        if( ! mapCountFinished ) {
+            SimpleVector<int> ids;
+            SimpleVector<int> counts;
+            
+            // positions that the snapshot pass couldn't count go back
+            // into our list
+            if( ! getMapObjectCountResult( &ids, &counts, 
+                                           &mapPosToCheck ) ) {
+                return;
+                }
+            
+            mapCountFinished = true;
+            
+            for( int i=0; i<ids.size(); i++ ) {
+                addToRecord( ids.getElementDirect( i ),
+                             counts.getElementDirect( i ) );
+                }
+            
+            AppLog::infoF( 
+                "Map snapshot pass counted %d unique objects, "
+                "%d map positions left to check",
+                ids.size(), mapPosToCheck.size() );
+            return;
+            }
+        
+
         int numMapPosLeft = mapPosToCheck.size();
         if( numMapPosLeft > 0 ) {
             
@@ -161,14 +219,7 @@ void stepObjectSurvey() {
                 
 
                 if( id > 0 ) {    
-                    SurveyRecord *r = findRecord( id );
-                    if( r != NULL ) {
-                        r->count ++;
-                        }
-                    else {
-                        SurveyRecord newRec = { id, 1 };
-                        objectSurveyRecords.push_back( newRec );
-                        }
+                    addToRecord( id, 1 );
                     }
                 }
             return;
@@ -279,6 +330,11 @@ char shouldRunObjectSurvey() {
 
 
 void startObjectSurvey( SimpleVector<GridPos> *inLivingPlayerPositions ) {
+    if( surveyRunning ) {
+        AppLog::info( "Object survey already running, not starting another" );
+        return;
+        }
+    
     AppLog::infoF( "Starting object survey around %d players",
                    inLivingPlayerPositions->size() );
     
@@ -293,5 +349,8 @@ void startObjectSurvey( SimpleVector<GridPos> *inLivingPlayerPositions ) {
     playerPosToCheck.push_back_other( inLivingPlayerPositions );
     nextPlayerPosToCheck = 0;
     nextFinalPosToAdd = 0;
+    
+    mapCountStarted = false;
+    mapCountFinished = false;
     }
 
@@ -0,0 +1,220 @@
+#include "playerGrid.h"
+
+
+
+static PlayerGridBox noBox = { 0, 0, -1, -1 };
+
+
+
+PlayerGrid::PlayerGrid( int inCellSize )
+        : mCellSize( inCellSize ),
+          mCellIndex( 1024, -1 ),
+          mBoxes( 1024, noBox ) {
+    }
+
+
+
+PlayerGrid::~PlayerGrid() {
+    clear();
+    }
+
+
+
+int PlayerGrid::getCellCoord( int inTileCoord ) {
+    // round toward negative infinity, so cell 0 doesn't cover both
+    // sides of the origin
+    if( inTileCoord < 0 ) {
+        return - ( ( - inTileCoord - 1 ) / mCellSize ) - 1;
+        }
+    return inTileCoord / mCellSize;
+    }
+
+
+
+void PlayerGrid::addToCells( int inID, PlayerGridBox inBox ) {
+    PlayerGridEntry e = { inID, inBox.minCX, inBox.minCY };
+
+    for( int cy = inBox.minCY; cy <= inBox.maxCY; cy++ ) {
+        for( int cx = inBox.minCX; cx <= inBox.maxCX; cx++ ) {
+
+            char found;
+            int index = mCellIndex.lookup( cx, cy, 0, 0, &found );
+
+            if( ! found ) {
+                PlayerGridCell c = { cx, cy,
+                                     new SimpleVector<PlayerGridEntry>() };
+                mCells.push_back( c );
+
+                index = mCells.size() - 1;
+                mCellIndex.insert( cx, cy, 0, 0, index );
+                }
+
+            mCells.getElement( index )->entries->push_back( e );
+            }
+        }
+    }
+
+
+
+void PlayerGrid::removeFromCells( int inID, PlayerGridBox inBox ) {
+    for( int cy = inBox.minCY; cy <= inBox.maxCY; cy++ ) {
+        for( int cx = inBox.minCX; cx <= inBox.maxCX; cx++ ) {
+
+            char found;
+            int index = mCellIndex.lookup( cx, cy, 0, 0, &found );
+
+            if( ! found ) {
+                continue;
+                }
+
+            SimpleVector<PlayerGridEntry> *entries =
+                mCells.getElement( index )->entries;
+
+            for( int i=0; i<entries->size(); i++ ) {
+                if( entries->getElementDirect( i ).id == inID ) {
+                    // order doesn't matter, fill hole with last
+                    int last = entries->size() - 1;
+                    *( entries->getElement( i ) ) =
+                        entries->getElementDirect( last );
+                    entries->deleteElement( last );
+                    break;
+                    }
+                }
+
+            if( entries->size() == 0 ) {
+                // drop empty cell, moving last cell into its slot
+                delete entries;
+                mCellIndex.remove( cx, cy, 0, 0 );
+
+                int last = mCells.size() - 1;
+
+                if( index != last ) {
+                    PlayerGridCell lastCell = mCells.getElementDirect( last );
+
+                    *( mCells.getElement( index ) ) = lastCell;
+                    mCellIndex.insert( lastCell.cx, lastCell.cy, 0, 0,
+                                       index );
+                    }
+                mCells.deleteElement( last );
+                }
+            }
+        }
+    }
+
+
+
+void PlayerGrid::update( int inID, int inMinX, int inMinY,
+                         int inMaxX, int inMaxY ) {
+
+    PlayerGridBox newBox = { getCellCoord( inMinX ), getCellCoord( inMinY ),
+                             getCellCoord( inMaxX ), getCellCoord( inMaxY ) };
+
+    char found;
+    PlayerGridBox oldBox = mBoxes.lookup( inID, 0, 0, 0, &found );
+
+    if( found ) {
+        if( oldBox.minCX == newBox.minCX && oldBox.minCY == newBox.minCY &&
+            oldBox.maxCX == newBox.maxCX && oldBox.maxCY == newBox.maxCY ) {
+            return;
+            }
+        removeFromCells( inID, oldBox );
+        }
+
+    addToCells( inID, newBox );
+    mBoxes.insert( inID, 0, 0, 0, newBox );
+    }
+
+
+
+void PlayerGrid::remove( int inID ) {
+    char found;
+    PlayerGridBox oldBox = mBoxes.lookup( inID, 0, 0, 0, &found );
+
+    if( found ) {
+        removeFromCells( inID, oldBox );
+        mBoxes.remove( inID, 0, 0, 0 );
+        }
+    }
+
+
+
+void PlayerGrid::clear() {
+    for( int i=0; i<mCells.size(); i++ ) {
+        delete mCells.getElementDirect( i ).entries;
+        }
+    mCells.deleteAll();
+    mCellIndex.clear();
+    mBoxes.clear();
+    }
+
+
+
+int PlayerGrid::getNumPlayers() {
+    return mBoxes.getNumElements();
+    }
+
+
+
+static void addEntries( PlayerGridCell *inCell,
+                        int inQueryMinCX, int inQueryMinCY,
+                        SimpleVector<int> *outIDs ) {
+
+    SimpleVector<PlayerGridEntry> *entries = inCell->entries;
+
+    for( int i=0; i<entries->size(); i++ ) {
+        PlayerGridEntry *e = entries->getElement( i );
+
+        // report from the first cell that both boxes share
+        int firstCX = e->minCX;
+        if( inQueryMinCX > firstCX ) {
+            firstCX = inQueryMinCX;
+            }
+        int firstCY = e->minCY;
+        if( inQueryMinCY > firstCY ) {
+            firstCY = inQueryMinCY;
+            }
+
+        if( inCell->cx == firstCX && inCell->cy == firstCY ) {
+            outIDs->push_back( e->id );
+            }
+        }
+    }
+
+
+
+void PlayerGrid::getNear( int inX, int inY, int inRadius,
+                          SimpleVector<int> *outIDs ) {
+
+    int minCX = getCellCoord( inX - inRadius );
+    int minCY = getCellCoord( inY - inRadius );
+    int maxCX = getCellCoord( inX + inRadius );
+    int maxCY = getCellCoord( inY + inRadius );
+
+    double numQueryCells =
+        (double)( maxCX - minCX + 1 ) * (double)( maxCY - minCY + 1 );
+
+    if( numQueryCells <= mCells.size() ) {
+        for( int cy = minCY; cy <= maxCY; cy++ ) {
+            for( int cx = minCX; cx <= maxCX; cx++ ) {
+                char found;
+                int index = mCellIndex.lookup( cx, cy, 0, 0, &found );
+
+                if( found ) {
+                    addEntries( mCells.getElement( index ),
+                                minCX, minCY, outIDs );
+                    }
+                }
+            }
+        }
+    else {
+        // huge radius, cheaper to look at every cell we have
+        for( int i=0; i<mCells.size(); i++ ) {
+            PlayerGridCell *c = mCells.getElement( i );
+
+            if( c->cx >= minCX && c->cx <= maxCX &&
+                c->cy >= minCY && c->cy <= maxCY ) {
+                addEntries( c, minCX, minCY, outIDs );
+                }
+            }
+        }
+    }
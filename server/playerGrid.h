@@ -0,0 +1,92 @@
+#ifndef PLAYER_GRID_H_INCLUDED
+#define PLAYER_GRID_H_INCLUDED
+
+
+#include "minorGems/util/SimpleVector.h"
+
+#include "FlatHashTable.h"
+
+
+
+typedef struct PlayerGridBox {
+        // in cells, inclusive
+        int minCX, minCY, maxCX, maxCY;
+    } PlayerGridBox;
+
+
+typedef struct PlayerGridEntry {
+        int id;
+        // corner of player's box, so a query spanning several of the
+        // player's cells can report them only once
+        int minCX, minCY;
+    } PlayerGridEntry;
+
+
+typedef struct PlayerGridCell {
+        int cx, cy;
+        SimpleVector<PlayerGridEntry> *entries;
+    } PlayerGridCell;
+
+
+
+// Uniform spatial hash of players, for finding who is near a spot without
+// looking at every player.
+//
+// Each player is listed in every cell touched by a box that covers all the
+// spots they might be reported at until their next update (usually where
+// they are now, the rest of their path, and their destination).  Only
+// cells that have players in them are stored.
+//
+// Queries only narrow things down to the cell level, so callers still
+// check exact distances on what comes back.
+class PlayerGrid {
+    public:
+
+        PlayerGrid( int inCellSize );
+
+        ~PlayerGrid();
+
+
+        // box in world tiles, inclusive
+        // cheap if box still touches the same cells as last time
+        void update( int inID, int inMinX, int inMinY,
+                     int inMaxX, int inMaxY );
+
+        void remove( int inID );
+
+        void clear();
+
+
+        int getNumPlayers();
+
+
+        // adds ID of every player whose box comes within inRadius of
+        // (inX,inY) on both axes, each only once
+        void getNear( int inX, int inY, int inRadius,
+                      SimpleVector<int> *outIDs );
+
+
+    protected:
+
+        int mCellSize;
+
+        // in mCells, by cell coordinates
+        FlatHashTable<int> mCellIndex;
+
+        SimpleVector<PlayerGridCell> mCells;
+
+        // by player ID
+        FlatHashTable<PlayerGridBox> mBoxes;
+
+
+        int getCellCoord( int inTileCoord );
+
+        void addToCells( int inID, PlayerGridBox inBox );
+
+        void removeFromCells( int inID, PlayerGridBox inBox );
+
+    };
+
+
+
+#endif
@@ -0,0 +1,358 @@
+// Benchmark for the main loop's range-filtered sends, comparing the old
+// nested loops (every player checks every change) to finding receivers
+// for each change through PlayerGrid.
+//
+// 500 players are spread across several towns far apart from each other,
+// and each step some of them start moves, and the rest of the world makes
+// a mix of near (32 tile) and middle (64 tile) range changes around them.
+//
+// Also compares closest-player lookups (getClosestPlayerPos).
+
+
+#include "playerGrid.h"
+
+#include "minorGems/system/Time.h"
+
+#include "minorGems/util/random/CustomRandomSource.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+
+#define NUM_PLAYERS 500
+#define NUM_TOWNS 10
+#define TOWN_RADIUS 100
+#define TOWN_SPACING 4000
+
+#define NUM_STEPS 200
+
+// per step
+#define NUM_MOVES 60
+#define NUM_NEAR_CHANGES 120
+#define NUM_MIDDLE_CHANGES 120
+#define NUM_CLOSEST_QUERIES 200
+
+// matches chunkDimensionX in server.cpp
+#define CELL_SIZE 32
+
+#define NEAR_RANGE 32
+#define MIDDLE_RANGE 64
+
+
+typedef struct SimPlayer {
+        int xs, ys;
+        int xd, yd;
+    } SimPlayer;
+
+
+typedef struct SimChange {
+        int x, y;
+        int range;
+    } SimChange;
+
+
+static SimPlayer players[ NUM_PLAYERS ];
+
+static int townX[ NUM_TOWNS ];
+static int townY[ NUM_TOWNS ];
+
+
+
+static double intDist( int inXA, int inYA, int inXB, int inYB ) {
+    double dx = (double)inXA - (double)inXB;
+    double dy = (double)inYA - (double)inYB;
+
+    return sqrt( dx * dx + dy * dy );
+    }
+
+
+
+static void updateGrid( PlayerGrid *inGrid, int inID ) {
+    SimPlayer *p = &( players[ inID ] );
+
+    int minX = p->xs < p->xd ? p->xs : p->xd;
+    int minY = p->ys < p->yd ? p->ys : p->yd;
+    int maxX = p->xs > p->xd ? p->xs : p->xd;
+    int maxY = p->ys > p->yd ? p->ys : p->yd;
+
+    inGrid->update( inID, minX, minY, maxX, maxY );
+    }
+
+
+
+// same world for both runs
+static void placePlayers( CustomRandomSource *inSource ) {
+    for( int t=0; t<NUM_TOWNS; t++ ) {
+        townX[t] = ( t % 5 ) * TOWN_SPACING - 2 * TOWN_SPACING;
+        townY[t] = ( t / 5 ) * TOWN_SPACING - TOWN_SPACING / 2;
+        }
+
+    for( int i=0; i<NUM_PLAYERS; i++ ) {
+        // most in towns, a few out exploring
+        int t = inSource->getRandomBoundedInt( 0, NUM_TOWNS - 1 );
+
+        int spread = TOWN_RADIUS;
+        if( inSource->getRandomBoundedInt( 0, 9 ) == 0 ) {
+            spread = TOWN_RADIUS * 10;
+            }
+
+        players[i].xs = townX[t] +
+            inSource->getRandomBoundedInt( -spread, spread );
+        players[i].ys = townY[t] +
+            inSource->getRandomBoundedInt( -spread, spread );
+
+        players[i].xd = players[i].xs;
+        players[i].yd = players[i].ys;
+        }
+    }
+
+
+
+static void makeStep( CustomRandomSource *inSource,
+                      SimpleVector<SimChange> *outChanges,
+                      SimpleVector<int> *outMovedIDs ) {
+
+    // finish last step's moves
+    for( int i=0; i<NUM_PLAYERS; i++ ) {
+        players[i].xs = players[i].xd;
+        players[i].ys = players[i].yd;
+        }
+
+    for( int m=0; m<NUM_MOVES; m++ ) {
+        int id = inSource->getRandomBoundedInt( 0, NUM_PLAYERS - 1 );
+
+        players[id].xd += inSource->getRandomBoundedInt( -8, 8 );
+        players[id].yd += inSource->getRandomBoundedInt( -8, 8 );
+
+        outMovedIDs->push_back( id );
+        }
+
+    // changes happen around players
+    for( int c=0; c<NUM_NEAR_CHANGES + NUM_MIDDLE_CHANGES; c++ ) {
+        int id = inSource->getRandomBoundedInt( 0, NUM_PLAYERS - 1 );
+
+        SimChange change;
+        change.x = players[id].xd + inSource->getRandomBoundedInt( -3, 3 );
+        change.y = players[id].yd + inSource->getRandomBoundedInt( -3, 3 );
+        change.range = NEAR_RANGE;
+
+        if( c >= NUM_NEAR_CHANGES ) {
+            change.range = MIDDLE_RANGE;
+            }
+
+        outChanges->push_back( change );
+        }
+    }
+
+
+
+static int getClosestBrute( int inX, int inY ) {
+    double closeDist = DBL_MAX;
+    int closeID = -1;
+
+    for( int i=0; i<NUM_PLAYERS; i++ ) {
+        double d = intDist( players[i].xd, players[i].yd, inX, inY );
+
+        if( d < closeDist ) {
+            closeDist = d;
+            closeID = i;
+            }
+        }
+    return closeID;
+    }
+
+
+
+// same widening search as getClosestPlayerPos
+static int getClosestGrid( PlayerGrid *inGrid, int inX, int inY ) {
+    double closeDist = DBL_MAX;
+    int closeID = -1;
+
+    int radius = CELL_SIZE;
+
+    SimpleVector<int> ids;
+
+    while( true ) {
+        ids.deleteAll();
+        inGrid->getNear( inX, inY, radius, &ids );
+
+        for( int i=0; i<ids.size(); i++ ) {
+            int id = ids.getElementDirect( i );
+
+            double d = intDist( players[id].xd, players[id].yd, inX, inY );
+
+            if( d < closeDist || ( d == closeDist && id < closeID ) ) {
+                closeDist = d;
+                closeID = id;
+                }
+            }
+
+        if( closeDist <= radius ||
+            ids.size() >= inGrid->getNumPlayers() ||
+            radius > 1 << 24 ) {
+            break;
+            }
+        radius *= 4;
+        }
+
+    return closeID;
+    }
+
+
+
+static void printRate( const char *inLabel, int inCount, double inSeconds ) {
+    printf( "    %-22s %10.1f steps/sec  (%d in %.3f sec)\n",
+            inLabel, inCount / inSeconds, inCount, inSeconds );
+    }
+
+
+
+int main() {
+    printf( "Player grid benchmark, %d players in %d towns, %d steps\n",
+            NUM_PLAYERS, NUM_TOWNS, NUM_STEPS );
+    printf( "%d moves, %d near and %d middle changes, %d closest-player "
+            "lookups per step\n\n",
+            NUM_MOVES, NUM_NEAR_CHANGES, NUM_MIDDLE_CHANGES,
+            NUM_CLOSEST_QUERIES );
+
+
+    // nested loops, like before
+    CustomRandomSource bruteSource( 2417 );
+    placePlayers( &bruteSource );
+
+    double bruteSendSeconds = 0;
+    double bruteClosestSeconds = 0;
+
+    double bruteNumReceived = 0;
+    double bruteClosestSum = 0;
+
+    for( int s=0; s<NUM_STEPS; s++ ) {
+        SimpleVector<SimChange> changes;
+        SimpleVector<int> movedIDs;
+
+        makeStep( &bruteSource, &changes, &movedIDs );
+
+        double startTime = Time::getCurrentTime();
+
+        for( int i=0; i<NUM_PLAYERS; i++ ) {
+            for( int c=0; c<changes.size(); c++ ) {
+                SimChange *change = changes.getElement( c );
+
+                if( intDist( change->x, change->y,
+                             players[i].xd, players[i].yd )
+                    <= change->range ) {
+                    bruteNumReceived++;
+                    }
+                }
+            }
+
+        bruteSendSeconds += Time::getCurrentTime() - startTime;
+
+
+        startTime = Time::getCurrentTime();
+
+        for( int q=0; q<NUM_CLOSEST_QUERIES; q++ ) {
+            // like animals deciding whether to chase someone, which
+            // only happens on map near players
+            int id = bruteSource.getRandomBoundedInt( 0, NUM_PLAYERS - 1 );
+            int x = players[id].xd +
+                bruteSource.getRandomBoundedInt( -40, 40 );
+            int y = players[id].yd +
+                bruteSource.getRandomBoundedInt( -40, 40 );
+
+            bruteClosestSum += getClosestBrute( x, y );
+            }
+
+        bruteClosestSeconds += Time::getCurrentTime() - startTime;
+        }
+
+
+    // through grid
+    CustomRandomSource gridSource( 2417 );
+    placePlayers( &gridSource );
+
+    PlayerGrid grid( CELL_SIZE );
+
+    for( int i=0; i<NUM_PLAYERS; i++ ) {
+        updateGrid( &grid, i );
+        }
+
+    double gridSendSeconds = 0;
+    double gridClosestSeconds = 0;
+
+    double gridNumReceived = 0;
+    double gridClosestSum = 0;
+
+    SimpleVector<int> ids;
+
+    for( int s=0; s<NUM_STEPS; s++ ) {
+        SimpleVector<SimChange> changes;
+        SimpleVector<int> movedIDs;
+
+        makeStep( &gridSource, &changes, &movedIDs );
+
+        double startTime = Time::getCurrentTime();
+
+        // moves that finished, and new ones starting
+        for( int i=0; i<NUM_PLAYERS; i++ ) {
+            updateGrid( &grid, i );
+            }
+
+        for( int c=0; c<changes.size(); c++ ) {
+            SimChange *change = changes.getElement( c );
+
+            ids.deleteAll();
+            grid.getNear( change->x, change->y, change->range, &ids );
+
+            for( int j=0; j<ids.size(); j++ ) {
+                int id = ids.getElementDirect( j );
+
+                if( intDist( change->x, change->y,
+                             players[id].xd, players[id].yd )
+                    <= change->range ) {
+                    gridNumReceived++;
+                    }
+                }
+            }
+
+        gridSendSeconds += Time::getCurrentTime() - startTime;
+
+
+        startTime = Time::getCurrentTime();
+
+        for( int q=0; q<NUM_CLOSEST_QUERIES; q++ ) {
+            // like animals deciding whether to chase someone, which
+            // only happens on map near players
+            int id = gridSource.getRandomBoundedInt( 0, NUM_PLAYERS - 1 );
+            int x = players[id].xd +
+                gridSource.getRandomBoundedInt( -40, 40 );
+            int y = players[id].yd +
+                gridSource.getRandomBoundedInt( -40, 40 );
+
+            gridClosestSum += getClosestGrid( &grid, x, y );
+            }
+
+        gridClosestSeconds += Time::getCurrentTime() - startTime;
+        }
+
+
+    printf( "Range-filtered sends:\n" );
+    printRate( "nested loops", NUM_STEPS, bruteSendSeconds );
+    printRate( "player grid", NUM_STEPS, gridSendSeconds );
+    printf( "    (%.0f vs %.0f change deliveries)\n\n",
+            bruteNumReceived, gridNumReceived );
+
+    printf( "Closest-player lookups:\n" );
+    printRate( "scan all players", NUM_STEPS, bruteClosestSeconds );
+    printRate( "player grid", NUM_STEPS, gridClosestSeconds );
+
+
+    if( bruteNumReceived != gridNumReceived ||
+        bruteClosestSum != gridClosestSum ) {
+        printf( "\nResults don't match\n" );
+        return 1;
+        }
+
+    return 0;
+    }
@@ -0,0 +1,1983 @@
+#include "regiondb.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define fseeko fseeko64
+#define ftello ftello64
+#else
+#include <unistd.h>
+#endif
+
+#include "minorGems/formats/encodingUtils.h"
+
+
+
+// file header is padded out to one 4096-byte block, so that pages
+// start on block boundaries
+#define HEADER_SIZE 4096
+
+static const char *magicString = "Rgn1";
+
+
+// page header, followed by value slots
+//   int32 region x
+//   int32 region y
+//   uint32 number of cells with values
+//   uint32 unused
+//   one bit per cell, set if cell has a value
+#define PAGE_HEADER_SIZE ( 16 + REGIONDB_CELLS_PER_REGION / 8 )
+
+#define BITMAP_OFFSET 16
+
+
+// .cold file header
+//   magic
+//   uint32 region size
+//   uint32 value size
+//   uint32 unused
+#define COLD_HEADER_SIZE 16
+
+static const char *coldMagicString = "Rgc1";
+
+// .cold entry header, followed by compressed page
+//   int32 region x
+//   int32 region y
+//   uint32 compressed size
+//   uint32 number of cells with values, set to 0 when region is thawed
+#define COLD_ENTRY_HEADER_SIZE 16
+
+#define COLD_COUNT_OFFSET 12
+
+
+
+// rounds toward negative infinity, so that regions tile the plane
+static int toRegion( int inV ) {
+    if( inV >= 0 ) {
+        return inV / REGIONDB_REGION_SIZE;
+        }
+    return - ( ( - ( inV + 1 ) ) / REGIONDB_REGION_SIZE ) - 1;
+    }
+
+
+
+static int cellIndex( int inX, int inY, int inRegionX, int inRegionY ) {
+    return ( inY - inRegionY * REGIONDB_REGION_SIZE ) * REGIONDB_REGION_SIZE
+        + ( inX - inRegionX * REGIONDB_REGION_SIZE );
+    }
+
+
+
+static uint32_t regionHash( int inRegionX, int inRegionY ) {
+    uint32_t h = (uint32_t)inRegionX * 0x9E3779B1U;
+    h ^= (uint32_t)inRegionY + 0x7F4A7C15U + ( h << 6 ) + ( h >> 2 );
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    return h;
+    }
+
+
+
+static uint64_t pageOffset( REGIONDB *inDB, uint32_t inPage ) {
+    return HEADER_SIZE + (uint64_t)inPage * inDB->pageBytes;
+    }
+
+
+
+static void initIndex( REGIONDB_Index *inIndex, uint32_t inNumEntries ) {
+    inIndex->size = 128;
+    while( inIndex->size <= inNumEntries * 2 ) {
+        inIndex->size *= 2;
+        }
+    inIndex->slots = new uint32_t[ inIndex->size ];
+    memset( inIndex->slots, 0, inIndex->size * sizeof( uint32_t ) );
+    inIndex->numUsed = 0;
+    }
+
+
+
+// returns slot holding region's entry, or the empty slot where it belongs
+// inRegionX and inRegionY give region of each entry
+static uint32_t findIndexSlot( REGIONDB_Index *inIndex,
+                               const int *inRegionX, const int *inRegionY,
+                               int inX, int inY ) {
+    uint32_t mask = inIndex->size - 1;
+    uint32_t slot = regionHash( inX, inY ) & mask;
+
+    while( true ) {
+        uint32_t e = inIndex->slots[ slot ];
+
+        if( e == 0 ||
+            ( inRegionX[ e - 1 ] == inX &&
+              inRegionY[ e - 1 ] == inY ) ) {
+            return slot;
+            }
+        slot = ( slot + 1 ) & mask;
+        }
+    }
+
+
+
+// returns entry number, or UINT32_MAX if region not in index
+static uint32_t indexLookup( REGIONDB_Index *inIndex,
+                             const int *inRegionX, const int *inRegionY,
+                             int inX, int inY ) {
+    uint32_t e = inIndex->slots[
+        findIndexSlot( inIndex, inRegionX, inRegionY, inX, inY ) ];
+
+    if( e == 0 ) {
+        return UINT32_MAX;
+        }
+    return e - 1;
+    }
+
+
+
+// adds entry, or points region's existing slot at it
+static void indexInsert( REGIONDB_Index *inIndex,
+                         const int *inRegionX, const int *inRegionY,
+                         uint32_t inEntry ) {
+
+    // keep index at most half full
+    if( ( inIndex->numUsed + 1 ) * 2 > inIndex->size ) {
+        uint32_t *oldSlots = inIndex->slots;
+        uint32_t oldSize = inIndex->size;
+
+        inIndex->size *= 2;
+        inIndex->slots = new uint32_t[ inIndex->size ];
+        memset( inIndex->slots, 0, inIndex->size * sizeof( uint32_t ) );
+
+        for( uint32_t i=0; i<oldSize; i++ ) {
+            uint32_t e = oldSlots[i];
+
+            if( e != 0 ) {
+                inIndex->slots[
+                    findIndexSlot( inIndex, inRegionX, inRegionY,
+                                   inRegionX[ e - 1 ],
+                                   inRegionY[ e - 1 ] ) ] = e;
+                }
+            }
+        delete [] oldSlots;
+        }
+
+    uint32_t slot = findIndexSlot( inIndex, inRegionX, inRegionY,
+                                   inRegionX[ inEntry ],
+                                   inRegionY[ inEntry ] );
+
+    if( inIndex->slots[ slot ] == 0 ) {
+        inIndex->numUsed++;
+        }
+    inIndex->slots[ slot ] = inEntry + 1;
+    }
+
+
+
+// backward-shift removal, so probes still stop at first empty slot
+static void indexRemove( REGIONDB_Index *inIndex,
+                         const int *inRegionX, const int *inRegionY,
+                         int inX, int inY ) {
+    uint32_t mask = inIndex->size - 1;
+    uint32_t slot = findIndexSlot( inIndex, inRegionX, inRegionY, inX, inY );
+
+    if( inIndex->slots[ slot ] == 0 ) {
+        return;
+        }
+
+    inIndex->slots[ slot ] = 0;
+    inIndex->numUsed--;
+
+    uint32_t next = ( slot + 1 ) & mask;
+
+    while( inIndex->slots[ next ] != 0 ) {
+        uint32_t e = inIndex->slots[ next ] - 1;
+        uint32_t home = regionHash( inRegionX[ e ], inRegionY[ e ] ) & mask;
+
+        // move entry back into hole if hole is between its home and
+        // where it sits now (cyclically)
+        if( ( ( next - home ) & mask ) >= ( ( next - slot ) & mask ) ) {
+            inIndex->slots[ slot ] = inIndex->slots[ next ];
+            inIndex->slots[ next ] = 0;
+            slot = next;
+            }
+        next = ( next + 1 ) & mask;
+        }
+    }
+
+
+
+// returns page index, or UINT32_MAX if region has no hot page
+static uint32_t findPage( REGIONDB *inDB, int inRegionX, int inRegionY ) {
+    return indexLookup( &( inDB->pageIndex ),
+                        inDB->pageRegionX, inDB->pageRegionY,
+                        inRegionX, inRegionY );
+    }
+
+
+
+// returns .cold entry, or UINT32_MAX if region not frozen
+static uint32_t findColdEntry( REGIONDB *inDB,
+                               int inRegionX, int inRegionY ) {
+    return indexLookup( &( inDB->coldIndex ),
+                        inDB->coldRegionX, inDB->coldRegionY,
+                        inRegionX, inRegionY );
+    }
+
+
+
+static int writePage( REGIONDB *inDB, REGIONDB_CachedPage *inEntry ) {
+    if( inDB->holdWrites ) {
+        uint32_t slot = inDB->deltaSlots[ inEntry->pageIndex ];
+
+        if( slot == 0 ) {
+            if( inDB->numDeltaPages == inDB->deltaSpace ) {
+                uint32_t newSpace = inDB->deltaSpace * 2;
+
+                uint8_t **newPages = new uint8_t*[ newSpace ];
+                uint32_t *newIndex = new uint32_t[ newSpace ];
+
+                memcpy( newPages, inDB->deltaPages,
+                        inDB->numDeltaPages * sizeof( uint8_t* ) );
+                memcpy( newIndex, inDB->deltaPageIndex,
+                        inDB->numDeltaPages * sizeof( uint32_t ) );
+
+                delete [] inDB->deltaPages;
+                delete [] inDB->deltaPageIndex;
+
+                inDB->deltaPages = newPages;
+                inDB->deltaPageIndex = newIndex;
+                inDB->deltaSpace = newSpace;
+                }
+
+            slot = inDB->numDeltaPages + 1;
+            inDB->numDeltaPages++;
+
+            inDB->deltaPages[ slot - 1 ] = new uint8_t[ inDB->pageBytes ];
+            inDB->deltaPageIndex[ slot - 1 ] = inEntry->pageIndex;
+            inDB->deltaSlots[ inEntry->pageIndex ] = slot;
+            }
+
+        memcpy( inDB->deltaPages[ slot - 1 ], inEntry->data,
+                inDB->pageBytes );
+        inEntry->dirty = false;
+        return 0;
+        }
+
+    if( fseeko( inDB->file, pageOffset( inDB, inEntry->pageIndex ),
+                SEEK_SET ) ) {
+        return -1;
+        }
+    if( fwrite( inEntry->data, inDB->pageBytes, 1, inDB->file ) != 1 ) {
+        return -1;
+        }
+    inEntry->dirty = false;
+    inDB->numPageWrites++;
+    return 0;
+    }
+
+
+
+// returns cache entry holding page, reading it from file if inLoad set,
+// or starting it blank otherwise
+// returns NULL on I/O error
+static REGIONDB_CachedPage *getPage( REGIONDB *inDB, uint32_t inPage,
+                                     char inLoad ) {
+    REGIONDB_CachedPage *entry = &( inDB->cache[ inPage % inDB->cacheSize ] );
+
+    if( entry->pageIndex == inPage ) {
+        return entry;
+        }
+
+    if( entry->dirty ) {
+        if( writePage( inDB, entry ) == -1 ) {
+            return NULL;
+            }
+        }
+
+    if( entry->data == NULL ) {
+        entry->data = new uint8_t[ inDB->pageBytes ];
+        }
+
+    // in case read fails
+    entry->pageIndex = UINT32_MAX;
+
+    if( inLoad && inDB->holdWrites && inDB->deltaSlots[ inPage ] != 0 ) {
+        memcpy( entry->data,
+                inDB->deltaPages[ inDB->deltaSlots[ inPage ] - 1 ],
+                inDB->pageBytes );
+        }
+    else if( inLoad ) {
+        if( fseeko( inDB->file, pageOffset( inDB, inPage ), SEEK_SET ) ) {
+            return NULL;
+            }
+        if( fread( entry->data, inDB->pageBytes, 1, inDB->file ) != 1 ) {
+            return NULL;
+            }
+        inDB->numPageReads++;
+        }
+    else {
+        memset( entry->data, 0, inDB->pageBytes );
+        }
+
+    entry->pageIndex = inPage;
+    return entry;
+    }
+
+
+
+// forgets cached copy of page without writing it back
+static void dropCachedPage( REGIONDB *inDB, uint32_t inPage ) {
+    REGIONDB_CachedPage *entry = &( inDB->cache[ inPage % inDB->cacheSize ] );
+
+    if( entry->pageIndex == inPage ) {
+        entry->pageIndex = UINT32_MAX;
+        entry->dirty = false;
+        }
+    }
+
+
+
+static void setPageCount( REGIONDB_CachedPage *inEntry, uint32_t inCount ) {
+    memcpy( &( inEntry->data[8] ), &inCount, 4 );
+    }
+
+
+
+static char isCellSet( const uint8_t *inPageData, int inCell ) {
+    return ( inPageData[ BITMAP_OFFSET + inCell / 8 ] >> ( inCell % 8 ) )
+        & 1;
+    }
+
+
+
+static void addPageSlot( REGIONDB *inDB ) {
+    if( inDB->numPages < inDB->pageSpace ) {
+        return;
+        }
+
+    uint32_t newSpace = inDB->pageSpace * 2;
+
+    int *newX = new int[ newSpace ];
+    int *newY = new int[ newSpace ];
+    uint16_t *newCounts = new uint16_t[ newSpace ];
+
+    memcpy( newX, inDB->pageRegionX, inDB->numPages * sizeof( int ) );
+    memcpy( newY, inDB->pageRegionY, inDB->numPages * sizeof( int ) );
+    memcpy( newCounts, inDB->pageCounts,
+            inDB->numPages * sizeof( uint16_t ) );
+
+    delete [] inDB->pageRegionX;
+    delete [] inDB->pageRegionY;
+    delete [] inDB->pageCounts;
+
+    inDB->pageRegionX = newX;
+    inDB->pageRegionY = newY;
+    inDB->pageCounts = newCounts;
+
+    if( inDB->deltaSlots != NULL ) {
+        uint32_t *newSlots = new uint32_t[ newSpace ];
+        memset( newSlots, 0, newSpace * sizeof( uint32_t ) );
+        memcpy( newSlots, inDB->deltaSlots,
+                inDB->pageSpace * sizeof( uint32_t ) );
+        delete [] inDB->deltaSlots;
+        inDB->deltaSlots = newSlots;
+        }
+
+    inDB->pageSpace = newSpace;
+    }
+
+
+
+// appends a blank page for a region, and returns its cache entry
+// returns NULL on I/O error
+static REGIONDB_CachedPage *addPage( REGIONDB *inDB,
+                                     int inRegionX, int inRegionY ) {
+    addPageSlot( inDB );
+
+    uint32_t page = inDB->numPages;
+
+    // might have to write back another page to make room, so don't
+    // count new page until that has worked
+    REGIONDB_CachedPage *entry = getPage( inDB, page, false );
+
+    if( entry == NULL ) {
+        return NULL;
+        }
+    memcpy( entry->data, &inRegionX, 4 );
+    memcpy( &( entry->data[4] ), &inRegionY, 4 );
+
+    inDB->numPages++;
+
+    inDB->pageRegionX[ page ] = inRegionX;
+    inDB->pageRegionY[ page ] = inRegionY;
+    inDB->pageCounts[ page ] = 0;
+
+    indexInsert( &( inDB->pageIndex ), inDB->pageRegionX, inDB->pageRegionY,
+                 page );
+
+    return entry;
+    }
+
+
+
+static void addColdSlot( REGIONDB *inDB ) {
+    if( inDB->numColdEntries < inDB->coldSpace ) {
+        return;
+        }
+
+    uint32_t newSpace = inDB->coldSpace * 2;
+    uint32_t n = inDB->numColdEntries;
+
+    int *newX = new int[ newSpace ];
+    int *newY = new int[ newSpace ];
+    uint64_t *newOffsets = new uint64_t[ newSpace ];
+    uint32_t *newSizes = new uint32_t[ newSpace ];
+    uint16_t *newCounts = new uint16_t[ newSpace ];
+
+    memcpy( newX, inDB->coldRegionX, n * sizeof( int ) );
+    memcpy( newY, inDB->coldRegionY, n * sizeof( int ) );
+    memcpy( newOffsets, inDB->coldOffsets, n * sizeof( uint64_t ) );
+    memcpy( newSizes, inDB->coldSizes, n * sizeof( uint32_t ) );
+    memcpy( newCounts, inDB->coldCounts, n * sizeof( uint16_t ) );
+
+    delete [] inDB->coldRegionX;
+    delete [] inDB->coldRegionY;
+    delete [] inDB->coldOffsets;
+    delete [] inDB->coldSizes;
+    delete [] inDB->coldCounts;
+
+    inDB->coldRegionX = newX;
+    inDB->coldRegionY = newY;
+    inDB->coldOffsets = newOffsets;
+    inDB->coldSizes = newSizes;
+    inDB->coldCounts = newCounts;
+    inDB->coldSpace = newSpace;
+    }
+
+
+
+static uint32_t addColdEntry( REGIONDB *inDB, int inRegionX, int inRegionY,
+                              uint64_t inOffset, uint32_t inSize,
+                              uint16_t inCount ) {
+    addColdSlot( inDB );
+
+    uint32_t c = inDB->numColdEntries;
+    inDB->numColdEntries++;
+
+    inDB->coldRegionX[c] = inRegionX;
+    inDB->coldRegionY[c] = inRegionY;
+    inDB->coldOffsets[c] = inOffset;
+    inDB->coldSizes[c] = inSize;
+    inDB->coldCounts[c] = inCount;
+
+    return c;
+    }
+
+
+
+// sets entry's count to 0 in .cold file, so it isn't reloaded on open
+// while holding writes, only RAM count is set, and file is marked when
+// hold is released
+static int markColdEntryDead( REGIONDB *inDB, uint32_t inEntry ) {
+    uint32_t zero = 0;
+
+    if( inDB->holdWrites ) {
+        inDB->coldCounts[ inEntry ] = 0;
+        return 0;
+        }
+
+    if( fseeko( inDB->coldFile,
+                inDB->coldOffsets[ inEntry ] + COLD_COUNT_OFFSET,
+                SEEK_SET ) ) {
+        return -1;
+        }
+    if( fwrite( &zero, 4, 1, inDB->coldFile ) != 1 ) {
+        return -1;
+        }
+    inDB->coldCounts[ inEntry ] = 0;
+    return 0;
+    }
+
+
+
+// returns new[]'d compressed page, or NULL on I/O error
+static uint8_t *readColdEntry( REGIONDB *inDB, uint32_t inEntry ) {
+    uint32_t size = inDB->coldSizes[ inEntry ];
+
+    if( fseeko( inDB->coldFile,
+                inDB->coldOffsets[ inEntry ] + COLD_ENTRY_HEADER_SIZE,
+                SEEK_SET ) ) {
+        return NULL;
+        }
+
+    uint8_t *compressed = new uint8_t[ size ];
+
+    if( fread( compressed, size, 1, inDB->coldFile ) != 1 ) {
+        delete [] compressed;
+        return NULL;
+        }
+    return compressed;
+    }
+
+
+
+// returns new[]'d page, or NULL on I/O or decompression error
+static uint8_t *decompressColdEntry( REGIONDB *inDB, uint32_t inEntry ) {
+    uint8_t *compressed = readColdEntry( inDB, inEntry );
+
+    if( compressed == NULL ) {
+        return NULL;
+        }
+
+    uint8_t *page = zipDecompress( compressed, inDB->coldSizes[ inEntry ],
+                                   inDB->pageBytes );
+    delete [] compressed;
+
+    return page;
+    }
+
+
+
+// decompresses a frozen region into a new hot page
+// returns page index, or UINT32_MAX on error
+static uint32_t thaw( REGIONDB *inDB, uint32_t inEntry ) {
+    clock_t startTime = clock();
+
+    uint8_t *data = decompressColdEntry( inDB, inEntry );
+
+    inDB->thawSeconds += (double)( clock() - startTime ) / CLOCKS_PER_SEC;
+
+    if( data == NULL ) {
+        printf( "Failed to thaw region (%d,%d) from REGIONDB .cold file\n",
+                inDB->coldRegionX[ inEntry ], inDB->coldRegionY[ inEntry ] );
+        return UINT32_MAX;
+        }
+
+    REGIONDB_CachedPage *entry = addPage( inDB,
+                                          inDB->coldRegionX[ inEntry ],
+                                          inDB->coldRegionY[ inEntry ] );
+    if( entry == NULL ) {
+        delete [] data;
+        return UINT32_MAX;
+        }
+
+    memcpy( entry->data, data, inDB->pageBytes );
+    delete [] data;
+
+    uint32_t page = entry->pageIndex;
+
+    inDB->pageCounts[ page ] = inDB->coldCounts[ inEntry ];
+
+    // hot copy must reach file before cold copy is marked dead
+    if( writePage( inDB, entry ) == -1 ||
+        fflush( inDB->file ) != 0 ||
+        markColdEntryDead( inDB, inEntry ) == -1 ) {
+        return UINT32_MAX;
+        }
+
+    indexRemove( &( inDB->coldIndex ), inDB->coldRegionX, inDB->coldRegionY,
+                 inDB->coldRegionX[ inEntry ], inDB->coldRegionY[ inEntry ] );
+
+    inDB->numColdRegions--;
+    inDB->coldBytes -= inDB->coldSizes[ inEntry ];
+    inDB->numThaws++;
+
+    return page;
+    }
+
+
+
+// returns region's hot page, thawing region if it is frozen
+// returns UINT32_MAX if region has no page, and sets outError on
+// I/O error
+static uint32_t findOrThawPage( REGIONDB *inDB,
+                                int inRegionX, int inRegionY,
+                                char *outError ) {
+    *outError = false;
+
+    uint32_t page = findPage( inDB, inRegionX, inRegionY );
+
+    if( page != UINT32_MAX || inDB->numColdRegions == 0 ) {
+        return page;
+        }
+
+    uint32_t c = findColdEntry( inDB, inRegionX, inRegionY );
+
+    if( c == UINT32_MAX ) {
+        return UINT32_MAX;
+        }
+
+    page = thaw( inDB, c );
+
+    if( page == UINT32_MAX ) {
+        *outError = true;
+        }
+    return page;
+    }
+
+
+
+static int truncateFile( FILE *inFile, uint64_t inSize ) {
+    fflush( inFile );
+
+#ifdef _WIN32
+    if( _chsize_s( _fileno( inFile ), inSize ) != 0 ) {
+        return -1;
+        }
+#else
+    if( ftruncate( fileno( inFile ), inSize ) != 0 ) {
+        return -1;
+        }
+#endif
+    return 0;
+    }
+
+
+
+static FILE *openColdFile( const char *inPath, unsigned int inValueSize ) {
+    FILE *f = fopen( inPath, "r+b" );
+
+    uint8_t header[ COLD_HEADER_SIZE ];
+
+    uint32_t regionSize = REGIONDB_REGION_SIZE;
+    uint32_t valueSize = inValueSize;
+
+    if( f == NULL ) {
+        f = fopen( inPath, "w+b" );
+
+        if( f == NULL ) {
+            return NULL;
+            }
+
+        memset( header, 0, COLD_HEADER_SIZE );
+        memcpy( header, coldMagicString, 4 );
+        memcpy( &( header[4] ), &regionSize, 4 );
+        memcpy( &( header[8] ), &valueSize, 4 );
+
+        if( fwrite( header, COLD_HEADER_SIZE, 1, f ) != 1 ) {
+            fclose( f );
+            return NULL;
+            }
+        return f;
+        }
+
+    if( fread( header, COLD_HEADER_SIZE, 1, f ) != 1 ||
+        memcmp( header, coldMagicString, 4 ) != 0 ||
+        memcmp( &( header[4] ), &regionSize, 4 ) != 0 ||
+        memcmp( &( header[8] ), &valueSize, 4 ) != 0 ) {
+        printf( "REGIONDB file %s has bad header or doesn't match "
+                "requested region size %d and value size %d\n",
+                inPath, REGIONDB_REGION_SIZE, inValueSize );
+        fclose( f );
+        return NULL;
+        }
+    return f;
+    }
+
+
+
+// copies live .cold entries into a fresh file, dropping thawed ones
+static int rewriteColdFile( REGIONDB *inDB, const char *inColdPath ) {
+    char *tempPath = new char[ strlen( inColdPath ) + 10 ];
+    sprintf( tempPath, "%s.temp", inColdPath );
+
+    remove( tempPath );
+
+    FILE *tempFile = openColdFile( tempPath, inDB->valueSize );
+
+    if( tempFile == NULL ) {
+        delete [] tempPath;
+        return -1;
+        }
+
+    uint64_t offset = COLD_HEADER_SIZE;
+    uint32_t numLive = 0;
+
+    for( uint32_t c=0; c<inDB->numColdEntries; c++ ) {
+        if( inDB->coldCounts[c] == 0 ) {
+            continue;
+            }
+
+        uint8_t *compressed = readColdEntry( inDB, c );
+
+        if( compressed == NULL ) {
+            fclose( tempFile );
+            remove( tempPath );
+            delete [] tempPath;
+            return -1;
+            }
+
+        uint32_t entryHeader[4] = {
+            (uint32_t)inDB->coldRegionX[c], (uint32_t)inDB->coldRegionY[c],
+            inDB->coldSizes[c], inDB->coldCounts[c] };
+
+        char failed =
+            fwrite( entryHeader, COLD_ENTRY_HEADER_SIZE, 1, tempFile ) != 1 ||
+            fwrite( compressed, inDB->coldSizes[c], 1, tempFile ) != 1;
+
+        delete [] compressed;
+
+        if( failed ) {
+            fclose( tempFile );
+            remove( tempPath );
+            delete [] tempPath;
+            return -1;
+            }
+
+        inDB->coldRegionX[ numLive ] = inDB->coldRegionX[c];
+        inDB->coldRegionY[ numLive ] = inDB->coldRegionY[c];
+        inDB->coldOffsets[ numLive ] = offset;
+        inDB->coldSizes[ numLive ] = inDB->coldSizes[c];
+        inDB->coldCounts[ numLive ] = inDB->coldCounts[c];
+
+        offset += COLD_ENTRY_HEADER_SIZE + inDB->coldSizes[c];
+        numLive++;
+        }
+
+    fclose( tempFile );
+    fclose( inDB->coldFile );
+
+    remove( inColdPath );
+    rename( tempPath, inColdPath );
+
+    delete [] tempPath;
+
+    inDB->numColdEntries = numLive;
+    inDB->coldFileSize = offset;
+
+    inDB->coldFile = openColdFile( inColdPath, inDB->valueSize );
+
+    if( inDB->coldFile == NULL ) {
+        return -1;
+        }
+
+    // entry numbers changed
+    delete [] inDB->coldIndex.slots;
+    initIndex( &( inDB->coldIndex ), numLive );
+
+    for( uint32_t c=0; c<numLive; c++ ) {
+        indexInsert( &( inDB->coldIndex ),
+                     inDB->coldRegionX, inDB->coldRegionY, c );
+        }
+
+    return 0;
+    }
+
+
+
+// loads .cold entries, after hot pages have been indexed
+static int loadColdFile( REGIONDB *inDB, const char *inPath ) {
+    char *coldPath = new char[ strlen( inPath ) + 10 ];
+    sprintf( coldPath, "%s.cold", inPath );
+
+    inDB->coldFile = openColdFile( coldPath, inDB->valueSize );
+
+    if( inDB->coldFile == NULL ) {
+        delete [] coldPath;
+        return -1;
+        }
+
+    if( fseeko( inDB->coldFile, 0, SEEK_END ) ) {
+        delete [] coldPath;
+        return -1;
+        }
+
+    uint64_t fileSize = ftello( inDB->coldFile );
+
+    uint64_t offset = COLD_HEADER_SIZE;
+    uint64_t deadBytes = 0;
+
+    while( offset + COLD_ENTRY_HEADER_SIZE <= fileSize ) {
+        uint32_t entryHeader[4];
+
+        if( fseeko( inDB->coldFile, offset, SEEK_SET ) ||
+            fread( entryHeader, COLD_ENTRY_HEADER_SIZE, 1,
+                   inDB->coldFile ) != 1 ) {
+            delete [] coldPath;
+            return -1;
+            }
+
+        int regionX = (int)entryHeader[0];
+        int regionY = (int)entryHeader[1];
+        uint32_t size = entryHeader[2];
+        uint32_t count = entryHeader[3];
+
+        if( offset + COLD_ENTRY_HEADER_SIZE + size > fileSize ) {
+            // partial entry at end, from a crash mid-freeze
+            // hot page was not emptied yet, so nothing is lost
+            break;
+            }
+
+        uint32_t c = addColdEntry( inDB, regionX, regionY, offset, size,
+                                   count );
+
+        offset += COLD_ENTRY_HEADER_SIZE + size;
+
+        if( count == 0 ) {
+            deadBytes += COLD_ENTRY_HEADER_SIZE + size;
+            continue;
+            }
+
+        // crash between writing one copy of a region and marking
+        // the other dead leaves two
+        // a hot page is newer than any .cold entry, and later
+        // .cold entries are newer than earlier ones
+        uint32_t older = findColdEntry( inDB, regionX, regionY );
+
+        if( findPage( inDB, regionX, regionY ) != UINT32_MAX ) {
+            older = c;
+            }
+
+        if( older != UINT32_MAX ) {
+            deadBytes += COLD_ENTRY_HEADER_SIZE + inDB->coldSizes[ older ];
+
+            if( older != c ) {
+                inDB->numColdRegions--;
+                inDB->numRecords -= inDB->coldCounts[ older ];
+                inDB->coldBytes -= inDB->coldSizes[ older ];
+                }
+
+            if( markColdEntryDead( inDB, older ) == -1 ) {
+                delete [] coldPath;
+                return -1;
+                }
+            if( older == c ) {
+                continue;
+                }
+            }
+
+        indexInsert( &( inDB->coldIndex ),
+                     inDB->coldRegionX, inDB->coldRegionY, c );
+
+        inDB->numColdRegions++;
+        inDB->numRecords += count;
+        inDB->coldBytes += size;
+        }
+
+    inDB->coldFileSize = offset;
+
+    if( offset < fileSize ) {
+        if( truncateFile( inDB->coldFile, offset ) == -1 ) {
+            delete [] coldPath;
+            return -1;
+            }
+        }
+
+    int result = 0;
+
+    if( deadBytes > inDB->coldBytes ) {
+        result = rewriteColdFile( inDB, coldPath );
+        }
+
+    delete [] coldPath;
+
+    return result;
+    }
+
+
+
+int REGIONDB_open( REGIONDB *inDB, const char *inPath,
+                   unsigned int inValueSize,
+                   unsigned int inCachedPages ) {
+
+    inDB->valueSize = inValueSize;
+
+    inDB->pageBytes = PAGE_HEADER_SIZE +
+        REGIONDB_CELLS_PER_REGION * inValueSize;
+
+    // whole blocks
+    inDB->pageBytes = ( ( inDB->pageBytes + 4095 ) / 4096 ) * 4096;
+
+
+    inDB->file = fopen( inPath, "r+b" );
+
+    if( inDB->file == NULL ) {
+        // doesn't exist yet
+        inDB->file = fopen( inPath, "w+b" );
+
+        if( inDB->file == NULL ) {
+            return 1;
+            }
+
+        uint8_t header[ HEADER_SIZE ];
+        memset( header, 0, HEADER_SIZE );
+
+        uint32_t regionSize = REGIONDB_REGION_SIZE;
+        uint32_t valueSize = inValueSize;
+
+        memcpy( header, magicString, 4 );
+        memcpy( &( header[4] ), &regionSize, 4 );
+        memcpy( &( header[8] ), &valueSize, 4 );
+
+        if( fwrite( header, HEADER_SIZE, 1, inDB->file ) != 1 ) {
+            fclose( inDB->file );
+            return 1;
+            }
+        }
+    else {
+        uint8_t header[12];
+
+        if( fread( header, 12, 1, inDB->file ) != 1 ) {
+            printf( "Failed to read header from REGIONDB file %s\n",
+                    inPath );
+            fclose( inDB->file );
+            return 1;
+            }
+
+        uint32_t regionSize;
+        uint32_t valueSize;
+
+        memcpy( &regionSize, &( header[4] ), 4 );
+        memcpy( &valueSize, &( header[8] ), 4 );
+
+        if( memcmp( header, magicString, 4 ) != 0 ||
+            regionSize != REGIONDB_REGION_SIZE ||
+            valueSize != inValueSize ) {
+            printf( "REGIONDB file %s has bad header or doesn't match "
+                    "requested region size %d and value size %d\n",
+                    inPath, REGIONDB_REGION_SIZE, inValueSize );
+            fclose( inDB->file );
+            return 1;
+            }
+        }
+
+    if( fseeko( inDB->file, 0, SEEK_END ) ) {
+        fclose( inDB->file );
+        return 1;
+        }
+
+    uint64_t fileSize = ftello( inDB->file );
+
+    // partial page at end (from a crash mid-append) is ignored, and
+    // overwritten by next new page
+    inDB->numPages = 0;
+
+    if( fileSize > HEADER_SIZE ) {
+        inDB->numPages = ( fileSize - HEADER_SIZE ) / inDB->pageBytes;
+        }
+
+    inDB->pageSpace = 64;
+    while( inDB->pageSpace < inDB->numPages ) {
+        inDB->pageSpace *= 2;
+        }
+
+    inDB->pageRegionX = new int[ inDB->pageSpace ];
+    inDB->pageRegionY = new int[ inDB->pageSpace ];
+    inDB->pageCounts = new uint16_t[ inDB->pageSpace ];
+
+    initIndex( &( inDB->pageIndex ), inDB->numPages );
+
+    inDB->numRecords = 0;
+    inDB->numPageReads = 0;
+    inDB->numPageWrites = 0;
+
+    inDB->coldFile = NULL;
+    inDB->coldFileSize = 0;
+    inDB->numColdEntries = 0;
+    inDB->coldSpace = 64;
+    inDB->coldRegionX = new int[ inDB->coldSpace ];
+    inDB->coldRegionY = new int[ inDB->coldSpace ];
+    inDB->coldOffsets = new uint64_t[ inDB->coldSpace ];
+    inDB->coldSizes = new uint32_t[ inDB->coldSpace ];
+    inDB->coldCounts = new uint16_t[ inDB->coldSpace ];
+    initIndex( &( inDB->coldIndex ), 0 );
+    inDB->numColdRegions = 0;
+    inDB->coldBytes = 0;
+    inDB->coldScratch = NULL;
+    inDB->coldScratchEntry = UINT32_MAX;
+    inDB->freezeCursor = 0;
+    inDB->numFreezes = 0;
+    inDB->numThaws = 0;
+    inDB->thawSeconds = 0;
+    inDB->holdWrites = false;
+    inDB->deltaSlots = NULL;
+    inDB->deltaPages = NULL;
+    inDB->deltaPageIndex = NULL;
+    inDB->numDeltaPages = 0;
+    inDB->deltaSpace = 0;
+
+    inDB->cacheSize = inCachedPages;
+    if( inDB->cacheSize < 1 ) {
+        inDB->cacheSize = 1;
+        }
+    inDB->cache = new REGIONDB_CachedPage[ inDB->cacheSize ];
+
+    for( uint32_t i=0; i<inDB->cacheSize; i++ ) {
+        inDB->cache[i].pageIndex = UINT32_MAX;
+        inDB->cache[i].dirty = false;
+        inDB->cache[i].data = NULL;
+        }
+
+
+    // rebuild index from page headers
+    uint8_t pageHeader[ PAGE_HEADER_SIZE ];
+
+    for( uint32_t p=0; p<inDB->numPages; p++ ) {
+        if( fseeko( inDB->file, pageOffset( inDB, p ), SEEK_SET ) ||
+            fread( pageHeader, PAGE_HEADER_SIZE, 1, inDB->file ) != 1 ) {
+            printf( "Failed to read page %u header from REGIONDB file %s\n",
+                    p, inPath );
+            REGIONDB_close( inDB );
+            return 1;
+            }
+
+        int regionX, regionY;
+        memcpy( &regionX, pageHeader, 4 );
+        memcpy( &regionY, &( pageHeader[4] ), 4 );
+
+        // count from bitmap, which is what gets and puts trust
+        int count = 0;
+        for( int i=0; i<REGIONDB_CELLS_PER_REGION / 8; i++ ) {
+            uint8_t b = pageHeader[ BITMAP_OFFSET + i ];
+            while( b != 0 ) {
+                count += b & 1;
+                b >>= 1;
+                }
+            }
+
+        inDB->pageRegionX[p] = regionX;
+        inDB->pageRegionY[p] = regionY;
+        inDB->pageCounts[p] = count;
+
+        if( count == 0 ) {
+            // never written, or emptied
+            // left for compaction, not indexed
+            continue;
+            }
+
+        if( findPage( inDB, regionX, regionY ) != UINT32_MAX ) {
+            // second copy from a crash during compaction
+            // first copy is the one compaction moved into place
+            inDB->pageCounts[p] = 0;
+            continue;
+            }
+
+        indexInsert( &( inDB->pageIndex ),
+                     inDB->pageRegionX, inDB->pageRegionY, p );
+        inDB->numRecords += count;
+        }
+
+
+    if( loadColdFile( inDB, inPath ) == -1 ) {
+        printf( "Failed to load .cold file for REGIONDB file %s\n", inPath );
+        REGIONDB_close( inDB );
+        return 1;
+        }
+
+    return 0;
+    }
+
+
+
+void REGIONDB_close( REGIONDB *inDB ) {
+    if( inDB->holdWrites ) {
+        REGIONDB_holdWrites( inDB, false );
+        }
+
+    REGIONDB_flush( inDB );
+
+    // drop all empty pages
+    while( REGIONDB_compact( inDB, inDB->numPages ) > 0 ) {
+        }
+
+    for( uint32_t i=0; i<inDB->cacheSize; i++ ) {
+        if( inDB->cache[i].data != NULL ) {
+            delete [] inDB->cache[i].data;
+            }
+        }
+    delete [] inDB->cache;
+
+    fclose( inDB->file );
+
+    if( inDB->coldFile != NULL ) {
+        fclose( inDB->coldFile );
+        }
+
+    delete [] inDB->pageRegionX;
+    delete [] inDB->pageRegionY;
+    delete [] inDB->pageCounts;
+    delete [] inDB->pageIndex.slots;
+
+    delete [] inDB->coldRegionX;
+    delete [] inDB->coldRegionY;
+    delete [] inDB->coldOffsets;
+    delete [] inDB->coldSizes;
+    delete [] inDB->coldCounts;
+    delete [] inDB->coldIndex.slots;
+
+    if( inDB->coldScratch != NULL ) {
+        delete [] inDB->coldScratch;
+        }
+    }
+
+
+
+int REGIONDB_get( REGIONDB *inDB, int inX, int inY, void *outValue ) {
+    int regionX = toRegion( inX );
+    int regionY = toRegion( inY );
+
+    char error;
+    uint32_t page = findOrThawPage( inDB, regionX, regionY, &error );
+
+    if( error ) {
+        return -1;
+        }
+    if( page == UINT32_MAX ) {
+        return 1;
+        }
+
+    REGIONDB_CachedPage *entry = getPage( inDB, page, true );
+
+    if( entry == NULL ) {
+        return -1;
+        }
+
+    int cell = cellIndex( inX, inY, regionX, regionY );
+
+    if( ! isCellSet( entry->data, cell ) ) {
+        return 1;
+        }
+
+    memcpy( outValue,
+            &( entry->data[ PAGE_HEADER_SIZE + cell * inDB->valueSize ] ),
+            inDB->valueSize );
+    return 0;
+    }
+
+
+
+int REGIONDB_put( REGIONDB *inDB, int inX, int inY, const void *inValue ) {
+    int regionX = toRegion( inX );
+    int regionY = toRegion( inY );
+
+    char error;
+    uint32_t page = findOrThawPage( inDB, regionX, regionY, &error );
+
+    if( error ) {
+        return -1;
+        }
+
+    REGIONDB_CachedPage *entry;
+
+    if( page == UINT32_MAX ) {
+        // new page at end of file
+        entry = addPage( inDB, regionX, regionY );
+
+        if( entry == NULL ) {
+            return -1;
+            }
+        page = entry->pageIndex;
+        }
+    else {
+        entry = getPage( inDB, page, true );
+
+        if( entry == NULL ) {
+            return -1;
+            }
+        }
+
+    int cell = cellIndex( inX, inY, regionX, regionY );
+
+    if( ! isCellSet( entry->data, cell ) ) {
+        entry->data[ BITMAP_OFFSET + cell / 8 ] |= 1 << ( cell % 8 );
+        inDB->pageCounts[ page ]++;
+        inDB->numRecords++;
+        setPageCount( entry, inDB->pageCounts[ page ] );
+        }
+
+    memcpy( &( entry->data[ PAGE_HEADER_SIZE + cell * inDB->valueSize ] ),
+            inValue, inDB->valueSize );
+
+    entry->dirty = true;
+    return 0;
+    }
+
+
+
+int REGIONDB_delete( REGIONDB *inDB, int inX, int inY ) {
+    int regionX = toRegion( inX );
+    int regionY = toRegion( inY );
+
+    char error;
+    uint32_t page = findOrThawPage( inDB, regionX, regionY, &error );
+
+    if( error ) {
+        return -1;
+        }
+    if( page == UINT32_MAX ) {
+        return 1;
+        }
+
+    REGIONDB_CachedPage *entry = getPage( inDB, page, true );
+
+    if( entry == NULL ) {
+        return -1;
+        }
+
+    int cell = cellIndex( inX, inY, regionX, regionY );
+
+    if( ! isCellSet( entry->data, cell ) ) {
+        return 1;
+        }
+
+    entry->data[ BITMAP_OFFSET + cell / 8 ] &= ~( 1 << ( cell % 8 ) );
+    inDB->pageCounts[ page ]--;
+    inDB->numRecords--;
+    setPageCount( entry, inDB->pageCounts[ page ] );
+
+    entry->dirty = true;
+    return 0;
+    }
+
+
+
+static int compareUInt32( const void *inA, const void *inB ) {
+    uint32_t a = *(const uint32_t*)inA;
+    uint32_t b = *(const uint32_t*)inB;
+
+    if( a < b ) {
+        return -1;
+        }
+    if( a > b ) {
+        return 1;
+        }
+    return 0;
+    }
+
+
+
+int REGIONDB_loadRect( REGIONDB *inDB, int inXStart, int inYStart,
+                       int inWidth, int inHeight ) {
+    int rx0 = toRegion( inXStart );
+    int ry0 = toRegion( inYStart );
+    int rx1 = toRegion( inXStart + inWidth - 1 );
+    int ry1 = toRegion( inYStart + inHeight - 1 );
+
+    int maxPages = ( rx1 - rx0 + 1 ) * ( ry1 - ry0 + 1 );
+
+    uint32_t *pages = new uint32_t[ maxPages ];
+    int numPages = 0;
+
+    int result = 0;
+
+    for( int ry=ry0; ry<=ry1; ry++ ) {
+        for( int rx=rx0; rx<=rx1; rx++ ) {
+            char error;
+            uint32_t p = findOrThawPage( inDB, rx, ry, &error );
+
+            if( error ) {
+                result = -1;
+                }
+            else if( p != UINT32_MAX ) {
+                pages[ numPages ] = p;
+                numPages++;
+                }
+            }
+        }
+
+    // file order, for read-ahead
+    qsort( pages, numPages, sizeof( uint32_t ), compareUInt32 );
+
+    for( int i=0; i<numPages; i++ ) {
+        if( getPage( inDB, pages[i], true ) == NULL ) {
+            result = -1;
+            break;
+            }
+        }
+
+    delete [] pages;
+
+    return result;
+    }
+
+
+
+int REGIONDB_flush( REGIONDB *inDB ) {
+    int result = 0;
+
+    for( uint32_t i=0; i<inDB->cacheSize; i++ ) {
+        if( inDB->cache[i].dirty ) {
+            if( writePage( inDB, &( inDB->cache[i] ) ) == -1 ) {
+                result = -1;
+                }
+            }
+        }
+
+    if( fflush( inDB->file ) != 0 ) {
+        result = -1;
+        }
+    if( inDB->coldFile != NULL && fflush( inDB->coldFile ) != 0 ) {
+        result = -1;
+        }
+    return result;
+    }
+
+
+
+int REGIONDB_compact( REGIONDB *inDB, int inMaxMoves ) {
+    if( inDB->holdWrites ) {
+        return 0;
+        }
+
+    int numMoved = 0;
+    uint32_t oldNumPages = inDB->numPages;
+
+    // next empty page to fill
+    uint32_t hole = 0;
+
+    while( inDB->numPages > 0 ) {
+        uint32_t last = inDB->numPages - 1;
+
+        if( inDB->pageCounts[ last ] == 0 ) {
+            // empty page at end, just drop it
+            if( findPage( inDB, inDB->pageRegionX[ last ],
+                          inDB->pageRegionY[ last ] ) == last ) {
+                indexRemove( &( inDB->pageIndex ),
+                             inDB->pageRegionX, inDB->pageRegionY,
+                             inDB->pageRegionX[ last ],
+                             inDB->pageRegionY[ last ] );
+                }
+            dropCachedPage( inDB, last );
+            inDB->numPages--;
+            continue;
+            }
+
+        if( numMoved >= inMaxMoves ) {
+            break;
+            }
+
+        while( hole < last && inDB->pageCounts[ hole ] != 0 ) {
+            hole++;
+            }
+
+        if( hole >= last ) {
+            // no empty pages before last
+            break;
+            }
+
+        // copy last page over empty one
+        REGIONDB_CachedPage *entry = getPage( inDB, last, true );
+
+        if( entry == NULL ) {
+            return -1;
+            }
+
+        if( inDB->pageRegionX[ hole ] != inDB->pageRegionX[ last ] ||
+            inDB->pageRegionY[ hole ] != inDB->pageRegionY[ last ] ) {
+            if( findPage( inDB, inDB->pageRegionX[ hole ],
+                          inDB->pageRegionY[ hole ] ) == hole ) {
+                indexRemove( &( inDB->pageIndex ),
+                             inDB->pageRegionX, inDB->pageRegionY,
+                             inDB->pageRegionX[ hole ],
+                             inDB->pageRegionY[ hole ] );
+                }
+            }
+        dropCachedPage( inDB, hole );
+
+        entry->pageIndex = hole;
+
+        if( writePage( inDB, entry ) == -1 ) {
+            return -1;
+            }
+
+        // entry is in last's cache slot, not hole's
+        entry->pageIndex = UINT32_MAX;
+
+        inDB->pageRegionX[ hole ] = inDB->pageRegionX[ last ];
+        inDB->pageRegionY[ hole ] = inDB->pageRegionY[ last ];
+        inDB->pageCounts[ hole ] = inDB->pageCounts[ last ];
+
+        indexInsert( &( inDB->pageIndex ),
+                     inDB->pageRegionX, inDB->pageRegionY, hole );
+
+        inDB->numPages--;
+        numMoved++;
+        }
+
+    if( inDB->numPages != oldNumPages ) {
+        // moved pages must reach file before old copies are cut off
+        if( truncateFile( inDB->file,
+                          pageOffset( inDB, inDB->numPages ) ) == -1 ) {
+            return -1;
+            }
+        }
+
+    if( inDB->freezeCursor >= inDB->numPages ) {
+        inDB->freezeCursor = 0;
+        }
+
+    return numMoved;
+    }
+
+
+
+int REGIONDB_freeze( REGIONDB *inDB, int inMaxPages,
+                     char ( *inIsColdRegion )( int inXStart, int inYStart,
+                                               int inSize ) ) {
+    if( inDB->holdWrites ) {
+        return 0;
+        }
+
+    int numFrozen = 0;
+
+    for( int i=0; i<inMaxPages && inDB->numPages > 0; i++ ) {
+        if( inDB->freezeCursor >= inDB->numPages ) {
+            inDB->freezeCursor = 0;
+            }
+
+        uint32_t page = inDB->freezeCursor;
+        inDB->freezeCursor++;
+
+        if( inDB->pageCounts[ page ] == 0 ) {
+            continue;
+            }
+
+        int regionX = inDB->pageRegionX[ page ];
+        int regionY = inDB->pageRegionY[ page ];
+
+        if( ! inIsColdRegion( regionX * REGIONDB_REGION_SIZE,
+                              regionY * REGIONDB_REGION_SIZE,
+                              REGIONDB_REGION_SIZE ) ) {
+            continue;
+            }
+
+        REGIONDB_CachedPage *entry = getPage( inDB, page, true );
+
+        if( entry == NULL ) {
+            return -1;
+            }
+
+        int compressedSize;
+        uint8_t *compressed = zipCompress( entry->data, inDB->pageBytes,
+                                           &compressedSize );
+
+        if( compressed == NULL ) {
+            continue;
+            }
+
+        if( (uint32_t)compressedSize >= inDB->pageBytes ) {
+            // not worth it
+            delete [] compressed;
+            continue;
+            }
+
+        uint32_t entryHeader[4] = {
+            (uint32_t)regionX, (uint32_t)regionY,
+            (uint32_t)compressedSize, inDB->pageCounts[ page ] };
+
+        uint64_t offset = inDB->coldFileSize;
+
+        // cold copy must reach file before hot page is emptied
+        char failed =
+            fseeko( inDB->coldFile, offset, SEEK_SET ) ||
+            fwrite( entryHeader, COLD_ENTRY_HEADER_SIZE, 1,
+                    inDB->coldFile ) != 1 ||
+            fwrite( compressed, compressedSize, 1, inDB->coldFile ) != 1 ||
+            fflush( inDB->coldFile ) != 0;
+
+        delete [] compressed;
+
+        if( failed ) {
+            return -1;
+            }
+
+        inDB->coldFileSize += COLD_ENTRY_HEADER_SIZE + compressedSize;
+
+        uint32_t c = addColdEntry( inDB, regionX, regionY, offset,
+                                   compressedSize, inDB->pageCounts[ page ] );
+
+        indexInsert( &( inDB->coldIndex ),
+                     inDB->coldRegionX, inDB->coldRegionY, c );
+
+        inDB->numColdRegions++;
+        inDB->coldBytes += compressedSize;
+        inDB->numFreezes++;
+
+
+        // empty hot page, leaving it for compaction
+        indexRemove( &( inDB->pageIndex ),
+                     inDB->pageRegionX, inDB->pageRegionY,
+                     regionX, regionY );
+
+        inDB->pageCounts[ page ] = 0;
+
+        memset( &( entry->data[ BITMAP_OFFSET ] ), 0,
+                REGIONDB_CELLS_PER_REGION / 8 );
+        setPageCount( entry, 0 );
+
+        if( writePage( inDB, entry ) == -1 ) {
+            return -1;
+            }
+        dropCachedPage( inDB, page );
+
+        numFrozen++;
+        }
+
+    return numFrozen;
+    }
+
+
+
+int REGIONDB_holdWrites( REGIONDB *inDB, char inHold ) {
+    if( inHold == inDB->holdWrites ) {
+        return 0;
+        }
+
+    if( inHold ) {
+        int result = REGIONDB_flush( inDB );
+
+        inDB->deltaSlots = new uint32_t[ inDB->pageSpace ];
+        memset( inDB->deltaSlots, 0, inDB->pageSpace * sizeof( uint32_t ) );
+
+        inDB->deltaSpace = 64;
+        inDB->deltaPages = new uint8_t*[ inDB->deltaSpace ];
+        inDB->deltaPageIndex = new uint32_t[ inDB->deltaSpace ];
+        inDB->numDeltaPages = 0;
+
+        inDB->holdWrites = true;
+        return result;
+        }
+
+    inDB->holdWrites = false;
+
+    int result = 0;
+
+    for( uint32_t i=0; i<inDB->numDeltaPages; i++ ) {
+        if( fseeko( inDB->file, pageOffset( inDB, inDB->deltaPageIndex[i] ),
+                    SEEK_SET ) ||
+            fwrite( inDB->deltaPages[i], inDB->pageBytes, 1,
+                    inDB->file ) != 1 ) {
+            result = -1;
+            }
+        else {
+            inDB->numPageWrites++;
+            }
+        delete [] inDB->deltaPages[i];
+        }
+
+    delete [] inDB->deltaSlots;
+    delete [] inDB->deltaPages;
+    delete [] inDB->deltaPageIndex;
+
+    inDB->deltaSlots = NULL;
+    inDB->deltaPages = NULL;
+    inDB->deltaPageIndex = NULL;
+    inDB->numDeltaPages = 0;
+    inDB->deltaSpace = 0;
+
+    // thawed pages must reach file before their .cold entries are
+    // marked dead
+    if( fflush( inDB->file ) != 0 ) {
+        return -1;
+        }
+
+    // marking an already-dead entry again is harmless
+    for( uint32_t c=0; c<inDB->numColdEntries; c++ ) {
+        if( inDB->coldCounts[c] == 0 &&
+            markColdEntryDead( inDB, c ) == -1 ) {
+            result = -1;
+            }
+        }
+
+    if( fflush( inDB->coldFile ) != 0 ) {
+        result = -1;
+        }
+
+    return result;
+    }
+
+
+
+unsigned int REGIONDB_getNumRecords( REGIONDB *inDB ) {
+    return inDB->numRecords;
+    }
+
+
+
+void REGIONDB_Iterator_init( REGIONDB *inDB, REGIONDB_Iterator *inDBi ) {
+    inDBi->db = inDB;
+    inDBi->nextPage = 0;
+    inDBi->nextCell = 0;
+    inDBi->inCold = false;
+    inDBi->nextColdEntry = 0;
+    }
+
+
+
+// returns 1 and fills outputs if a set cell is found in page data,
+// starting at iterator's next cell, 0 if none left
+static int nextCellInPage( REGIONDB_Iterator *inDBi, const uint8_t *inData,
+                           int inRegionX, int inRegionY,
+                           int *outX, int *outY, void *outValue ) {
+    REGIONDB *db = inDBi->db;
+
+    while( inDBi->nextCell < REGIONDB_CELLS_PER_REGION ) {
+        int cell = inDBi->nextCell;
+        inDBi->nextCell++;
+
+        if( isCellSet( inData, cell ) ) {
+            *outX = inRegionX * REGIONDB_REGION_SIZE +
+                cell % REGIONDB_REGION_SIZE;
+            *outY = inRegionY * REGIONDB_REGION_SIZE +
+                cell / REGIONDB_REGION_SIZE;
+
+            memcpy( outValue,
+                    &( inData[ PAGE_HEADER_SIZE + cell * db->valueSize ] ),
+                    db->valueSize );
+            return 1;
+            }
+        }
+    return 0;
+    }
+
+
+
+int REGIONDB_Iterator_next( REGIONDB_Iterator *inDBi,
+                            int *outX, int *outY, void *outValue ) {
+    REGIONDB *db = inDBi->db;
+
+    while( ! inDBi->inCold && inDBi->nextPage < db->numPages ) {
+        uint32_t page = inDBi->nextPage;
+
+        if( db->pageCounts[ page ] == 0 ) {
+            inDBi->nextPage++;
+            inDBi->nextCell = 0;
+            continue;
+            }
+
+        REGIONDB_CachedPage *entry = getPage( db, page, true );
+
+        if( entry == NULL ) {
+            return -1;
+            }
+
+        if( nextCellInPage( inDBi, entry->data,
+                            db->pageRegionX[ page ], db->pageRegionY[ page ],
+                            outX, outY, outValue ) ) {
+            return 1;
+            }
+
+        inDBi->nextPage++;
+        inDBi->nextCell = 0;
+        }
+
+    if( ! inDBi->inCold ) {
+        inDBi->inCold = true;
+        inDBi->nextCell = 0;
+        }
+
+    while( inDBi->nextColdEntry < db->numColdEntries ) {
+        uint32_t c = inDBi->nextColdEntry;
+
+        // a region thawed part way through is finished from scratch copy,
+        // because its hot page is past where iteration went
+        if( inDBi->nextCell == 0 && db->coldCounts[c] == 0 ) {
+            inDBi->nextColdEntry++;
+            continue;
+            }
+
+        if( db->coldScratchEntry != c ) {
+            uint8_t *data = decompressColdEntry( db, c );
+
+            if( data == NULL ) {
+                return -1;
+                }
+
+            if( db->coldScratch == NULL ) {
+                db->coldScratch = new uint8_t[ db->pageBytes ];
+                }
+            memcpy( db->coldScratch, data, db->pageBytes );
+            delete [] data;
+
+            db->coldScratchEntry = c;
+            }
+
+        if( nextCellInPage( inDBi, db->coldScratch,
+                            db->coldRegionX[c], db->coldRegionY[c],
+                            outX, outY, outValue ) ) {
+            return 1;
+            }
+
+        inDBi->nextColdEntry++;
+        inDBi->nextCell = 0;
+        }
+
+    return 0;
+    }
+
+
+
+static char bitmapEmpty( const uint8_t *inPageData ) {
+    for( int i=0; i<REGIONDB_CELLS_PER_REGION / 8; i++ ) {
+        if( inPageData[ BITMAP_OFFSET + i ] != 0 ) {
+            return false;
+            }
+        }
+    return true;
+    }
+
+
+
+int REGIONDB_Scanner_open( REGIONDB_Scanner *inScanner, const char *inPath,
+                           unsigned int inValueSize ) {
+    inScanner->valueSize = inValueSize;
+
+    inScanner->pageBytes = PAGE_HEADER_SIZE +
+        REGIONDB_CELLS_PER_REGION * inValueSize;
+    inScanner->pageBytes = ( ( inScanner->pageBytes + 4095 ) / 4096 ) * 4096;
+
+    inScanner->coldFile = NULL;
+    inScanner->coldFileSize = 0;
+    inScanner->nextColdOffset = COLD_HEADER_SIZE;
+
+    inScanner->file = fopen( inPath, "rb" );
+
+    if( inScanner->file == NULL ) {
+        return -1;
+        }
+
+    uint8_t header[12];
+
+    uint32_t regionSize = REGIONDB_REGION_SIZE;
+    uint32_t valueSize = inValueSize;
+
+    if( fread( header, 12, 1, inScanner->file ) != 1 ||
+        memcmp( header, magicString, 4 ) != 0 ||
+        memcmp( &( header[4] ), &regionSize, 4 ) != 0 ||
+        memcmp( &( header[8] ), &valueSize, 4 ) != 0 ||
+        fseeko( inScanner->file, 0, SEEK_END ) ) {
+        fclose( inScanner->file );
+        return -1;
+        }
+
+    uint64_t fileSize = ftello( inScanner->file );
+
+    // partial page at end ignored, same as open
+    inScanner->numPages = 0;
+
+    if( fileSize > HEADER_SIZE ) {
+        inScanner->numPages = ( fileSize - HEADER_SIZE ) / inScanner->pageBytes;
+        }
+    inScanner->nextPage = 0;
+
+
+    char *coldPath = new char[ strlen( inPath ) + 10 ];
+    sprintf( coldPath, "%s.cold", inPath );
+
+    inScanner->coldFile = fopen( coldPath, "rb" );
+
+    delete [] coldPath;
+
+    if( inScanner->coldFile != NULL ) {
+        uint8_t coldHeader[ COLD_HEADER_SIZE ];
+
+        if( fread( coldHeader, COLD_HEADER_SIZE, 1, 
+                   inScanner->coldFile ) != 1 ||
+            memcmp( coldHeader, coldMagicString, 4 ) != 0 ||
+            memcmp( &( coldHeader[4] ), &regionSize, 4 ) != 0 ||
+            memcmp( &( coldHeader[8] ), &valueSize, 4 ) != 0 ||
+            fseeko( inScanner->coldFile, 0, SEEK_END ) ) {
+            fclose( inScanner->coldFile );
+            fclose( inScanner->file );
+            return -1;
+            }
+        inScanner->coldFileSize = ftello( inScanner->coldFile );
+        }
+
+    inScanner->numRegions = 0;
+    inScanner->regionSpace = 64;
+    inScanner->regionX = new int[ inScanner->regionSpace ];
+    inScanner->regionY = new int[ inScanner->regionSpace ];
+    initIndex( &( inScanner->regionIndex ), 0 );
+
+    inScanner->page = new uint8_t[ inScanner->pageBytes ];
+    inScanner->pageLoaded = false;
+    inScanner->nextCell = 0;
+
+    if( fseeko( inScanner->file, HEADER_SIZE, SEEK_SET ) ) {
+        REGIONDB_Scanner_close( inScanner );
+        return -1;
+        }
+
+    return 0;
+    }
+
+
+
+// loads next page with values into scanner's page buffer
+// returns 1 on success, 0 if done, -1 on error
+static int loadNextScannerPage( REGIONDB_Scanner *inScanner ) {
+    
+    while( inScanner->nextPage < inScanner->numPages ) {
+        inScanner->nextPage++;
+
+        // pages read in file order, no seeking needed
+        if( fread( inScanner->page, inScanner->pageBytes, 1,
+                   inScanner->file ) != 1 ) {
+            return -1;
+            }
+
+        if( bitmapEmpty( inScanner->page ) ) {
+            continue;
+            }
+
+        int regionX, regionY;
+        memcpy( &regionX, inScanner->page, 4 );
+        memcpy( &regionY, &( inScanner->page[4] ), 4 );
+
+        if( indexLookup( &( inScanner->regionIndex ),
+                         inScanner->regionX, inScanner->regionY,
+                         regionX, regionY ) != UINT32_MAX ) {
+            // second copy from a crash during compaction
+            // first copy is the live one
+            continue;
+            }
+
+        if( inScanner->numRegions == inScanner->regionSpace ) {
+            uint32_t newSpace = inScanner->regionSpace * 2;
+            
+            int *newX = new int[ newSpace ];
+            int *newY = new int[ newSpace ];
+            
+            memcpy( newX, inScanner->regionX, 
+                    inScanner->numRegions * sizeof( int ) );
+            memcpy( newY, inScanner->regionY, 
+                    inScanner->numRegions * sizeof( int ) );
+            
+            delete [] inScanner->regionX;
+            delete [] inScanner->regionY;
+            
+            inScanner->regionX = newX;
+            inScanner->regionY = newY;
+            inScanner->regionSpace = newSpace;
+            }
+
+        inScanner->regionX[ inScanner->numRegions ] = regionX;
+        inScanner->regionY[ inScanner->numRegions ] = regionY;
+        indexInsert( &( inScanner->regionIndex ), 
+                     inScanner->regionX, inScanner->regionY,
+                     inScanner->numRegions );
+        inScanner->numRegions++;
+
+        inScanner->pageRegionX = regionX;
+        inScanner->pageRegionY = regionY;
+        return 1;
+        }
+
+    if( inScanner->coldFile == NULL ) {
+        return 0;
+        }
+
+    while( inScanner->nextColdOffset + COLD_ENTRY_HEADER_SIZE <= 
+           inScanner->coldFileSize ) {
+        
+        uint32_t entryHeader[4];
+
+        if( fseeko( inScanner->coldFile, inScanner->nextColdOffset, 
+                    SEEK_SET ) ||
+            fread( entryHeader, COLD_ENTRY_HEADER_SIZE, 1,
+                   inScanner->coldFile ) != 1 ) {
+            return -1;
+            }
+
+        int regionX = (int)entryHeader[0];
+        int regionY = (int)entryHeader[1];
+        uint32_t size = entryHeader[2];
+        uint32_t count = entryHeader[3];
+
+        if( inScanner->nextColdOffset + COLD_ENTRY_HEADER_SIZE + size > 
+            inScanner->coldFileSize ) {
+            // partial entry at end
+            return 0;
+            }
+
+        inScanner->nextColdOffset += COLD_ENTRY_HEADER_SIZE + size;
+
+        if( count == 0 ||
+            indexLookup( &( inScanner->regionIndex ),
+                         inScanner->regionX, inScanner->regionY,
+                         regionX, regionY ) != UINT32_MAX ) {
+            // thawed, or has a newer hot page
+            continue;
+            }
+
+        uint8_t *compressed = new uint8_t[ size ];
+
+        if( fread( compressed, size, 1, inScanner->coldFile ) != 1 ) {
+            delete [] compressed;
+            return -1;
+            }
+
+        uint8_t *data = zipDecompress( compressed, size, 
+                                       inScanner->pageBytes );
+        delete [] compressed;
+
+        if( data == NULL ) {
+            return -1;
+            }
+
+        memcpy( inScanner->page, data, inScanner->pageBytes );
+        delete [] data;
+
+        inScanner->pageRegionX = regionX;
+        inScanner->pageRegionY = regionY;
+        return 1;
+        }
+
+    return 0;
+    }
+
+
+
+int REGIONDB_Scanner_next( REGIONDB_Scanner *inScanner,
+                           int *outX, int *outY, void *outValue ) {
+    while( true ) {
+        if( ! inScanner->pageLoaded ) {
+            int result = loadNextScannerPage( inScanner );
+            
+            if( result <= 0 ) {
+                return result;
+                }
+            inScanner->pageLoaded = true;
+            inScanner->nextCell = 0;
+            }
+
+        while( inScanner->nextCell < REGIONDB_CELLS_PER_REGION ) {
+            int cell = inScanner->nextCell;
+            inScanner->nextCell++;
+
+            if( isCellSet( inScanner->page, cell ) ) {
+                *outX = inScanner->pageRegionX * REGIONDB_REGION_SIZE +
+                    cell % REGIONDB_REGION_SIZE;
+                *outY = inScanner->pageRegionY * REGIONDB_REGION_SIZE +
+                    cell / REGIONDB_REGION_SIZE;
+
+                memcpy( outValue,
+                        &( inScanner->page[ PAGE_HEADER_SIZE + 
+                                            cell * inScanner->valueSize ] ),
+                        inScanner->valueSize );
+                return 1;
+                }
+            }
+        
+        inScanner->pageLoaded = false;
+        }
+    }
+
+
+
+void REGIONDB_Scanner_close( REGIONDB_Scanner *inScanner ) {
+    fclose( inScanner->file );
+
+    if( inScanner->coldFile != NULL ) {
+        fclose( inScanner->coldFile );
+        }
+
+    delete [] inScanner->regionX;
+    delete [] inScanner->regionY;
+    delete [] inScanner->regionIndex.slots;
+    delete [] inScanner->page;
+    }
@@ -0,0 +1,383 @@
+#ifndef REGIONDB_H_INCLUDED
+#define REGIONDB_H_INCLUDED
+
+
+
+// Storage for fixed-size per-cell map records, grouped by region
+//
+// Each REGIONDB_REGION_SIZE x REGIONDB_REGION_SIZE square of cells is
+// stored as one page in the data file, with a value slot for every cell
+// in the region.  Pages are read and written whole, and kept in a RAM
+// page cache, so looking up neighboring cells touches one page, and a
+// rectangle of cells touches a handful of pages.
+//
+// Pages are appended in the order that regions are first written to.
+// A RAM index from region to page is rebuilt from the page headers on
+// open.
+//
+// Writes go into cached pages, which are written back to the file when
+// evicted, and by REGIONDB_flush.
+//
+// Regions that the caller reports as cold can be frozen with
+// REGIONDB_freeze, which compresses their pages into a separate
+// .cold file and frees their spots in the data file.  A frozen region
+// is decompressed back into a hot page the next time it is accessed.
+
+
+// some compilers require this to access UINT64_MAX
+#define __STDC_LIMIT_MACROS
+#include <stdint.h>
+
+#include <stdio.h>
+
+
+// cells on a side of a region
+// must be a power of 2
+#define REGIONDB_REGION_SIZE 16
+
+#define REGIONDB_CELLS_PER_REGION \
+    ( REGIONDB_REGION_SIZE * REGIONDB_REGION_SIZE )
+
+
+
+typedef struct {
+        // page held, or UINT32_MAX if none
+        uint32_t pageIndex;
+
+        char dirty;
+
+        // whole page, as stored in file
+        uint8_t *data;
+    } REGIONDB_CachedPage;
+
+
+
+// open-addressed table from region to entry number
+typedef struct {
+        // entry number + 1, 0 for empty
+        // size is power of 2
+        uint32_t *slots;
+        uint32_t size;
+
+        uint32_t numUsed;
+    } REGIONDB_Index;
+
+
+
+typedef struct {
+        FILE *file;
+
+        unsigned int valueSize;
+
+        // bytes per page in file, rounded up to a multiple of 4096
+        uint32_t pageBytes;
+
+        uint32_t numPages;
+        uint32_t pageSpace;
+
+        // for each page in file
+        int *pageRegionX;
+        int *pageRegionY;
+        uint16_t *pageCounts;
+
+        REGIONDB_Index pageIndex;
+
+        // direct-mapped, indexed by page number
+        REGIONDB_CachedPage *cache;
+        uint32_t cacheSize;
+
+        // cells with values, hot and cold
+        uint32_t numRecords;
+
+        uint64_t numPageReads;
+        uint64_t numPageWrites;
+
+
+        // compressed pages of frozen regions, appended to end of .cold file
+        FILE *coldFile;
+        uint64_t coldFileSize;
+
+        uint32_t numColdEntries;
+        uint32_t coldSpace;
+
+        // for each entry in .cold file
+        int *coldRegionX;
+        int *coldRegionY;
+        uint64_t *coldOffsets;
+        uint32_t *coldSizes;
+        // 0 once region thawed
+        uint16_t *coldCounts;
+
+        // live entries only
+        REGIONDB_Index coldIndex;
+
+        uint32_t numColdRegions;
+
+        // compressed bytes of live entries
+        uint64_t coldBytes;
+
+        // decompressed copy of one .cold entry, for iterators
+        uint8_t *coldScratch;
+        // UINT32_MAX if none
+        uint32_t coldScratchEntry;
+
+        // next page for REGIONDB_freeze to consider
+        uint32_t freezeCursor;
+
+        uint64_t numFreezes;
+        uint64_t numThaws;
+
+        // total CPU time spent decompressing thawed pages
+        double thawSeconds;
+
+
+        // while set, page writes go to RAM delta pages instead of file
+        // (see REGIONDB_holdWrites)
+        char holdWrites;
+
+        // for each page, its delta slot + 1, or 0 if none
+        // NULL when not holding
+        uint32_t *deltaSlots;
+
+        uint8_t **deltaPages;
+        uint32_t *deltaPageIndex;
+        uint32_t numDeltaPages;
+        uint32_t deltaSpace;
+    } REGIONDB;
+
+
+
+typedef struct {
+        REGIONDB *db;
+        uint32_t nextPage;
+        int nextCell;
+
+        // past last page, walking .cold entries instead
+        char inCold;
+        uint32_t nextColdEntry;
+    } REGIONDB_Iterator;
+
+
+
+/**
+ * Open database
+ *
+ * @param inDB the database to open
+ * @param inPath path to database file
+ * @param inValueSize size of each cell's value in bytes
+ * @param inCachedPages number of pages to keep in RAM
+ * @return 0 on success, nonzero on error
+ *
+ * Also opens (or creates) inPath.cold, and rewrites it without the
+ * entries of thawed regions if those take up more than half of it.
+ */
+int REGIONDB_open( REGIONDB *inDB, const char *inPath,
+                   unsigned int inValueSize,
+                   unsigned int inCachedPages );
+
+
+
+/**
+ * Writes back dirty pages, drops empty pages, and closes database
+ *
+ * @param inDB DB to close
+ */
+void REGIONDB_close( REGIONDB *inDB );
+
+
+
+/**
+ * Get a cell's value
+ *
+ * @return -1 on I/O error, 1 if not found, 0 if found
+ */
+int REGIONDB_get( REGIONDB *inDB, int inX, int inY, void *outValue );
+
+
+
+/**
+ * Put a cell's value
+ *
+ * @return -1 on I/O error, 0 on success
+ */
+int REGIONDB_put( REGIONDB *inDB, int inX, int inY, const void *inValue );
+
+
+
+/**
+ * Remove a cell's value
+ *
+ * A page stays in the file when its last value is removed, until
+ * REGIONDB_compact or REGIONDB_close drops it.
+ *
+ * @return -1 on I/O error, 1 if not found, 0 if removed
+ */
+int REGIONDB_delete( REGIONDB *inDB, int inX, int inY );
+
+
+
+/**
+ * Load every page that overlaps a rectangle of cells into the page
+ * cache, in file order.
+ *
+ * Subsequent gets in that rectangle do no I/O, as long as the
+ * rectangle's pages fit in the cache without colliding.
+ *
+ * @return -1 on I/O error, 0 on success
+ */
+int REGIONDB_loadRect( REGIONDB *inDB, int inXStart, int inYStart,
+                       int inWidth, int inHeight );
+
+
+
+/**
+ * Writes all dirty cached pages back to file.
+ *
+ * @return -1 on I/O error, 0 on success
+ */
+int REGIONDB_flush( REGIONDB *inDB );
+
+
+
+/**
+ * Moves up to inMaxMoves pages from the end of the file into the spots
+ * of empty pages, and truncates the file.
+ *
+ * @return number of pages moved, or -1 on I/O error
+ */
+int REGIONDB_compact( REGIONDB *inDB, int inMaxMoves );
+
+
+
+/**
+ * Freezes cold regions.
+ *
+ * Considers up to inMaxPages hot pages, continuing from where the last
+ * call left off, and wrapping around at the end of the file.  Each
+ * page's region is passed to inIsColdRegion, as the cell coordinates of
+ * its lower-left corner, and if that returns true, the page is
+ * compressed into the .cold file, and its spot in the data file is
+ * emptied (for REGIONDB_compact to drop).
+ *
+ * Pages that don't compress to less than their own size are left hot.
+ *
+ * @return number of regions frozen, or -1 on I/O error
+ */
+int REGIONDB_freeze( REGIONDB *inDB, int inMaxPages,
+                     char ( *inIsColdRegion )( int inXStart, int inYStart,
+                                               int inSize ) );
+
+
+
+/**
+ * Holds or releases writes to the data and .cold files.
+ *
+ * When holding starts, dirty pages are flushed, and from then on the
+ * files are left untouched, so they can be copied as a consistent
+ * snapshot while the database stays in use.  Pages written back while
+ * holding are kept in RAM as delta pages, and read from there.
+ * Compaction and freezing do nothing while holding.
+ *
+ * When holding is released, delta pages are written to the data file,
+ * and regions thawed in the mean time are marked dead in the .cold file.
+ *
+ * @return -1 on I/O error, 0 on success
+ */
+int REGIONDB_holdWrites( REGIONDB *inDB, char inHold );
+
+
+
+/**
+ * @return number of cells with values
+ */
+unsigned int REGIONDB_getNumRecords( REGIONDB *inDB );
+
+
+
+/**
+ * Iterates through all cells with values, page by page in file order,
+ * and then through frozen regions.
+ *
+ * Pages are read through the page cache.  Frozen regions are
+ * decompressed into a buffer shared by all iterators, without thawing
+ * them.
+ * Puts and deletes are safe during iteration, but cells added to pages
+ * that have already been passed are not returned.
+ */
+void REGIONDB_Iterator_init( REGIONDB *inDB, REGIONDB_Iterator *inDBi );
+
+
+/**
+ * @return 1 if value fetched, 0 if done, -1 on I/O error
+ */
+int REGIONDB_Iterator_next( REGIONDB_Iterator *inDBi,
+                            int *outX, int *outY, void *outValue );
+
+
+
+/**
+ * Read-only walk through all cells with values in a data file and its
+ * .cold file, without opening them as a database.
+ *
+ * The files must not be written to while they are being scanned (the
+ * database must be closed, or holding writes for a snapshot).
+ *
+ * Safe to use from any thread, since it shares nothing with open
+ * databases.
+ */
+typedef struct {
+        FILE *file;
+        FILE *coldFile;
+
+        unsigned int valueSize;
+        uint32_t pageBytes;
+
+        uint32_t numPages;
+        uint32_t nextPage;
+
+        uint64_t coldFileSize;
+        uint64_t nextColdOffset;
+
+        // regions of hot pages already returned, so that leftover
+        // copies of a region are skipped
+        int *regionX;
+        int *regionY;
+        uint32_t numRegions;
+        uint32_t regionSpace;
+        REGIONDB_Index regionIndex;
+
+        // current page, whole, as stored in data file
+        uint8_t *page;
+        char pageLoaded;
+        int pageRegionX;
+        int pageRegionY;
+        int nextCell;
+    } REGIONDB_Scanner;
+
+
+
+/**
+ * @param inValueSize size of each cell's value in bytes
+ * @return 0 on success, -1 if files can't be read or have bad headers
+ *
+ * A missing .cold file is treated as empty.
+ */
+int REGIONDB_Scanner_open( REGIONDB_Scanner *inScanner, const char *inPath,
+                           unsigned int inValueSize );
+
+
+/**
+ * Hot pages are walked in file order, then frozen regions.
+ *
+ * @return 1 if value fetched, 0 if done, -1 on I/O error
+ */
+int REGIONDB_Scanner_next( REGIONDB_Scanner *inScanner,
+                           int *outX, int *outY, void *outValue );
+
+
+void REGIONDB_Scanner_close( REGIONDB_Scanner *inScanner );
+
+
+
+
+#endif
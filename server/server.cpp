@@ -62,6 +62,11 @@
 #include "curseDB.h"
 #include "cravings.h"
 #include "ipBanList.h"
+#include "clientReadBuffer.h"
+#include "clientSendQueue.h"
+#include "clientFrameBuilder.h"
+#include "socketEpoll.h"
+#include "playerGrid.h"
 
 
 #include "minorGems/util/random/JenkinsRandomSource.h"
@@ -519,7 +524,7 @@ typedef struct PastLifeStats {
 // for incoming socket connections that are still in the login process
 typedef struct FreshConnection {
         Socket *sock;
-        SimpleVector<char> *sockBuffer;
+        ClientReadBuffer *sockBuffer;
 
         unsigned int sequenceNumber;
         char *sequenceNumberString;
@@ -759,7 +764,13 @@ typedef struct LiveObject {
         
 
         Socket *sock;
-        SimpleVector<char> *sockBuffer;
+        ClientReadBuffer *sockBuffer;
+        
+        // what their socket hasn't taken yet
+        ClientSendQueue *sendQueue;
+        
+        // what we've sent them so far this step
+        ClientFrameBuilder *frame;
         
         // indicates that some messages were sent to this player this 
         // frame, and they need a FRAME terminator message
@@ -1812,6 +1823,14 @@ void quitCleanup() {
             delete nextPlayer->sockBuffer;
             nextPlayer->sockBuffer = NULL;
             }
+        if( nextPlayer->sendQueue != NULL ) {
+            delete nextPlayer->sendQueue;
+            nextPlayer->sendQueue = NULL;
+            }
+        if( nextPlayer->frame != NULL ) {
+            delete nextPlayer->frame;
+            nextPlayer->frame = NULL;
+            }
 
         delete nextPlayer->lineage;
 
@@ -1919,6 +1938,7 @@ void quitCleanup() {
     
     freeIPBanList();
 
+    waitForBackup();
 
     freeMap();
 
@@ -2102,11 +2122,18 @@ int numConnections = 0;
 
 // reads all waiting data from socket and stores it in buffer
 // returns true if socket still good, false on error
-char readSocketFull( Socket *inSock, SimpleVector<char> *inBuffer ) {
+char readSocketFull( Socket *inSock, ClientReadBuffer *inBuffer ) {
+
+    if( isSocketEpollOn() ) {
+        // skips sockets that have nothing new
+        return socketEpollRead( inSock, inBuffer );
+        }
 
-    char buffer[512];
+    // receive straight into buffer
+    int spaceSize;
+    char *space = inBuffer->getWriteSpace( 4096, &spaceSize );
     
-    int numRead = inSock->receive( (unsigned char*)buffer, 512, 0 );
+    int numRead = inSock->receive( (unsigned char*)space, spaceSize, 0 );
     
     if( numRead == -1 ) {
 
@@ -2141,9 +2168,11 @@ char readSocketFull( Socket *inSock, SimpleVector<char> *inBuffer ) {
         }
     
     while( numRead > 0 ) {
-        inBuffer->appendArray( buffer, numRead );
+        inBuffer->commitWrite( numRead );
 
-        numRead = inSock->receive( (unsigned char*)buffer, 512, 0 );
+        space = inBuffer->getWriteSpace( 4096, &spaceSize );
+        
+        numRead = inSock->receive( (unsigned char*)space, spaceSize, 0 );
         }
 
     return true;
@@ -2157,7 +2186,7 @@ char readSocketFull( Socket *inSock, SimpleVector<char> *inBuffer ) {
 // start with either string as NONSENSE (this allows us to instantly reject 
 // web requests and other non-OHOL messages that don't end with # and don't
 // exceed our 200 char limit)
-char *getNextClientMessage( SimpleVector<char> *inBuffer,
+char *getNextClientMessage( ClientReadBuffer *inBuffer,
                             char inLoginMessageOnly = false ) {
 
     // find first terminal character #
@@ -2216,9 +2245,7 @@ char *getNextClientMessage( SimpleVector<char> *inBuffer,
     char *message = new char[ index + 1 ];
     
     // all but terminal character
-    for( int i=0; i<index; i++ ) {
-        message[i] = inBuffer->getElementDirect( i );
-        }
+    inBuffer->getStartElements( message, index );
     
     // delete from buffer, including terminal character
     inBuffer->deleteStartElements( index + 1 );
@@ -2263,10 +2290,17 @@ typedef enum messageType {
     PHOTO,
     PHOID,
     FLIP,
+    FEATURES,
     UNKNOWN
     } messageType;
 
 
+// bits of x in FEATURES message, for protocol extensions the client 
+// understands
+#define CLIENT_FEATURE_COMPRESSED_FRAMES 1
+#define CLIENT_FEATURE_DEFLATE_STREAM 2
+
+
 
 
 typedef struct ClientMessage {
@@ -2601,6 +2635,9 @@ ClientMessage parseMessage( LiveObject *inPlayer, char *inMessage ) {
     else if( strcmp( nameBuffer, "MAP" ) == 0 ) {
         m.type = MAP;
         }
+    else if( strcmp( nameBuffer, "FEATURES" ) == 0 ) {
+        m.type = FEATURES;
+        }
     else if( strcmp( nameBuffer, "SAY" ) == 0 ) {
         m.type = SAY;
 
@@ -2849,12 +2886,18 @@ doublePair computePartialMoveSpotPrecise( LiveObject *inPlayer ) {
 
 
 
+static void updatePlayerGrid( LiveObject *inPlayer, int inPathStep = -2 );
+
+
 // if inOverrideC > -2, then it is used instead of current partial move step
 GridPos computePartialMoveSpot( LiveObject *inPlayer, int inOverrideC = -2 ) {
 
     int c = inOverrideC;
     if( c < -1 ) {
         c = computePartialMovePathStep( inPlayer );
+        
+        // player's box can shrink to what's left of path
+        updatePlayerGrid( inPlayer, c );
         }
     
     if( c >= 0 ) {
@@ -4331,47 +4374,256 @@ static char equal( GridPos inA, GridPos inB ) {
 
 
 
-// returns (0,0) if no player found
-GridPos getClosestPlayerPos( int inX, int inY ) {
-    GridPos c = { inX, inY };
+static int chunkDimensionX = 32;
+static int chunkDimensionY = 30;
+
+
+// cells are chunk-sized, so the usual range checks (one or two chunk
+// widths) only touch a handful of cells
+static PlayerGrid playerGrid( chunkDimensionX );
+
+// index in players by ID, rebuilt by refreshPlayerGrid
+static FlatHashTable<int> playerIndexByID( 1024, -1 );
+
+
+
+static void addToPlayerGridBox( int inX, int inY,
+                                int *ioMinX, int *ioMinY,
+                                int *ioMaxX, int *ioMaxY ) {
+    if( inX < *ioMinX ) {
+        *ioMinX = inX;
+        }
+    if( inY < *ioMinY ) {
+        *ioMinY = inY;
+        }
+    if( inX > *ioMaxX ) {
+        *ioMaxX = inX;
+        }
+    if( inY > *ioMaxY ) {
+        *ioMaxY = inY;
+        }
+    }
+
+
+
+// adds every spot inPlayer might be reported at from path step
+// inPathStep on (or -2 to use their current step)
+static void addMoveToPlayerGridBox( LiveObject *inPlayer, int inPathStep,
+                                    int *ioMinX, int *ioMinY,
+                                    int *ioMaxX, int *ioMaxY ) {
     
-    double closeDist = DBL_MAX;
-    GridPos closeP = { 0, 0 };
+    addToPlayerGridBox( inPlayer->xd, inPlayer->yd, 
+                        ioMinX, ioMinY, ioMaxX, ioMaxY );
+    
+    if( inPlayer->xs == inPlayer->xd && inPlayer->ys == inPlayer->yd ) {
+        return;
+        }
+    
+    if( inPathStep < -1 ) {
+        inPathStep = computePartialMovePathStep( inPlayer );
+        }
+    
+    // precise spots round down to step before
+    int start = inPathStep - 1;
+    
+    if( start < 0 || inPlayer->pathToDest == NULL ) {
+        addToPlayerGridBox( inPlayer->xs, inPlayer->ys, 
+                            ioMinX, ioMinY, ioMaxX, ioMaxY );
+        start = 0;
+        }
+    
+    if( inPlayer->pathToDest != NULL ) {
+        for( int i=start; i<inPlayer->pathLength; i++ ) {
+            GridPos p = inPlayer->pathToDest[i];
+            addToPlayerGridBox( p.x, p.y, ioMinX, ioMinY, ioMaxX, ioMaxY );
+            }
+        }
+    }
+
+
+
+// called when a move starts or finishes, and whenever we find out
+// where a player is along their path
+// refreshPlayerGrid catches everything else (teleports, births, being
+// picked up) once per step
+static void updatePlayerGrid( LiveObject *inPlayer, int inPathStep ) {
+    int minX = inPlayer->xd;
+    int minY = inPlayer->yd;
+    int maxX = minX;
+    int maxY = minY;
+    
+    addMoveToPlayerGridBox( inPlayer, inPathStep, 
+                            &minX, &minY, &maxX, &maxY );
+    
+    if( inPlayer->heldByOther ) {
+        // updates about held players use holder's position
+        LiveObject *holder = getLiveObject( inPlayer->heldByOtherID );
+        
+        if( holder != NULL ) {
+            addMoveToPlayerGridBox( holder, -2, 
+                                    &minX, &minY, &maxX, &maxY );
+            }
+        }
+    
+    playerGrid.update( inPlayer->id, minX, minY, maxX, maxY );
+    }
+
+
+
+static void refreshPlayerGrid() {
+    playerIndexByID.clear();
     
     for( int i=0; i<players.size(); i++ ) {
         LiveObject *o = players.getElement( i );
-        if( o->error ) {
-            continue;
+        
+        playerIndexByID.insert( o->id, 0, 0, 0, i );
+        
+        updatePlayerGrid( o );
+        }
+    }
+
+
+
+// finds player for ID that came out of playerGrid
+static LiveObject *getGridPlayer( int inID ) {
+    char found;
+    int i = playerIndexByID.lookup( inID, 0, 0, 0, &found );
+    
+    if( found && i < players.size() ) {
+        LiveObject *o = players.getElement( i );
+        
+        if( o->id == inID ) {
+            return o;
             }
-        if( o->heldByOther ) {
+        }
+    
+    // players list changed since last refresh
+    return getLiveObject( inID );
+    }
+
+
+
+// players within inRadius of inPos on both axes, plus some that are
+// a bit further away
+static void getNearbyPlayers( GridPos inPos, int inRadius,
+                              SimpleVector<LiveObject*> *outPlayers ) {
+    SimpleVector<int> ids;
+    
+    playerGrid.getNear( inPos.x, inPos.y, inRadius, &ids );
+    
+    for( int i=0; i<ids.size(); i++ ) {
+        LiveObject *o = getGridPlayer( ids.getElementDirect( i ) );
+        
+        if( o != NULL ) {
+            outPlayers->push_back( o );
+            }
+        }
+    }
+
+
+
+// for each change in inPositions, adds its index to the list of every
+// player that might be within inRadius of it
+// global changes go to everyone
+// outLists is indexed like players, and each list comes out in change order
+static void getNearbyChangesForPlayers( 
+    SimpleVector<ChangePosition> *inPositions, int inRadius,
+    SimpleVector<int> *outLists ) {
+    
+    SimpleVector<int> ids;
+    
+    for( int u=0; u<inPositions->size(); u++ ) {
+        ChangePosition *p = inPositions->getElement( u );
+        
+        if( p->global ) {
+            for( int i=0; i<players.size(); i++ ) {
+                outLists[i].push_back( u );
+                }
             continue;
             }
         
-        GridPos p;
+        ids.deleteAll();
+        playerGrid.getNear( p->x, p->y, inRadius, &ids );
+        
+        for( int j=0; j<ids.size(); j++ ) {
+            char found;
+            int i = playerIndexByID.lookup( ids.getElementDirect( j ), 
+                                            0, 0, 0, &found );
+            if( found && i < players.size() ) {
+                outLists[i].push_back( u );
+                }
+            }
+        }
+    }
 
-        if( o->xs == o->xd && o->ys == o->yd ) {
-            p.x = o->xd;
-            p.y = o->yd;
+
+
+// returns (0,0) if no player found
+GridPos getClosestPlayerPos( int inX, int inY ) {
+    GridPos c = { inX, inY };
+    
+    double closeDist = DBL_MAX;
+    GridPos closeP = { 0, 0 };
+    
+    // widen search until closest is inside it, or we've seen everyone
+    int radius = chunkDimensionX;
+    
+    SimpleVector<LiveObject*> near;
+    
+    while( true ) {
+        near.deleteAll();
+        
+        if( radius > 1 << 24 ) {
+            // they're all very far away, look at everyone
+            for( int i=0; i<players.size(); i++ ) {
+                near.push_back( players.getElement( i ) );
+                }
             }
         else {
-            p = computePartialMoveSpot( o );
+            getNearbyPlayers( c, radius, &near );
             }
         
-        double d = distance( p, c );
+        for( int i=0; i<near.size(); i++ ) {
+            LiveObject *o = near.getElementDirect( i );
+            if( o->error ) {
+                continue;
+                }
+            if( o->heldByOther ) {
+                continue;
+                }
+            
+            GridPos p;
+
+            if( o->xs == o->xd && o->ys == o->yd ) {
+                p.x = o->xd;
+                p.y = o->yd;
+                }
+            else {
+                p = computePartialMoveSpot( o );
+                }
+            
+            double d = distance( p, c );
+            
+            if( d < closeDist ) {
+                closeDist = d;
+                closeP = p;
+                }
+            }
         
-        if( d < closeDist ) {
-            closeDist = d;
-            closeP = p;
+        if( closeDist <= radius || 
+            near.size() >= playerGrid.getNumPlayers() ||
+            radius > 1 << 24 ) {
+            break;
             }
+        radius *= 4;
         }
+    
     return closeP;
     }
 
 
 
 
-static int chunkDimensionX = 32;
-static int chunkDimensionY = 30;
 
 
 static int getMaxChunkDimension() {
@@ -4382,6 +4634,146 @@ static int getMaxChunkDimension() {
 static SocketPoll sockPoll;
 
 
+// sockPoll is our fallback when epoll is off
+static void addPolledSocket( Socket *inSock ) {
+    if( isSocketEpollOn() ) {
+        socketEpollAdd( inSock );
+        }
+    else {
+        sockPoll.addSocket( inSock );
+        }
+    }
+
+
+
+static void removePolledSocket( Socket *inSock ) {
+    if( isSocketEpollOn() ) {
+        socketEpollRemove( inSock );
+        }
+    else {
+        sockPoll.removeSocket( inSock );
+        }
+    }
+
+
+
+static ClientSendQueue *newSendQueue() {
+    return new ClientSendQueue( 
+        SettingsManager::getIntSetting( "sendQueueLowWatermark", 65536 ),
+        SettingsManager::getIntSetting( "sendQueueHighWatermark", 262144 ),
+        SettingsManager::getIntSetting( "maxSendQueueBytes", 4194304 ) );
+    }
+
+
+
+// adds message to what goes out to player at the end of this step
+//
+// inLowPriority messages are dropped instead if their connection
+// is backed up, now or by the time the frame goes out
+//
+// returns inLength, or -1 if they have no connection
+static int sendToPlayer( LiveObject *inPlayer, 
+                         unsigned char *inMessage, int inLength,
+                         char inLowPriority = false ) {
+    
+    if( inPlayer->sock == NULL || inPlayer->frame == NULL ) {
+        return -1;
+        }
+    
+    if( inLowPriority && inPlayer->sendQueue->isBackedUp() ) {
+        inPlayer->sendQueue->noteDropped( inLength );
+        return inLength;
+        }
+    
+    inPlayer->frame->add( inMessage, inLength, inLowPriority );
+
+    return inLength;
+    }
+
+
+
+// sends everything collected for player this step in one write, 
+// and queues whatever their socket won't take
+//
+// returns false if their connection failed or has backed up past the max
+static char sendPlayerFrame( LiveObject *inPlayer ) {
+    if( inPlayer->sock == NULL || inPlayer->frame == NULL ) {
+        return false;
+        }
+    
+    ClientFrameBuilder *frame = inPlayer->frame;
+    ClientSendQueue *q = inPlayer->sendQueue;
+
+    if( frame->isEmpty() ) {
+        return true;
+        }
+    
+    // drop low-priority messages before they're compressed
+    frame->finish( q->wouldBackUp( frame->getNumBytes() ) );
+    
+    if( frame->getNumDropped() > 0 ) {
+        q->noteDropped( frame->getNumBytesDropped(), 
+                        frame->getNumDropped() );
+        }
+    
+    if( frame->getNumParts() == 0 ) {
+        frame->clear();
+        return true;
+        }
+
+    char result = q->sendParts( inPlayer->sock, frame->getNumParts(),
+                                frame->getParts(), 
+                                frame->getPartLengths(),
+                                frame->getPartLowPriority() );
+    frame->clear();
+
+    if( ! result ) {
+        if( q->isOverMax() ) {
+            AppLog::infoF( "Player %d send queue backed up to %d bytes, "
+                           "giving up on them",
+                           inPlayer->id, q->getNumBytes() );
+            }
+        return false;
+        }
+    
+    if( q->getNumBytes() > 0 && isSocketEpollOn() ) {
+        // wake us when there's room for the rest
+        socketEpollWatchWritable( inPlayer->sock, true );
+        }
+
+    return true;
+    }
+
+
+
+// last chance to get what's waiting out to a client, without blocking,
+// before their socket is deleted
+// things like death messages are often still queued for slow clients
+static void flushBeforeClose( LiveObject *inPlayer ) {
+    ClientSendQueue *q = inPlayer->sendQueue;
+    
+    if( inPlayer->sock == NULL || q == NULL ) {
+        return;
+        }
+    
+    if( ! q->hadSocketError() ) {
+        if( inPlayer->frame != NULL ) {
+            sendPlayerFrame( inPlayer );
+            }
+        
+        if( ! q->hadSocketError() ) {
+            q->flush( inPlayer->sock );
+            }
+        }
+    
+    if( q->getNumBytes() > 0 ) {
+        AppLog::infoF( "Player %d connection closed with %d queued bytes "
+                       "unsent, dropping them",
+                       inPlayer->id, q->getNumBytes() );
+        }
+    }
+
+
 
 static void setPlayerDisconnected( LiveObject *inPlayer, 
                                    const char *inReason ) {    
@@ -4419,10 +4811,12 @@ static void setPlayerDisconnected( LiveObject *inPlayer,
         }
     
     
+    flushBeforeClose( inPlayer );
+    
     if( inPlayer->sock != NULL ) {
         // also, stop polling their socket, which will trigger constant
         // socket events from here on out, and cause us to busy-loop
-        sockPoll.removeSocket( inPlayer->sock );
+        removePolledSocket( inPlayer->sock );
 
         delete inPlayer->sock;
         inPlayer->sock = NULL;
@@ -4431,6 +4825,153 @@ static void setPlayerDisconnected( LiveObject *inPlayer,
         delete inPlayer->sockBuffer;
         inPlayer->sockBuffer = NULL;
         }
+    if( inPlayer->sendQueue != NULL ) {
+        delete inPlayer->sendQueue;
+        inPlayer->sendQueue = NULL;
+        }
+    if( inPlayer->frame != NULL ) {
+        delete inPlayer->frame;
+        inPlayer->frame = NULL;
+        }
+    }
+
+
+
+// sends whatever their sockets will take from players' send queues
+// returns true if anything is still waiting
+static char flushSendQueues() {
+    char anyWaiting = false;
+    
+    for( int i=0; i<players.size(); i++ ) {
+        LiveObject *nextPlayer = players.getElement( i );
+        
+        if( ! nextPlayer->connected || nextPlayer->sock == NULL ||
+            nextPlayer->sendQueue == NULL ) {
+            continue;
+            }
+        
+        if( ! nextPlayer->frame->isEmpty() ) {
+            // sent after last step's frames went out
+            if( ! sendPlayerFrame( nextPlayer ) ) {
+                setPlayerDisconnected( nextPlayer, "Socket write failed" );
+                continue;
+                }
+            }
+
+        if( nextPlayer->sendQueue->getNumBytes() > 0 &&
+            ! nextPlayer->sendQueue->flush( nextPlayer->sock ) ) {
+            setPlayerDisconnected( nextPlayer, "Socket write failed" );
+            continue;
+            }
+        
+        if( nextPlayer->sendQueue->getNumBytes() > 0 ) {
+            anyWaiting = true;
+            }
+        else if( isSocketEpollOn() ) {
+            // queue may have drained in an earlier send, outside of
+            // this loop
+            // cheap, does nothing if we already stopped watching
+            socketEpollWatchWritable( nextPlayer->sock, false );
+            }
+        }
+
+    return anyWaiting;
+    }
+
+
+
+static double lastSendQueueReportTime = 0;
+
+// how often to retry waiting sends when we can't wait for sockets
+// to become writable
+static double sendQueueRetryTime = 0.02;
+
+
+// logs queue depth and drops for players whose connections have
+// been slow since last report
+static void reportSendQueues() {
+    double curTime = Time::getCurrentTime();
+    
+    if( curTime - lastSendQueueReportTime < 
+        SettingsManager::getIntSetting( "sendQueueReportSeconds", 60 ) ) {
+        return;
+        }
+    lastSendQueueReportTime = curTime;
+    
+    int numWaiting = 0;
+    int numBackedUp = 0;
+    int maxBytes = 0;
+    int totalBytes = 0;
+    int numDropped = 0;
+    int numBytesDropped = 0;
+    
+    for( int i=0; i<players.size(); i++ ) {
+        LiveObject *nextPlayer = players.getElement( i );
+        
+        ClientSendQueue *q = nextPlayer->sendQueue;
+        
+        if( q == NULL ) {
+            continue;
+            }
+        
+        int numBytes = q->getNumBytes();
+        
+        if( numBytes > 0 ) {
+            numWaiting++;
+            totalBytes += numBytes;
+            }
+        if( q->isBackedUp() ) {
+            numBackedUp++;
+            }
+        if( numBytes > maxBytes ) {
+            maxBytes = numBytes;
+            }
+        numDropped += q->getNumDropped();
+        numBytesDropped += q->getNumBytesDropped();
+        
+        if( q->getNumDropped() > 0 || q->isBackedUp() ) {
+            AppLog::infoF( 
+                "Player %d (%s) send queue:  %d bytes waiting, "
+                "peak %d, %d messages (%d bytes) dropped",
+                nextPlayer->id, nextPlayer->email,
+                numBytes, q->getPeakBytes(),
+                q->getNumDropped(), q->getNumBytesDropped() );
+            }
+
+        q->clearStats();
+        }
+    
+    if( numWaiting > 0 || numDropped > 0 ) {
+        AppLog::infoF( 
+            "Send queues:  %d of %d players waiting (%d bytes total, "
+            "%d max), %d backed up, %d messages (%d bytes) dropped",
+            numWaiting, players.size(), totalBytes, maxBytes,
+            numBackedUp, numDropped, numBytesDropped );
+        }
+
+    double compressSeconds, compressBytesIn, compressBytesOut;
+    ClientFrameBuilder::getStats( &compressSeconds, 
+                                  &compressBytesIn, &compressBytesOut );
+    
+    if( compressBytesIn > 0 ) {
+        int numStreams = 0;
+        
+        for( int i=0; i<players.size(); i++ ) {
+            LiveObject *nextPlayer = players.getElement( i );
+            
+            if( nextPlayer->frame != NULL && 
+                nextPlayer->frame->getDeflateStream() ) {
+                numStreams++;
+                }
+            }
+        
+        AppLog::infoF( 
+            "Frame compression:  %.0f bytes down to %.0f (%.1f%%) "
+            "in %.3f sec, %d of %d players on deflate streams",
+            compressBytesIn, compressBytesOut, 
+            100 * compressBytesOut / compressBytesIn,
+            compressSeconds, numStreams, players.size() );
+        }
     }
 
 
@@ -4464,9 +5005,7 @@ void sendGlobalMessage( char *inMessage,
                 minGlobalMessageSpacingSeconds ) {
                 
                 int numSent = 
-                    o->sock->send( (unsigned char*)fullMessage, 
-                                   len, 
-                                   false, false );
+                    sendToPlayer( o, (unsigned char*)fullMessage, len );
                 
                 o->lastGlobalMessageTime = curTime;
                 
@@ -4674,6 +5213,7 @@ int sendMapChunkMessage( LiveObject *inO,
     
     int numSent = 0;
 
+    char wasFirstMap = ! inO->firstMapSent;
     
 
     if( ! inO->firstMapSent ) {
@@ -4689,9 +5229,7 @@ int sendMapChunkMessage( LiveObject *inO,
                                                           &messageLength );
                 
         numSent += 
-            inO->sock->send( mapChunkMessage, 
-                             messageLength, 
-                             false, false );
+            sendToPlayer( inO, mapChunkMessage, messageLength );
                 
         delete [] mapChunkMessage;
         }
@@ -4773,9 +5311,7 @@ int sendMapChunkMessage( LiveObject *inO,
             messageLength += len;
             
             numSent += 
-                inO->sock->send( mapChunkMessage, 
-                                 len, 
-                                 false, false );
+                sendToPlayer( inO, mapChunkMessage, len );
             
             delete [] mapChunkMessage;
             }
@@ -4790,9 +5326,7 @@ int sendMapChunkMessage( LiveObject *inO,
             messageLength += len;
             
             numSent += 
-                inO->sock->send( mapChunkMessage, 
-                                 len, 
-                                 false, false );
+                sendToPlayer( inO, mapChunkMessage, len );
             
             delete [] mapChunkMessage;
             }
@@ -4804,6 +5338,34 @@ int sendMapChunkMessage( LiveObject *inO,
 
     if( numSent == messageLength ) {
         // sent correctly
+        
+        // have base map ready for where they are going next
+        int moveX = 0;
+        int moveY = 0;
+        
+        if( ! wasFirstMap ) {
+            moveX = xd - inO->lastSentMapX;
+            moveY = yd - inO->lastSentMapY;
+            }
+        
+        if( moveX == 0 && moveY == 0 ) {
+            // not moving, or just arrived, whole area around them
+            prefetchMapRegions( fullStartX - chunkDimensionX,
+                                fullStartY - chunkDimensionY,
+                                3 * chunkDimensionX,
+                                3 * chunkDimensionY );
+            }
+        else {
+            // next chunk in direction of motion
+            int dirX = ( moveX > 0 ) - ( moveX < 0 );
+            int dirY = ( moveY > 0 ) - ( moveY < 0 );
+            
+            prefetchMapRegions( fullStartX + dirX * chunkDimensionX,
+                                fullStartY + dirY * chunkDimensionY,
+                                chunkDimensionX,
+                                chunkDimensionY );
+            }
+
         inO->lastSentMapX = xd;
         inO->lastSentMapY = yd;
         }
@@ -7229,7 +7791,7 @@ uint64_t fnv1aHash(std::string &s, const uint64_t FNV_init = 0xcbf29ce484222325u
 // or -1 if this player reconnected to an existing ID
 int processLoggedInPlayer( char inAllowReconnect,
                            Socket *inSock,
-                           SimpleVector<char> *inSockBuffer,
+                           ClientReadBuffer *inSockBuffer,
                            char *inEmail,
                            //passing the whole thing for the seed and famTarget
                            FreshConnection *connection,
@@ -7318,9 +7880,19 @@ int processLoggedInPlayer( char inAllowReconnect,
                 delete o->sockBuffer;
                 o->sockBuffer = NULL;
                 }
+            if( o->sendQueue != NULL ) {
+                delete o->sendQueue;
+                o->sendQueue = NULL;
+                }
+            if( o->frame != NULL ) {
+                delete o->frame;
+                o->frame = NULL;
+                }
             
             o->sock = inSock;
             o->sockBuffer = inSockBuffer;
+            o->sendQueue = newSendQueue();
+            o->frame = new ClientFrameBuilder();
             
             // they are connecting again, need to send them everything again
             o->firstMapSent = false;
@@ -8487,6 +9059,8 @@ int processLoggedInPlayer( char inAllowReconnect,
 
     newObject.sock = inSock;
     newObject.sockBuffer = inSockBuffer;
+    newObject.sendQueue = newSendQueue();
+    newObject.frame = new ClientFrameBuilder();
     
     newObject.gotPartOfThisFrame = false;
     
@@ -10766,6 +11340,16 @@ static unsigned char *makeCompressedMessage( char *inMessage, int inLength,
 static int maxUncompressedSize = 256;
 
 
+// players that get whole compressed frames don't need messages 
+// compressed one by one
+static int getMaxUncompressedSize( LiveObject *inPlayer ) {
+    if( inPlayer->frame != NULL && inPlayer->frame->getCompress() ) {
+        return INT_MAX;
+        }
+    return maxUncompressedSize;
+    }
+
+
 void sendMessageToPlayer( LiveObject *inPlayer, 
                                  char *inMessage, int inLength ) {
     if( ! inPlayer->connected ) {
@@ -10779,15 +11363,13 @@ void sendMessageToPlayer( LiveObject *inPlayer,
     
     char deleteMessage = false;
 
-    if( inLength > maxUncompressedSize ) {
+    if( inLength > getMaxUncompressedSize( inPlayer ) ) {
         message = makeCompressedMessage( inMessage, inLength, &len );
         deleteMessage = true;
         }
 
     int numSent = 
-        inPlayer->sock->send( message, 
-                              len, 
-                              false, false );
+        sendToPlayer( inPlayer, message, len );
         
     if( numSent != len ) {
         setPlayerDisconnected( inPlayer, "Socket write failed" );
@@ -10972,9 +11554,11 @@ LiveObject *getClosestOtherPlayer( LiveObject *inThisPlayer,
     double closestDist = 20;
     LiveObject *closestOther = NULL;
     
-    for( int j=0; j<players.size(); j++ ) {
-        LiveObject *otherPlayer = 
-            players.getElement(j);
+    SimpleVector<LiveObject*> near;
+    getNearbyPlayers( thisPos, (int)closestDist, &near );
+    
+    for( int j=0; j<near.size(); j++ ) {
+        LiveObject *otherPlayer = near.getElementDirect( j );
         
         if( otherPlayer != inThisPlayer &&
             ! otherPlayer->error &&
@@ -11211,10 +11795,9 @@ void apocalypseStep() {
                 if( !nextPlayer->error && nextPlayer->connected ) {
                     
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            (unsigned char*)message, 
-                            messageLength,
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      (unsigned char*)message, 
+                                      messageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -11279,6 +11862,7 @@ void apocalypseStep() {
     
 
                 // clear map
+                waitForBackup();
                 freeMap( true );
 
                 AppLog::infoF( "Apocalypse freeMap took %f sec",
@@ -11339,10 +11923,9 @@ void apocalypseStep() {
                         if( !nextPlayer->error && nextPlayer->connected ) {
                     
                             int numSent = 
-                                nextPlayer->sock->send( 
-                                    (unsigned char*)message, 
-                                    messageLength,
-                                    false, false );
+                                sendToPlayer( nextPlayer, 
+                                              (unsigned char*)message, 
+                                              messageLength );
                             
                             nextPlayer->gotPartOfThisFrame = true;
                     
@@ -11393,10 +11976,9 @@ void monumentStep() {
 
 
                 int numSent = 
-                    nextPlayer->sock->send( 
-                        (unsigned char*)message, 
-                        messageLength,
-                        false, false );
+                    sendToPlayer( nextPlayer, 
+                                  (unsigned char*)message, 
+                                  messageLength );
                 
                 nextPlayer->gotPartOfThisFrame = true;
                 
@@ -13221,13 +13803,68 @@ int constant_time_strcmp(const char *s1, const char *s2) {
     }
 
 
-int main() {
+int main( int inNumArgs, char **inArgs ) {
 
     if( checkReadOnly() ) {
         printf( "File system read-only.  Server exiting.\n" );
         return 1;
         }
     
+    // offline map tools, run with server shut down, in place of
+    // running server
+    char bakeNaturalMapMode = false;
+    char checkNaturalMapMode = false;
+    char checkMapSnapshotMode = false;
+    int mapToolArg = -1;
+    
+    if( inNumArgs > 1 ) {
+        if( strcmp( inArgs[1], "bakeNaturalMap" ) == 0 ) {
+            bakeNaturalMapMode = true;
+            }
+        else if( strcmp( inArgs[1], "checkNaturalMap" ) == 0 ) {
+            checkNaturalMapMode = true;
+            }
+        else if( strcmp( inArgs[1], "checkMapSnapshot" ) == 0 ) {
+            checkMapSnapshotMode = true;
+            }
+        else {
+            printf( "Usage:\n" );
+            printf( "OneLifeServer\n" );
+            printf( "    runs server\n\n" );
+            printf( "OneLifeServer bakeNaturalMap [radius]\n" );
+            printf( "    pre-generates natural map into naturalMap.bin, "
+                    "out to barrierRadius by default\n\n" );
+            printf( "OneLifeServer checkNaturalMap [numCells]\n" );
+            printf( "    compares naturalMap.bin to live generation\n\n" );
+            printf( "OneLifeServer checkMapSnapshot\n" );
+            printf( "    checks that a map snapshot backup, taken while "
+                    "writes are held,\n"
+                    "    restores correctly through initMap\n"
+                    "    writes over map, so only runs in a scratch copy "
+                    "of the server folder\n"
+                    "    marked with an empty %s file\n\n",
+                    MAP_SCRATCH_MARKER );
+            return 1;
+            }
+        
+        if( inNumArgs > 2 ) {
+            sscanf( inArgs[2], "%d", &mapToolArg );
+            }
+        }
+    
+    if( checkMapSnapshotMode ) {
+        // overwrites and restores map files in place, never on a live map
+        File markerFile( NULL, MAP_SCRATCH_MARKER );
+        
+        if( ! markerFile.exists() ) {
+            printf( "Refusing to run checkMapSnapshot, no %s here.\n"
+                    "Copy the server folder and create an empty %s "
+                    "in the copy to run it there.\n",
+                    MAP_SCRATCH_MARKER, MAP_SCRATCH_MARKER );
+            return 1;
+            }
+        }
+    
     familyDataLogFile = fopen( "familyDataLog.txt", "a" );
 
     if( familyDataLogFile != NULL ) {
@@ -13489,7 +14126,8 @@ int main() {
     
 
     initLifeLog();
-    //initBackup();
+    // before initMap, may restore map files from a snapshot
+    initBackup();
     
     initPlayerStats();
     initLineageLog();
@@ -13547,6 +14185,36 @@ int main() {
         return 1;
         }
     
+    
+    if( bakeNaturalMapMode || checkNaturalMapMode || 
+        checkMapSnapshotMode ) {
+        int result;
+        
+        if( checkMapSnapshotMode ) {
+            result = checkMapSnapshotRestore();
+            }
+        else if( bakeNaturalMapMode ) {
+            result = bakeNaturalMap( mapToolArg );
+            
+            if( result == 0 ) {
+                result = checkNaturalMap( 10000 );
+                }
+            }
+        else {
+            if( mapToolArg <= 0 ) {
+                mapToolArg = 100000;
+                }
+            result = checkNaturalMap( mapToolArg );
+            }
+        
+        quitCleanup();
+        
+        if( result != 0 ) {
+            return 1;
+            }
+        return 0;
+        }
+    
 
 
     if( false ) {
@@ -13610,7 +14278,9 @@ int main() {
 
     SocketServer *server = new SocketServer(port, 256);
 
-    sockPoll.addSocketServer( server );
+    if( ! initSocketEpoll( server ) ) {
+        sockPoll.addSocketServer( server );
+        }
     
     AppLog::infoF( "Listening for connection on port %d", port );
 
@@ -13737,10 +14407,9 @@ int main() {
                     }
 
                 if( nextPlayer->connected ) {    
-                    nextPlayer->sock->send( 
-                        (unsigned char*)shutdownMessage, 
-                        messageLength,
-                        false, false );
+                    sendToPlayer( nextPlayer, 
+                                  (unsigned char*)shutdownMessage, 
+                                  messageLength );
                 
                     nextPlayer->gotPartOfThisFrame = true;
                     }
@@ -13776,7 +14445,7 @@ int main() {
             apocalypseStep();
             monumentStep();
             
-            //checkBackup();
+            checkBackup();
 
             stepFoodLog();
             stepFailureLog();
@@ -14010,8 +14679,6 @@ int main() {
             }
         
         
-        SocketOrServer *readySock =  NULL;
-
         // at bare minimum, run our periodic steps at a fixed
         // frequency
         double pollTimeout = periodicStepTime;
@@ -14037,6 +14704,17 @@ int main() {
             }
 
         
+        char anySendsWaiting = flushSendQueues();
+        
+        reportSendQueues();
+
+        if( anySendsWaiting && ! isSocketEpollOn() && 
+            pollTimeout > sendQueueRetryTime ) {
+            // SocketPoll can't wake us when their sockets have room
+            pollTimeout = sendQueueRetryTime;
+            }
+
+        
         char anyTicketServerRequestsOut = false;
 
         for( int i=0; i<newConnections.size(); i++ ) {
@@ -14085,12 +14763,23 @@ int main() {
         // come in, and only wake up when some timed action needs to be
         // handled
         
-        readySock = sockPoll.wait( (int)( pollTimeout * 1000 ) );
+        char serverReady;
+        
+        if( isSocketEpollOn() ) {
+            // marks all sockets that have data in one go
+            serverReady = socketEpollWait( (int)( pollTimeout * 1000 ) );
+            }
+        else {
+            SocketOrServer *readySock = 
+                sockPoll.wait( (int)( pollTimeout * 1000 ) );
+            
+            serverReady = ( readySock != NULL && !readySock->isSocket );
+            }
         
         
         
         
-        if( readySock != NULL && !readySock->isSocket ) {
+        if( serverReady ) {
             // server ready
             Socket *sock = server->acceptConnection( 0 );
 
@@ -14256,10 +14945,10 @@ int main() {
                     }
                 else {
                     // first message sent okay
-                    newConnection.sockBuffer = new SimpleVector<char>();
+                    newConnection.sockBuffer = new ClientReadBuffer();
                     
 
-                    sockPoll.addSocket( sock );
+                    addPolledSocket( sock );
 
                     newConnections.push_back( newConnection );
                     }
@@ -15102,7 +15791,7 @@ int main() {
                                        nextConnection->errorCauseString );
                         
                         if( nextConnection->sock != NULL ) {
-                            sockPoll.removeSocket( nextConnection->sock );
+                            removePolledSocket( nextConnection->sock );
                             }
                         
                         deleteMembers( nextConnection );
@@ -15713,9 +16402,9 @@ int main() {
                                              &length );
                         
                         int numSent = 
-                            nextPlayer->sock->send( mapChunkMessage, 
-                                                    length, 
-                                                    false, false );
+                            sendToPlayer( nextPlayer, 
+                                          mapChunkMessage, 
+                                          length );
                         
                         nextPlayer->gotPartOfThisFrame = true;
                         
@@ -15998,6 +16687,19 @@ int main() {
                                          strlen( message ) );
                     delete [] message;
                     }
+                else if( m.type == FEATURES ) {
+                    // sent once, right after login
+                    nextPlayer->frame->setCompress( 
+                        ( m.x & CLIENT_FEATURE_COMPRESSED_FRAMES ) != 0 );
+
+                    if( ( m.x & CLIENT_FEATURE_DEFLATE_STREAM ) &&
+                        SettingsManager::getIntSetting( "useDeflateStream",
+                                                        1 ) ) {
+                        nextPlayer->frame->startDeflateStream(
+                            SettingsManager::getIntSetting( 
+                                "deflateStreamLevel", 6 ) );
+                        }
+                    }
                 else if( m.type == DIE ) {
                     if( computeAge( nextPlayer ) < 2 ) {
                         
@@ -17094,6 +17796,8 @@ int main() {
                             
                                 nextPlayer->newMove = true;
                                 
+                                updatePlayerGrid( nextPlayer, -1 );
+                                
                                 
                                 // check if path passes over
                                 // an object with autoDefaultTrans
@@ -21335,7 +22039,7 @@ int main() {
                 else {
                     if( nextPlayer->sock != NULL ) {
                         // stop listening for activity on this socket
-                        sockPoll.removeSocket( nextPlayer->sock );
+                        removePolledSocket( nextPlayer->sock );
                         }
                     }
                 
@@ -22278,6 +22982,8 @@ int main() {
                         nextPlayer->xs = nextPlayer->xd;
                         nextPlayer->ys = nextPlayer->yd;                        
 
+                        updatePlayerGrid( nextPlayer );
+
                         //printf( "Player %d's move is done at %d,%d\n",
                         //        nextPlayer->id,
                         //        nextPlayer->xs,
@@ -23410,6 +24116,39 @@ int main() {
         SimpleVector<int> playersReceivingPlayerUpdate;
         
 
+        // find out who might be in range of each change through
+        // playerGrid, so each player below only looks at changes near them,
+        // not at every change in the world
+        refreshPlayerGrid();
+        
+        int rangeNear = getMaxChunkDimension();
+        int rangeMiddle = rangeNear * 2;
+
+        // indexed like players
+        SimpleVector<int> *nearUpdateLists = 
+            new SimpleVector<int>[ players.size() ];
+        SimpleVector<int> *nearMoveLists = 
+            new SimpleVector<int>[ players.size() ];
+        SimpleVector<int> *nearMapChangeLists = 
+            new SimpleVector<int>[ players.size() ];
+        SimpleVector<int> *nearSpeechLists = 
+            new SimpleVector<int>[ players.size() ];
+        SimpleVector<int> *nearLocationSpeechLists = 
+            new SimpleVector<int>[ players.size() ];
+        
+        // PU and PM need middle distance too, for PO messages
+        getNearbyChangesForPlayers( &newUpdatesPos, rangeMiddle,
+                                    nearUpdateLists );
+        getNearbyChangesForPlayers( &movesPos, rangeMiddle,
+                                    nearMoveLists );
+        getNearbyChangesForPlayers( &mapChangesPos, rangeNear,
+                                    nearMapChangeLists );
+        getNearbyChangesForPlayers( &newSpeechPos, rangeNear,
+                                    nearSpeechLists );
+        getNearbyChangesForPlayers( &newLocationSpeechPos, rangeNear,
+                                    nearLocationSpeechLists );
+        
+
         for( int p=0; p<numLive; p++ ) {
             
             LiveObject *nextPlayer = players.getElement(p);
@@ -24293,10 +25032,9 @@ int main() {
                 // are holding post-wound come later                
                 if( dyingMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            dyingMessage, 
-                            dyingMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      dyingMessage, 
+                                      dyingMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
 
@@ -24310,10 +25048,9 @@ int main() {
                 // EVERYONE gets info about now-healed players           
                 if( healingMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            healingMessage, 
-                            healingMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      healingMessage, 
+                                      healingMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -24327,10 +25064,9 @@ int main() {
                 // EVERYONE gets info about emots           
                 if( emotMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            emotMessage, 
-                            emotMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      emotMessage, 
+                                      emotMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -24352,10 +25088,12 @@ int main() {
 
 
                 if( newUpdates.size() > 0 && nextPlayer->connected ) {
+                    SimpleVector<int> *nearUpdates = &( nearUpdateLists[p] );
 
                     double minUpdateDist = maxDist2 * 2;                    
 
-                    for( int u=0; u<newUpdatesPos.size(); u++ ) {
+                    for( int n=0; n<nearUpdates->size(); n++ ) {
+                        int u = nearUpdates->getElementDirect( n );
                         ChangePosition *p = newUpdatesPos.getElement( u );
                         
                         // update messages can be global when a new
@@ -24386,8 +25124,13 @@ int main() {
                         unsigned char *updateMessage = NULL;
                         int updateMessageLength = 0;
                         SimpleVector<char> updateChars;
+
+                        // a PU with only distant updates in it can be
+                        // dropped if this player's connection backs up
+                        char anyNearUpdates = false;
                         
-                        for( int u=0; u<newUpdates.size(); u++ ) {
+                        for( int n=0; n<nearUpdates->size(); n++ ) {
+                            int u = nearUpdates->getElementDirect( n );
                             ChangePosition *p = newUpdatesPos.getElement( u );
                         
                             double d = intDist( p->x, p->y, 
@@ -24404,6 +25147,10 @@ int main() {
                                 middleDistancePlayerIDs.push_back(
                                     newUpdatePlayerIDs.getElementDirect( u ) );
                                 }
+
+                            if( p->global || d <= maxDist / 2 ) {
+                                anyNearUpdates = true;
+                                }
                             
                             
                             char *line =
@@ -24427,7 +25174,8 @@ int main() {
                             
                             updateMessageLength = strlen( updateMessageText );
 
-                            if( updateMessageLength < maxUncompressedSize ) {
+                            if( updateMessageLength < 
+                                getMaxUncompressedSize( nextPlayer ) ) {
                                 updateMessage = 
                                     (unsigned char*)updateMessageText;
                                 }
@@ -24445,10 +25193,10 @@ int main() {
                                 nextPlayer->id );
                             
                             int numSent = 
-                                nextPlayer->sock->send( 
-                                    updateMessage, 
-                                    updateMessageLength, 
-                                    false, false );
+                                sendToPlayer( nextPlayer, 
+                                              updateMessage, 
+                                              updateMessageLength,
+                                              ! anyNearUpdates );
                             
                             nextPlayer->gotPartOfThisFrame = true;
                             
@@ -24466,10 +25214,12 @@ int main() {
 
 
                 if( moveList.size() > 0 && nextPlayer->connected ) {
+                    SimpleVector<int> *nearMoves = &( nearMoveLists[p] );
                     
                     double minUpdateDist = getMaxChunkDimension() * 2;
                     
-                    for( int u=0; u<movesPos.size(); u++ ) {
+                    for( int n=0; n<nearMoves->size(); n++ ) {
+                        int u = nearMoves->getElementDirect( n );
                         ChangePosition *p = movesPos.getElement( u );
                         
                         // move messages are never global
@@ -24490,7 +25240,8 @@ int main() {
                         
                         SimpleVector<MoveRecord> closeMoves;
                         
-                        for( int u=0; u<movesPos.size(); u++ ) {
+                        for( int n=0; n<nearMoves->size(); n++ ) {
+                            int u = nearMoves->getElementDirect( n );
                             ChangePosition *p = movesPos.getElement( u );
                             
                             // move messages are never global
@@ -24517,7 +25268,8 @@ int main() {
                                 moveMessage = (unsigned char*)moveMessageText;
                                 moveMessageLength = strlen( moveMessageText );
 
-                                if( moveMessageLength > maxUncompressedSize ) {
+                                if( moveMessageLength > 
+                                    getMaxUncompressedSize( nextPlayer ) ) {
                                     moveMessage = makeCompressedMessage( 
                                         moveMessageText,
                                         moveMessageLength,
@@ -24527,10 +25279,9 @@ int main() {
                                 }
 
                             int numSent = 
-                                nextPlayer->sock->send( 
-                                    moveMessage, 
-                                    moveMessageLength, 
-                                    false, false );
+                                sendToPlayer( nextPlayer, 
+                                              moveMessage, 
+                                              moveMessageLength );
                             
                             nextPlayer->gotPartOfThisFrame = true;
                             
@@ -24578,7 +25329,7 @@ int main() {
                             strlen( outOfRangeMessageText );
 
                         if( outOfRangeMessageLength < 
-                            maxUncompressedSize ) {
+                            getMaxUncompressedSize( nextPlayer ) ) {
                             outOfRangeMessage = 
                                 (unsigned char*)outOfRangeMessageText;
                             }
@@ -24594,10 +25345,9 @@ int main() {
                         }
                         
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            outOfRangeMessage, 
-                            outOfRangeMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      outOfRangeMessage, 
+                                      outOfRangeMessageLength );
                         
                     nextPlayer->gotPartOfThisFrame = true;
 
@@ -24613,9 +25363,13 @@ int main() {
 
                 
                 if( mapChanges.size() > 0 && nextPlayer->connected ) {
+                    SimpleVector<int> *nearMapChanges = 
+                        &( nearMapChangeLists[p] );
+
                     double minUpdateDist = getMaxChunkDimension() * 2;
                     
-                    for( int u=0; u<mapChangesPos.size(); u++ ) {
+                    for( int n=0; n<nearMapChanges->size(); n++ ) {
+                        int u = nearMapChanges->getElementDirect( n );
                         ChangePosition *p = mapChangesPos.getElement( u );
                         
                         // map changes are never global
@@ -24639,7 +25393,8 @@ int main() {
                         int mapChangeMessageLength = 0;
                         SimpleVector<char> mapChangeChars;
 
-                        for( int u=0; u<mapChanges.size(); u++ ) {
+                        for( int n=0; n<nearMapChanges->size(); n++ ) {
+                            int u = nearMapChanges->getElementDirect( n );
                             ChangePosition *p = mapChangesPos.getElement( u );
                         
                             double d = intDist( p->x, p->y, 
@@ -24675,7 +25430,7 @@ int main() {
                                 strlen( mapChangeMessageText );
             
                             if( mapChangeMessageLength < 
-                                maxUncompressedSize ) {
+                                getMaxUncompressedSize( nextPlayer ) ) {
                                 mapChangeMessage = 
                                     (unsigned char*)mapChangeMessageText;
                                 }
@@ -24693,10 +25448,9 @@ int main() {
                         if( mapChangeMessage != NULL ) {
 
                             int numSent = 
-                                nextPlayer->sock->send( 
-                                    mapChangeMessage, 
-                                    mapChangeMessageLength, 
-                                    false, false );
+                                sendToPlayer( nextPlayer, 
+                                              mapChangeMessage, 
+                                              mapChangeMessageLength );
                             
                             nextPlayer->gotPartOfThisFrame = true;
                             
@@ -24710,9 +25464,12 @@ int main() {
                         }
                     }
                 if( newSpeechPos.size() > 0 && nextPlayer->connected ) {
+                    SimpleVector<int> *nearSpeech = &( nearSpeechLists[p] );
+
                     double minUpdateDist = getMaxChunkDimension() * 2;
                     
-                    for( int u=0; u<newSpeechPos.size(); u++ ) {
+                    for( int n=0; n<nearSpeech->size(); n++ ) {
+                        int u = nearSpeech->getElementDirect( n );
                         ChangePosition *p = newSpeechPos.getElement( u );
                         
                         // speech never global
@@ -24732,7 +25489,8 @@ int main() {
                         messageWorking.appendElementString( "PS\n" );
                         
                         
-                        for( int u=0; u<newSpeechPos.size(); u++ ) {
+                        for( int n=0; n<nearSpeech->size(); n++ ) {
+                            int u = nearSpeech->getElementDirect( n );
 
                             ChangePosition *p = newSpeechPos.getElement( u );
 
@@ -24959,7 +25717,8 @@ int main() {
                             (unsigned char*) messageText;
                         
                         
-                        if( messageLen >= maxUncompressedSize ) {
+                        if( messageLen >= 
+                            getMaxUncompressedSize( nextPlayer ) ) {
                             char *old = messageText;
                             int oldLen = messageLen;
                             
@@ -24971,11 +25730,10 @@ int main() {
                             }
                         
                         
+                        // speech can be dropped if connection backs up
                         int numSent = 
-                            nextPlayer->sock->send( 
-                                message, 
-                                messageLen, 
-                                false, false );
+                            sendToPlayer( nextPlayer, message, messageLen,
+                                          true );
                         
                         delete [] message;
                         
@@ -24990,9 +25748,13 @@ int main() {
 
 
                 if( newLocationSpeech.size() > 0 && nextPlayer->connected ) {
+                    SimpleVector<int> *nearLocationSpeech = 
+                        &( nearLocationSpeechLists[p] );
+
                     double minUpdateDist = getMaxChunkDimension() * 2;
                     
-                    for( int u=0; u<newLocationSpeechPos.size(); u++ ) {
+                    for( int n=0; n<nearLocationSpeech->size(); n++ ) {
+                        int u = nearLocationSpeech->getElementDirect( n );
                         ChangePosition *p = 
                             newLocationSpeechPos.getElement( u );
                         
@@ -25043,7 +25805,7 @@ int main() {
                         int len = working.size();
                         
 
-                        if( len > maxUncompressedSize ) {
+                        if( len > getMaxUncompressedSize( nextPlayer ) ) {
                             int compLen = 0;
                             
                             unsigned char *compMessage = makeCompressedMessage( 
@@ -25057,10 +25819,9 @@ int main() {
                             }
 
                         int numSent = 
-                            nextPlayer->sock->send( 
-                                (unsigned char*)message,
-                                len, 
-                                false, false );
+                            sendToPlayer( nextPlayer, 
+                                          (unsigned char*)message, 
+                                          len, true );
                         
                         delete [] message;
                         
@@ -25107,7 +25868,8 @@ int main() {
                         deleteUpdateMessageLength = 
                             strlen( deleteUpdateMessageText );
 
-                        if( deleteUpdateMessageLength < maxUncompressedSize ) {
+                        if( deleteUpdateMessageLength < 
+                            getMaxUncompressedSize( nextPlayer ) ) {
                             deleteUpdateMessage = 
                                 (unsigned char*)deleteUpdateMessageText;
                             }
@@ -25124,10 +25886,9 @@ int main() {
 
                     if( deleteUpdateMessage != NULL ) {
                         int numSent = 
-                            nextPlayer->sock->send( 
-                                deleteUpdateMessage, 
-                                deleteUpdateMessageLength, 
-                                false, false );
+                            sendToPlayer( nextPlayer, 
+                                          deleteUpdateMessage, 
+                                          deleteUpdateMessageLength );
                     
                         nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25145,10 +25906,9 @@ int main() {
                 // EVERYONE gets lineage info for new babies
                 if( lineageMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            lineageMessage, 
-                            lineageMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      lineageMessage, 
+                                      lineageMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25162,10 +25922,9 @@ int main() {
                 // EVERYONE gets curse info for new babies
                 if( cursesMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            cursesMessage, 
-                            cursesMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      cursesMessage, 
+                                      cursesMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25178,10 +25937,9 @@ int main() {
                 // EVERYONE gets newly-given names
                 if( namesMessage != NULL && nextPlayer->connected ) {
                     int numSent = 
-                        nextPlayer->sock->send( 
-                            namesMessage, 
-                            namesMessageLength, 
-                            false, false );
+                        sendToPlayer( nextPlayer, 
+                                      namesMessage, 
+                                      namesMessageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25254,10 +26012,9 @@ int main() {
                         int messageLength = strlen( foodMessage );
                         
                         int numSent = 
-                            nextPlayer->sock->send( 
-                                (unsigned char*)foodMessage, 
-                                messageLength,
-                                false, false );
+                            sendToPlayer( nextPlayer, 
+                                          (unsigned char*)foodMessage, 
+                                          messageLength );
                         
                         nextPlayer->gotPartOfThisFrame = true;
                         
@@ -25293,10 +26050,9 @@ int main() {
                     int messageLength = strlen( heatMessage );
                     
                     int numSent = 
-                         nextPlayer->sock->send( 
-                             (unsigned char*)heatMessage, 
-                             messageLength,
-                             false, false );
+                         sendToPlayer( nextPlayer, 
+                                       (unsigned char*)heatMessage, 
+                                       messageLength );
                     
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25322,10 +26078,9 @@ int main() {
                     int messageLength = strlen( tokenMessage );
                     
                     int numSent = 
-                         nextPlayer->sock->send( 
-                             (unsigned char*)tokenMessage, 
-                             messageLength,
-                             false, false );
+                         sendToPlayer( nextPlayer, 
+                                       (unsigned char*)tokenMessage, 
+                                       messageLength );
 
                     nextPlayer->gotPartOfThisFrame = true;
                     
@@ -25341,6 +26096,12 @@ int main() {
                 }
             }
 
+        delete [] nearUpdateLists;
+        delete [] nearMoveLists;
+        delete [] nearMapChangeLists;
+        delete [] nearSpeechLists;
+        delete [] nearLocationSpeechLists;
+
 
         for( int u=0; u<moveList.size(); u++ ) {
             MoveRecord *r = moveList.getElement( u );
@@ -25436,15 +26197,14 @@ int main() {
             LiveObject *nextPlayer = players.getElement(i);
             
             if( nextPlayer->gotPartOfThisFrame && nextPlayer->connected ) {
-                int numSent = 
-                    nextPlayer->sock->send( 
-                        (unsigned char*)frameMessage, 
-                        frameMessageLength,
-                        false, false );
-
-                if( numSent != frameMessageLength ) {
-                    setPlayerDisconnected( nextPlayer, "Socket write failed" );
-                    }
+                sendToPlayer( nextPlayer, 
+                              (unsigned char*)frameMessage, 
+                              frameMessageLength );
+                }
+            
+            if( nextPlayer->connected && 
+                ! sendPlayerFrame( nextPlayer ) ) {
+                setPlayerDisconnected( nextPlayer, "Socket write failed" );
                 }
             nextPlayer->gotPartOfThisFrame = false;
             }
@@ -25466,8 +26226,10 @@ int main() {
                 
                 addPastPlayer( nextPlayer );
 
+                flushBeforeClose( nextPlayer );
+                
                 if( nextPlayer->sock != NULL ) {
-                    sockPoll.removeSocket( nextPlayer->sock );
+                    removePolledSocket( nextPlayer->sock );
                 
                     delete nextPlayer->sock;
                     nextPlayer->sock = NULL;
@@ -25477,6 +26239,14 @@ int main() {
                     delete nextPlayer->sockBuffer;
                     nextPlayer->sockBuffer = NULL;
                     }
+                if( nextPlayer->sendQueue != NULL ) {
+                    delete nextPlayer->sendQueue;
+                    nextPlayer->sendQueue = NULL;
+                    }
+                if( nextPlayer->frame != NULL ) {
+                    delete nextPlayer->frame;
+                    nextPlayer->frame = NULL;
+                    }
                 
                 delete nextPlayer->lineage;
                 
@@ -25540,6 +26310,8 @@ int main() {
                 delete nextPlayer->babyBirthTimes;
                 delete nextPlayer->babyIDs;
 
+                playerGrid.remove( nextPlayer->id );
+                
                 players.deleteElement( i );
                 i--;
                 }
@@ -25562,6 +26334,7 @@ int main() {
 
     // Closing the server socket makes these connection requests fail
     // instantly (instead of relying on client timeouts).
+    freeSocketEpoll();
     delete server;
 
     quitCleanup();
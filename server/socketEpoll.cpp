@@ -0,0 +1,320 @@
+#include "socketEpoll.h"
+
+#include "minorGems/util/SettingsManager.h"
+#include "minorGems/util/log/AppLog.h"
+
+
+#ifdef __linux__
+#define SOCKET_EPOLL_SUPPORTED
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+
+
+static char epollOn = false;
+
+
+#ifdef SOCKET_EPOLL_SUPPORTED
+
+
+static int epollFD = -1;
+
+static int serverFD = -1;
+
+
+#define MAX_EVENTS_PER_WAIT 256
+
+static struct epoll_event events[ MAX_EVENTS_PER_WAIT ];
+
+
+// indexed by FD
+static char *fdFlags = NULL;
+static int numFDFlags = 0;
+
+// socket has data we haven't read yet
+#define FLAG_READY 1
+// we have data waiting to send on socket
+#define FLAG_WATCH_WRITABLE 2
+
+
+// stop reading a socket once this much is sitting unprocessed in its buffer
+// leave it flagged, and pick up the rest next step
+// keeps one flooding client from eating all our memory
+#define MAX_BUFFERED_BYTES 65536
+
+// recv directly into buffer in chunks this big
+#define READ_CHUNK_SIZE 16384
+
+
+
+// minorGems keeps the FD behind this pointer on Linux
+static int getFD( Socket *inSock ) {
+    return *( (int*)( inSock->mNativeObjectPointer ) );
+    }
+
+
+
+static void setFlag( int inFD, char inFlag, char inOn ) {
+    if( inFD < 0 ) {
+        return;
+        }
+
+    if( inFD >= numFDFlags ) {
+        int newNum = numFDFlags * 2;
+
+        if( newNum <= inFD ) {
+            newNum = inFD + 1;
+            }
+
+        char *newFlags = new char[ newNum ];
+
+        memset( newFlags, 0, newNum );
+
+        if( fdFlags != NULL ) {
+            memcpy( newFlags, fdFlags, numFDFlags );
+            delete [] fdFlags;
+            }
+
+        fdFlags = newFlags;
+        numFDFlags = newNum;
+        }
+
+    if( inOn ) {
+        fdFlags[ inFD ] |= inFlag;
+        }
+    else {
+        fdFlags[ inFD ] &= ~inFlag;
+        }
+    }
+
+
+
+static char getFlag( int inFD, char inFlag ) {
+    if( inFD < 0 || inFD >= numFDFlags ) {
+        return false;
+        }
+    return ( fdFlags[ inFD ] & inFlag ) != 0;
+    }
+
+
+
+char initSocketEpoll( SocketServer *inServer ) {
+    epollOn = false;
+
+    if( ! SettingsManager::getIntSetting( "useEpoll", 1 ) ) {
+        return false;
+        }
+
+    epollFD = epoll_create1( 0 );
+
+    if( epollFD == -1 ) {
+        AppLog::errorF( "epoll_create1 failed (%s), using SocketPoll",
+                        strerror( errno ) );
+        return false;
+        }
+
+    serverFD = *( (int*)( inServer->mNativeObjectPointer ) );
+
+    // level-triggered, we only accept one connection per wait
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = serverFD;
+
+    if( epoll_ctl( epollFD, EPOLL_CTL_ADD, serverFD, &ev ) == -1 ) {
+        AppLog::errorF( "epoll_ctl failed for server socket (%s), "
+                        "using SocketPoll",
+                        strerror( errno ) );
+        close( epollFD );
+        epollFD = -1;
+        return false;
+        }
+
+    AppLog::info( "Using epoll for client sockets" );
+
+    epollOn = true;
+    return true;
+    }
+
+
+
+void freeSocketEpoll() {
+    if( epollFD != -1 ) {
+        close( epollFD );
+        epollFD = -1;
+        }
+
+    if( fdFlags != NULL ) {
+        delete [] fdFlags;
+        fdFlags = NULL;
+        }
+    numFDFlags = 0;
+
+    epollOn = false;
+    }
+
+
+
+void socketEpollAdd( Socket *inSock ) {
+    int fd = getFD( inSock );
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if( epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &ev ) == -1 ) {
+        AppLog::errorF( "epoll_ctl failed to add socket %d (%s)",
+                        fd, strerror( errno ) );
+        }
+
+    // edge-triggered, so anything that arrived before we added it
+    // would never be reported
+    // read it once to find out
+    setFlag( fd, FLAG_READY, true );
+    setFlag( fd, FLAG_WATCH_WRITABLE, false );
+    }
+
+
+
+void socketEpollRemove( Socket *inSock ) {
+    int fd = getFD( inSock );
+
+    // closing the FD would remove it too, but only if nothing else
+    // has a copy of it
+    epoll_ctl( epollFD, EPOLL_CTL_DEL, fd, NULL );
+
+    setFlag( fd, FLAG_READY | FLAG_WATCH_WRITABLE, false );
+    }
+
+
+
+void socketEpollWatchWritable( Socket *inSock, char inWatch ) {
+    int fd = getFD( inSock );
+
+    if( getFlag( fd, FLAG_WATCH_WRITABLE ) == inWatch ) {
+        return;
+        }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if( inWatch ) {
+        ev.events |= EPOLLOUT;
+        }
+
+    if( epoll_ctl( epollFD, EPOLL_CTL_MOD, fd, &ev ) == -1 ) {
+        AppLog::errorF( "epoll_ctl failed to modify socket %d (%s)",
+                        fd, strerror( errno ) );
+        return;
+        }
+
+    setFlag( fd, FLAG_WATCH_WRITABLE, inWatch );
+
+    // re-arming reports whatever is pending again, which we might have
+    // missed between edges
+    setFlag( fd, FLAG_READY, true );
+    }
+
+
+
+char socketEpollWait( int inTimeoutMS ) {
+    int numEvents = epoll_wait( epollFD, events, MAX_EVENTS_PER_WAIT,
+                                inTimeoutMS );
+
+    char serverReady = false;
+
+    for( int i=0; i<numEvents; i++ ) {
+        int fd = events[i].data.fd;
+
+        if( fd == serverFD ) {
+            serverReady = true;
+            }
+        else if( events[i].events != EPOLLOUT ) {
+            // errors and hangups too, so the read finds out about them
+            setFlag( fd, FLAG_READY, true );
+            }
+        // else just writable, caller flushes whatever is waiting
+        // after every wait
+        }
+
+    return serverReady;
+    }
+
+
+
+char socketEpollRead( Socket *inSock, ClientReadBuffer *inBuffer ) {
+    int fd = getFD( inSock );
+
+    if( ! getFlag( fd, FLAG_READY ) ) {
+        // nothing new since last drained
+        return true;
+        }
+
+    while( inBuffer->size() < MAX_BUFFERED_BYTES ) {
+        int spaceSize;
+        char *space = inBuffer->getWriteSpace( READ_CHUNK_SIZE, &spaceSize );
+
+        int numRead = recv( fd, space, spaceSize, MSG_DONTWAIT );
+
+        if( numRead > 0 ) {
+            inBuffer->commitWrite( numRead );
+            }
+        else if( numRead == 0 ) {
+            // closed by remote host
+            return false;
+            }
+        else if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+            // drained, wait for next edge
+            setFlag( fd, FLAG_READY, false );
+            return true;
+            }
+        else if( errno != EINTR ) {
+            return false;
+            }
+        }
+
+    // buffer full, stay flagged for next time
+    return true;
+    }
+
+
+
+#else
+
+
+char initSocketEpoll( SocketServer *inServer ) {
+    return false;
+    }
+
+void freeSocketEpoll() {
+    }
+
+void socketEpollAdd( Socket *inSock ) {
+    }
+
+void socketEpollRemove( Socket *inSock ) {
+    }
+
+void socketEpollWatchWritable( Socket *inSock, char inWatch ) {
+    }
+
+char socketEpollWait( int inTimeoutMS ) {
+    return false;
+    }
+
+char socketEpollRead( Socket *inSock, ClientReadBuffer *inBuffer ) {
+    return false;
+    }
+
+
+#endif
+
+
+
+char isSocketEpollOn() {
+    return epollOn;
+    }
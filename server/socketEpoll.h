@@ -0,0 +1,59 @@
+#ifndef SOCKET_EPOLL_H_INCLUDED
+#define SOCKET_EPOLL_H_INCLUDED
+
+
+#include "minorGems/network/Socket.h"
+#include "minorGems/network/SocketServer.h"
+
+#include "clientReadBuffer.h"
+
+
+
+// Linux epoll replacement for SocketPoll in the server's main loop.
+//
+// One wait collects every descriptor that has become readable, instead
+// of waking up once per socket.  Client sockets are edge-triggered and
+// flagged ready until a read drains them, so the per-step read of each
+// connection only calls recv for sockets that actually have data.
+//
+// Off on other platforms, or if the useEpoll setting is 0, in which case
+// the caller should keep using SocketPoll.
+
+
+// returns true if epoll is now in use
+char initSocketEpoll( SocketServer *inServer );
+
+void freeSocketEpoll();
+
+
+char isSocketEpollOn();
+
+
+void socketEpollAdd( Socket *inSock );
+
+// must be called before inSock is deleted
+void socketEpollRemove( Socket *inSock );
+
+
+// while inWatch is true, socketEpollWait also wakes up when inSock
+// becomes writable
+// for sockets that have a send queue waiting
+void socketEpollWatchWritable( Socket *inSock, char inWatch );
+
+
+// waits up to inTimeoutMS for activity on any socket, and marks every
+// client socket that has data
+//
+// returns true if the server has a connection waiting to be accepted
+char socketEpollWait( int inTimeoutMS );
+
+
+// reads everything waiting on inSock into inBuffer, if it was marked ready
+// by socketEpollWait, or does nothing if not
+//
+// returns false on error or closed connection
+char socketEpollRead( Socket *inSock, ClientReadBuffer *inBuffer );
+
+
+
+#endif
@@ -4,6 +4,9 @@
 #include "minorGems/system/Thread.h"
 #include "minorGems/util/random/JenkinsRandomSource.h"
 #include "minorGems/formats/encodingUtils.h"
+#include "minorGems/system/Time.h"
+
+#include <zlib.h>
 
 
 JenkinsRandomSource randSource;
@@ -12,10 +15,18 @@ JenkinsRandomSource randSource;
 
 void usage() {
     printf( "Usage:\n" );
-    printf( "stressTestClient server_address server_port email_prefix num_clients\n\n" );
+    printf( "stressTestClient server_address server_port email_prefix num_clients [compression]\n\n" );
+    
+    printf( "compression is one of:\n" );
+    printf( "  0  single CM messages only (default, like older clients)\n" );
+    printf( "  1  CF compressed frames\n" );
+    printf( "  3  CZ deflate stream for whole connection\n\n" );
+    
+    printf( "Bytes received and time spent decompressing are reported "
+            "every 10 seconds\n\n" );
     
     printf( "Example:\n" );
-    printf( "stressTestClient onehouronelife.com 8005 dummy 100\n\n" );
+    printf( "stressTestClient onehouronelife.com 8005 dummy 100 3\n\n" );
     
     exit( 1 );
     }
@@ -33,6 +44,16 @@ typedef struct Client {
         int pendingCMCompressedSize;
         int pendingCMDecompressedSize;
 
+        // CF or CZ
+        char pendingFrameType;
+        int pendingFrameCompressedSize;
+        int pendingFrameDecompressedSize;
+
+        z_stream inflateStream;
+        char inflateStreamOn;
+
+        char featuresSent;
+
         int id;
         int x, y;
 
@@ -44,6 +65,71 @@ typedef struct Client {
 
 
 
+// totals over all clients since last report
+static double bytesReceived = 0;
+static double bytesDecompressed = 0;
+static double decompressSeconds = 0;
+
+static double lastReportTime = 0;
+
+static void reportStats( int inNumConnected ) {
+    double curTime = Time::getCurrentTime();
+    
+    double elapsed = curTime - lastReportTime;
+    
+    if( elapsed < 10 ) {
+        return;
+        }
+    
+    printf( "%d clients connected, received %.0f bytes/sec "
+            "(%.0f decompressed), %.2f%% of a CPU spent decompressing\n",
+            inNumConnected,
+            bytesReceived / elapsed, bytesDecompressed / elapsed,
+            100 * decompressSeconds / elapsed );
+    
+    bytesReceived = 0;
+    bytesDecompressed = 0;
+    decompressSeconds = 0;
+    lastReportTime = curTime;
+    }
+
+
+
+// returns NULL on failure
+static unsigned char *inflateFromStream( Client *inC, 
+                                         unsigned char *inData,
+                                         int inDataLength,
+                                         int inInflatedLength ) {
+    if( ! inC->inflateStreamOn ) {
+        memset( &( inC->inflateStream ), 0, sizeof( z_stream ) );
+        
+        if( inflateInit( &( inC->inflateStream ) ) != Z_OK ) {
+            return NULL;
+            }
+        inC->inflateStreamOn = true;
+        }
+    
+    unsigned char *inflated = new unsigned char[ inInflatedLength ];
+    
+    inC->inflateStream.next_in = inData;
+    inC->inflateStream.avail_in = inDataLength;
+    inC->inflateStream.next_out = inflated;
+    inC->inflateStream.avail_out = inInflatedLength;
+    
+    int result = inflate( &( inC->inflateStream ), Z_SYNC_FLUSH );
+    
+    if( ( result != Z_OK && result != Z_BUF_ERROR ) ||
+        inC->inflateStream.avail_in != 0 ||
+        inC->inflateStream.avail_out != 0 ) {
+        delete [] inflated;
+        return NULL;
+        }
+    
+    return inflated;
+    }
+
+
+
 // NULL if no message read
 char *getNextMessage( Client *inC ) {
 
@@ -88,6 +174,7 @@ char *getNextMessage( Client *inC ) {
 
             if( numRead > 0 ) {
                 inC->skipCompressedData -= numRead;
+                bytesReceived += numRead;
                 }
             }
 
@@ -109,6 +196,7 @@ char *getNextMessage( Client *inC ) {
     
     
     while( numRead > 0 ) {
+        bytesReceived += numRead;
         inC->buffer.appendArray( buffer, numRead );
         numRead = inC->sock->receive( buffer, 512, 0 );
         
@@ -130,10 +218,15 @@ char *getNextMessage( Client *inC ) {
                 }
             inC->buffer.deleteStartElements( inC->pendingCMCompressedSize );
             
+            double startTime = Time::getCurrentTime();
+            
             unsigned char *decompressedMessage =
                 zipDecompress( compressedData, 
                                inC->pendingCMCompressedSize,
                                inC->pendingCMDecompressedSize );
+            
+            decompressSeconds += Time::getCurrentTime() - startTime;
+            bytesDecompressed += inC->pendingCMDecompressedSize;
 
             delete [] compressedData;
 
@@ -160,6 +253,67 @@ char *getNextMessage( Client *inC ) {
         }
 
 
+    if( inC->pendingFrameType != '\0' ) {
+        if( inC->buffer.size() >= inC->pendingFrameCompressedSize ) {
+            char type = inC->pendingFrameType;
+            inC->pendingFrameType = '\0';
+            
+            unsigned char *compressedData = 
+                new unsigned char[ inC->pendingFrameCompressedSize ];
+            
+            for( int i=0; i<inC->pendingFrameCompressedSize; i++ ) {
+                compressedData[i] = inC->buffer.getElementDirect( i );
+                }
+            inC->buffer.deleteStartElements( 
+                inC->pendingFrameCompressedSize );
+            
+            double startTime = Time::getCurrentTime();
+            
+            unsigned char *decompressedFrame;
+            
+            if( type == 'F' ) {
+                decompressedFrame =
+                    zipDecompress( compressedData, 
+                                   inC->pendingFrameCompressedSize,
+                                   inC->pendingFrameDecompressedSize );
+                }
+            else {
+                decompressedFrame =
+                    inflateFromStream( inC, compressedData,
+                                       inC->pendingFrameCompressedSize,
+                                       inC->pendingFrameDecompressedSize );
+                }
+            
+            decompressSeconds += Time::getCurrentTime() - startTime;
+            bytesDecompressed += inC->pendingFrameDecompressedSize;
+            
+            delete [] compressedData;
+            
+            if( decompressedFrame == NULL ) {
+                printf( "Client %d decompressing C%c message failed\n",
+                        inC->i, type );
+                inC->disconnected = true;
+                return NULL;
+                }
+            
+            // whole messages, read them like any others
+            int restSize = inC->buffer.size();
+            unsigned char *rest = inC->buffer.getElementArray();
+            
+            inC->buffer.deleteAll();
+            inC->buffer.appendArray( decompressedFrame,
+                                     inC->pendingFrameDecompressedSize );
+            inC->buffer.appendArray( rest, restSize );
+            
+            delete [] rest;
+            delete [] decompressedFrame;
+            }
+        else {
+            // wait for more data to arrive
+            return NULL;
+            }
+        }
+
 
 
     // find first terminal character #
@@ -195,6 +349,18 @@ char *getNextMessage( Client *inC ) {
         
         return NULL;
         }
+    else if( strstr( message, "CF\n" ) == message ||
+             strstr( message, "CZ\n" ) == message ) {
+        inC->pendingFrameType = message[1];
+        
+        sscanf( &( message[3] ), "%d %d", 
+                &( inC->pendingFrameDecompressedSize ), 
+                &( inC->pendingFrameCompressedSize ) );
+
+        delete [] message;
+        
+        return NULL;
+        }
     
 
     return message;
@@ -246,7 +412,7 @@ void parsePlayerUpdateMessage( Client *inC, char *inMessageLine ) {
 
 int main( int inNumArgs, char **inArgs ) {
     
-    if( inNumArgs != 5 ) {
+    if( inNumArgs != 5 && inNumArgs != 6 ) {
         usage();
         }
     
@@ -260,6 +426,11 @@ int main( int inNumArgs, char **inArgs ) {
     int numClients = 1;
     sscanf( inArgs[4], "%d", &numClients );
 
+    int features = 0;
+    if( inNumArgs == 6 ) {
+        sscanf( inArgs[5], "%d", &features );
+        }
+
     
     Client *connections = new Client[ numClients ];
     
@@ -271,6 +442,9 @@ int main( int inNumArgs, char **inArgs ) {
         connections[i].id = -1;
         connections[i].skipCompressedData = 0;
         connections[i].pendingCMData = false;
+        connections[i].pendingFrameType = '\0';
+        connections[i].inflateStreamOn = false;
+        connections[i].featuresSent = false;
         connections[i].moving = false;
         connections[i].dead = false;
         connections[i].disconnected = false;
@@ -313,8 +487,12 @@ int main( int inNumArgs, char **inArgs ) {
         }
 
     
+    lastReportTime = Time::getCurrentTime();
+    
     // process messages
     while( numConnected > 0 ) {
+        reportStats( numConnected );
+        
         numConnected = 0;
         
         for( int i=0; i<numClients; i++ ) {
@@ -371,6 +549,19 @@ int main( int inNumArgs, char **inArgs ) {
                                 connections[i].x, 
                                 connections[i].y );
 
+                        if( features != 0 && ! connections[i].featuresSent ) {
+                            // server only takes this once we're logged in
+                            char *featuresMessage = 
+                                autoSprintf( "FEATURES %d 0#", features );
+                            
+                            connections[i].sock->send( 
+                                (unsigned char*)featuresMessage, 
+                                strlen( featuresMessage ), true, false );
+                            
+                            delete [] featuresMessage;
+                            connections[i].featuresSent = true;
+                            }
+
 
                         
                         for( int p=0; p<numLines; p++ ) {
@@ -470,6 +661,9 @@ int main( int inNumArgs, char **inArgs ) {
         if( connections[i].sock != NULL ) {
             delete connections[i].sock;
             }
+        if( connections[i].inflateStreamOn ) {
+            inflateEnd( &( connections[i].inflateStream ) );
+            }
         }
     delete [] connections;
     
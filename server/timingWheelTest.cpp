@@ -0,0 +1,326 @@
+// Checks TimingWheel against a plain list of live items, with random
+// inserts, cancels, reschedules, and time steps (some huge), plus a few
+// fixed cases that have broken before.
+
+
+#include "TimingWheel.h"
+
+#include "minorGems/util/random/CustomRandomSource.h"
+
+#include <stdio.h>
+
+
+#define NUM_STEPS 400000
+
+// wall clock around when this was written
+#define START_TIME 1.7e9
+
+// top level of wheel covers 2^24 seconds
+#define TOP_BLOCK 16777216.0
+
+
+
+typedef struct ModelItem {
+        int id;
+        int handle;
+        timeSec_t eta;
+    } ModelItem;
+
+
+static SimpleVector<ModelItem> model;
+
+static int numBad = 0;
+
+
+
+static void fail( const char *inWhat, int inStep ) {
+    if( numBad < 10 ) {
+        printf( "Step %d: %s\n", inStep, inWhat );
+        }
+    numBad++;
+    }
+
+
+
+static int findModelItem( int inID ) {
+    for( int i=0; i<model.size(); i++ ) {
+        if( model.getElement( i )->id == inID ) {
+            return i;
+            }
+        }
+    return -1;
+    }
+
+
+
+static void removeModelItem( int inIndex ) {
+    int last = model.size() - 1;
+    *( model.getElement( inIndex ) ) = model.getElementDirect( last );
+    model.deleteElement( last );
+    }
+
+
+
+// pops everything due, and checks that wheel and model agree afterward
+static void popAndCheck( TimingWheel<int> *inWheel, timeSec_t inNow,
+                         int inStep ) {
+    int id;
+    while( inWheel->popDue( inNow, &id ) ) {
+        int index = findModelItem( id );
+
+        if( index == -1 ) {
+            fail( "popped item that isn't live", inStep );
+            continue;
+            }
+        if( model.getElement( index )->eta > inNow ) {
+            fail( "popped item early", inStep );
+            }
+        removeModelItem( index );
+        }
+
+    char haveMin = false;
+    timeSec_t minETA = 0;
+
+    for( int i=0; i<model.size(); i++ ) {
+        timeSec_t eta = model.getElement( i )->eta;
+
+        if( eta <= inNow ) {
+            fail( "due item left in wheel", inStep );
+            }
+        if( ! haveMin || eta < minETA ) {
+            minETA = eta;
+            haveMin = true;
+            }
+        }
+
+    timeSec_t nextETA;
+    char haveNext = inWheel->getNextETA( &nextETA );
+
+    if( haveNext != haveMin ) {
+        fail( "wrong empty state", inStep );
+        }
+    else if( haveNext && nextETA != minETA ) {
+        fail( "wrong next ETA", inStep );
+        }
+
+    if( inWheel->size() != model.size() ) {
+        fail( "wrong size", inStep );
+        }
+    }
+
+
+
+static void checkNextETA( TimingWheel<int> *inWheel, timeSec_t inExpected,
+                          const char *inCase ) {
+    timeSec_t eta;
+    if( ! inWheel->getNextETA( &eta ) || eta != inExpected ) {
+        printf( "%s: wrong next ETA\n", inCase );
+        numBad++;
+        }
+    }
+
+
+
+static void checkPop( TimingWheel<int> *inWheel, timeSec_t inNow,
+                      int inExpectedID, const char *inCase ) {
+    int id = -1;
+    char popped = inWheel->popDue( inNow, &id );
+
+    if( inExpectedID == -1 ) {
+        if( popped ) {
+            printf( "%s: popped %d, expected nothing\n", inCase, id );
+            numBad++;
+            }
+        }
+    else if( ! popped || id != inExpectedID ) {
+        printf( "%s: expected to pop %d\n", inCase, inExpectedID );
+        numBad++;
+        }
+    }
+
+
+
+static void fixedCases() {
+    // items inserted before the first pop, while wheel is still at 0,
+    // and later items that land in the levels once wheel has moved
+    {
+    TimingWheel<int> w;
+    timeSec_t t = START_TIME;
+
+    w.insert( 1, t + 30 );
+    checkPop( &w, t, -1, "insert before first pop" );
+
+    w.insert( 2, t + 50 );
+
+    checkNextETA( &w, t + 30, "insert before first pop" );
+    checkPop( &w, t + 40, 1, "insert before first pop" );
+    checkPop( &w, t + 40, -1, "insert before first pop" );
+    checkPop( &w, t + 50, 2, "insert before first pop" );
+    }
+
+
+    // same, but without any pop before second insert
+    {
+    TimingWheel<int> w;
+    timeSec_t t = START_TIME;
+
+    w.insert( 1, t + 30 );
+    w.insert( 2, t + 50 );
+
+    checkNextETA( &w, t + 30, "two inserts before first pop" );
+    checkPop( &w, t + 40, 1, "two inserts before first pop" );
+    checkPop( &w, t + 60, 2, "two inserts before first pop" );
+    }
+
+
+    // time crosses into next top-level block, with an item there that
+    // was inserted before the crossing
+    {
+    TimingWheel<int> w;
+
+    // just short of a top-level boundary
+    timeSec_t boundary = ceil( START_TIME / TOP_BLOCK ) * TOP_BLOCK;
+    timeSec_t t = boundary - 100;
+
+    checkPop( &w, t, -1, "boundary crossing" );
+
+    w.insert( 1, boundary + 30 );
+
+    checkPop( &w, boundary + 5, -1, "boundary crossing" );
+
+    w.insert( 2, boundary + 50 );
+
+    checkNextETA( &w, boundary + 30, "boundary crossing" );
+    checkPop( &w, boundary + 40, 1, "boundary crossing" );
+    checkPop( &w, boundary + 50, 2, "boundary crossing" );
+    }
+
+
+    // far-off item inserted long ago, wheel stepping up to it in
+    // small steps with nearer items coming and going
+    {
+    TimingWheel<int> w;
+    timeSec_t t = START_TIME;
+
+    checkPop( &w, t, -1, "far item" );
+
+    w.insert( 1, t + TOP_BLOCK * 2 + 7 );
+
+    timeSec_t now = t;
+    int nextID = 2;
+
+    while( now + 100000 < t + TOP_BLOCK * 2 ) {
+        now += 100000;
+        w.insert( nextID, now + 90000 );
+
+        // item from last time around is due now
+        int expectedID = nextID - 1;
+        if( expectedID == 1 ) {
+            expectedID = -1;
+            }
+        checkPop( &w, now, expectedID, "far item" );
+        checkPop( &w, now, -1, "far item" );
+        nextID++;
+        }
+
+    // only the last near item and the far one are left
+    timeSec_t farETA = t + TOP_BLOCK * 2 + 7;
+    timeSec_t nearETA = now + 90000;
+
+    if( nearETA < farETA ) {
+        checkNextETA( &w, nearETA, "far item" );
+        checkPop( &w, nearETA, nextID - 1, "far item" );
+        }
+    checkNextETA( &w, farETA, "far item" );
+    checkPop( &w, farETA, 1, "far item" );
+    }
+    }
+
+
+
+int main() {
+    fixedCases();
+
+
+    CustomRandomSource randSource( 7 );
+
+    TimingWheel<int> wheel;
+
+    timeSec_t now = START_TIME;
+    int nextID = 0;
+
+    for( int s=0; s<NUM_STEPS; s++ ) {
+        int op = randSource.getRandomBoundedInt( 0, 9 );
+
+        if( op < 4 ) {
+            timeSec_t eta = now;
+
+            int kind = randSource.getRandomBoundedInt( 0, 5 );
+
+            if( kind < 2 ) {
+                // fractional, within a few seconds
+                eta += randSource.getRandomBoundedInt( 0, 99 ) / 7.0;
+                }
+            else if( kind < 4 ) {
+                eta += randSource.getRandomBoundedInt( 0, 5000 );
+                }
+            else if( kind < 5 ) {
+                // up to past the end of the levels
+                eta += randSource.getRandomBoundedInt( 0, 1 << 30 ) / 16.0;
+                }
+            else {
+                // already due
+                eta -= randSource.getRandomBoundedInt( 0, 5 );
+                }
+
+            ModelItem m = { nextID, wheel.insert( nextID, eta ), eta };
+            model.push_back( m );
+            nextID++;
+            }
+        else if( op == 4 && model.size() > 0 ) {
+            int index =
+                randSource.getRandomBoundedInt( 0, model.size() - 1 );
+
+            wheel.cancel( model.getElement( index )->handle );
+            removeModelItem( index );
+            }
+        else if( op == 5 && model.size() > 0 ) {
+            int index =
+                randSource.getRandomBoundedInt( 0, model.size() - 1 );
+
+            timeSec_t eta = now + randSource.getRandomBoundedInt( 0, 300 );
+
+            ModelItem *m = model.getElement( index );
+            wheel.reschedule( m->handle, eta );
+            m->eta = eta;
+            }
+        else {
+            if( randSource.getRandomBoundedInt( 0, 49 ) == 0 ) {
+                now += randSource.getRandomBoundedInt( 0, 100000 );
+                }
+            else if( randSource.getRandomBoundedInt( 0, 999 ) == 0 ) {
+                // jump into a later top-level block
+                now += TOP_BLOCK *
+                    randSource.getRandomBoundedInt( 1, 3 );
+                }
+            else {
+                now += randSource.getRandomBoundedInt( 0, 999 ) / 300.0;
+                }
+
+            popAndCheck( &wheel, now, s );
+            }
+        }
+
+    popAndCheck( &wheel, now, NUM_STEPS );
+
+    printf( "%d steps, %d items inserted, %d left\n",
+            NUM_STEPS, nextID, model.size() );
+
+    if( numBad > 0 ) {
+        printf( "%d failures\n", numBad );
+        return 1;
+        }
+
+    printf( "All OK\n" );
+    return 0;
+    }